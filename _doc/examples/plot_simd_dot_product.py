@@ -0,0 +1,82 @@
+"""
+.. _l-example-simd-dot-product:
+
+Vectorized dot products and instruction sets
+============================================
+
+The SVM runtimes compute one dot product (or one squared
+distance for kernel RBF) between every observation and every
+support vector. The kernels check which instruction set
+the machine supports when the runtime starts (SSE2, AVX2 and FMA,
+AVX-512) and the compiler does not need any specific option.
+The following example measures every instruction set
+available on this machine for several vector sizes.
+
+.. contents::
+    :local:
+
+Available instruction sets
+++++++++++++++++++++++++++
+"""
+import numpy
+from pandas import DataFrame
+import matplotlib.pyplot as plt
+from mlprodict.onnxrt.validate.validate_helper import measure_time
+from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import (  # pylint: disable=E0611
+    simd_cpu_level, simd_name,
+    vector_dot_product_float, vector_dot_product_double)
+
+best = simd_cpu_level()
+print("best instruction set:", simd_name(best))
+
+levels = list(range(0, best + 1))
+print([simd_name(level) for level in levels])
+
+########################################
+# Benchmark
+# +++++++++
+#
+# Every function receives two vectors of the same size,
+# the second one starts one element after an aligned address
+# as it usually happens for the support vectors.
+
+obs = []
+for dtype, fct in [(numpy.float32, vector_dot_product_float),
+                   (numpy.float64, vector_dot_product_double)]:
+    for size in [4, 8, 16, 32, 64, 128, 256, 512, 1024, 4096]:
+        a = numpy.random.randn(size).astype(dtype)
+        b = numpy.random.randn(size + 1).astype(dtype)[1:]
+        for level in levels:
+            res = measure_time(
+                lambda x, level=level: fct(x, b, level), a,
+                repeat=10, number=200, div_by_number=True)
+            res.update(dict(dtype=dtype.__name__, size=size,
+                            isa=simd_name(level)))
+            obs.append(res)
+        res = measure_time(lambda x: numpy.dot(x, b), a,
+                           repeat=10, number=200, div_by_number=True)
+        res.update(dict(dtype=dtype.__name__, size=size, isa='numpy.dot'))
+        obs.append(res)
+
+df = DataFrame(obs)
+df
+
+##########################################
+# Speedup compared to the scalar version.
+
+piv = df.pivot_table(index=['dtype', 'size'], columns='isa',
+                     values='average')
+speedup = piv.copy()
+for c in speedup.columns:
+    speedup[c] = piv['NONE'] / piv[c]
+speedup
+
+#########################################
+# Graphs.
+
+fig, ax = plt.subplots(1, 2, figsize=(12, 4))
+for i, dtype in enumerate(['float32', 'float64']):
+    sub = piv.loc[dtype]
+    sub.plot(ax=ax[i], logx=True, logy=True,
+             title="dot product %s" % dtype)
+plt.show()
@@ -46,6 +46,72 @@ class TestOnnxrtPythonRuntimeMlSVM(ExtTestCase):
         nb = ru.omp_get_max_threads()
         self.assertGreater(nb, 0)
 
+    def test_simd_dot_product(self):
+        from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import (  # pylint: disable=E0611
+            simd_cpu_level, simd_name,
+            vector_dot_product_float, vector_dot_product_double,
+            vector_squared_distance_float, vector_squared_distance_double)
+        best = simd_cpu_level()
+        self.assertIn(simd_name(best), ('NONE', 'SSE2', 'AVX2', 'AVX512'))
+        for dtype, dot, dist, decimal in [
+                (numpy.float32, vector_dot_product_float,
+                 vector_squared_distance_float, 3),
+                (numpy.float64, vector_dot_product_double,
+                 vector_squared_distance_double, 8)]:
+            for size in [0, 1, 7, 8, 15, 16, 17, 33, 100, 1001]:
+                # unaligned slices
+                a = numpy.random.randn(size + 1).astype(dtype)[1:]
+                b = numpy.random.randn(size + 3).astype(dtype)[3:]
+                exp_dot = numpy.dot(a.astype(numpy.float64),
+                                    b.astype(numpy.float64))
+                exp_dist = ((a.astype(numpy.float64) - b) ** 2).sum()
+                for level in [-1] + list(range(0, best + 2)):
+                    with self.subTest(dtype=dtype, size=size, level=level):
+                        self.assertAlmostEqual(
+                            exp_dot, dot(a, b, level), places=decimal - 1)
+                        self.assertAlmostEqual(
+                            exp_dist / max(exp_dist, 1),
+                            dist(a, b, level) / max(exp_dist, 1),
+                            places=decimal - 1)
+        self.assertRaise(
+            lambda: vector_dot_product_float(
+                numpy.zeros(3, dtype=numpy.float32),
+                numpy.zeros(4, dtype=numpy.float32), -1),
+            RuntimeError)
+
+    def test_simd_math(self):
+        from scipy.special import erfinv  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import (  # pylint: disable=E0611
+            simd_cpu_level, vector_math_float, vector_math_double)
+        best = simd_cpu_level()
+        x = numpy.random.randn(1001) * 10
+        u = numpy.random.rand(1001) * 1.998 - 0.999
+        expected = {
+            'exp': (x, numpy.exp, 0),
+            'log': (numpy.abs(x), numpy.log, 0),
+            'tanh': (x, numpy.tanh, 0),
+            'logistic': (x, lambda v: 1 / (1 + numpy.exp(-v)), 0),
+            'erfinv': (u, erfinv, 2e-3)}
+        for dtype, fct, rtol in [(numpy.float32, vector_math_float, 1e-6),
+                                 (numpy.float64, vector_math_double, 1e-14)]:
+            for name, (inp, ref, tol) in expected.items():
+                for size in [0, 1, 7, 17, 1001]:
+                    xd = inp[:size].astype(dtype)
+                    exp = ref(xd.astype(numpy.float64))
+                    for level in [-1] + list(range(0, best + 2)):
+                        with self.subTest(dtype=dtype, name=name,
+                                          size=size, level=level):
+                            got = fct(name, xd, level)
+                            self.assertEqual(got.dtype, dtype)
+                            self.assertEqual(got.shape, (size, ))
+                            numpy.testing.assert_allclose(
+                                exp, got, rtol=max(tol, rtol),
+                                atol=max(tol, rtol))
+        self.assertRaise(
+            lambda: vector_math_float(
+                'sin', numpy.zeros(3, dtype=numpy.float32), -1),
+            RuntimeError)
+
     @ignore_warnings(category=(UserWarning, ConvergenceWarning, RuntimeWarning))
     def test_onnxrt_python_SVR(self):
         iris = load_iris()
@@ -236,6 +302,109 @@ class TestOnnxrtPythonRuntimeMlSVM(ExtTestCase):
         self.assertEqualArray(lexp, y['output_label'], decimal=5)
         self.assertEqualArray(lprob, got, decimal=5)
 
+    @ignore_warnings(category=(UserWarning, ConvergenceWarning, RuntimeWarning))
+    def test_onnxrt_python_svm_batch_rows(self):
+        # a batch computes the kernels with a matrix product,
+        # a single observation computes them one by one
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for dtype, decimal in [(numpy.float32, 4), (numpy.float64, 8)]:
+            for kernel in ['linear', 'poly', 'rbf', 'sigmoid']:
+                for model in [SVC(kernel=kernel, probability=True),
+                              SVC(kernel=kernel), SVR(kernel=kernel)]:
+                    with self.subTest(dtype=dtype, kernel=kernel,
+                                      model=model.__class__.__name__):
+                        model.fit(X_train, y_train)
+                        xt = X_test.astype(dtype)
+                        oinf = OnnxInference(to_onnx(model, xt))
+                        name = oinf.output_names[-1]
+                        batch = oinf.run({'X': xt})
+                        for i in range(xt.shape[0]):
+                            row = oinf.run({'X': xt[i:i + 1]})
+                            self.assertEqualArray(
+                                batch[oinf.output_names[0]][i:i + 1],
+                                row[oinf.output_names[0]], decimal=decimal)
+                            got = batch[name]
+                            exp = row[name]
+                            if hasattr(got, 'values'):
+                                got, exp = got.values, exp.values
+                            self.assertEqualArray(
+                                got[i:i + 1], exp, decimal=decimal)
+
+    @ignore_warnings(category=(UserWarning, ConvergenceWarning, RuntimeWarning))
+    def test_onnxrt_python_svm_rbf_unscaled(self):
+        # ||x||^2 + ||sv||^2 - 2 x.sv cancels with features around 1000,
+        # the observations are at a squared distance of 0.025
+        # from a support vector
+        rnd = numpy.random.RandomState(0)
+        X = 1000 + rnd.randn(20, 10)
+        y = rnd.randn(20)
+        model = SVR(kernel='rbf', gamma=1.).fit(X, y)
+        sign = numpy.array([-1, 1] * 5, dtype=numpy.float64)
+        xt = (model.support_vectors_ + sign * 0.05).astype(numpy.float32)
+        exp = model.predict(xt.astype(numpy.float64))
+        oinf = OnnxInference(to_onnx(model, xt))
+        got = oinf.run({'X': xt})['variable']
+        self.assertEqualArray(exp, got.ravel(), decimal=3)
+
+    @ignore_warnings(category=(UserWarning, ConvergenceWarning, RuntimeWarning))
+    def test_onnxrt_python_svm_scratch(self):
+        # compute reuses the buffers allocated by init,
+        # batches above 20 rows are computed in parallel
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for dtype in [numpy.float32, numpy.float64]:
+            for model in [SVC(kernel='rbf', probability=True),
+                          SVC(kernel='linear')]:
+                with self.subTest(dtype=dtype, kernel=model.kernel):
+                    model.fit(X_train, y_train)
+                    xt = X_test.astype(dtype)
+                    oinf = OnnxInference(to_onnx(model, xt))
+                    rt = oinf.sequence_[0].ops_.rt_
+                    self.assertEqual(rt.scratch_allocations(), 0)
+                    exp = oinf.run({'X': xt})
+                    for n in [1, 3, xt.shape[0]]:
+                        oinf.run({'X': xt[:n]})
+                    self.assertEqual(rt.scratch_allocations(), 0)
+                    got = oinf.run({'X': xt})
+                    for name in oinf.output_names:
+                        e, g = exp[name], got[name]
+                        if hasattr(e, 'values'):
+                            e, g = e.values, g.values
+                        self.assertEqualArray(e, g)
+
+    @ignore_warnings(category=(UserWarning, ConvergenceWarning, RuntimeWarning))
+    def test_onnxrt_python_svm_thread_pool(self):
+        # the SVMs and the tree ensembles share the same thread pool,
+        # batches above 20 (classifier) or 50 rows (regressor)
+        # are computed in parallel
+        from mlprodict.onnxrt.ops_cpu import set_thread_pool
+        from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import thread_pool_size  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, _, y_train, _ = train_test_split(X, y, random_state=11)
+        xt = X.astype(numpy.float64)
+        models = [SVC(probability=True).fit(X_train, y_train),
+                  SVR().fit(X_train, y_train)]
+        oinfs = [OnnxInference(to_onnx(model, xt)) for model in models]
+        exps = [oinf.run({'X': xt}) for oinf in oinfs]
+        default = thread_pool_size()
+        try:
+            for n_threads in [1, 3]:
+                set_thread_pool(n_threads)
+                self.assertEqual(thread_pool_size(), n_threads)
+                for oinf, exp in zip(oinfs, exps):
+                    got = oinf.run({'X': xt})
+                    for name in oinf.output_names:
+                        e, g = exp[name], got[name]
+                        if hasattr(e, 'values'):
+                            e, g = e.values, g.values
+                        self.assertEqualArray(e, g)
+        finally:
+            set_thread_pool(default)
+
     @ignore_warnings(category=(UserWarning, ConvergenceWarning, RuntimeWarning))
     def test_onnxrt_python_one_class_svm(self):
         X = numpy.array([[0, 1, 2], [44, 36, 18],
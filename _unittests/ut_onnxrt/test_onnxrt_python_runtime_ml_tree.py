@@ -1,15 +1,21 @@
 """
 @brief      test log(time=2s)
 """
+import os
+import pickle
+import signal
+import struct
 import unittest
 from logging import getLogger
 import numpy
 import pandas
 from sklearn.datasets import load_iris
 from sklearn.model_selection import train_test_split
-from sklearn.ensemble import RandomForestClassifier, GradientBoostingClassifier, GradientBoostingRegressor
+from sklearn.ensemble import (
+    RandomForestClassifier, GradientBoostingClassifier, GradientBoostingRegressor,
+    RandomForestRegressor)
 from sklearn.tree import DecisionTreeClassifier, DecisionTreeRegressor
-from pyquickhelper.pycode import ExtTestCase
+from pyquickhelper.pycode import ExtTestCase, get_temp_folder
 from mlprodict.onnx_conv import to_onnx
 from mlprodict.onnxrt import OnnxInference
 
@@ -430,6 +436,703 @@ class TestOnnxrtPythonRuntimeMlTree(ExtTestCase):
                 for b in [False, True]:
                     test_tree_regressor_multitarget_max(*(conf + [b, True]))
 
+    def test_cpp_packed(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloat  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPFloat  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = X_test.astype(numpy.float32)
+        for cls, rt_cls in [(GradientBoostingRegressor, RuntimeTreeEnsembleRegressorPFloat),
+                            (GradientBoostingClassifier, RuntimeTreeEnsembleClassifierPFloat)]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=20, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                op = [node.ops_ for node in oinf.sequence_
+                      if 'TreeEnsemble' in node.ops_.__class__.__name__][0]
+                atts = [op._get_typed_attributes(k)  # pylint: disable=W0212
+                        for k in op.__class__.atts]
+                rt = rt_cls(60, 20, True)
+                rt.init(*atts)
+                self.assertTrue(rt.packed_)
+                self.assertFalse(op.rt_.packed_)
+                self.assertEqual(op.rt_.nodes_modes_, rt.nodes_modes_)
+                self.assertLess(rt.__sizeof__(), op.rt_.__sizeof__())
+                for n in [1, X_test.shape[0]]:
+                    exp = op.rt_.compute(X_test[:n])
+                    got = rt.compute(X_test[:n])
+                    if isinstance(exp, tuple):
+                        self.assertEqualArray(exp[0], got[0])
+                        self.assertEqualArray(exp[1], got[1])
+                    else:
+                        self.assertEqualArray(exp, got)
+
+    def test_cpp_tile(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = X_test.astype(numpy.float32)
+        for cls in [GradientBoostingRegressor, GradientBoostingClassifier]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=20, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                op = [node.ops_ for node in oinf.sequence_
+                      if 'TreeEnsemble' in node.ops_.__class__.__name__][0]
+                op.rt_.tile_N_ = 1
+                exp = op.rt_.compute(X_test)
+                for tile in [3, 16, 1000]:
+                    for omp_N in [10000, 1]:
+                        op.rt_.tile_N_ = tile
+                        op.rt_.omp_N_ = omp_N
+                        got = op.rt_.compute(X_test)
+                        if isinstance(exp, tuple):
+                            self.assertEqualArray(exp[0], got[0])
+                            self.assertEqualArray(exp[1], got[1])
+                        else:
+                            self.assertEqualArray(exp, got)
+
+    def test_cpp_simd(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloat  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPFloat  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = X_test.astype(numpy.float32)
+        X_test[::7, 1] = numpy.nan
+        for cls, rt_cls in [(GradientBoostingRegressor, RuntimeTreeEnsembleRegressorPFloat),
+                            (GradientBoostingClassifier, RuntimeTreeEnsembleClassifierPFloat)]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=20, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                op = [node.ops_ for node in oinf.sequence_
+                      if 'TreeEnsemble' in node.ops_.__class__.__name__][0]
+                atts = [op._get_typed_attributes(k)  # pylint: disable=W0212
+                        for k in op.__class__.atts]
+                rt = rt_cls(60, 20, True)
+                rt.init(*atts)
+                options = rt.runtime_options().split()
+                self.assertIn('OPENMP', options)
+                self.assertNotIn('AVX', op.rt_.runtime_options())
+                exp = op.rt_.compute(X_test)
+                for use_simd in [True, False]:
+                    rt.use_simd_ = use_simd
+                    if not use_simd:
+                        self.assertNotIn('AVX', rt.runtime_options())
+                    got = rt.compute(X_test)
+                    if isinstance(exp, tuple):
+                        self.assertEqualArray(exp[0], got[0])
+                        self.assertEqualArray(exp[1], got[1])
+                    else:
+                        self.assertEqualArray(exp, got)
+
+    def test_cpp_quickscorer(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = X_test.astype(numpy.float32)
+        X_test[::5, 2] = numpy.nan
+        for cls in [GradientBoostingRegressor, GradientBoostingClassifier,
+                    RandomForestRegressor]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=20, random_state=11, max_depth=5)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                op = [node.ops_ for node in oinf.sequence_
+                      if 'TreeEnsemble' in node.ops_.__class__.__name__][0]
+                self.assertIn('QUICKSCORER', op.rt_.runtime_options())
+                exp = op.rt_.compute(X_test)
+                op.rt_.use_quickscorer_ = False
+                self.assertNotIn('QUICKSCORER', op.rt_.runtime_options())
+                got = op.rt_.compute(X_test)
+                if isinstance(exp, tuple):
+                    self.assertEqualArray(exp[0], got[0])
+                    self.assertEqualArray(exp[1], got[1])
+                else:
+                    self.assertEqualArray(exp, got)
+                # QuickScorer is built again when the runtime is unpickled
+                oinf2 = pickle.loads(pickle.dumps(oinf))
+                op2 = [node.ops_ for node in oinf2.sequence_
+                       if 'TreeEnsemble' in node.ops_.__class__.__name__][0]
+                self.assertIn('QUICKSCORER', op2.rt_.runtime_options())
+
+    def test_cpp_quantized(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPDouble  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPFloat  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test[::6, 0] = numpy.nan
+        for cls, rt_cls, dtype in [
+                (GradientBoostingRegressor, RuntimeTreeEnsembleRegressorPDouble, numpy.float64),
+                (GradientBoostingClassifier, RuntimeTreeEnsembleClassifierPFloat, numpy.float32)]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=20, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(dtype))
+                oinf = OnnxInference(model_def)
+                op = [node.ops_ for node in oinf.sequence_
+                      if 'TreeEnsemble' in node.ops_.__class__.__name__][0]
+                atts = [op._get_typed_attributes(k)  # pylint: disable=W0212
+                        for k in op.__class__.atts]
+                rt = rt_cls(60, 20, False, True)
+                rt.init(*atts)
+                self.assertTrue(rt.quantized_)
+                self.assertIn('QUANTIZED8', rt.runtime_options())
+                rt2 = rt_cls(60, 20)
+                rt2.deserialize(rt.serialize())
+                self.assertIn('QUANTIZED8', rt2.runtime_options())
+                xt = X_test.astype(dtype)
+                exp = op.rt_.compute(xt)
+                for r in [rt, rt2]:
+                    got = r.compute(xt)
+                    if isinstance(exp, tuple):
+                        self.assertEqualArray(exp[0], got[0])
+                        self.assertEqualArray(exp[1], got[1])
+                    else:
+                        self.assertEqualArray(exp, got)
+
+    def test_cpp_init_buffers(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloat  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestRegressor(n_estimators=10, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        op = oinf.sequence_[0].ops_
+        atts = [op._get_typed_attributes(k)  # pylint: disable=W0212
+                for k in op.__class__.atts]
+        rt = RuntimeTreeEnsembleRegressorPFloat(60, 20)
+        rt.init(*atts)
+        self.assertGreater(rt.load_time_, 0)
+        xt = X_test.astype(numpy.float32)
+        self.assertEqualArray(op.rt_.compute(xt), rt.compute(xt))
+        # every node array must have the same length
+        atts[3] = atts[3][:-1]
+        self.assertRaise(lambda: rt.init(*atts), RuntimeError)
+
+    def test_cpp_serialize(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloat  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPDouble  # pylint: disable=E0611
+        temp = get_temp_folder(__file__, "temp_cpp_serialize")
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for cls, rt_cls, dtype in [
+                (RandomForestRegressor, RuntimeTreeEnsembleRegressorPFloat, numpy.float32),
+                (RandomForestClassifier, RuntimeTreeEnsembleClassifierPDouble, numpy.float64)]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=10, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(dtype))
+                oinf = OnnxInference(model_def)
+                xt = X_test.astype(dtype)
+                exp = oinf.run({'X': xt})
+
+                oinf2 = pickle.loads(pickle.dumps(oinf))
+                got = oinf2.run({'X': xt})
+                for k in exp:
+                    if isinstance(exp[k], numpy.ndarray):
+                        self.assertEqualArray(exp[k], got[k])
+
+                op = oinf.sequence_[0].ops_
+                name = os.path.join(temp, cls.__name__ + ".bin")
+                op.rt_.save(name)
+                rt = rt_cls(60, 20)
+                rt.load(name)
+                self.assertTrue(rt.packed_)
+                exp = op.rt_.compute(xt)
+                got = rt.compute(xt)
+                if isinstance(exp, tuple):
+                    self.assertEqualArray(exp[0], got[0])
+                    self.assertEqualArray(exp[1], got[1])
+                else:
+                    self.assertEqualArray(exp, got)
+                self.assertRaise(lambda: rt.deserialize(b"MLPTREE"), RuntimeError)
+
+    def test_cpp_serialize_invalid(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloat  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        clr = DecisionTreeRegressor(max_depth=3)
+        clr.fit(X, y)
+        model_def = to_onnx(clr, X.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        blob = oinf.sequence_[0].ops_.rt_.serialize()
+        rt = RuntimeTreeEnsembleRegressorPFloat(60, 20)
+        rt.deserialize(blob)
+
+        # see TreeEnsembleBlobHeader, a packed node of floats takes 16 bytes
+        post_transform = 64
+        offset_nodes, offset_roots = struct.unpack_from("qq", blob, 136)
+        root = struct.unpack_from("I", blob, offset_roots)[0]
+        truenode = offset_nodes + 16 * root + 8
+
+        wrong = bytearray(blob)
+        struct.pack_into("i", wrong, post_transform, 99)
+        self.assertRaise(lambda: rt.deserialize(bytes(wrong)), RuntimeError)
+        # the root is its own child
+        wrong = bytearray(blob)
+        struct.pack_into("I", wrong, truenode, root)
+        self.assertRaise(lambda: rt.deserialize(bytes(wrong)), RuntimeError)
+        # the previous model is kept
+        xt = X.astype(numpy.float32)
+        self.assertEqualArray(oinf.sequence_[0].ops_.rt_.compute(xt), rt.compute(xt))
+
+    def test_cpp_threads(self):
+        from concurrent.futures import ThreadPoolExecutor
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPDouble  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestRegressor(n_estimators=50, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float64))
+        oinf = OnnxInference(model_def)
+        blob = oinf.sequence_[0].ops_.rt_.serialize()
+        for omp in [1, 1000]:
+            with self.subTest(omp=omp):
+                rt = RuntimeTreeEnsembleRegressorPDouble(60, 20)
+                rt.deserialize(blob)
+                rt.omp_tree_ = omp
+                rt.omp_N_ = omp
+                xts = [X_test[i: i + n] for i, n in enumerate([1, 5, 20, 38])]
+                exp = [rt.compute(xt) for xt in xts]
+                with ThreadPoolExecutor(max_workers=8) as pool:
+                    got = list(pool.map(
+                        lambda i: rt.compute(xts[i % len(xts)]), range(64)))
+                for i, g in enumerate(got):
+                    self.assertEqualArray(exp[i % len(xts)], g)
+
+    def test_cpp_thread_pool(self):
+        from mlprodict.onnxrt.ops_cpu import set_thread_pool
+        from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import thread_pool_size  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestRegressor(n_estimators=50, max_depth=6, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        xt = X_test.astype(numpy.float32)
+        rt.omp_tree_ = 1000
+        rt.omp_N_ = 1000
+        exp = rt.compute(xt)
+        exp1 = rt.compute(xt[:1])
+        default = thread_pool_size()
+        try:
+            for n_threads in [1, 3]:
+                for affinity in [False, True]:
+                    set_thread_pool(n_threads, affinity)
+                    self.assertEqual(thread_pool_size(), n_threads)
+                    for omp_tree, omp_N in [(1, 1000), (1000, 1), (1, 1)]:
+                        with self.subTest(n_threads=n_threads, omp_tree=omp_tree, omp_N=omp_N):
+                            rt.omp_tree_ = omp_tree
+                            rt.omp_N_ = omp_N
+                            self.assertEqualArray(exp, rt.compute(xt), decimal=5)
+                            self.assertEqualArray(exp1, rt.compute(xt[:1]), decimal=5)
+        finally:
+            set_thread_pool(default, False)
+
+    @unittest.skipIf(not hasattr(os, 'fork'), reason="fork not available")
+    def test_cpp_thread_pool_fork(self):
+        # the child process cannot use the workers of its parent
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestRegressor(n_estimators=50, max_depth=6, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        xt = X_test.astype(numpy.float32)
+        rt.omp_tree_ = 1
+        rt.omp_N_ = 1
+        exp = rt.compute(xt)
+        pid = os.fork()
+        if pid == 0:
+            # killed if the pool waits for workers which do not exist
+            signal.alarm(20)
+            code = 1
+            try:
+                got = [rt.compute(xt) for i in range(3)]
+                code = 0 if all(numpy.allclose(exp, g, atol=1e-5) for g in got) else 2
+            finally:
+                os._exit(code)  # pylint: disable=W0150,W0212
+        _, status = os.waitpid(pid, 0)
+        self.assertTrue(os.WIFEXITED(status))
+        self.assertEqual(os.WEXITSTATUS(status), 0)
+        self.assertEqualArray(exp, rt.compute(xt), decimal=5)
+
+    def test_cpp_autotune(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPFloat  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestClassifier(n_estimators=30, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        xt = X_test.astype(numpy.float32)
+        exp = rt.compute(xt)
+        rt.autotune(xt, 3)
+        self.assertIn(rt.tile_N_, [1, 2, 4, 8, 16, 32, 64])
+        self.assertIn(rt.omp_tree_, [0, 30])
+        self.assertGreater(rt.omp_N_, 0)
+        self.assertLesser(rt.omp_N_, xt.shape[0])
+        got = rt.compute(xt)
+        self.assertEqualArray(exp[0], got[0])
+        self.assertEqualArray(exp[1], got[1])
+
+        rt2 = RuntimeTreeEnsembleClassifierPFloat(60, 20)
+        rt2.deserialize(rt.serialize())
+        self.assertEqual(rt2.tile_N_, rt.tile_N_)
+        self.assertEqual(rt2.omp_tree_, rt.omp_tree_)
+        self.assertEqual(rt2.omp_N_, rt.omp_N_)
+        self.assertRaise(lambda: rt.autotune(xt[:0], 3), RuntimeError)
+
+        # compute waits for autotune called by another thread
+        from concurrent.futures import ThreadPoolExecutor
+        with ThreadPoolExecutor(max_workers=4) as pool:
+            tune = pool.submit(lambda: rt.autotune(xt, 3))
+            got = list(pool.map(lambda i: rt.compute(xt[i:]), range(16)))
+            tune.result()
+        for i, g in enumerate(got):
+            self.assertEqualArray(exp[0][i:], g[0])
+            self.assertEqualArray(exp[1][i:], g[1])
+
+    def test_cpp_deterministic(self):
+        from mlprodict.onnxrt.ops_cpu import set_thread_pool
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloat  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import thread_pool_size  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = GradientBoostingRegressor(n_estimators=100, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        self.assertIn('QUICKSCORER', rt.runtime_options())
+        rt.deterministic_ = True
+        # the trees are summed by blocks, QuickScorer is not used
+        self.assertNotIn('QUICKSCORER', rt.runtime_options())
+        xt = X_test.astype(numpy.float32)
+        exp = rt.compute(xt)
+        exp1 = rt.compute(xt[:1])
+        self.assertEqual(exp[:1].tobytes(), exp1.tobytes())
+        default = thread_pool_size()
+        try:
+            for n_threads in [1, 2, 5]:
+                set_thread_pool(n_threads)
+                for omp, tile in [(1, 1), (1000, 16), (1, 64)]:
+                    rt.omp_tree_ = omp
+                    rt.omp_N_ = omp
+                    rt.tile_N_ = tile
+                    self.assertEqual(exp.tobytes(), rt.compute(xt).tobytes())
+                    self.assertEqual(exp1.tobytes(), rt.compute(xt[:1]).tobytes())
+        finally:
+            set_thread_pool(default)
+
+        rt2 = RuntimeTreeEnsembleRegressorPFloat(60, 20)
+        rt2.deserialize(rt.serialize())
+        self.assertTrue(rt2.deterministic_)
+        self.assertEqual(exp.tobytes(), rt2.compute(xt).tobytes())
+
+    def test_cpp_dense_leaves(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestClassifier(n_estimators=20, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        self.assertTrue(rt.dense_leaves_)
+        xt = X_test.astype(numpy.float32)
+        y = oinf.run({'X': xt})
+        self.assertEqualArray(clr.predict(X_test), y['output_label'])
+        got = pandas.DataFrame(list(y['output_probability'])).values
+        self.assertEqualArray(clr.predict_proba(X_test), got, decimal=5)
+
+        clr = GradientBoostingRegressor(n_estimators=10, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        self.assertFalse(oinf.sequence_[0].ops_.rt_.dense_leaves_)
+
+    def test_cpp_early_exit(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestClassifier(n_estimators=50, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        xt = X_test.astype(numpy.float32)
+        exp = rt.compute(xt)[0]
+        labels, n_trees = rt.compute_label(xt)
+        self.assertEqualArray(exp, labels)
+        self.assertEqual(n_trees.shape, (xt.shape[0], ))
+        self.assertLess(n_trees.sum(), 50 * xt.shape[0])
+        self.assertGreater(n_trees.min(), 0)
+
+        order = list(range(50))
+        rt.set_early_exit_order(order)
+        self.assertEqual(rt.early_exit_order_, order)
+        labels, n_trees = rt.compute_label(xt)
+        self.assertEqualArray(exp, labels)
+        self.assertRaise(lambda: rt.set_early_exit_order([0, 0]), RuntimeError)
+
+    def test_cpp_early_exit_tie(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPFloat  # pylint: disable=E0611
+        # three trees with the same weights in both leaves, classes 0 and 1
+        # tie exactly if the trees are summed in their order,
+        # 1e8 + 1 - 1e8 = 0 but 1e8 - 1e8 + 1 = 1 in float
+        w1 = [1e8, 1, -1e8]
+        class_ids, class_nodeids, class_treeids, class_weights = [], [], [], []
+        for t in range(3):
+            for n in [1, 2]:
+                for c, w in enumerate([0, w1[t], -1]):
+                    class_ids.append(c)
+                    class_nodeids.append(n)
+                    class_treeids.append(t)
+                    class_weights.append(w)
+
+        def i64(values):
+            return numpy.array(values, dtype=numpy.int64)
+
+        def f32(values):
+            return numpy.array(values, dtype=numpy.float32)
+
+        rt = RuntimeTreeEnsembleClassifierPFloat(60, 20)
+        rt.init(f32([]), i64(class_ids), i64(class_nodeids), i64(class_treeids),
+                f32(class_weights), i64([0, 1, 2]), [],
+                i64([2, -1, -1] * 3), i64([0, -2, -2] * 3), f32([]), i64([]),
+                ["BRANCH_LEQ", "LEAF", "LEAF"] * 3, i64([0, 1, 2] * 3),
+                i64([0, 0, 0, 1, 1, 1, 2, 2, 2]), i64([1, -1, -1] * 3),
+                f32([0.5, 0, 0] * 3), "NONE")
+        rt.set_early_exit_order([0, 2, 1])
+        xt = f32([[0], [1]])
+        exp = rt.compute(xt)[0]
+        self.assertEqualArray(exp, i64([0, 0]))
+        labels, n_trees = rt.compute_label(xt)
+        self.assertEqualArray(exp, labels)
+        self.assertEqualArray(n_trees, i64([3, 3]))
+
+    def test_cpp_profile(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = RandomForestRegressor(n_estimators=10, max_depth=4, random_state=11)
+        clr.fit(X_train, y_train)
+        model_def = to_onnx(clr, X_train.astype(numpy.float32))
+        oinf = OnnxInference(model_def)
+        rt = oinf.sequence_[0].ops_.rt_
+        xt = X_test.astype(numpy.float32)
+        exp = rt.compute(xt)
+        self.assertEqual(rt.get_node_counts().sum(), 0)
+        rt.profile_ = True
+        got = rt.compute(xt)
+        rt.profile_ = False
+        self.assertEqualArray(exp, got)
+
+        counts = rt.get_node_counts()
+        atts = oinf.sequence_[0].ops_
+        self.assertEqual(counts.shape, (len(atts.nodes_modes), 3))
+        leaves = numpy.array(atts.nodes_modes) == b'LEAF'
+        roots = atts.nodes_nodeids == 0
+        self.assertEqual(counts[roots, 0].tolist(), [xt.shape[0]] * 10)
+        self.assertEqualArray(counts[~leaves, 0], counts[~leaves, 1] + counts[~leaves, 2])
+        self.assertEqual(counts[leaves, 0].sum(), xt.shape[0] * 10)
+
+        hitrates = rt.get_hitrates()
+        self.assertEqualArray(hitrates, counts[:, 0] / xt.shape[0], decimal=5)
+        rt.reset_node_counts()
+        self.assertEqual(rt.get_node_counts().sum(), 0)
+
+        atts.nodes_hitrates = hitrates
+        atts._init(dtype=numpy.float32, version=1)
+        self.assertEqual(atts.rt_.node_order_, "HITRATES")
+        self.assertEqualArray(exp, atts.rt_.compute(xt))
+
+    def test_cpp_legacy_engine(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        xt = X_test.astype(numpy.float32)
+        for cl in [RandomForestRegressor, RandomForestClassifier]:
+            with self.subTest(cl=cl.__name__):
+                clr = cl(n_estimators=10, max_depth=4, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                atts = oinf.sequence_[0].ops_
+                exp = atts.rt_.compute(xt)
+                atts._init(dtype=numpy.float32, version=0)
+                got = atts.rt_.compute(xt)
+                if isinstance(exp, tuple):
+                    self.assertEqualArray(exp[0], got[0])
+                    self.assertEqualArray(exp[1].ravel(), got[1].ravel())
+                else:
+                    self.assertEqualArray(exp, got)
+                self.assertEqual(len(atts.rt_.roots_), 10)
+                self.assertEqual(
+                    numpy.array(atts.rt_.nodes_nodeids_)[atts.rt_.roots_].tolist(),
+                    [0] * 10)
+                self.assertEqualArray(
+                    numpy.array(atts.rt_.nodes_nodeids_), atts.nodes_nodeids)
+
+    def test_cpp_float_double(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import RuntimeTreeEnsembleRegressorPFloatDouble  # pylint: disable=E0611
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_p_ import RuntimeTreeEnsembleClassifierPFloatDouble  # pylint: disable=E0611
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        xt = X_test.astype(numpy.float32)
+        for cls, rt_cls in [(GradientBoostingRegressor, RuntimeTreeEnsembleRegressorPFloatDouble),
+                            (GradientBoostingClassifier, RuntimeTreeEnsembleClassifierPFloatDouble)]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=50, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                op = oinf.sequence_[0].ops_
+                atts = [op._get_typed_attributes(k)  # pylint: disable=W0212
+                        for k in op.__class__.atts]
+                rt = rt_cls(60, 20)
+                rt.init(*atts)
+                exp = op.rt_.compute(xt)
+                got = rt.compute(xt)
+                if isinstance(exp, tuple):
+                    self.assertEqualArray(exp[0], got[0])
+                    self.assertEqual(got[1].dtype, numpy.float64)
+                    self.assertEqualArray(exp[1], got[1], decimal=5)
+                else:
+                    self.assertEqual(got.dtype, numpy.float64)
+                    self.assertEqualArray(exp, got, decimal=5)
+                rt.omp_N_ = 1
+                rt.tile_N_ = 4
+                got2 = rt.compute(xt)
+                if isinstance(got, tuple):
+                    self.assertEqualArray(got[1], got2[1])
+                else:
+                    self.assertEqualArray(got, got2)
+
+    def test_cpp_stream(self):
+        temp = get_temp_folder(__file__, "temp_cpp_stream")
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        xt = X_test.astype(numpy.float32)
+        name = os.path.join(temp, "x.npy")
+        numpy.save(name, xt)
+        for cls in [RandomForestRegressor, RandomForestClassifier]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=10, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(numpy.float32))
+                oinf = OnnxInference(model_def)
+                op = oinf.sequence_[0].ops_
+                exp = op.rt_.compute(xt)
+                if isinstance(exp, tuple):
+                    exp_labels, exp = exp
+                exp = exp.reshape((xt.shape[0], -1))
+
+                chunks = (xt[i:i + 7] for i in range(0, xt.shape[0], 7))
+                out = numpy.empty(exp.shape, dtype=numpy.float32)
+                if cls is RandomForestClassifier:
+                    labels = numpy.empty(xt.shape[0], dtype=numpy.int64)
+                    self.assertEqual(op.run_stream(chunks, out, labels), xt.shape[0])
+                    self.assertEqualArray(exp_labels, labels)
+                else:
+                    self.assertEqual(op.run_stream(chunks, out), xt.shape[0])
+                self.assertEqualArray(exp, out)
+
+                for chunk_rows in [0, 1, 10]:
+                    nout = os.path.join(temp, "z%s%d.npy" % (cls.__name__, chunk_rows))
+                    if cls is RandomForestClassifier:
+                        nlab = os.path.join(temp, "l%d.npy" % chunk_rows)
+                        self.assertEqual(
+                            op.rt_.compute_npy(name, nout, nlab, chunk_rows), xt.shape[0])
+                        self.assertEqualArray(exp_labels, numpy.load(nlab))
+                    else:
+                        self.assertEqual(
+                            op.rt_.compute_npy(name, nout, chunk_rows), xt.shape[0])
+                    self.assertEqualArray(exp, numpy.load(nout))
+                # the runtime expects float features
+                name64 = os.path.join(temp, "x64.npy")
+                numpy.save(name64, xt.astype(numpy.float64))
+                self.assertRaise(lambda: op.run_stream(name64, nout), RuntimeError)
+
+    def test_cpp_fortran_order(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for cls, dtype in [(GradientBoostingRegressor, numpy.float32),
+                           (RandomForestClassifier, numpy.float64)]:
+            with self.subTest(cls=cls.__name__):
+                clr = cls(n_estimators=20, random_state=11)
+                clr.fit(X_train, y_train)
+                model_def = to_onnx(clr, X_train.astype(dtype))
+                oinf = OnnxInference(model_def)
+                rt = oinf.sequence_[0].ops_.rt_
+                xt = numpy.ascontiguousarray(X_test.astype(dtype))
+                exp = rt.compute(xt)
+                wide = numpy.zeros((xt.shape[0] * 2, xt.shape[1] * 3), dtype=dtype)
+                wide[::2, 1::3] = xt
+                for x in [numpy.asfortranarray(xt), wide[::2, 1::3], xt[::-1][::-1]]:
+                    got = rt.compute(x)
+                    if isinstance(exp, tuple):
+                        self.assertEqualArray(exp[0], got[0])
+                        self.assertEqualArray(exp[1], got[1])
+                        self.assertEqualArray(rt.compute_label(xt)[0],
+                                              rt.compute_label(x)[0])
+                    else:
+                        self.assertEqualArray(exp, got)
+
+    def test_cpp_post_transform_batch(self):
+        # the post transform is applied to a whole tile of rows,
+        # every row must receive the same scores as if it were alone
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for binary in [True, False]:
+            yt = y_train.copy()
+            if binary:
+                yt[yt == 2] = 1
+            clr = GradientBoostingClassifier(n_estimators=20, random_state=11)
+            clr.fit(X_train, yt)
+            model_def = to_onnx(clr, X_train.astype(numpy.float32))
+            oinf = OnnxInference(model_def)
+            rt = oinf.sequence_[0].ops_.rt_
+            xt = X_test.astype(numpy.float32)
+            for omp in [1, 1000]:
+                with self.subTest(binary=binary, omp=omp):
+                    rt.omp_tree_ = omp
+                    rt.omp_N_ = omp
+                    label, proba = rt.compute(xt)
+                    proba = proba.reshape((xt.shape[0], -1))
+                    self.assertEqualArray(clr.predict(X_test), label)
+                    self.assertEqualArray(clr.predict_proba(X_test), proba,
+                                          decimal=3)
+                    for i in range(xt.shape[0]):
+                        lab1, proba1 = rt.compute(xt[i: i + 1])
+                        self.assertEqual(label[i], lab1[0])
+                        self.assertEqualArray(proba[i], proba1)
+
+
 
 if __name__ == "__main__":
     TestOnnxrtPythonRuntimeMlTree().test_onnxrt_python_GradientBoostingRegressor64()
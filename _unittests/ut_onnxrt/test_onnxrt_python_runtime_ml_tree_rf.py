@@ -79,6 +79,8 @@ class TestOnnxrtPythonRuntimeMlTreeRF(ExtTestCase):
                     "---------\n{}\n-----".format(model_def)) from e
         self.assertEqual(oinf.sequence_[0].ops_.rt_.same_mode_, True)
         self.assertNotEmpty(oinf.sequence_[0].ops_.rt_.nodes_modes_)
+        self.assertIn(oinf.sequence_[0].ops_.rt_.node_order_,
+                      ('BFS', 'HITRATES'))
 
     @ignore_warnings(category=(UserWarning, RuntimeWarning, DeprecationWarning))
     def test_onnxrt_python_RandomForestRegressor32(self):
@@ -45,6 +45,23 @@ def get_opset_number_from_onnx(benchmark=False):
     return onnx_opset_version()
 
 
+def set_thread_pool(n_threads=0, affinity=False):
+    """
+    Restarts the thread pool shared by the runtimes of the tree ensembles
+    (``RuntimeTreeEnsembleRegressor*``, ``RuntimeTreeEnsembleClassifier*``)
+    and the SVMs (``RuntimeSVMRegressor*``, ``RuntimeSVMClassifier*``).
+    There is only one pool whatever the number of extensions using it.
+    It runs one computation at a time, a runtime called from another
+    thread while the pool is busy waits for it before using all threads.
+
+    @param      n_threads       number of threads including the calling thread,
+                                0 for the number of threads :epkg:`openmp` would use
+    @param      affinity        pins every thread to one core
+    """
+    from ._op_onnx_numpy import thread_pool_configure  # pylint: disable=E0611
+    thread_pool_configure(n_threads, affinity)
+
+
 def load_op(onnx_node, desc=None, options=None):
     """
     Gets the operator related to the *onnx* node.
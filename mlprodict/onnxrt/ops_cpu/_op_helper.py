@@ -2,6 +2,7 @@
 @file
 @brief Runtime operator.
 """
+from concurrent.futures import ThreadPoolExecutor
 import numpy
 from onnx import TensorProto
 
@@ -25,6 +26,38 @@ def _get_typed_class_attribute(self, k, atts):
             k, getattr(self, k)))
 
 
+def _stream_compute(compute, chunks, outputs):
+    """
+    Applies *compute* on every array produced by *chunks* and copies
+    the results into *outputs* (in the same order, *None* skips one),
+    the next chunk is retrieved by another thread while
+    the current one is computed by the C++ runtime which releases the GIL.
+
+    @param      compute         function returning an array or a tuple
+    @param      chunks          iterable of 2D arrays
+    @param      outputs         list of arrays (or :epkg:`numpy` memmap)
+    @return                     number of rows
+    """
+    it = iter(chunks)
+    pos = 0
+    with ThreadPoolExecutor(max_workers=1) as pool:
+        following = pool.submit(next, it, None)
+        while True:
+            x = following.result()
+            if x is None:
+                break
+            following = pool.submit(next, it, None)
+            res = compute(x)
+            if not isinstance(res, tuple):
+                res = (res, )
+            n = x.shape[0]
+            for out, r in zip(outputs, res):
+                if out is not None:
+                    out[pos:pos + n] = r.reshape((n, ) + out.shape[1:])
+            pos += n
+    return pos
+
+
 def proto2dtype(proto_type):
     """
     Converts a proto type into a :epkg:`numpy` type.
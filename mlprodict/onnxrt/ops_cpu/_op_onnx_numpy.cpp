@@ -27,6 +27,8 @@ namespace py = pybind11;
 #endif
 
 #include "op_common_.hpp"
+#include "op_common_num_.hpp"
+#include "op_common_thread_pool_.hpp"
 
 
 /////////////////////////////////////////////
@@ -396,6 +398,117 @@ py::array_t<int64_t> topk_element_fetch_int64(
 
 
 
+/////////////////////////////////////////////
+// begin: vectorized dot product
+/////////////////////////////////////////////
+
+
+template<typename NTYPE>
+void check_vector_pair(const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& a,
+                       const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& b) {
+    if (a.size() != b.size())
+        throw std::runtime_error("Both vectors must have the same size.");
+}
+
+
+float vector_dot_product_float(
+        py::array_t<float, py::array::c_style | py::array::forcecast> a,
+        py::array_t<float, py::array::c_style | py::array::forcecast> b,
+        int level) {
+    check_vector_pair(a, b);
+    return vector_dot_product_pointer(a.data(), b.data(), (size_t)a.size(), level);
+}
+
+
+double vector_dot_product_double(
+        py::array_t<double, py::array::c_style | py::array::forcecast> a,
+        py::array_t<double, py::array::c_style | py::array::forcecast> b,
+        int level) {
+    check_vector_pair(a, b);
+    return vector_dot_product_pointer(a.data(), b.data(), (size_t)a.size(), level);
+}
+
+
+float vector_squared_distance_float(
+        py::array_t<float, py::array::c_style | py::array::forcecast> a,
+        py::array_t<float, py::array::c_style | py::array::forcecast> b,
+        int level) {
+    check_vector_pair(a, b);
+    return vector_squared_distance_pointer(a.data(), b.data(), (size_t)a.size(), level);
+}
+
+
+double vector_squared_distance_double(
+        py::array_t<double, py::array::c_style | py::array::forcecast> a,
+        py::array_t<double, py::array::c_style | py::array::forcecast> b,
+        int level) {
+    check_vector_pair(a, b);
+    return vector_squared_distance_pointer(a.data(), b.data(), (size_t)a.size(), level);
+}
+
+
+std::string simd_name(int level) {
+    return num_simd_name(level);
+}
+
+
+template<typename NTYPE>
+py::array_t<NTYPE> vector_math(
+        const std::string& name,
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> x,
+        int level) {
+    std::vector<int64_t> shape;
+    arrayshape2vector(shape, x);
+    if (shape.empty())
+        shape.push_back((int64_t)x.size());
+    std::vector<int64_t> strides;
+    shape2strides(shape, strides, (NTYPE)0);
+    auto result = py::array_t<NTYPE>(shape, strides);
+    py::buffer_info buf = result.request();
+    NTYPE* y = (NTYPE*) buf.ptr;
+    size_t size = (size_t)x.size();
+    if (name == "exp")
+        vector_exp_pointer(x.data(), y, size, level);
+    else if (name == "log")
+        vector_log_pointer(x.data(), y, size, level);
+    else if (name == "tanh")
+        vector_tanh_pointer(x.data(), y, size, level);
+    else if (name == "logistic")
+        vector_logistic_pointer(x.data(), y, size, level);
+    else if (name == "erfinv")
+        vector_erfinv_pointer(x.data(), y, size, level);
+    else
+        throw std::runtime_error("Unknown function '" + name + "'.");
+    return result;
+}
+
+
+py::array_t<float> vector_math_float(
+        const std::string& name,
+        py::array_t<float, py::array::c_style | py::array::forcecast> x,
+        int level) {
+    return vector_math<float>(name, x, level);
+}
+
+
+py::array_t<double> vector_math_double(
+        const std::string& name,
+        py::array_t<double, py::array::c_style | py::array::forcecast> x,
+        int level) {
+    return vector_math<double>(name, x, level);
+}
+
+
+py::capsule thread_pool_capsule() {
+    return py::capsule((void*)&ThreadPool::global(), "mlprodict.ThreadPool");
+}
+
+
+/////////////////////////////////////////////
+// end: vectorized dot product
+/////////////////////////////////////////////
+
+
 
 #ifndef SKIP_PYTHON
 
@@ -459,6 +572,50 @@ on each row (= last dimension for a multi dimension array).)pbdoc");
     m.def("topk_element_fetch_int64", &topk_element_fetch_int64,
             R"pbdoc(Fetches the top k element knowing their indices
 on each row (= last dimension for a multi dimension array).)pbdoc");
+
+    m.def("simd_cpu_level", &num_simd_cpu_level,
+            R"pbdoc(Returns the best instruction set the vectorized kernels
+can use on this machine, 0 for none, 1 for SSE2, 2 for AVX2 and FMA,
+3 for AVX-512.)pbdoc");
+    m.def("simd_name", &simd_name,
+            R"pbdoc(Returns the name of an instruction set returned by
+*simd_cpu_level*.)pbdoc");
+    m.def("vector_dot_product_float", &vector_dot_product_float,
+            R"pbdoc(Computes the dot product of two float32 vectors
+with the vectorized kernel used by the SVM runtimes.
+*level* is the instruction set (see *simd_cpu_level*), -1 for the best one,
+a level the machine does not support falls back to the best one.)pbdoc");
+    m.def("vector_dot_product_double", &vector_dot_product_double,
+            R"pbdoc(Computes the dot product of two float64 vectors
+with the vectorized kernel used by the SVM runtimes.
+*level* is the instruction set (see *simd_cpu_level*), -1 for the best one,
+a level the machine does not support falls back to the best one.)pbdoc");
+    m.def("vector_squared_distance_float", &vector_squared_distance_float,
+            R"pbdoc(Computes the squared euclidean distance between two float32 vectors
+with the vectorized kernel used by the SVM runtimes (kernel RBF).
+*level* is the instruction set (see *simd_cpu_level*), -1 for the best one.)pbdoc");
+    m.def("vector_squared_distance_double", &vector_squared_distance_double,
+            R"pbdoc(Computes the squared euclidean distance between two float64 vectors
+with the vectorized kernel used by the SVM runtimes (kernel RBF).
+*level* is the instruction set (see *simd_cpu_level*), -1 for the best one.)pbdoc");
+    m.def("vector_math_float", &vector_math_float,
+            R"pbdoc(Applies a vectorized function (*exp*, *log*, *tanh*, *logistic*,
+*erfinv*) used by the post transforms and the SVM kernels to a float32 array.
+*level* is the instruction set (see *simd_cpu_level*), -1 for the best one.)pbdoc");
+    m.def("vector_math_double", &vector_math_double,
+            R"pbdoc(Applies a vectorized function (*exp*, *log*, *tanh*, *logistic*,
+*erfinv*) used by the post transforms and the SVM kernels to a float64 array.
+*level* is the instruction set (see *simd_cpu_level*), -1 for the best one.)pbdoc");
+
+    m.def("thread_pool_configure", &thread_pool_configure,
+          "Restarts the thread pool shared by the runtimes of every extension "
+          "with *n_threads* threads (0 for the number of threads openmp would use), "
+          "*affinity* pins every thread to one core.");
+    m.def("thread_pool_size", &thread_pool_size,
+          "Returns the number of threads of the thread pool.");
+    m.def("thread_pool_capsule", &thread_pool_capsule,
+          "Returns the thread pool in a capsule, the other extensions "
+          "use it instead of creating their own.");
 }
 
 #endif
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <thread>
 #include <iterator>
 #include <iostream> // cout
 #include <math.h>
+#include "op_common_num_.hpp"
 
 #if defined(_WIN32) || defined(WIN32)
 
@@ -129,15 +131,19 @@ static inline double ErfInv(double x) {
 }
 
 
+// Same formula as vector_logistic_pointer, exp(-|x|) / (1 + exp(-|x|))
+// is more accurate than 1 - 1 / (1 + exp(-|x|)) for negative values.
 static inline float ComputeLogistic(float val) {
-  float v = 1 / (1 + std::exp(-std::abs(val)));
-  return (val < 0) ? (1 - v) : v;
+  float e = std::exp(-std::abs(val));
+  float v = 1 / (1 + e);
+  return (val < 0) ? (e * v) : v;
 }
 
 
 static inline double ComputeLogistic(double val) {
-  double v = 1. / (1. + std::exp(-std::abs(val)));
-  return (val < 0) ? (1. - v) : v;
+  double e = std::exp(-std::abs(val));
+  double v = 1. / (1. + e);
+  return (val < 0) ? (e * v) : v;
 }
 
 
@@ -150,6 +156,17 @@ static inline NTYPE ComputeProbit(NTYPE val) {
 }
 
 
+template<class NTYPE>
+static inline void ComputeProbit(const NTYPE* begin, const NTYPE* end, NTYPE* Z) {
+  size_t n = end - begin;
+  for (size_t i = 0; i < n; ++i)
+    Z[i] = begin[i] * 2 - 1;
+  vector_erfinv_pointer(Z, Z, n);
+  for (size_t i = 0; i < n; ++i)
+    Z[i] *= ml_sqrt2;
+}
+
+
 template<class NTYPE>
 static inline NTYPE sigmoid_probability(NTYPE score, NTYPE proba, NTYPE probb) {
   NTYPE val = score * proba + probb;
@@ -165,11 +182,12 @@ void ComputeSoftmax(NTYPE* begin, NTYPE* end) {
         if (*it > v_max)
           v_max = *it;
     }
+    for (it = begin; it != end; ++it)
+        *it -= v_max;
+    vector_exp_pointer(begin, begin, end - begin);
     NTYPE this_sum = (NTYPE)0.;
-    for (it = begin; it != end; ++it) {
-        *it = std::exp(*it - v_max);
+    for (it = begin; it != end; ++it)
         this_sum += *it;
-    }
     for (it = begin; it != end; ++it)
         *it /= this_sum;
 }
@@ -191,12 +209,20 @@ void ComputeSoftmaxZero(NTYPE* begin, NTYPE* end) {
     }
     NTYPE exp_neg_v_max = std::exp(-v_max);
     NTYPE this_sum = (NTYPE)0;
-    for (it = begin; it != end; ++it) {
-        if (*it > 0.0000001f || *it < -0.0000001f) {
-            *it = std::exp(*it - v_max);
-            this_sum += *it;
-        } else {
-            *it *= exp_neg_v_max;
+    NTYPE buffer[64];
+    size_t i, n;
+    for (it = begin; it != end; it += n) {
+        n = std::min((size_t)(end - it), (size_t)64);
+        for (i = 0; i < n; ++i)
+            buffer[i] = it[i] - v_max;
+        vector_exp_pointer(buffer, buffer, n);
+        for (i = 0; i < n; ++i) {
+            if (it[i] > 0.0000001f || it[i] < -0.0000001f) {
+                it[i] = buffer[i];
+                this_sum += it[i];
+            } else {
+                it[i] *= exp_neg_v_max;
+            }
         }
     }
     for (it = begin; it != end; ++it)
@@ -210,74 +236,111 @@ void ComputeSoftmaxZero(std::vector<NTYPE>& values) {
 }
 
 
+// Value of add_second_class for a row of write_scores_batch
+// which holds one score per class.
+#define SCORES_FULL_ROW -2
+
+
 template<class NTYPE>
-void write_scores(std::vector<NTYPE>& scores, POST_EVAL_TRANSFORM post_transform,
-                  NTYPE* Z, int add_second_class) {
-    if (scores.size() >= 2) {
-        switch (post_transform) {
-            case POST_EVAL_TRANSFORM::PROBIT:
-                for(auto it = scores.cbegin(); it != scores.cend(); ++it, ++Z)
-                    *Z = ComputeProbit(*it);
-                break;
-            case POST_EVAL_TRANSFORM::LOGISTIC:
-                for(auto it = scores.cbegin(); it != scores.cend(); ++it, ++Z)
-                    *Z = ComputeLogistic(*it);
-                break;
-            case POST_EVAL_TRANSFORM::SOFTMAX:
-                ComputeSoftmax(scores);
-                memcpy(Z, scores.data(), scores.size() * sizeof(NTYPE));
-                break;
-            case POST_EVAL_TRANSFORM::SOFTMAX_ZERO:
-                ComputeSoftmaxZero(scores);
-                memcpy(Z, scores.data(), scores.size() * sizeof(NTYPE));
-                break;
-            default:
-            case POST_EVAL_TRANSFORM::NONE:
-                memcpy(Z, scores.data(), scores.size() * sizeof(NTYPE));
-                break;
-        }
+void _write_scores_full_rows(int64_t N, int64_t n_classes, NTYPE* Z,
+                             POST_EVAL_TRANSFORM post_transform) {
+    int64_t i;
+    switch (post_transform) {
+        case POST_EVAL_TRANSFORM::PROBIT:
+            ComputeProbit(Z, Z + N * n_classes, Z);
+            break;
+        case POST_EVAL_TRANSFORM::LOGISTIC:
+            vector_logistic_pointer(Z, Z, N * n_classes);
+            break;
+        case POST_EVAL_TRANSFORM::SOFTMAX:
+            for (i = 0; i < N; ++i, Z += n_classes)
+                ComputeSoftmax(Z, Z + n_classes);
+            break;
+        case POST_EVAL_TRANSFORM::SOFTMAX_ZERO:
+            for (i = 0; i < N; ++i, Z += n_classes)
+                ComputeSoftmaxZero(Z, Z + n_classes);
+            break;
+        default:
+        case POST_EVAL_TRANSFORM::NONE:
+            break;
     }
-    else if (scores.size() == 1) {  //binary case
-        if (post_transform == POST_EVAL_TRANSFORM::PROBIT) {
-            scores[0] = ComputeProbit(scores[0]);
-            *Z = scores[0];
+}
+
+
+/**
+* Applies the post transform in place to a matrix of scores Z (N, n_classes)
+* stored row by row. add_second_class[i] is SCORES_FULL_ROW if row i holds
+* n_classes scores, otherwise row i holds a single score expanded into two
+* columns the same way write_scores does in the binary case.
+* add_second_class may be null if every row is full.
+* Consecutive full rows are transformed at once, nothing is allocated,
+* the function can be called by several threads on distinct rows.
+*/
+template<class NTYPE>
+void write_scores_batch(int64_t N, int64_t n_classes, NTYPE* Z,
+                        POST_EVAL_TRANSFORM post_transform,
+                        const int* add_second_class) {
+    if (n_classes == 1) {
+        if (post_transform == POST_EVAL_TRANSFORM::PROBIT)
+            ComputeProbit(Z, Z + N, Z);
+        return;
+    }
+    int64_t i = 0, j;
+    NTYPE* row;
+    NTYPE val;
+    while (i < N) {
+        for (j = i; j < N && (add_second_class == NULL ||
+                              add_second_class[j] == SCORES_FULL_ROW); ++j);
+        if (j > i) {
+            _write_scores_full_rows(j - i, n_classes, Z + i * n_classes, post_transform);
+            i = j;
+            continue;
         }
+        // binary case
+        row = Z + i * n_classes;
+        val = row[0];
+        if (post_transform == POST_EVAL_TRANSFORM::PROBIT)
+            row[0] = ComputeProbit(val);
         else {
-            switch (add_second_class) {
+            switch (add_second_class[i]) {
                 case 0:  //0=all positive weights, winning class is positive
-                    scores.push_back(scores[0]);
-                    scores[0] = 1.f - scores[0];  //put opposite score in positive slot
-                    *Z = scores[0];
-                    *(Z+1) = scores[1];
-                    break;
                 case 1:  //1 = all positive weights, winning class is negative
-                    scores.push_back(scores[0]);
-                    scores[0] = 1.f - scores[0];  //put opposite score in positive slot
-                    *Z = scores[0];
-                    *(Z+1) = scores[1];
+                    row[0] = 1.f - val;  //put opposite score in positive slot
+                    row[1] = val;
                     break;
                 case 2:
                 case 3:  //2 = mixed weights, winning class is positive
                     if (post_transform == POST_EVAL_TRANSFORM::LOGISTIC) {
-                        scores.push_back(ComputeLogistic(scores[0]));  //ml_logit(scores[k]);
-                        scores[0] = ComputeLogistic(-scores[0]);
+                        row[0] = ComputeLogistic(-val);
+                        row[1] = ComputeLogistic(val);  //ml_logit(scores[k]);
                     }
                     else {
-                        scores.push_back(scores[0]);
-                        scores[0] = -scores[0];
+                        row[0] = -val;
+                        row[1] = val;
                     }
-                    *Z = scores[0];
-                    *(Z+1) = scores[1];
                     break;
                 default:
-                    *Z = scores[0];
                     break;
             }
         }
+        ++i;
     }
 }
 
 
+template<class NTYPE>
+void write_scores(std::vector<NTYPE>& scores, POST_EVAL_TRANSFORM post_transform,
+                  NTYPE* Z, int add_second_class) {
+    if (scores.empty())
+        return;
+    memcpy(Z, scores.data(), scores.size() * sizeof(NTYPE));
+    if (scores.size() >= 2)
+        add_second_class = SCORES_FULL_ROW;
+    write_scores_batch(1, std::max((int64_t)scores.size(), (int64_t)2), Z,
+                       post_transform, &add_second_class);
+}
+
+
 template<class NTYPE>
 void write_scores2(NTYPE* scores, POST_EVAL_TRANSFORM post_transform,
                    NTYPE* Z, int add_second_class) {
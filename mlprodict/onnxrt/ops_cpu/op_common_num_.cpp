@@ -1,93 +1,786 @@
-
 #if !defined(_CRT_SECURE_NO_WARNINGS)
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 #include "op_common_num_.hpp"
+#include "op_common_thread_pool_.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
 
-#include <xmmintrin.h>
-#include <emmintrin.h>
-
-
-#define BYNF 16
-
-
-// Optimisation are disabled. The debug version works
-// but the release does not.
-// It requires further investigation.
-#if defined(_WIN32) || defined(WIN32)
-//#pragma optimize( "", off )
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define NUM_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define NUM_SIMD_TARGET_SSE2
+#define NUM_SIMD_TARGET_AVX2
+#define NUM_SIMD_TARGET_AVX512
 #else
-//#pragma GCC push_options
-//#pragma GCC optimize ("O0")
-//         works: gcc -pthread -Wno-unused-result -Wsign-compare -DNDEBUG -g -fwrapv -O3 -Wall -g -fstack-protector --param=ssp-buffer-size=4 -Wformat -Werror=format-security -fPIC -fopenmp
-// does not work: gcc -pthread -Wno-unused-result -Wsign-compare -DNDEBUG -g -fwrapv -O3 -Wall -fPIC -fopenmp
+#define NUM_SIMD_TARGET_SSE2 __attribute__((target("sse2")))
+#define NUM_SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define NUM_SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
 #endif
-float vector_dot_product_pointer16_sse(const float *p1, const float *p2, size_t size)
-{
-    float sum = 0;
-    size_t i = 0;
-#if 0
-    // Compilers do some optimisation and this code fails at _mm_store_ps.
-    if (size >= BYNF) {
-        float r[4];
-        size_t size_ = size - size % BYNF;
-        __m128 r1 = _mm_setzero_ps();
-        for (; i != size_; i += 4, p1 += 4, p2 += 4) {
-            r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_load_ps(p1), _mm_load_ps(p2)));
+#endif
+
+
+int num_simd_cpu_level() {
+#if defined(NUM_SIMD_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+    static int level = -1;
+    if (level == -1) {
+        int info[4];
+        level = NUM_SIMD_SSE2;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        if (osxsave) {
+            unsigned long long xcr0 = _xgetbv(0);
+            __cpuidex(info, 7, 0);
+            if ((xcr0 & 0x6) == 0x6 && fma && (info[1] & (1 << 5)) != 0)
+                level = NUM_SIMD_AVX2;
+            if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0)
+                level = NUM_SIMD_AVX512;
         }
-        _mm_store_ps(r, r1);
-        sum += r[0] + r[1] + r[2] + r[3];
     }
+    return level;
+#else
+    static int level = __builtin_cpu_supports("avx512f")
+        ? NUM_SIMD_AVX512
+        : (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+            ? NUM_SIMD_AVX2
+            : (__builtin_cpu_supports("sse2") ? NUM_SIMD_SSE2 : NUM_SIMD_NONE));
+    return level;
+#endif
+#else
+    return NUM_SIMD_NONE;
 #endif
-    size -= i;
+}
+
+
+const char* num_simd_name(int level) {
+    switch(level) {
+        case NUM_SIMD_SSE2: return "SSE2";
+        case NUM_SIMD_AVX2: return "AVX2";
+        case NUM_SIMD_AVX512: return "AVX512";
+        default: return "NONE";
+    }
+}
+
+
+inline int num_simd_select(int level) {
+    int cpu = num_simd_cpu_level();
+    return level < 0 || level > cpu ? cpu : level;
+}
+
+
+////////////////////////////
+// scalar version
+////////////////////////////
+
+
+template <typename NTYPE>
+inline NTYPE _dot_product_none(const NTYPE *p1, const NTYPE *p2, size_t size) {
+    NTYPE sum = 0;
     for (; size > 0; ++p1, ++p2, --size)
         sum += *p1 * *p2;
     return sum;
 }
-#if defined(_WIN32) || defined(WIN32)
-//#pragma optimize( "", on )
-#else
-// #pragma GCC pop_options
+
+
+template <typename NTYPE>
+inline NTYPE _squared_distance_none(const NTYPE *p1, const NTYPE *p2, size_t size) {
+    NTYPE sum = 0, d;
+    for (; size > 0; ++p1, ++p2, --size) {
+        d = *p1 - *p2;
+        sum += d * d;
+    }
+    return sum;
+}
+
+
+template <typename NTYPE>
+inline void _axpy_none(NTYPE a, const NTYPE *x, NTYPE *y, size_t size) {
+    for (; size > 0; ++x, ++y, --size)
+        *y += a * *x;
+}
+
+
+#if defined(NUM_SIMD_X86)
+
+////////////////////////////
+// SSE2, two accumulators
+////////////////////////////
+
+
+NUM_SIMD_TARGET_SSE2 inline float _hsum_sse2(__m128 s) {
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+
+NUM_SIMD_TARGET_SSE2 inline double _hsum_sse2(__m128d s) {
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+
+NUM_SIMD_TARGET_SSE2 float _dot_product_sse2(const float *p1, const float *p2, size_t size) {
+    __m128 r1 = _mm_setzero_ps();
+    __m128 r2 = _mm_setzero_ps();
+    for (; size >= 8; size -= 8, p1 += 8, p2 += 8) {
+        r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_loadu_ps(p1), _mm_loadu_ps(p2)));
+        r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_loadu_ps(p1 + 4), _mm_loadu_ps(p2 + 4)));
+    }
+    return _hsum_sse2(_mm_add_ps(r1, r2)) + _dot_product_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_SSE2 double _dot_product_sse2(const double *p1, const double *p2, size_t size) {
+    __m128d r1 = _mm_setzero_pd();
+    __m128d r2 = _mm_setzero_pd();
+    for (; size >= 4; size -= 4, p1 += 4, p2 += 4) {
+        r1 = _mm_add_pd(r1, _mm_mul_pd(_mm_loadu_pd(p1), _mm_loadu_pd(p2)));
+        r2 = _mm_add_pd(r2, _mm_mul_pd(_mm_loadu_pd(p1 + 2), _mm_loadu_pd(p2 + 2)));
+    }
+    return _hsum_sse2(_mm_add_pd(r1, r2)) + _dot_product_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_SSE2 float _squared_distance_sse2(const float *p1, const float *p2, size_t size) {
+    __m128 r1 = _mm_setzero_ps();
+    __m128 r2 = _mm_setzero_ps();
+    __m128 d1, d2;
+    for (; size >= 8; size -= 8, p1 += 8, p2 += 8) {
+        d1 = _mm_sub_ps(_mm_loadu_ps(p1), _mm_loadu_ps(p2));
+        d2 = _mm_sub_ps(_mm_loadu_ps(p1 + 4), _mm_loadu_ps(p2 + 4));
+        r1 = _mm_add_ps(r1, _mm_mul_ps(d1, d1));
+        r2 = _mm_add_ps(r2, _mm_mul_ps(d2, d2));
+    }
+    return _hsum_sse2(_mm_add_ps(r1, r2)) + _squared_distance_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_SSE2 double _squared_distance_sse2(const double *p1, const double *p2, size_t size) {
+    __m128d r1 = _mm_setzero_pd();
+    __m128d r2 = _mm_setzero_pd();
+    __m128d d1, d2;
+    for (; size >= 4; size -= 4, p1 += 4, p2 += 4) {
+        d1 = _mm_sub_pd(_mm_loadu_pd(p1), _mm_loadu_pd(p2));
+        d2 = _mm_sub_pd(_mm_loadu_pd(p1 + 2), _mm_loadu_pd(p2 + 2));
+        r1 = _mm_add_pd(r1, _mm_mul_pd(d1, d1));
+        r2 = _mm_add_pd(r2, _mm_mul_pd(d2, d2));
+    }
+    return _hsum_sse2(_mm_add_pd(r1, r2)) + _squared_distance_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_SSE2 void _axpy_sse2(float a, const float *x, float *y, size_t size) {
+    __m128 va = _mm_set1_ps(a);
+    for (; size >= 4; size -= 4, x += 4, y += 4)
+        _mm_storeu_ps(y, _mm_add_ps(_mm_loadu_ps(y), _mm_mul_ps(va, _mm_loadu_ps(x))));
+    _axpy_none(a, x, y, size);
+}
+
+
+NUM_SIMD_TARGET_SSE2 void _axpy_sse2(double a, const double *x, double *y, size_t size) {
+    __m128d va = _mm_set1_pd(a);
+    for (; size >= 2; size -= 2, x += 2, y += 2)
+        _mm_storeu_pd(y, _mm_add_pd(_mm_loadu_pd(y), _mm_mul_pd(va, _mm_loadu_pd(x))));
+    _axpy_none(a, x, y, size);
+}
+
+
+////////////////////////////
+// AVX2 + FMA, two accumulators
+// every kernel clears the upper part of the registers before returning,
+// the caller may run SSE instructions which are much slower otherwise
+////////////////////////////
+
+
+NUM_SIMD_TARGET_AVX2 inline float _hsum_avx2(__m256 s) {
+    __m128 r = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    r = _mm_add_ss(r, _mm_shuffle_ps(r, r, 1));
+    return _mm_cvtss_f32(r);
+}
+
+
+NUM_SIMD_TARGET_AVX2 inline double _hsum_avx2(__m256d s) {
+    __m128d r = _mm_add_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(r, _mm_unpackhi_pd(r, r)));
+}
+
+
+NUM_SIMD_TARGET_AVX2 float _dot_product_avx2(const float *p1, const float *p2, size_t size) {
+    __m256 r1 = _mm256_setzero_ps();
+    __m256 r2 = _mm256_setzero_ps();
+    for (; size >= 16; size -= 16, p1 += 16, p2 += 16) {
+        r1 = _mm256_fmadd_ps(_mm256_loadu_ps(p1), _mm256_loadu_ps(p2), r1);
+        r2 = _mm256_fmadd_ps(_mm256_loadu_ps(p1 + 8), _mm256_loadu_ps(p2 + 8), r2);
+    }
+    if (size >= 8) {
+        r1 = _mm256_fmadd_ps(_mm256_loadu_ps(p1), _mm256_loadu_ps(p2), r1);
+        size -= 8, p1 += 8, p2 += 8;
+    }
+    float res = _hsum_avx2(_mm256_add_ps(r1, r2));
+    _mm256_zeroupper();
+    return res + _dot_product_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_AVX2 double _dot_product_avx2(const double *p1, const double *p2, size_t size) {
+    __m256d r1 = _mm256_setzero_pd();
+    __m256d r2 = _mm256_setzero_pd();
+    for (; size >= 8; size -= 8, p1 += 8, p2 += 8) {
+        r1 = _mm256_fmadd_pd(_mm256_loadu_pd(p1), _mm256_loadu_pd(p2), r1);
+        r2 = _mm256_fmadd_pd(_mm256_loadu_pd(p1 + 4), _mm256_loadu_pd(p2 + 4), r2);
+    }
+    if (size >= 4) {
+        r1 = _mm256_fmadd_pd(_mm256_loadu_pd(p1), _mm256_loadu_pd(p2), r1);
+        size -= 4, p1 += 4, p2 += 4;
+    }
+    double res = _hsum_avx2(_mm256_add_pd(r1, r2));
+    _mm256_zeroupper();
+    return res + _dot_product_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_AVX2 float _squared_distance_avx2(const float *p1, const float *p2, size_t size) {
+    __m256 r1 = _mm256_setzero_ps();
+    __m256 r2 = _mm256_setzero_ps();
+    __m256 d1, d2;
+    for (; size >= 16; size -= 16, p1 += 16, p2 += 16) {
+        d1 = _mm256_sub_ps(_mm256_loadu_ps(p1), _mm256_loadu_ps(p2));
+        d2 = _mm256_sub_ps(_mm256_loadu_ps(p1 + 8), _mm256_loadu_ps(p2 + 8));
+        r1 = _mm256_fmadd_ps(d1, d1, r1);
+        r2 = _mm256_fmadd_ps(d2, d2, r2);
+    }
+    if (size >= 8) {
+        d1 = _mm256_sub_ps(_mm256_loadu_ps(p1), _mm256_loadu_ps(p2));
+        r1 = _mm256_fmadd_ps(d1, d1, r1);
+        size -= 8, p1 += 8, p2 += 8;
+    }
+    float res = _hsum_avx2(_mm256_add_ps(r1, r2));
+    _mm256_zeroupper();
+    return res + _squared_distance_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_AVX2 double _squared_distance_avx2(const double *p1, const double *p2, size_t size) {
+    __m256d r1 = _mm256_setzero_pd();
+    __m256d r2 = _mm256_setzero_pd();
+    __m256d d1, d2;
+    for (; size >= 8; size -= 8, p1 += 8, p2 += 8) {
+        d1 = _mm256_sub_pd(_mm256_loadu_pd(p1), _mm256_loadu_pd(p2));
+        d2 = _mm256_sub_pd(_mm256_loadu_pd(p1 + 4), _mm256_loadu_pd(p2 + 4));
+        r1 = _mm256_fmadd_pd(d1, d1, r1);
+        r2 = _mm256_fmadd_pd(d2, d2, r2);
+    }
+    if (size >= 4) {
+        d1 = _mm256_sub_pd(_mm256_loadu_pd(p1), _mm256_loadu_pd(p2));
+        r1 = _mm256_fmadd_pd(d1, d1, r1);
+        size -= 4, p1 += 4, p2 += 4;
+    }
+    double res = _hsum_avx2(_mm256_add_pd(r1, r2));
+    _mm256_zeroupper();
+    return res + _squared_distance_none(p1, p2, size);
+}
+
+
+NUM_SIMD_TARGET_AVX2 void _axpy_avx2(float a, const float *x, float *y, size_t size) {
+    __m256 va = _mm256_set1_ps(a);
+    for (; size >= 8; size -= 8, x += 8, y += 8)
+        _mm256_storeu_ps(y, _mm256_fmadd_ps(va, _mm256_loadu_ps(x), _mm256_loadu_ps(y)));
+    _mm256_zeroupper();
+    _axpy_none(a, x, y, size);
+}
+
+
+NUM_SIMD_TARGET_AVX2 void _axpy_avx2(double a, const double *x, double *y, size_t size) {
+    __m256d va = _mm256_set1_pd(a);
+    for (; size >= 4; size -= 4, x += 4, y += 4)
+        _mm256_storeu_pd(y, _mm256_fmadd_pd(va, _mm256_loadu_pd(x), _mm256_loadu_pd(y)));
+    _mm256_zeroupper();
+    _axpy_none(a, x, y, size);
+}
+
+
+////////////////////////////
+// AVX-512, the remaining elements are loaded with a mask,
+// the intrinsics without a mask leave some operands undefined
+// and gcc warns about it, their maskz forms are used instead
+////////////////////////////
+
+
+NUM_SIMD_TARGET_AVX512 inline double _hsum_avx512(__m512d s) {
+    return _hsum_avx2(_mm256_add_pd(_mm512_maskz_extractf64x4_pd((__mmask8)0xf, s, 0),
+                                    _mm512_maskz_extractf64x4_pd((__mmask8)0xf, s, 1)));
+}
+
+
+NUM_SIMD_TARGET_AVX512 inline float _hsum_avx512(__m512 s) {
+    __m512d d = _mm512_castps_pd(s);
+    return _hsum_avx2(_mm256_add_ps(
+        _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)0xf, d, 0)),
+        _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)0xf, d, 1))));
+}
+
+
+NUM_SIMD_TARGET_AVX512 float _dot_product_avx512(const float *p1, const float *p2, size_t size) {
+    __m512 r1 = _mm512_setzero_ps();
+    __m512 r2 = _mm512_setzero_ps();
+    for (; size >= 32; size -= 32, p1 += 32, p2 += 32) {
+        r1 = _mm512_fmadd_ps(_mm512_loadu_ps(p1), _mm512_loadu_ps(p2), r1);
+        r2 = _mm512_fmadd_ps(_mm512_loadu_ps(p1 + 16), _mm512_loadu_ps(p2 + 16), r2);
+    }
+    for (; size > 0; size -= size >= 16 ? 16 : size, p1 += 16, p2 += 16) {
+        __mmask16 m = size >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << size) - 1);
+        r1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, p1), _mm512_maskz_loadu_ps(m, p2), r1);
+    }
+    float res = _hsum_avx512(_mm512_add_ps(r1, r2));
+    _mm256_zeroupper();
+    return res;
+}
+
+
+NUM_SIMD_TARGET_AVX512 double _dot_product_avx512(const double *p1, const double *p2, size_t size) {
+    __m512d r1 = _mm512_setzero_pd();
+    __m512d r2 = _mm512_setzero_pd();
+    for (; size >= 16; size -= 16, p1 += 16, p2 += 16) {
+        r1 = _mm512_fmadd_pd(_mm512_loadu_pd(p1), _mm512_loadu_pd(p2), r1);
+        r2 = _mm512_fmadd_pd(_mm512_loadu_pd(p1 + 8), _mm512_loadu_pd(p2 + 8), r2);
+    }
+    for (; size > 0; size -= size >= 8 ? 8 : size, p1 += 8, p2 += 8) {
+        __mmask8 m = size >= 8 ? (__mmask8)0xff : (__mmask8)((1u << size) - 1);
+        r1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, p1), _mm512_maskz_loadu_pd(m, p2), r1);
+    }
+    double res = _hsum_avx512(_mm512_add_pd(r1, r2));
+    _mm256_zeroupper();
+    return res;
+}
+
+
+NUM_SIMD_TARGET_AVX512 float _squared_distance_avx512(const float *p1, const float *p2, size_t size) {
+    __m512 r1 = _mm512_setzero_ps();
+    __m512 r2 = _mm512_setzero_ps();
+    __m512 d1, d2;
+    for (; size >= 32; size -= 32, p1 += 32, p2 += 32) {
+        d1 = _mm512_sub_ps(_mm512_loadu_ps(p1), _mm512_loadu_ps(p2));
+        d2 = _mm512_sub_ps(_mm512_loadu_ps(p1 + 16), _mm512_loadu_ps(p2 + 16));
+        r1 = _mm512_fmadd_ps(d1, d1, r1);
+        r2 = _mm512_fmadd_ps(d2, d2, r2);
+    }
+    for (; size > 0; size -= size >= 16 ? 16 : size, p1 += 16, p2 += 16) {
+        __mmask16 m = size >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << size) - 1);
+        d1 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, p1), _mm512_maskz_loadu_ps(m, p2));
+        r1 = _mm512_fmadd_ps(d1, d1, r1);
+    }
+    float res = _hsum_avx512(_mm512_add_ps(r1, r2));
+    _mm256_zeroupper();
+    return res;
+}
+
+
+NUM_SIMD_TARGET_AVX512 double _squared_distance_avx512(const double *p1, const double *p2, size_t size) {
+    __m512d r1 = _mm512_setzero_pd();
+    __m512d r2 = _mm512_setzero_pd();
+    __m512d d1, d2;
+    for (; size >= 16; size -= 16, p1 += 16, p2 += 16) {
+        d1 = _mm512_sub_pd(_mm512_loadu_pd(p1), _mm512_loadu_pd(p2));
+        d2 = _mm512_sub_pd(_mm512_loadu_pd(p1 + 8), _mm512_loadu_pd(p2 + 8));
+        r1 = _mm512_fmadd_pd(d1, d1, r1);
+        r2 = _mm512_fmadd_pd(d2, d2, r2);
+    }
+    for (; size > 0; size -= size >= 8 ? 8 : size, p1 += 8, p2 += 8) {
+        __mmask8 m = size >= 8 ? (__mmask8)0xff : (__mmask8)((1u << size) - 1);
+        d1 = _mm512_sub_pd(_mm512_maskz_loadu_pd(m, p1), _mm512_maskz_loadu_pd(m, p2));
+        r1 = _mm512_fmadd_pd(d1, d1, r1);
+    }
+    double res = _hsum_avx512(_mm512_add_pd(r1, r2));
+    _mm256_zeroupper();
+    return res;
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _axpy_avx512(float a, const float *x, float *y, size_t size) {
+    __m512 va = _mm512_set1_ps(a);
+    for (; size >= 16; size -= 16, x += 16, y += 16)
+        _mm512_storeu_ps(y, _mm512_fmadd_ps(va, _mm512_loadu_ps(x), _mm512_loadu_ps(y)));
+    if (size > 0) {
+        __mmask16 m = (__mmask16)((1u << size) - 1);
+        _mm512_mask_storeu_ps(y, m, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x),
+                                                    _mm512_maskz_loadu_ps(m, y)));
+    }
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _axpy_avx512(double a, const double *x, double *y, size_t size) {
+    __m512d va = _mm512_set1_pd(a);
+    for (; size >= 8; size -= 8, x += 8, y += 8)
+        _mm512_storeu_pd(y, _mm512_fmadd_pd(va, _mm512_loadu_pd(x), _mm512_loadu_pd(y)));
+    if (size > 0) {
+        __mmask8 m = (__mmask8)((1u << size) - 1);
+        _mm512_mask_storeu_pd(y, m, _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(m, x),
+                                                    _mm512_maskz_loadu_pd(m, y)));
+    }
+    _mm256_zeroupper();
+}
+
+
+////////////////////////////
+// matrix product, tiles of 4 rows and 2 registers,
+// the tile of C stays in registers while k goes through A and B
+////////////////////////////
+
+
+NUM_SIMD_TARGET_SSE2 void _gemm_tile_sse2(const float *A, int64_t lda, const float *B, int64_t ldb,
+                                          float *C, int64_t ldc, int64_t K) {
+    float *C1 = C + ldc, *C2 = C1 + ldc, *C3 = C2 + ldc;
+    __m128 c00 = _mm_loadu_ps(C), c01 = _mm_loadu_ps(C + 4);
+    __m128 c10 = _mm_loadu_ps(C1), c11 = _mm_loadu_ps(C1 + 4);
+    __m128 c20 = _mm_loadu_ps(C2), c21 = _mm_loadu_ps(C2 + 4);
+    __m128 c30 = _mm_loadu_ps(C3), c31 = _mm_loadu_ps(C3 + 4);
+    __m128 b0, b1, a;
+    for (int64_t k = 0; k < K; ++k, B += ldb) {
+        b0 = _mm_loadu_ps(B);
+        b1 = _mm_loadu_ps(B + 4);
+        a = _mm_set1_ps(A[k]);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(a, b1));
+        a = _mm_set1_ps(A[lda + k]);
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(a, b1));
+        a = _mm_set1_ps(A[2 * lda + k]);
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(a, b1));
+        a = _mm_set1_ps(A[3 * lda + k]);
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(a, b1));
+    }
+    _mm_storeu_ps(C, c00); _mm_storeu_ps(C + 4, c01);
+    _mm_storeu_ps(C1, c10); _mm_storeu_ps(C1 + 4, c11);
+    _mm_storeu_ps(C2, c20); _mm_storeu_ps(C2 + 4, c21);
+    _mm_storeu_ps(C3, c30); _mm_storeu_ps(C3 + 4, c31);
+}
+
+
+NUM_SIMD_TARGET_SSE2 void _gemm_tile_sse2(const double *A, int64_t lda, const double *B, int64_t ldb,
+                                          double *C, int64_t ldc, int64_t K) {
+    double *C1 = C + ldc, *C2 = C1 + ldc, *C3 = C2 + ldc;
+    __m128d c00 = _mm_loadu_pd(C), c01 = _mm_loadu_pd(C + 2);
+    __m128d c10 = _mm_loadu_pd(C1), c11 = _mm_loadu_pd(C1 + 2);
+    __m128d c20 = _mm_loadu_pd(C2), c21 = _mm_loadu_pd(C2 + 2);
+    __m128d c30 = _mm_loadu_pd(C3), c31 = _mm_loadu_pd(C3 + 2);
+    __m128d b0, b1, a;
+    for (int64_t k = 0; k < K; ++k, B += ldb) {
+        b0 = _mm_loadu_pd(B);
+        b1 = _mm_loadu_pd(B + 2);
+        a = _mm_set1_pd(A[k]);
+        c00 = _mm_add_pd(c00, _mm_mul_pd(a, b0));
+        c01 = _mm_add_pd(c01, _mm_mul_pd(a, b1));
+        a = _mm_set1_pd(A[lda + k]);
+        c10 = _mm_add_pd(c10, _mm_mul_pd(a, b0));
+        c11 = _mm_add_pd(c11, _mm_mul_pd(a, b1));
+        a = _mm_set1_pd(A[2 * lda + k]);
+        c20 = _mm_add_pd(c20, _mm_mul_pd(a, b0));
+        c21 = _mm_add_pd(c21, _mm_mul_pd(a, b1));
+        a = _mm_set1_pd(A[3 * lda + k]);
+        c30 = _mm_add_pd(c30, _mm_mul_pd(a, b0));
+        c31 = _mm_add_pd(c31, _mm_mul_pd(a, b1));
+    }
+    _mm_storeu_pd(C, c00); _mm_storeu_pd(C + 2, c01);
+    _mm_storeu_pd(C1, c10); _mm_storeu_pd(C1 + 2, c11);
+    _mm_storeu_pd(C2, c20); _mm_storeu_pd(C2 + 2, c21);
+    _mm_storeu_pd(C3, c30); _mm_storeu_pd(C3 + 2, c31);
+}
+
+
+NUM_SIMD_TARGET_AVX2 void _gemm_tile_avx2(const float *A, int64_t lda, const float *B, int64_t ldb,
+                                          float *C, int64_t ldc, int64_t K) {
+    float *C1 = C + ldc, *C2 = C1 + ldc, *C3 = C2 + ldc;
+    __m256 c00 = _mm256_loadu_ps(C), c01 = _mm256_loadu_ps(C + 8);
+    __m256 c10 = _mm256_loadu_ps(C1), c11 = _mm256_loadu_ps(C1 + 8);
+    __m256 c20 = _mm256_loadu_ps(C2), c21 = _mm256_loadu_ps(C2 + 8);
+    __m256 c30 = _mm256_loadu_ps(C3), c31 = _mm256_loadu_ps(C3 + 8);
+    __m256 b0, b1, a;
+    for (int64_t k = 0; k < K; ++k, B += ldb) {
+        b0 = _mm256_loadu_ps(B);
+        b1 = _mm256_loadu_ps(B + 8);
+        a = _mm256_set1_ps(A[k]);
+        c00 = _mm256_fmadd_ps(a, b0, c00);
+        c01 = _mm256_fmadd_ps(a, b1, c01);
+        a = _mm256_set1_ps(A[lda + k]);
+        c10 = _mm256_fmadd_ps(a, b0, c10);
+        c11 = _mm256_fmadd_ps(a, b1, c11);
+        a = _mm256_set1_ps(A[2 * lda + k]);
+        c20 = _mm256_fmadd_ps(a, b0, c20);
+        c21 = _mm256_fmadd_ps(a, b1, c21);
+        a = _mm256_set1_ps(A[3 * lda + k]);
+        c30 = _mm256_fmadd_ps(a, b0, c30);
+        c31 = _mm256_fmadd_ps(a, b1, c31);
+    }
+    _mm256_storeu_ps(C, c00); _mm256_storeu_ps(C + 8, c01);
+    _mm256_storeu_ps(C1, c10); _mm256_storeu_ps(C1 + 8, c11);
+    _mm256_storeu_ps(C2, c20); _mm256_storeu_ps(C2 + 8, c21);
+    _mm256_storeu_ps(C3, c30); _mm256_storeu_ps(C3 + 8, c31);
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX2 void _gemm_tile_avx2(const double *A, int64_t lda, const double *B, int64_t ldb,
+                                          double *C, int64_t ldc, int64_t K) {
+    double *C1 = C + ldc, *C2 = C1 + ldc, *C3 = C2 + ldc;
+    __m256d c00 = _mm256_loadu_pd(C), c01 = _mm256_loadu_pd(C + 4);
+    __m256d c10 = _mm256_loadu_pd(C1), c11 = _mm256_loadu_pd(C1 + 4);
+    __m256d c20 = _mm256_loadu_pd(C2), c21 = _mm256_loadu_pd(C2 + 4);
+    __m256d c30 = _mm256_loadu_pd(C3), c31 = _mm256_loadu_pd(C3 + 4);
+    __m256d b0, b1, a;
+    for (int64_t k = 0; k < K; ++k, B += ldb) {
+        b0 = _mm256_loadu_pd(B);
+        b1 = _mm256_loadu_pd(B + 4);
+        a = _mm256_set1_pd(A[k]);
+        c00 = _mm256_fmadd_pd(a, b0, c00);
+        c01 = _mm256_fmadd_pd(a, b1, c01);
+        a = _mm256_set1_pd(A[lda + k]);
+        c10 = _mm256_fmadd_pd(a, b0, c10);
+        c11 = _mm256_fmadd_pd(a, b1, c11);
+        a = _mm256_set1_pd(A[2 * lda + k]);
+        c20 = _mm256_fmadd_pd(a, b0, c20);
+        c21 = _mm256_fmadd_pd(a, b1, c21);
+        a = _mm256_set1_pd(A[3 * lda + k]);
+        c30 = _mm256_fmadd_pd(a, b0, c30);
+        c31 = _mm256_fmadd_pd(a, b1, c31);
+    }
+    _mm256_storeu_pd(C, c00); _mm256_storeu_pd(C + 4, c01);
+    _mm256_storeu_pd(C1, c10); _mm256_storeu_pd(C1 + 4, c11);
+    _mm256_storeu_pd(C2, c20); _mm256_storeu_pd(C2 + 4, c21);
+    _mm256_storeu_pd(C3, c30); _mm256_storeu_pd(C3 + 4, c31);
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _gemm_tile_avx512(const float *A, int64_t lda, const float *B, int64_t ldb,
+                                              float *C, int64_t ldc, int64_t K) {
+    float *C1 = C + ldc, *C2 = C1 + ldc, *C3 = C2 + ldc;
+    __m512 c00 = _mm512_loadu_ps(C), c01 = _mm512_loadu_ps(C + 16);
+    __m512 c10 = _mm512_loadu_ps(C1), c11 = _mm512_loadu_ps(C1 + 16);
+    __m512 c20 = _mm512_loadu_ps(C2), c21 = _mm512_loadu_ps(C2 + 16);
+    __m512 c30 = _mm512_loadu_ps(C3), c31 = _mm512_loadu_ps(C3 + 16);
+    __m512 b0, b1, a;
+    for (int64_t k = 0; k < K; ++k, B += ldb) {
+        b0 = _mm512_loadu_ps(B);
+        b1 = _mm512_loadu_ps(B + 16);
+        a = _mm512_set1_ps(A[k]);
+        c00 = _mm512_fmadd_ps(a, b0, c00);
+        c01 = _mm512_fmadd_ps(a, b1, c01);
+        a = _mm512_set1_ps(A[lda + k]);
+        c10 = _mm512_fmadd_ps(a, b0, c10);
+        c11 = _mm512_fmadd_ps(a, b1, c11);
+        a = _mm512_set1_ps(A[2 * lda + k]);
+        c20 = _mm512_fmadd_ps(a, b0, c20);
+        c21 = _mm512_fmadd_ps(a, b1, c21);
+        a = _mm512_set1_ps(A[3 * lda + k]);
+        c30 = _mm512_fmadd_ps(a, b0, c30);
+        c31 = _mm512_fmadd_ps(a, b1, c31);
+    }
+    _mm512_storeu_ps(C, c00); _mm512_storeu_ps(C + 16, c01);
+    _mm512_storeu_ps(C1, c10); _mm512_storeu_ps(C1 + 16, c11);
+    _mm512_storeu_ps(C2, c20); _mm512_storeu_ps(C2 + 16, c21);
+    _mm512_storeu_ps(C3, c30); _mm512_storeu_ps(C3 + 16, c31);
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _gemm_tile_avx512(const double *A, int64_t lda, const double *B, int64_t ldb,
+                                              double *C, int64_t ldc, int64_t K) {
+    double *C1 = C + ldc, *C2 = C1 + ldc, *C3 = C2 + ldc;
+    __m512d c00 = _mm512_loadu_pd(C), c01 = _mm512_loadu_pd(C + 8);
+    __m512d c10 = _mm512_loadu_pd(C1), c11 = _mm512_loadu_pd(C1 + 8);
+    __m512d c20 = _mm512_loadu_pd(C2), c21 = _mm512_loadu_pd(C2 + 8);
+    __m512d c30 = _mm512_loadu_pd(C3), c31 = _mm512_loadu_pd(C3 + 8);
+    __m512d b0, b1, a;
+    for (int64_t k = 0; k < K; ++k, B += ldb) {
+        b0 = _mm512_loadu_pd(B);
+        b1 = _mm512_loadu_pd(B + 8);
+        a = _mm512_set1_pd(A[k]);
+        c00 = _mm512_fmadd_pd(a, b0, c00);
+        c01 = _mm512_fmadd_pd(a, b1, c01);
+        a = _mm512_set1_pd(A[lda + k]);
+        c10 = _mm512_fmadd_pd(a, b0, c10);
+        c11 = _mm512_fmadd_pd(a, b1, c11);
+        a = _mm512_set1_pd(A[2 * lda + k]);
+        c20 = _mm512_fmadd_pd(a, b0, c20);
+        c21 = _mm512_fmadd_pd(a, b1, c21);
+        a = _mm512_set1_pd(A[3 * lda + k]);
+        c30 = _mm512_fmadd_pd(a, b0, c30);
+        c31 = _mm512_fmadd_pd(a, b1, c31);
+    }
+    _mm512_storeu_pd(C, c00); _mm512_storeu_pd(C + 8, c01);
+    _mm512_storeu_pd(C1, c10); _mm512_storeu_pd(C1 + 8, c11);
+    _mm512_storeu_pd(C2, c20); _mm512_storeu_pd(C2 + 8, c21);
+    _mm512_storeu_pd(C3, c30); _mm512_storeu_pd(C3 + 8, c31);
+    _mm256_zeroupper();
+}
+
 #endif
 
 
-#define BYND 8
+////////////////////////////
+// dispatch
+////////////////////////////
+
+
+// below that size, the scalar loop is faster than the vectorized
+// kernels if the caller lets the function choose
+#define NUM_SIMD_MIN_SIZE 8
 
 
-#if defined(_WIN32) || defined(WIN32)
-//#pragma optimize( "", off )
+#if defined(NUM_SIMD_X86)
+#define NUM_SIMD_DISPATCH(name, args) \
+    if (level < 0 && size < NUM_SIMD_MIN_SIZE) \
+        return _##name##_none args; \
+    switch(num_simd_select(level)) { \
+        case NUM_SIMD_AVX512: return _##name##_avx512 args; \
+        case NUM_SIMD_AVX2: return _##name##_avx2 args; \
+        case NUM_SIMD_SSE2: return _##name##_sse2 args; \
+        default: return _##name##_none args; \
+    }
 #else
-//#pragma GCC push_options
-//#pragma GCC optimize ("O0")
+#define NUM_SIMD_DISPATCH(name, args) \
+    return _##name##_none args;
 #endif
-double vector_dot_product_pointer16_sse(const double *p1, const double *p2, size_t size)
-{
-    double sum = 0;
-    size_t i = 0;
-#if 0
-    // Compilers do some optimisation and this code fails at _mm_store_ps.
-    if (size >= BYND) {
-        double r[2];
-        size_t size_ = size - size % BYND;
-        __m128d r1 = _mm_setzero_pd();
-        for (; i != size_; i += 2, p1 += 2, p2 += 2) {
-            r1 = _mm_add_pd(r1, _mm_mul_pd(_mm_load_pd(p1), _mm_load_pd(p2)));
+
+
+float vector_dot_product_pointer(const float *p1, const float *p2, size_t size, int level) {
+    NUM_SIMD_DISPATCH(dot_product, (p1, p2, size))
+}
+
+
+double vector_dot_product_pointer(const double *p1, const double *p2, size_t size, int level) {
+    NUM_SIMD_DISPATCH(dot_product, (p1, p2, size))
+}
+
+
+float vector_squared_distance_pointer(const float *p1, const float *p2, size_t size, int level) {
+    NUM_SIMD_DISPATCH(squared_distance, (p1, p2, size))
+}
+
+
+double vector_squared_distance_pointer(const double *p1, const double *p2, size_t size, int level) {
+    NUM_SIMD_DISPATCH(squared_distance, (p1, p2, size))
+}
+
+
+void vector_axpy_pointer(float a, const float *x, float *y, size_t size, int level) {
+    NUM_SIMD_DISPATCH(axpy, (a, x, y, size))
+}
+
+
+void vector_axpy_pointer(double a, const double *x, double *y, size_t size, int level) {
+    NUM_SIMD_DISPATCH(axpy, (a, x, y, size))
+}
+
+
+// rows of A computed at the same time by the tiles
+#define NUM_GEMM_MR 4
+// number of rows and columns of the blocks of B kept in cache
+#define NUM_GEMM_KC 256
+#define NUM_GEMM_NC 256
+
+
+template <typename NTYPE>
+void _matrix_product_add(const NTYPE *A, int64_t lda, const NTYPE *B, int64_t ldb,
+                         NTYPE *C, int64_t ldc, int64_t M, int64_t N, int64_t K, int level,
+                         void (*tile)(const NTYPE*, int64_t, const NTYPE*, int64_t, NTYPE*, int64_t, int64_t),
+                         int64_t tile_n) {
+    // tile is null if no vectorized tile is available, every row is then
+    // computed with vector_axpy_pointer, it also handles the remaining rows and columns
+    for (int64_t j0 = 0; j0 < N; j0 += NUM_GEMM_NC) {
+        int64_t nc = std::min(N - j0, (int64_t)NUM_GEMM_NC);
+        int64_t nt = tile == nullptr ? 0 : nc - nc % tile_n;
+        for (int64_t k0 = 0; k0 < K; k0 += NUM_GEMM_KC) {
+            int64_t kc = std::min(K - k0, (int64_t)NUM_GEMM_KC);
+            const NTYPE *pb = B + k0 * ldb + j0;
+            int64_t i = 0;
+            if (nt > 0) {
+                for (; i + NUM_GEMM_MR <= M; i += NUM_GEMM_MR) {
+                    const NTYPE *pa = A + i * lda + k0;
+                    NTYPE *pc = C + i * ldc + j0;
+                    for (int64_t j = 0; j < nt; j += tile_n)
+                        tile(pa, lda, pb + j, ldb, pc + j, ldc, kc);
+                    if (nt < nc) {
+                        for (int64_t r = 0; r < NUM_GEMM_MR; ++r)
+                            for (int64_t k = 0; k < kc; ++k)
+                                vector_axpy_pointer(pa[r * lda + k], pb + k * ldb + nt,
+                                                    pc + r * ldc + nt, (size_t)(nc - nt), level);
+                    }
+                }
+            }
+            for (; i < M; ++i) {
+                const NTYPE *pa = A + i * lda + k0;
+                NTYPE *pc = C + i * ldc + j0;
+                for (int64_t k = 0; k < kc; ++k)
+                    vector_axpy_pointer(pa[k], pb + k * ldb, pc, (size_t)nc, level);
+            }
         }
-        _mm_store_pd(r, r1);
-        sum += r[0] + r[1];
     }
-#endif    
-    size -= i;
-    for (; size > 0; ++p1, ++p2, --size)
-        sum += *p1 * *p2;
-    return sum;
 }
-#if defined(_WIN32) || defined(WIN32)
-// #pragma optimize( "", on )
-#else
-// #pragma GCC pop_options
+
+
+void matrix_product_add_pointer(const float *A, int64_t lda, const float *B, int64_t ldb,
+                                float *C, int64_t ldc, int64_t M, int64_t N, int64_t K,
+                                int level) {
+#if defined(NUM_SIMD_X86)
+    switch(num_simd_select(level)) {
+        case NUM_SIMD_AVX512:
+            _matrix_product_add(A, lda, B, ldb, C, ldc, M, N, K, level, _gemm_tile_avx512, 32);
+            return;
+        case NUM_SIMD_AVX2:
+            _matrix_product_add(A, lda, B, ldb, C, ldc, M, N, K, level, _gemm_tile_avx2, 16);
+            return;
+        case NUM_SIMD_SSE2:
+            _matrix_product_add(A, lda, B, ldb, C, ldc, M, N, K, level, _gemm_tile_sse2, 8);
+            return;
+    }
+#endif
+    _matrix_product_add<float>(A, lda, B, ldb, C, ldc, M, N, K, level, nullptr, 1);
+}
+
+
+void matrix_product_add_pointer(const double *A, int64_t lda, const double *B, int64_t ldb,
+                                double *C, int64_t ldc, int64_t M, int64_t N, int64_t K,
+                                int level) {
+#if defined(NUM_SIMD_X86)
+    switch(num_simd_select(level)) {
+        case NUM_SIMD_AVX512:
+            _matrix_product_add(A, lda, B, ldb, C, ldc, M, N, K, level, _gemm_tile_avx512, 16);
+            return;
+        case NUM_SIMD_AVX2:
+            _matrix_product_add(A, lda, B, ldb, C, ldc, M, N, K, level, _gemm_tile_avx2, 8);
+            return;
+        case NUM_SIMD_SSE2:
+            _matrix_product_add(A, lda, B, ldb, C, ldc, M, N, K, level, _gemm_tile_sse2, 4);
+            return;
+    }
 #endif
+    _matrix_product_add<double>(A, lda, B, ldb, C, ldc, M, N, K, level, nullptr, 1);
+}
+
+
+// The former SSE versions used aligned loads and failed
+// on unaligned pointers, they now call the dispatched kernels.
+float vector_dot_product_pointer16_sse(const float *p1, const float *p2, size_t size)
+{
+    return vector_dot_product_pointer(p1, p2, size);
+}
+
+
+double vector_dot_product_pointer16_sse(const double *p1, const double *p2, size_t size)
+{
+    return vector_dot_product_pointer(p1, p2, size);
+}
 
 
 template <>
@@ -102,3 +795,681 @@ double vector_dot_product_pointer_sse(const double *p1, const double *p2, size_t
     return vector_dot_product_pointer16_sse(p1, p2, size);
 }
 
+
+////////////////////////////
+// mathematical functions, scalar versions
+// exp comes from Cephes (range reduction and polynomial or rational
+// approximation), log from fdlibm, the vectorized versions follow
+// the same steps
+////////////////////////////
+
+
+#define NUM_LOG2E 1.4426950408889634073599
+#define NUM_SQRT2 1.4142135623730950488017
+
+#define NUM_EXPF_HI 88.72283905206835f
+#define NUM_EXPF_LO -103.972077083991796f
+#define NUM_EXPF_C1 0.693359375f
+#define NUM_EXPF_C2 -2.12194440e-4f
+#define NUM_EXPF_P0 1.9875691500E-4f
+#define NUM_EXPF_P1 1.3981999507E-3f
+#define NUM_EXPF_P2 8.3334519073E-3f
+#define NUM_EXPF_P3 4.1665795894E-2f
+#define NUM_EXPF_P4 1.6666665459E-1f
+#define NUM_EXPF_P5 5.0000001201E-1f
+
+#define NUM_EXP_HI 709.782712893383996843
+#define NUM_EXP_LO -745.13321910194110842
+#define NUM_EXP_C1 6.93145751953125E-1
+#define NUM_EXP_C2 1.42860682030941723212E-6
+#define NUM_EXP_P0 1.26177193074810590878E-4
+#define NUM_EXP_P1 3.02994407707441961300E-2
+#define NUM_EXP_P2 9.99999999999999999910E-1
+#define NUM_EXP_Q0 3.00198505138664455042E-6
+#define NUM_EXP_Q1 2.52448340349684104192E-3
+#define NUM_EXP_Q2 2.27265548208155028766E-1
+#define NUM_EXP_Q3 2.00000000000000000009E0
+
+#define NUM_LOGF_LN2_HI 6.9313812256e-01f
+#define NUM_LOGF_LN2_LO 9.0580006145e-06f
+#define NUM_LOGF_LG1 6.6666668653e-01f
+#define NUM_LOGF_LG2 4.0000000596e-01f
+#define NUM_LOGF_LG3 2.8571429849e-01f
+#define NUM_LOGF_LG4 2.2222198546e-01f
+#define NUM_LOGF_LG5 1.8183572590e-01f
+#define NUM_LOGF_LG6 1.5313838422e-01f
+#define NUM_LOGF_LG7 1.4798198640e-01f
+
+#define NUM_LOG_LN2_HI 6.93147180369123816490e-01
+#define NUM_LOG_LN2_LO 1.90821492927058770002e-10
+#define NUM_LOG_LG1 6.666666666666735130e-01
+#define NUM_LOG_LG2 3.999999999940941908e-01
+#define NUM_LOG_LG3 2.857142874366239149e-01
+#define NUM_LOG_LG4 2.222219843214978396e-01
+#define NUM_LOG_LG5 1.818357216161805012e-01
+#define NUM_LOG_LG6 1.531383769920937332e-01
+#define NUM_LOG_LG7 1.479819860511658591e-01
+
+// tanh(x) = 1 - 2 / (exp(2x) + 1) above this value, a polynomial below
+#define NUM_TANH_SPLIT 0.625
+
+
+inline float _as_float(uint32_t u) { float f; memcpy(&f, &u, sizeof(f)); return f; }
+inline uint32_t _as_uint(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+inline double _as_double(uint64_t u) { double f; memcpy(&f, &u, sizeof(f)); return f; }
+inline uint64_t _as_uint(double f) { uint64_t u; memcpy(&u, &f, sizeof(u)); return u; }
+
+
+inline float _exp_value(float x) {
+    if (!(x < NUM_EXPF_HI))
+        return x != x ? x : std::numeric_limits<float>::infinity();
+    if (x < NUM_EXPF_LO)
+        return 0;
+    float n = std::floor(x * (float)NUM_LOG2E + 0.5f);
+    float r = x - n * NUM_EXPF_C1;
+    r = r - n * NUM_EXPF_C2;
+    float p = ((((NUM_EXPF_P0 * r + NUM_EXPF_P1) * r + NUM_EXPF_P2) * r +
+                NUM_EXPF_P3) * r + NUM_EXPF_P4) * r + NUM_EXPF_P5;
+    float y = (p * (r * r) + r) + 1;
+    // 2^n is split into two factors, the first one may overflow and the
+    // result may be a denormal number
+    int32_t k = (int32_t)n;
+    int32_t k1 = k >> 1;
+    return y * _as_float((uint32_t)(k1 + 127) << 23) * _as_float((uint32_t)(k - k1 + 127) << 23);
+}
+
+
+inline double _exp_value(double x) {
+    if (!(x < NUM_EXP_HI))
+        return x != x ? x : std::numeric_limits<double>::infinity();
+    if (x < NUM_EXP_LO)
+        return 0;
+    double n = std::floor(x * NUM_LOG2E + 0.5);
+    double r = x - n * NUM_EXP_C1;
+    r = r - n * NUM_EXP_C2;
+    double xx = r * r;
+    double px = r * ((NUM_EXP_P0 * xx + NUM_EXP_P1) * xx + NUM_EXP_P2);
+    double q = ((NUM_EXP_Q0 * xx + NUM_EXP_Q1) * xx + NUM_EXP_Q2) * xx + NUM_EXP_Q3;
+    double y = 2 * (px / (q - px)) + 1;
+    int64_t k = (int64_t)n;
+    int64_t k1 = k >> 1;
+    return y * _as_double((uint64_t)(k1 + 1023) << 52) * _as_double((uint64_t)(k - k1 + 1023) << 52);
+}
+
+
+inline float _log_value(float x) {
+    if (!(x > 0))
+        return x == 0 ? -std::numeric_limits<float>::infinity()
+                      : std::numeric_limits<float>::quiet_NaN();
+    if (x == std::numeric_limits<float>::infinity())
+        return x;
+    int32_t e = -127;
+    if (x < std::numeric_limits<float>::min()) {
+        x *= 33554432.f;  // 2^25
+        e -= 25;
+    }
+    uint32_t u = _as_uint(x);
+    e += (int32_t)(u >> 23);
+    float m = _as_float((u & 0x007fffff) | 0x3f800000);
+    if (m > (float)NUM_SQRT2) {
+        m *= 0.5f;
+        ++e;
+    }
+    float f = m - 1;
+    float s = f / (2 + f);
+    float z = s * s;
+    float w = z * z;
+    float t1 = w * (NUM_LOGF_LG2 + w * (NUM_LOGF_LG4 + w * NUM_LOGF_LG6));
+    float t2 = z * (NUM_LOGF_LG1 + w * (NUM_LOGF_LG3 + w * (NUM_LOGF_LG5 + w * NUM_LOGF_LG7)));
+    float hfsq = 0.5f * f * f;
+    float fe = (float)e;
+    return fe * NUM_LOGF_LN2_HI - ((hfsq - (s * (hfsq + (t2 + t1)) + fe * NUM_LOGF_LN2_LO)) - f);
+}
+
+
+inline double _log_value(double x) {
+    if (!(x > 0))
+        return x == 0 ? -std::numeric_limits<double>::infinity()
+                      : std::numeric_limits<double>::quiet_NaN();
+    if (x == std::numeric_limits<double>::infinity())
+        return x;
+    int64_t e = -1023;
+    if (x < std::numeric_limits<double>::min()) {
+        x *= 18014398509481984.;  // 2^54
+        e -= 54;
+    }
+    uint64_t u = _as_uint(x);
+    e += (int64_t)(u >> 52);
+    double m = _as_double((u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    if (m > NUM_SQRT2) {
+        m *= 0.5;
+        ++e;
+    }
+    double f = m - 1;
+    double s = f / (2 + f);
+    double z = s * s;
+    double w = z * z;
+    double t1 = w * (NUM_LOG_LG2 + w * (NUM_LOG_LG4 + w * NUM_LOG_LG6));
+    double t2 = z * (NUM_LOG_LG1 + w * (NUM_LOG_LG3 + w * (NUM_LOG_LG5 + w * NUM_LOG_LG7)));
+    double hfsq = 0.5 * f * f;
+    double fe = (double)e;
+    return fe * NUM_LOG_LN2_HI - ((hfsq - (s * (hfsq + (t2 + t1)) + fe * NUM_LOG_LN2_LO)) - f);
+}
+
+
+template <typename NTYPE>
+void _exp_none(const NTYPE *x, NTYPE *y, size_t size) {
+    for (; size > 0; ++x, ++y, --size)
+        *y = _exp_value(*x);
+}
+
+
+template <typename NTYPE>
+void _log_none(const NTYPE *x, NTYPE *y, size_t size) {
+    for (; size > 0; ++x, ++y, --size)
+        *y = _log_value(*x);
+}
+
+
+#if defined(NUM_SIMD_X86)
+
+////////////////////////////
+// mathematical functions, AVX2 + FMA,
+// the last elements go through a padded buffer
+////////////////////////////
+
+
+NUM_SIMD_TARGET_AVX2 inline __m256 _exp_avx2(__m256 x) {
+    __m256 xc = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(NUM_EXPF_LO)), _mm256_set1_ps(NUM_EXPF_HI));
+    __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(xc, _mm256_set1_ps((float)NUM_LOG2E), _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(NUM_EXPF_C1), xc);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(NUM_EXPF_C2), r);
+    __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(NUM_EXPF_P0), r, _mm256_set1_ps(NUM_EXPF_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(NUM_EXPF_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(NUM_EXPF_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(NUM_EXPF_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(NUM_EXPF_P5));
+    __m256 y = _mm256_add_ps(_mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r), _mm256_set1_ps(1.f));
+    __m256i k = _mm256_cvtps_epi32(n);
+    __m256i k1 = _mm256_srai_epi32(k, 1);
+    __m256i k2 = _mm256_sub_epi32(k, k1);
+    __m256i bias = _mm256_set1_epi32(127);
+    y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(k1, bias), 23)));
+    y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(k2, bias), 23)));
+    y = _mm256_blendv_ps(y, _mm256_set1_ps(std::numeric_limits<float>::infinity()),
+                         _mm256_cmp_ps(x, _mm256_set1_ps(NUM_EXPF_HI), _CMP_GE_OQ));
+    y = _mm256_blendv_ps(y, _mm256_setzero_ps(),
+                         _mm256_cmp_ps(x, _mm256_set1_ps(NUM_EXPF_LO), _CMP_LT_OQ));
+    return _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, x, _CMP_UNORD_Q));
+}
+
+
+NUM_SIMD_TARGET_AVX2 inline __m256d _exp_avx2(__m256d x) {
+    __m256d xc = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(NUM_EXP_LO)), _mm256_set1_pd(NUM_EXP_HI));
+    __m256d n = _mm256_floor_pd(_mm256_fmadd_pd(xc, _mm256_set1_pd(NUM_LOG2E), _mm256_set1_pd(0.5)));
+    __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(NUM_EXP_C1), xc);
+    r = _mm256_fnmadd_pd(n, _mm256_set1_pd(NUM_EXP_C2), r);
+    __m256d xx = _mm256_mul_pd(r, r);
+    __m256d px = _mm256_fmadd_pd(_mm256_set1_pd(NUM_EXP_P0), xx, _mm256_set1_pd(NUM_EXP_P1));
+    px = _mm256_mul_pd(r, _mm256_fmadd_pd(px, xx, _mm256_set1_pd(NUM_EXP_P2)));
+    __m256d q = _mm256_fmadd_pd(_mm256_set1_pd(NUM_EXP_Q0), xx, _mm256_set1_pd(NUM_EXP_Q1));
+    q = _mm256_fmadd_pd(q, xx, _mm256_set1_pd(NUM_EXP_Q2));
+    q = _mm256_fmadd_pd(q, xx, _mm256_set1_pd(NUM_EXP_Q3));
+    __m256d y = _mm256_fmadd_pd(_mm256_set1_pd(2.), _mm256_div_pd(px, _mm256_sub_pd(q, px)),
+                                _mm256_set1_pd(1.));
+    __m128i k = _mm256_cvtpd_epi32(n);
+    __m128i k1 = _mm_srai_epi32(k, 1);
+    __m128i k2 = _mm_sub_epi32(k, k1);
+    __m128i bias = _mm_set1_epi32(1023);
+    y = _mm256_mul_pd(y, _mm256_castsi256_pd(_mm256_slli_epi64(
+        _mm256_cvtepi32_epi64(_mm_add_epi32(k1, bias)), 52)));
+    y = _mm256_mul_pd(y, _mm256_castsi256_pd(_mm256_slli_epi64(
+        _mm256_cvtepi32_epi64(_mm_add_epi32(k2, bias)), 52)));
+    y = _mm256_blendv_pd(y, _mm256_set1_pd(std::numeric_limits<double>::infinity()),
+                         _mm256_cmp_pd(x, _mm256_set1_pd(NUM_EXP_HI), _CMP_GE_OQ));
+    y = _mm256_blendv_pd(y, _mm256_setzero_pd(),
+                         _mm256_cmp_pd(x, _mm256_set1_pd(NUM_EXP_LO), _CMP_LT_OQ));
+    return _mm256_blendv_pd(y, x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+}
+
+
+NUM_SIMD_TARGET_AVX2 inline __m256 _log_avx2(__m256 x) {
+    // denormal numbers are multiplied by 2^25
+    __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(std::numeric_limits<float>::min()), _CMP_LT_OQ);
+    __m256 xs = _mm256_blendv_ps(x, _mm256_mul_ps(x, _mm256_set1_ps(33554432.f)), small);
+    __m256i u = _mm256_castps_si256(xs);
+    __m256i e = _mm256_sub_epi32(_mm256_srli_epi32(u, 23), _mm256_blendv_epi8(
+        _mm256_set1_epi32(127), _mm256_set1_epi32(152), _mm256_castps_si256(small)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_and_si256(u, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+    __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps((float)NUM_SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+    e = _mm256_sub_epi32(e, _mm256_castps_si256(big));
+    __m256 f = _mm256_sub_ps(m, _mm256_set1_ps(1.f));
+    __m256 s = _mm256_div_ps(f, _mm256_add_ps(f, _mm256_set1_ps(2.f)));
+    __m256 z = _mm256_mul_ps(s, s);
+    __m256 w = _mm256_mul_ps(z, z);
+    __m256 t1 = _mm256_fmadd_ps(w, _mm256_set1_ps(NUM_LOGF_LG6), _mm256_set1_ps(NUM_LOGF_LG4));
+    t1 = _mm256_mul_ps(w, _mm256_fmadd_ps(w, t1, _mm256_set1_ps(NUM_LOGF_LG2)));
+    __m256 t2 = _mm256_fmadd_ps(w, _mm256_set1_ps(NUM_LOGF_LG7), _mm256_set1_ps(NUM_LOGF_LG5));
+    t2 = _mm256_fmadd_ps(w, t2, _mm256_set1_ps(NUM_LOGF_LG3));
+    t2 = _mm256_mul_ps(z, _mm256_fmadd_ps(w, t2, _mm256_set1_ps(NUM_LOGF_LG1)));
+    __m256 hfsq = _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(f, f));
+    __m256 fe = _mm256_cvtepi32_ps(e);
+    __m256 y = _mm256_fmadd_ps(s, _mm256_add_ps(hfsq, _mm256_add_ps(t2, t1)),
+                               _mm256_mul_ps(fe, _mm256_set1_ps(NUM_LOGF_LN2_LO)));
+    y = _mm256_sub_ps(_mm256_sub_ps(hfsq, y), f);
+    y = _mm256_fmsub_ps(fe, _mm256_set1_ps(NUM_LOGF_LN2_HI), y);
+    // log(0) = -inf, log(inf) = inf, log(x < 0) = nan
+    y = _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, _mm256_set1_ps(std::numeric_limits<float>::infinity()), _CMP_EQ_OQ));
+    y = _mm256_blendv_ps(y, _mm256_set1_ps(-std::numeric_limits<float>::infinity()),
+                         _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ));
+    return _mm256_blendv_ps(y, _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN()),
+                            _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_NGE_UQ));
+}
+
+
+NUM_SIMD_TARGET_AVX2 inline __m256d _log_avx2(__m256d x) {
+    // denormal numbers are multiplied by 2^54, the exponent is converted
+    // into a double with the mantissa of 2^52
+    __m256d small = _mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::min()), _CMP_LT_OQ);
+    __m256d xs = _mm256_blendv_pd(x, _mm256_mul_pd(x, _mm256_set1_pd(18014398509481984.)), small);
+    __m256i u = _mm256_castpd_si256(xs);
+    __m256d e = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(u, 52),
+                                            _mm256_set1_epi64x(0x4330000000000000LL))),
+        _mm256_set1_pd(4503599627370496.));
+    e = _mm256_sub_pd(e, _mm256_blendv_pd(_mm256_set1_pd(1023.), _mm256_set1_pd(1077.), small));
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+        _mm256_and_si256(u, _mm256_set1_epi64x(0x000fffffffffffffLL)),
+        _mm256_set1_epi64x(0x3ff0000000000000LL)));
+    __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(NUM_SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    e = _mm256_add_pd(e, _mm256_and_pd(big, _mm256_set1_pd(1.)));
+    __m256d f = _mm256_sub_pd(m, _mm256_set1_pd(1.));
+    __m256d s = _mm256_div_pd(f, _mm256_add_pd(f, _mm256_set1_pd(2.)));
+    __m256d z = _mm256_mul_pd(s, s);
+    __m256d w = _mm256_mul_pd(z, z);
+    __m256d t1 = _mm256_fmadd_pd(w, _mm256_set1_pd(NUM_LOG_LG6), _mm256_set1_pd(NUM_LOG_LG4));
+    t1 = _mm256_mul_pd(w, _mm256_fmadd_pd(w, t1, _mm256_set1_pd(NUM_LOG_LG2)));
+    __m256d t2 = _mm256_fmadd_pd(w, _mm256_set1_pd(NUM_LOG_LG7), _mm256_set1_pd(NUM_LOG_LG5));
+    t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(NUM_LOG_LG3));
+    t2 = _mm256_mul_pd(z, _mm256_fmadd_pd(w, t2, _mm256_set1_pd(NUM_LOG_LG1)));
+    __m256d hfsq = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_mul_pd(f, f));
+    __m256d y = _mm256_fmadd_pd(s, _mm256_add_pd(hfsq, _mm256_add_pd(t2, t1)),
+                                _mm256_mul_pd(e, _mm256_set1_pd(NUM_LOG_LN2_LO)));
+    y = _mm256_sub_pd(_mm256_sub_pd(hfsq, y), f);
+    y = _mm256_fmsub_pd(e, _mm256_set1_pd(NUM_LOG_LN2_HI), y);
+    y = _mm256_blendv_pd(y, x, _mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::infinity()), _CMP_EQ_OQ));
+    y = _mm256_blendv_pd(y, _mm256_set1_pd(-std::numeric_limits<double>::infinity()),
+                         _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_EQ_OQ));
+    return _mm256_blendv_pd(y, _mm256_set1_pd(std::numeric_limits<double>::quiet_NaN()),
+                            _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_NGE_UQ));
+}
+
+
+#define NUM_MATH_AVX2(name, NTYPE, VTYPE, W, load, store) \
+NUM_SIMD_TARGET_AVX2 void _##name##_avx2(const NTYPE *x, NTYPE *y, size_t size) { \
+    for (; size >= W; size -= W, x += W, y += W) \
+        store(y, _##name##_avx2(load(x))); \
+    if (size > 0) { \
+        NTYPE buffer[W] = {0}; \
+        memcpy(buffer, x, size * sizeof(NTYPE)); \
+        store(buffer, _##name##_avx2(load(buffer))); \
+        memcpy(y, buffer, size * sizeof(NTYPE)); \
+    } \
+    _mm256_zeroupper(); \
+}
+
+NUM_MATH_AVX2(exp, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps)
+NUM_MATH_AVX2(exp, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd)
+NUM_MATH_AVX2(log, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps)
+NUM_MATH_AVX2(log, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd)
+
+
+////////////////////////////
+// mathematical functions, AVX-512,
+// 2^n is applied with scalef, the exponent and the mantissa
+// come from getexp and getmant
+////////////////////////////
+
+
+NUM_SIMD_TARGET_AVX512 inline __m512 _exp_avx512(__m512 x) {
+    const __mmask16 all = (__mmask16)0xffff;
+    __m512 xc = _mm512_maskz_min_ps(all, _mm512_maskz_max_ps(all, x, _mm512_set1_ps(NUM_EXPF_LO)),
+                                    _mm512_set1_ps(NUM_EXPF_HI));
+    __m512 n = _mm512_floor_ps(_mm512_fmadd_ps(xc, _mm512_set1_ps((float)NUM_LOG2E), _mm512_set1_ps(0.5f)));
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(NUM_EXPF_C1), xc);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(NUM_EXPF_C2), r);
+    __m512 p = _mm512_fmadd_ps(_mm512_set1_ps(NUM_EXPF_P0), r, _mm512_set1_ps(NUM_EXPF_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(NUM_EXPF_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(NUM_EXPF_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(NUM_EXPF_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(NUM_EXPF_P5));
+    __m512 y = _mm512_add_ps(_mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r), _mm512_set1_ps(1.f));
+    y = _mm512_maskz_scalef_ps(all, y, n);
+    y = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_set1_ps(NUM_EXPF_HI), _CMP_GE_OQ),
+                             y, _mm512_set1_ps(std::numeric_limits<float>::infinity()));
+    y = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_set1_ps(NUM_EXPF_LO), _CMP_LT_OQ),
+                             y, _mm512_setzero_ps());
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q), y, x);
+}
+
+
+NUM_SIMD_TARGET_AVX512 inline __m512d _exp_avx512(__m512d x) {
+    const __mmask8 all = (__mmask8)0xff;
+    __m512d xc = _mm512_maskz_min_pd(all, _mm512_maskz_max_pd(all, x, _mm512_set1_pd(NUM_EXP_LO)),
+                                      _mm512_set1_pd(NUM_EXP_HI));
+    __m512d n = _mm512_floor_pd(_mm512_fmadd_pd(xc, _mm512_set1_pd(NUM_LOG2E), _mm512_set1_pd(0.5)));
+    __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(NUM_EXP_C1), xc);
+    r = _mm512_fnmadd_pd(n, _mm512_set1_pd(NUM_EXP_C2), r);
+    __m512d xx = _mm512_mul_pd(r, r);
+    __m512d px = _mm512_fmadd_pd(_mm512_set1_pd(NUM_EXP_P0), xx, _mm512_set1_pd(NUM_EXP_P1));
+    px = _mm512_mul_pd(r, _mm512_fmadd_pd(px, xx, _mm512_set1_pd(NUM_EXP_P2)));
+    __m512d q = _mm512_fmadd_pd(_mm512_set1_pd(NUM_EXP_Q0), xx, _mm512_set1_pd(NUM_EXP_Q1));
+    q = _mm512_fmadd_pd(q, xx, _mm512_set1_pd(NUM_EXP_Q2));
+    q = _mm512_fmadd_pd(q, xx, _mm512_set1_pd(NUM_EXP_Q3));
+    __m512d y = _mm512_fmadd_pd(_mm512_set1_pd(2.), _mm512_div_pd(px, _mm512_sub_pd(q, px)),
+                                _mm512_set1_pd(1.));
+    y = _mm512_maskz_scalef_pd(all, y, n);
+    y = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(NUM_EXP_HI), _CMP_GE_OQ),
+                             y, _mm512_set1_pd(std::numeric_limits<double>::infinity()));
+    y = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(NUM_EXP_LO), _CMP_LT_OQ),
+                             y, _mm512_setzero_pd());
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q), y, x);
+}
+
+
+NUM_SIMD_TARGET_AVX512 inline __m512 _log_avx512(__m512 x) {
+    const __mmask16 all = (__mmask16)0xffff;
+    __m512 m = _mm512_maskz_getmant_ps(all, x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+    __m512 e = _mm512_maskz_getexp_ps(all, x);
+    __mmask16 big = _mm512_cmp_ps_mask(m, _mm512_set1_ps((float)NUM_SQRT2), _CMP_GT_OQ);
+    m = _mm512_mask_mul_ps(m, big, m, _mm512_set1_ps(0.5f));
+    e = _mm512_mask_add_ps(e, big, e, _mm512_set1_ps(1.f));
+    __m512 f = _mm512_sub_ps(m, _mm512_set1_ps(1.f));
+    __m512 s = _mm512_div_ps(f, _mm512_add_ps(f, _mm512_set1_ps(2.f)));
+    __m512 z = _mm512_mul_ps(s, s);
+    __m512 w = _mm512_mul_ps(z, z);
+    __m512 t1 = _mm512_fmadd_ps(w, _mm512_set1_ps(NUM_LOGF_LG6), _mm512_set1_ps(NUM_LOGF_LG4));
+    t1 = _mm512_mul_ps(w, _mm512_fmadd_ps(w, t1, _mm512_set1_ps(NUM_LOGF_LG2)));
+    __m512 t2 = _mm512_fmadd_ps(w, _mm512_set1_ps(NUM_LOGF_LG7), _mm512_set1_ps(NUM_LOGF_LG5));
+    t2 = _mm512_fmadd_ps(w, t2, _mm512_set1_ps(NUM_LOGF_LG3));
+    t2 = _mm512_mul_ps(z, _mm512_fmadd_ps(w, t2, _mm512_set1_ps(NUM_LOGF_LG1)));
+    __m512 hfsq = _mm512_mul_ps(_mm512_set1_ps(0.5f), _mm512_mul_ps(f, f));
+    __m512 y = _mm512_fmadd_ps(s, _mm512_add_ps(hfsq, _mm512_add_ps(t2, t1)),
+                               _mm512_mul_ps(e, _mm512_set1_ps(NUM_LOGF_LN2_LO)));
+    y = _mm512_sub_ps(_mm512_sub_ps(hfsq, y), f);
+    y = _mm512_fmsub_ps(e, _mm512_set1_ps(NUM_LOGF_LN2_HI), y);
+    y = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_set1_ps(std::numeric_limits<float>::infinity()), _CMP_EQ_OQ), y, x);
+    y = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_EQ_OQ),
+                             y, _mm512_set1_ps(-std::numeric_limits<float>::infinity()));
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_NGE_UQ),
+                                y, _mm512_set1_ps(std::numeric_limits<float>::quiet_NaN()));
+}
+
+
+NUM_SIMD_TARGET_AVX512 inline __m512d _log_avx512(__m512d x) {
+    const __mmask8 all = (__mmask8)0xff;
+    __m512d m = _mm512_maskz_getmant_pd(all, x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+    __m512d e = _mm512_maskz_getexp_pd(all, x);
+    __mmask8 big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(NUM_SQRT2), _CMP_GT_OQ);
+    m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(0.5));
+    e = _mm512_mask_add_pd(e, big, e, _mm512_set1_pd(1.));
+    __m512d f = _mm512_sub_pd(m, _mm512_set1_pd(1.));
+    __m512d s = _mm512_div_pd(f, _mm512_add_pd(f, _mm512_set1_pd(2.)));
+    __m512d z = _mm512_mul_pd(s, s);
+    __m512d w = _mm512_mul_pd(z, z);
+    __m512d t1 = _mm512_fmadd_pd(w, _mm512_set1_pd(NUM_LOG_LG6), _mm512_set1_pd(NUM_LOG_LG4));
+    t1 = _mm512_mul_pd(w, _mm512_fmadd_pd(w, t1, _mm512_set1_pd(NUM_LOG_LG2)));
+    __m512d t2 = _mm512_fmadd_pd(w, _mm512_set1_pd(NUM_LOG_LG7), _mm512_set1_pd(NUM_LOG_LG5));
+    t2 = _mm512_fmadd_pd(w, t2, _mm512_set1_pd(NUM_LOG_LG3));
+    t2 = _mm512_mul_pd(z, _mm512_fmadd_pd(w, t2, _mm512_set1_pd(NUM_LOG_LG1)));
+    __m512d hfsq = _mm512_mul_pd(_mm512_set1_pd(0.5), _mm512_mul_pd(f, f));
+    __m512d y = _mm512_fmadd_pd(s, _mm512_add_pd(hfsq, _mm512_add_pd(t2, t1)),
+                                _mm512_mul_pd(e, _mm512_set1_pd(NUM_LOG_LN2_LO)));
+    y = _mm512_sub_pd(_mm512_sub_pd(hfsq, y), f);
+    y = _mm512_fmsub_pd(e, _mm512_set1_pd(NUM_LOG_LN2_HI), y);
+    y = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(std::numeric_limits<double>::infinity()), _CMP_EQ_OQ), y, x);
+    y = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_EQ_OQ),
+                             y, _mm512_set1_pd(-std::numeric_limits<double>::infinity()));
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_NGE_UQ),
+                                y, _mm512_set1_pd(std::numeric_limits<double>::quiet_NaN()));
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _exp_avx512(const float *x, float *y, size_t size) {
+    for (; size >= 16; size -= 16, x += 16, y += 16)
+        _mm512_storeu_ps(y, _exp_avx512(_mm512_loadu_ps(x)));
+    if (size > 0) {
+        __mmask16 m = (__mmask16)((1u << size) - 1);
+        _mm512_mask_storeu_ps(y, m, _exp_avx512(_mm512_maskz_loadu_ps(m, x)));
+    }
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _exp_avx512(const double *x, double *y, size_t size) {
+    for (; size >= 8; size -= 8, x += 8, y += 8)
+        _mm512_storeu_pd(y, _exp_avx512(_mm512_loadu_pd(x)));
+    if (size > 0) {
+        __mmask8 m = (__mmask8)((1u << size) - 1);
+        _mm512_mask_storeu_pd(y, m, _exp_avx512(_mm512_maskz_loadu_pd(m, x)));
+    }
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _log_avx512(const float *x, float *y, size_t size) {
+    for (; size >= 16; size -= 16, x += 16, y += 16)
+        _mm512_storeu_ps(y, _log_avx512(_mm512_loadu_ps(x)));
+    if (size > 0) {
+        __mmask16 m = (__mmask16)((1u << size) - 1);
+        _mm512_mask_storeu_ps(y, m, _log_avx512(_mm512_maskz_loadu_ps(m, x)));
+    }
+    _mm256_zeroupper();
+}
+
+
+NUM_SIMD_TARGET_AVX512 void _log_avx512(const double *x, double *y, size_t size) {
+    for (; size >= 8; size -= 8, x += 8, y += 8)
+        _mm512_storeu_pd(y, _log_avx512(_mm512_loadu_pd(x)));
+    if (size > 0) {
+        __mmask8 m = (__mmask8)((1u << size) - 1);
+        _mm512_mask_storeu_pd(y, m, _log_avx512(_mm512_maskz_loadu_pd(m, x)));
+    }
+    _mm256_zeroupper();
+}
+
+#endif
+
+
+////////////////////////////
+// mathematical functions, dispatch,
+// SSE2 uses the scalar versions
+////////////////////////////
+
+
+#if defined(NUM_SIMD_X86)
+#define NUM_MATH_DISPATCH(name, args) \
+    switch(num_simd_select(level)) { \
+        case NUM_SIMD_AVX512: _##name##_avx512 args; return; \
+        case NUM_SIMD_AVX2: _##name##_avx2 args; return; \
+        default: _##name##_none args; return; \
+    }
+#else
+#define NUM_MATH_DISPATCH(name, args) \
+    _##name##_none args;
+#endif
+
+
+void vector_exp_pointer(const float *x, float *y, size_t size, int level) {
+    NUM_MATH_DISPATCH(exp, (x, y, size))
+}
+
+
+void vector_exp_pointer(const double *x, double *y, size_t size, int level) {
+    NUM_MATH_DISPATCH(exp, (x, y, size))
+}
+
+
+void vector_log_pointer(const float *x, float *y, size_t size, int level) {
+    NUM_MATH_DISPATCH(log, (x, y, size))
+}
+
+
+void vector_log_pointer(const double *x, double *y, size_t size, int level) {
+    NUM_MATH_DISPATCH(log, (x, y, size))
+}
+
+
+// The following functions are computed by blocks,
+// the elementwise operations surround a call to exp or log.
+#define NUM_MATH_BLOCK 256
+
+
+inline float _tanh_polynomial(float z) {
+    return (((-5.70498872745E-3f * z + 2.06390887954E-2f) * z - 5.37397155531E-2f) * z +
+            1.33314422036E-1f) * z - 3.33332819422E-1f;
+}
+
+
+inline double _tanh_polynomial(double z) {
+    return ((-9.64399179425052238628E-1 * z - 9.92877231001918586564E1) * z -
+            1.61468768441708447952E3) /
+           (((z + 1.12811678491632931402E2) * z + 2.23548839060100448583E3) * z +
+            4.84406305325125486048E3);
+}
+
+
+template <typename NTYPE>
+void _tanh(const NTYPE *x, NTYPE *y, size_t size, int level) {
+    NTYPE buffer[NUM_MATH_BLOCK];
+    NTYPE a, t;
+    size_t i, n;
+    for (; size > 0; size -= n, x += n, y += n) {
+        n = std::min(size, (size_t)NUM_MATH_BLOCK);
+        for (i = 0; i < n; ++i)
+            buffer[i] = 2 * std::abs(x[i]);
+        vector_exp_pointer(buffer, buffer, n, level);
+        for (i = 0; i < n; ++i) {
+            a = std::abs(x[i]);
+            if (a < (NTYPE)NUM_TANH_SPLIT)
+                y[i] = x[i] + x[i] * (x[i] * x[i]) * _tanh_polynomial(x[i] * x[i]);
+            else {
+                t = 1 - 2 / (buffer[i] + 1);
+                y[i] = x[i] < 0 ? -t : (a == a ? t : x[i]);
+            }
+        }
+    }
+}
+
+
+template <typename NTYPE>
+void _logistic(const NTYPE *x, NTYPE *y, size_t size, int level) {
+    // exp(-|x|) does not overflow, 1 - v is avoided for negative values
+    NTYPE buffer[NUM_MATH_BLOCK];
+    NTYPE v;
+    size_t i, n;
+    for (; size > 0; size -= n, x += n, y += n) {
+        n = std::min(size, (size_t)NUM_MATH_BLOCK);
+        for (i = 0; i < n; ++i)
+            buffer[i] = -std::abs(x[i]);
+        vector_exp_pointer(buffer, buffer, n, level);
+        for (i = 0; i < n; ++i) {
+            v = 1 / (1 + buffer[i]);
+            y[i] = x[i] < 0 ? buffer[i] * v : v;
+        }
+    }
+}
+
+
+template <typename NTYPE>
+void _erfinv(const NTYPE *x, NTYPE *y, size_t size, int level) {
+    // Same approximation as ErfInv in op_common_.hpp,
+    // log(1 - x^2) is vectorized.
+    const NTYPE alpha = (NTYPE)2 / (3.14159f * 0.147f);
+    const NTYPE beta = (NTYPE)1 / 0.147f;
+    NTYPE buffer[NUM_MATH_BLOCK];
+    NTYPE ln, t, v;
+    size_t i, n;
+    for (; size > 0; size -= n, x += n, y += n) {
+        n = std::min(size, (size_t)NUM_MATH_BLOCK);
+        for (i = 0; i < n; ++i)
+            buffer[i] = (1 - x[i]) * (1 + x[i]);
+        vector_log_pointer(buffer, buffer, n, level);
+        for (i = 0; i < n; ++i) {
+            ln = buffer[i];
+            t = alpha + ln / 2;
+            v = std::sqrt(std::sqrt(t * t - ln * beta) - t);
+            y[i] = x[i] < 0 ? -v : v;
+        }
+    }
+}
+
+
+void vector_tanh_pointer(const float *x, float *y, size_t size, int level) {
+    _tanh(x, y, size, level);
+}
+
+
+void vector_tanh_pointer(const double *x, double *y, size_t size, int level) {
+    _tanh(x, y, size, level);
+}
+
+
+void vector_logistic_pointer(const float *x, float *y, size_t size, int level) {
+    _logistic(x, y, size, level);
+}
+
+
+void vector_logistic_pointer(const double *x, double *y, size_t size, int level) {
+    _logistic(x, y, size, level);
+}
+
+
+void vector_erfinv_pointer(const float *x, float *y, size_t size, int level) {
+    _erfinv(x, y, size, level);
+}
+
+
+void vector_erfinv_pointer(const double *x, double *y, size_t size, int level) {
+    _erfinv(x, y, size, level);
+}
+
+
+////////////////////////////
+// thread pool, there is one pool per process
+// whatever the number of extensions using it
+////////////////////////////
+
+
+static ThreadPool* _thread_pool_shared = NULL;
+
+
+#if !defined(_WIN32)
+static void _thread_pool_after_fork() {
+    ThreadPool::global().after_fork();
+}
+#endif
+
+
+static ThreadPool* _thread_pool_create() {
+    static ThreadPool pool;
+#if !defined(_WIN32)
+    pthread_atfork(NULL, NULL, &_thread_pool_after_fork);
+#endif
+    return &pool;
+}
+
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool* pool = _thread_pool_shared != NULL
+        ? _thread_pool_shared : _thread_pool_create();
+    return *pool;
+}
+
+
+void ThreadPool::share(ThreadPool* pool) {
+    _thread_pool_shared = pool;
+}
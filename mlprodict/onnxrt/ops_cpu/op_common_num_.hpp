@@ -1,13 +1,83 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
+#include <cstddef>
 #include <vector>
 #include <stdio.h>
 
 
+// Instruction sets used by the vectorized kernels, the best one
+// available on the machine is checked at runtime, the compiler
+// does not need any specific option.
+#define NUM_SIMD_NONE 0
+#define NUM_SIMD_SSE2 1
+#define NUM_SIMD_AVX2 2
+#define NUM_SIMD_AVX512 3
+
+
+// Returns the best instruction set available on this machine.
+int num_simd_cpu_level();
+
+// Returns the name of an instruction set.
+const char* num_simd_name(int level);
+
+
 float vector_dot_product_pointer16_sse(const float *p1, const float *p2, size_t size);
 
 double vector_dot_product_pointer16_sse(const double *p1, const double *p2, size_t size);
 
 template <typename NTYPE>
 NTYPE vector_dot_product_pointer_sse(const NTYPE *p1, const NTYPE *p2, size_t size);
+
+
+// The following kernels accept unaligned pointers, *level* is
+// the instruction set to use, -1 for the best available one,
+// a level the machine does not support is replaced by the best available one.
+
+// Returns sum_i p1[i] * p2[i].
+float vector_dot_product_pointer(const float *p1, const float *p2, size_t size, int level = -1);
+double vector_dot_product_pointer(const double *p1, const double *p2, size_t size, int level = -1);
+
+// Returns sum_i (p1[i] - p2[i])^2.
+float vector_squared_distance_pointer(const float *p1, const float *p2, size_t size, int level = -1);
+double vector_squared_distance_pointer(const double *p1, const double *p2, size_t size, int level = -1);
+
+// Computes y[i] += a * x[i].
+void vector_axpy_pointer(float a, const float *x, float *y, size_t size, int level = -1);
+void vector_axpy_pointer(double a, const double *x, double *y, size_t size, int level = -1);
+
+// Computes C += A B, A is a matrix (M, K), B (K, N), C (M, N),
+// every matrix is stored row by row, lda, ldb, ldc are the row strides.
+// B is split into blocks which remain in cache while the rows of A go through them.
+void matrix_product_add_pointer(const float *A, int64_t lda, const float *B, int64_t ldb,
+                                float *C, int64_t ldc, int64_t M, int64_t N, int64_t K,
+                                int level = -1);
+void matrix_product_add_pointer(const double *A, int64_t lda, const double *B, int64_t ldb,
+                                double *C, int64_t ldc, int64_t M, int64_t N, int64_t K,
+                                int level = -1);
+
+
+// Elementwise functions, y[i] = f(x[i]), x and y may be the same pointer.
+// The vectorized versions use AVX2 + FMA or AVX-512, SSE2 falls back
+// to the scalar version of the same algorithm. Maximum errors measured
+// against long double on 2 10^6 random values:
+// exp: 1 ulp (float), 1.6 ulp (double), log: 0.8 ulp, tanh: 1.4 ulp, logistic: 2.8 ulp.
+void vector_exp_pointer(const float *x, float *y, size_t size, int level = -1);
+void vector_exp_pointer(const double *x, double *y, size_t size, int level = -1);
+
+void vector_log_pointer(const float *x, float *y, size_t size, int level = -1);
+void vector_log_pointer(const double *x, double *y, size_t size, int level = -1);
+
+void vector_tanh_pointer(const float *x, float *y, size_t size, int level = -1);
+void vector_tanh_pointer(const double *x, double *y, size_t size, int level = -1);
+
+// Computes 1 / (1 + exp(-x)).
+void vector_logistic_pointer(const float *x, float *y, size_t size, int level = -1);
+void vector_logistic_pointer(const double *x, double *y, size_t size, int level = -1);
+
+// Approximation of erfinv used by onnxruntime (Winitzki, a=0.147),
+// relative error below 2e-3, the results are the results of the scalar
+// ErfInv with a relative difference below 1e-6 (float), 1e-14 (double).
+void vector_erfinv_pointer(const float *x, float *y, size_t size, int level = -1);
+void vector_erfinv_pointer(const double *x, double *y, size_t size, int level = -1);
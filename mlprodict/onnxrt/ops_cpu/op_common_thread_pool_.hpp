@@ -0,0 +1,327 @@
+#pragma once
+
+// Persistent thread pool shared by the runtimes of every extension.
+// Tasks are split into contiguous ranges, one per thread,
+// a thread whose range is empty steals half of the range of another one.
+// The workers start with the first job, a child process created
+// by fork starts its own workers (see after_fork).
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#endif
+
+#if USE_OPENMP
+#include <omp.h>
+#endif
+
+
+class ThreadPool {
+    public:
+
+        /**
+        * *n_threads* includes the calling thread, 0 means the number
+        * of threads :epkg:`openmp` would use, *affinity* pins every
+        * worker to one core.
+        */
+        ThreadPool(int n_threads = 0, bool affinity = false) :
+                n_threads_(0), affinity_(false), started_(false), generation_(0), running_(0),
+                task_(NULL), task_data_(NULL) {
+            start(n_threads, affinity);
+        }
+
+        ~ThreadPool() {
+            stop();
+        }
+
+        inline int n_threads() const { return n_threads_; }
+        inline bool affinity() const { return affinity_; }
+
+        /**
+        * Pool used by every runtime, it is defined in op_common_num_.cpp.
+        * Every extension links its own copy of that file, extension
+        * *_op_onnx_numpy* owns the pool and exposes it with function
+        * *thread_pool_capsule*, the other extensions call share with it
+        * when they are imported (see thread_pool_share).
+        */
+        static ThreadPool& global();
+
+        // Makes global() return *pool*, it must be called before global() is used.
+        static void share(ThreadPool* pool);
+
+        // Index of the current thread in the pool running it, -1 outside a pool.
+        static int& thread_index() {
+            static thread_local int index = -1;
+            return index;
+        }
+
+        // Waits for the running job and restarts the pool.
+        void configure(int n_threads, bool affinity) {
+            std::lock_guard<std::mutex> lock(job_mutex_);
+            stop();
+            start(n_threads, affinity);
+        }
+
+        /**
+        * Called in a child process created by fork. The workers of the
+        * parent do not exist in the child and any lock may have been held
+        * by one of the parent's threads: the workers are forgotten, the
+        * synchronization objects are built again and new workers start
+        * with the next job. Only the thread calling fork exists
+        * when this function runs.
+        */
+        void after_fork() {
+            // destroying a joinable std::thread calls std::terminate,
+            // the handles of the parent's workers are leaked on purpose
+            std::vector<std::thread>* lost = new std::vector<std::thread>();
+            lost->swap(workers_);
+            new (&job_mutex_) std::mutex();
+            new (&mutex_) std::mutex();
+            new (&wake_) std::condition_variable();
+            new (&done_) std::condition_variable();
+            for (int th = 0; th < n_threads_; ++th)
+                new (&ranges_[th].mutex) std::mutex();
+            stopping_ = false;
+            started_ = false;
+            running_ = 0;
+            error_ = std::exception_ptr();
+        }
+
+        /**
+        * Calls fn(task, thread) for every task in [0, n_tasks[
+        * and returns when all of them are done, *thread* is in
+        * [0, n_threads()[. The calling thread takes part in the computation.
+        * The pool runs one job at a time, a thread calling this function
+        * while another job runs waits for it to end, the jobs are not run
+        * sequentially on a busy pool. The tasks run sequentially on the
+        * calling thread only if the function is called from a task.
+        */
+        template<typename F>
+        void parallel_for(int64_t n_tasks, const F& fn) {
+            if (n_tasks <= 0)
+                return;
+            if (n_tasks > 1 && n_threads_ > 1 && thread_index() == -1) {
+                std::lock_guard<std::mutex> lock(job_mutex_);
+                if (!started_)
+                    spawn();
+                run(n_tasks, &ThreadPool::call<F>, (const void*)&fn);
+                return;
+            }
+            for (int64_t i = 0; i < n_tasks; ++i)
+                fn(i, 0);
+        }
+
+    private:
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+
+        typedef void (*task_type)(const void*, int64_t, int);
+
+        template<typename F>
+        static void call(const void* fn, int64_t task, int thread) {
+            (*(const F*)fn)(task, thread);
+        }
+
+        // Remaining tasks of one thread, padded to avoid false sharing.
+        struct TaskRange {
+            std::mutex mutex;
+            int64_t begin;
+            int64_t end;
+            char padding[64];
+        };
+
+        static int default_threads() {
+#if USE_OPENMP
+            return ::omp_get_max_threads();
+#else
+            int n = (int)std::thread::hardware_concurrency();
+            return n > 0 ? n : 1;
+#endif
+        }
+
+        // the workers are created by the first job (see spawn)
+        void start(int n_threads, bool affinity) {
+            n_threads_ = n_threads > 0 ? n_threads : default_threads();
+            affinity_ = affinity;
+            stopping_ = false;
+            started_ = false;
+            ranges_.reset(new TaskRange[n_threads_]);
+        }
+
+        // called with job_mutex_ held
+        void spawn() {
+            for (int th = 1; th < n_threads_; ++th)
+                workers_.push_back(std::thread(&ThreadPool::worker, this, th, generation_));
+            started_ = true;
+        }
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            for (size_t i = 0; i < workers_.size(); ++i)
+                workers_[i].join();
+            workers_.clear();
+        }
+
+        void pin(int th) {
+            if (!affinity_)
+                return;
+            unsigned int n_cores = std::thread::hardware_concurrency();
+            if (n_cores == 0)
+                return;
+            unsigned int core = (unsigned int)th % n_cores;
+#if defined(_WIN32)
+            if (core < 64)
+                SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(core, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#else
+            (void)core;
+#endif
+        }
+
+        // generation is the last job started before the worker
+        void worker(int th, int64_t generation) {
+            thread_index() = th;
+            pin(th);
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    while (!stopping_ && generation_ == generation)
+                        wake_.wait(lock);
+                    if (stopping_)
+                        return;
+                    generation = generation_;
+                }
+                work(th);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --running_;
+                }
+                done_.notify_one();
+            }
+        }
+
+        void run(int64_t n_tasks, task_type task, const void* data) {
+            task_ = task;
+            task_data_ = data;
+            error_ = std::exception_ptr();
+            for (int th = 0; th < n_threads_; ++th) {
+                ranges_[th].begin = n_tasks * th / n_threads_;
+                ranges_[th].end = n_tasks * (th + 1) / n_threads_;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                running_ = (int)workers_.size();
+                ++generation_;
+            }
+            wake_.notify_all();
+
+            thread_index() = 0;
+            work(0);
+            thread_index() = -1;
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (running_ > 0)
+                done_.wait(lock);
+            if (error_)
+                std::rethrow_exception(error_);
+        }
+
+        bool pop(int th, int64_t& task) {
+            TaskRange& own = ranges_[th];
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (own.begin < own.end) {
+                    task = own.begin++;
+                    return true;
+                }
+            }
+            // steals the second half of the first non empty range
+            for (int k = 1; k < n_threads_; ++k) {
+                TaskRange& other = ranges_[(th + k) % n_threads_];
+                int64_t begin, end;
+                {
+                    std::lock_guard<std::mutex> lock(other.mutex);
+                    if (other.begin >= other.end)
+                        continue;
+                    end = other.end;
+                    begin = other.begin + (other.end - other.begin) / 2;
+                    other.end = begin;
+                }
+                task = begin;
+                if (begin + 1 < end) {
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    own.begin = begin + 1;
+                    own.end = end;
+                }
+                return true;
+            }
+            return false;
+        }
+
+        void work(int th) {
+            int64_t task;
+            while (pop(th, task)) {
+                try {
+                    (*task_)(task_data_, task, th);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!error_)
+                        error_ = std::current_exception();
+                }
+            }
+        }
+
+        int n_threads_;
+        bool affinity_;
+        bool stopping_;
+        bool started_;
+        std::vector<std::thread> workers_;
+        std::unique_ptr<TaskRange[]> ranges_;
+
+        // job_mutex_ is held while a job runs, mutex_ protects the fields below
+        std::mutex job_mutex_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        int64_t generation_;
+        int running_;
+        std::exception_ptr error_;
+
+        task_type task_;
+        const void* task_data_;
+};
+
+
+// Functions exposed to python by extension _op_onnx_numpy.
+inline void thread_pool_configure(int n_threads, bool affinity) {
+    ThreadPool::global().configure(n_threads, affinity);
+}
+
+inline int thread_pool_size() {
+    return ThreadPool::global().n_threads();
+}
@@ -2,6 +2,28 @@
 // https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/svm_classifier.cc.
 
 #include "op_svm_common_.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+
+// Buffers needed to score a block of observations. Every task
+// scoring observations takes one from the pool filled by Initialize,
+// compute does not allocate anything else than the outputs.
+template<typename NTYPE>
+struct SVMClassifierScratch {
+    // kernels of a block of observations (SVM_BLOCK_N, vector_count_)
+    std::vector<NTYPE> kernels;
+    // one score per pair of classes or per class
+    std::vector<NTYPE> scores;
+    std::vector<int64_t> votes;
+    // pairwise probabilities (class_count_, class_count_)
+    std::vector<NTYPE> probsp2;
+    std::vector<NTYPE> estimates;
+    // buffers of multiclass_probability
+    std::vector<NTYPE> Q;
+    std::vector<NTYPE> Qp;
+};
 
 
 template<typename NTYPE>
@@ -18,6 +40,17 @@ class RuntimeSVMClassifier : public RuntimeSVMCommon<NTYPE>
         int64_t class_count_;
         std::vector<int64_t> vectors_per_class_;
         std::vector<int64_t> starting_vector_;
+
+    protected:
+
+        // scratch buffers not used by any task, there are as many as
+        // threads in the thread pool when Initialize ends, a task takes
+        // one and gives it back when it is done (see acquire_scratch,
+        // release_scratch)
+        mutable std::vector<std::unique_ptr<SVMClassifierScratch<NTYPE>>> scratch_pool_;
+        mutable std::mutex scratch_mutex_;
+        // number of scratch buffers allocated after Initialize
+        mutable std::atomic<int64_t> scratch_allocations_;
         
     public:
         
@@ -40,21 +73,38 @@ class RuntimeSVMClassifier : public RuntimeSVMCommon<NTYPE>
         
         py::tuple compute(py::array_t<NTYPE> X) const;
 
+        // Returns the number of scratch buffers allocated by compute
+        // since the runtime was initialized, it remains null unless
+        // more threads than expected score observations at the same time.
+        int64_t scratch_allocations() const { return scratch_allocations_; }
+
     private:
 
         void Initialize();
 
+        std::unique_ptr<SVMClassifierScratch<NTYPE>> new_scratch() const;
+        std::unique_ptr<SVMClassifierScratch<NTYPE>> acquire_scratch() const;
+        void release_scratch(std::unique_ptr<SVMClassifierScratch<NTYPE>>& scratch) const;
+
         void compute_gil_free(const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
                               const py::array_t<NTYPE>& X, py::array_t<int64_t>& Y,
                               py::array_t<NTYPE>& Z, int64_t z_stride) const;
 
-        void compute_gil_free_loop(const NTYPE * x_data, 
-                                   int64_t* y_data, NTYPE * z_data) const;
+        // Writes the scores before the post transform, returns
+        // add_second_class for write_scores_batch.
+        int compute_gil_free_loop(const NTYPE * x_data, const NTYPE * kernels_data,
+                                  int64_t* y_data, NTYPE * z_data,
+                                  SVMClassifierScratch<NTYPE>& scratch) const;
+
+        void compute_gil_free_block(const NTYPE * x_data, int64_t n_rows, int64_t stride,
+                                    int64_t* y_data, NTYPE * z_data, int64_t z_stride,
+                                    SVMClassifierScratch<NTYPE>& scratch) const;
 };
 
 
 template<typename NTYPE>
-RuntimeSVMClassifier<NTYPE>::RuntimeSVMClassifier(int omp_N) : RuntimeSVMCommon<NTYPE>(omp_N) {
+RuntimeSVMClassifier<NTYPE>::RuntimeSVMClassifier(int omp_N) :
+        RuntimeSVMCommon<NTYPE>(omp_N), scratch_allocations_(0) {
 }
 
 
@@ -120,6 +170,57 @@ void RuntimeSVMClassifier<NTYPE>::Initialize() {
         weights_are_all_positive_ = false;
         break;
     }  
+    this->init_kernel_matrix();
+
+    // one scratch buffer per thread
+    int n_threads = std::max(ThreadPool::global().n_threads(), 1);
+    scratch_pool_.clear();
+    for (int i = 0; i < n_threads; ++i)
+        scratch_pool_.push_back(new_scratch());
+    scratch_allocations_ = 0;
+}
+
+
+template<typename NTYPE>
+std::unique_ptr<SVMClassifierScratch<NTYPE>> RuntimeSVMClassifier<NTYPE>::new_scratch() const {
+    std::unique_ptr<SVMClassifierScratch<NTYPE>> scratch(new SVMClassifierScratch<NTYPE>());
+    int64_t n_pairs = class_count_ * (class_count_ - 1) / 2;
+    scratch->scores.resize(std::max(n_pairs, class_count_));
+    if (this->mode_ == SVM_TYPE::SVM_SVC && this->vector_count_ > 0) {
+        scratch->kernels.resize(SVM_BLOCK_N * this->vector_count_);
+        scratch->votes.resize(class_count_);
+        if (proba_.size() > 0) {
+            scratch->probsp2.resize(class_count_ * class_count_);
+            scratch->estimates.resize(class_count_);
+            scratch->Q.resize(class_count_ * class_count_);
+            scratch->Qp.resize(class_count_);
+        }
+    }
+    return scratch;
+}
+
+
+template<typename NTYPE>
+std::unique_ptr<SVMClassifierScratch<NTYPE>> RuntimeSVMClassifier<NTYPE>::acquire_scratch() const {
+    {
+        std::lock_guard<std::mutex> lock(scratch_mutex_);
+        if (!scratch_pool_.empty()) {
+            std::unique_ptr<SVMClassifierScratch<NTYPE>> scratch = std::move(scratch_pool_.back());
+            scratch_pool_.pop_back();
+            return scratch;
+        }
+    }
+    // more threads than expected, the buffer is kept for the next calls
+    ++scratch_allocations_;
+    return new_scratch();
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMClassifier<NTYPE>::release_scratch(
+        std::unique_ptr<SVMClassifierScratch<NTYPE>>& scratch) const {
+    std::lock_guard<std::mutex> lock(scratch_mutex_);
+    scratch_pool_.push_back(std::move(scratch));
 }
 
 
@@ -186,11 +287,11 @@ py::tuple RuntimeSVMClassifier<NTYPE>::compute(py::array_t<NTYPE> X) const {
 
 
 template<typename NTYPE>
-void multiclass_probability(int64_t classcount, const std::vector<NTYPE>& r,
-                            std::vector<NTYPE>& p) {
+void multiclass_probability(int64_t classcount, const NTYPE* r, NTYPE* p,
+                            NTYPE* Q, NTYPE* Qp) {
+    // Q is (classcount, classcount), Qp has classcount elements
     int64_t sized2 = classcount * classcount;
-    std::vector<NTYPE> Q(sized2, 0);
-    std::vector<NTYPE> Qp(classcount, 0);
+    std::fill(Q, Q + sized2, (NTYPE)0);
     NTYPE eps = 0.005f / static_cast<NTYPE>(classcount);
     int64_t ii, ij, ji, j;
     NTYPE t;
@@ -252,16 +353,19 @@ void multiclass_probability(int64_t classcount, const std::vector<NTYPE>& r,
 
 
 template<typename NTYPE>
-void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
-        const NTYPE * x_data, int64_t* y_data, NTYPE * z_data) const {
+int RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
+        const NTYPE * x_data, const NTYPE * kernels_data,
+        int64_t* y_data, NTYPE * z_data,
+        SVMClassifierScratch<NTYPE>& scratch) const {
+    // kernels_data holds the kernels for this observation if they were
+    // computed for a whole batch, they are computed here if it is null
     int64_t maxclass = -1;
-    std::vector<NTYPE> decisions;
-    std::vector<NTYPE> scores;
-    std::vector<NTYPE> kernels;
-    std::vector<int64_t> votes;
+    NTYPE* scores = scratch.scores.data();
+    int64_t n_scores = 0;
+    int64_t* votes = nullptr;
 
     if (this->vector_count_ == 0 && this->mode_ == SVM_TYPE::SVM_LINEAR) {
-        scores.resize(class_count_);
+        n_scores = class_count_;
         for (int64_t j = 0; j < class_count_; j++) {  //for each class
             scores[j] = this->rho_[0] + this->kernel_dot_gil_free(
                 x_data, 0,
@@ -274,15 +378,18 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
             throw std::runtime_error("No support vectors.");
         int evals = 0;
        
-        kernels.resize(this->vector_count_);
-        for (int64_t j = 0; j < this->vector_count_; j++) {
-            kernels[j] = this->kernel_dot_gil_free(
-                x_data, 0,
-                this->support_vectors_, this->feature_count_ * j,
-                this->feature_count_, this->kernel_type_);
+        if (kernels_data == nullptr) {
+            NTYPE* kernels = scratch.kernels.data();
+            for (int64_t j = 0; j < this->vector_count_; j++) {
+                kernels[j] = this->kernel_dot_gil_free(
+                    x_data, 0,
+                    this->support_vectors_, this->feature_count_ * j,
+                    this->feature_count_, this->kernel_type_);
+            }
+            kernels_data = kernels;
         }
-        votes.resize(class_count_, 0);
-        scores.reserve(class_count_ * (class_count_ - 1) / 2);
+        votes = scratch.votes.data();
+        std::fill(votes, votes + class_count_, 0);
         for (int64_t i = 0; i < class_count_; i++) {        // for each class
             int64_t start_index_i = starting_vector_[i];  // *feature_count_;
             int64_t class_i_support_count = vectors_per_class_[i];
@@ -294,17 +401,17 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
       
                 int64_t pos1 = (this->vector_count_) * (j - 1);
                 const NTYPE* val1 = &(this->coefficients_[pos1 + start_index_i]);
-                const NTYPE* val2 = &(kernels[start_index_i]);
+                const NTYPE* val2 = kernels_data + start_index_i;
                 for (int64_t m = 0; m < class_i_support_count; ++m, ++val1, ++val2)
                     sum += *val1 * *val2;
       
                 val1 = &(this->coefficients_[pos2 + start_index_j]);
-                val2 = &(kernels[start_index_j]);
+                val2 = kernels_data + start_index_j;
                 for (int64_t m = 0; m < class_j_support_count; ++m, ++val1, ++val2)
                     sum += *val1 * *val2;
       
                 sum += this->rho_[evals];
-                scores.push_back((NTYPE)sum);
+                scores[n_scores++] = (NTYPE)sum;
                 ++(votes[sum > 0 ? i : j]);
                 ++evals;  //index into rho
             }
@@ -313,9 +420,9 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
 
     if (proba_.size() > 0 && this->mode_ == SVM_TYPE::SVM_SVC) {
         //compute probabilities from the scores
-        int64_t num = class_count_ * class_count_;
-        std::vector<NTYPE> probsp2(num, 0.f);
-        std::vector<NTYPE> estimates(class_count_, 0.f);
+        NTYPE* probsp2 = scratch.probsp2.data();
+        NTYPE* estimates = scratch.estimates.data();
+        std::fill(probsp2, probsp2 + class_count_ * class_count_, (NTYPE)0);
         int64_t index = 0;
         NTYPE val1, val2;
         for (int64_t i = 0; i < class_count_; ++i) {
@@ -329,20 +436,20 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
                 probsp2[p2] = 1 - val2;
             }
         }
-        multiclass_probability(class_count_, probsp2, estimates);
+        multiclass_probability(class_count_, probsp2, estimates,
+                               scratch.Q.data(), scratch.Qp.data());
         // copy probabilities back into scores
-        scores.resize(estimates.size());
-        std::copy(estimates.begin(), estimates.end(), scores.begin());
+        n_scores = class_count_;
+        std::copy(estimates, estimates + class_count_, scores);
     }
 
     NTYPE max_weight = 0;
-    if (votes.size() > 0) {
-        auto it_maxvotes = std::max_element(votes.begin(), votes.end());
-        maxclass = std::distance(votes.begin(), it_maxvotes);
+    if (votes != nullptr) {
+        maxclass = std::max_element(votes, votes + class_count_) - votes;
     } 
     else {
-        auto it_max_weight = std::max_element(scores.begin(), scores.end());
-        maxclass = std::distance(scores.begin(), it_max_weight);
+        const NTYPE* it_max_weight = std::max_element(scores, scores + n_scores);
+        maxclass = it_max_weight - scores;
         max_weight = *it_max_weight;
     }
 
@@ -361,7 +468,9 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
         *y_data = maxclass;
     }
 
-    write_scores(scores, this->post_transform_, z_data, write_additional_scores);
+    // the caller applies the post transform to a block of rows
+    memcpy(z_data, scores, n_scores * sizeof(NTYPE));
+    return n_scores >= 2 ? SCORES_FULL_ROW : write_additional_scores;
 }
 
 
@@ -377,23 +486,61 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free(
     int64_t* y_data = (int64_t*)Y_.data(0);
     NTYPE* z_data = (NTYPE*)Z_.data(0);  
 
+    // the kernels of a block of observations are computed with a matrix
+    // product if there is more than one observation, the observations are
+    // otherwise scored one by one and a task is a small chunk of them,
+    // every task takes a scratch buffer and gives it back
+    bool by_block = N > 1 && this->mode_ == SVM_TYPE::SVM_SVC && this->vector_count_ > 0;
+    auto compute_rows = [&](int64_t begin, int64_t end) {
+        std::unique_ptr<SVMClassifierScratch<NTYPE>> scratch = acquire_scratch();
+        if (by_block) {
+            for (; begin < end; begin += SVM_BLOCK_N)
+                compute_gil_free_block(x_data + begin * stride,
+                                       std::min((int64_t)SVM_BLOCK_N, end - begin), stride,
+                                       y_data + begin, z_data + z_stride * begin, z_stride,
+                                       *scratch);
+        }
+        else {
+            int add_second_class;
+            for (int64_t n = begin; n < end; ++n) {
+                add_second_class = compute_gil_free_loop(
+                    x_data + n * x_dims[1], nullptr, y_data + n, z_data + z_stride * n,
+                    *scratch);
+                write_scores_batch(1, z_stride, z_data + z_stride * n,
+                                   this->post_transform_, &add_second_class);
+            }
+        }
+        release_scratch(scratch);
+    };
+
     if (N <= this->omp_N_) {
-        for (int64_t n = 0; n < N; ++n)
-            compute_gil_free_loop(x_data + n * x_dims[1],
-                                  y_data + n,
-                                  z_data + z_stride * n);
+        compute_rows(0, N);
     }
     else {
-        #ifdef USE_OPENMP
-        #pragma omp parallel for
-        #endif
-        for (int64_t n = 0; n < N; ++n)
-            compute_gil_free_loop(x_data + n * x_dims[1],
-                                  y_data + n,
-                                  z_data + z_stride * n);
+        int64_t task_n = by_block ? SVM_BLOCK_N : SVM_CHUNK_N;
+        ThreadPool::global().parallel_for(
+            (N + task_n - 1) / task_n, [&](int64_t b, int) {
+                compute_rows(b * task_n, std::min(b * task_n + task_n, N));
+            });
     }
 }
 
+
+template<typename NTYPE>
+void RuntimeSVMClassifier<NTYPE>::compute_gil_free_block(
+        const NTYPE * x_data, int64_t n_rows, int64_t stride,
+        int64_t* y_data, NTYPE * z_data, int64_t z_stride,
+        SVMClassifierScratch<NTYPE>& scratch) const {
+    NTYPE* kernels = scratch.kernels.data();
+    this->kernel_matrix_gil_free(x_data, n_rows, stride, kernels);
+    int add_second_class[SVM_BLOCK_N];
+    for (int64_t n = 0; n < n_rows; ++n)
+        add_second_class[n] = compute_gil_free_loop(
+            x_data + n * stride, kernels + n * this->vector_count_,
+            y_data + n, z_data + z_stride * n, scratch);
+    write_scores_batch(n_rows, z_stride, z_data, this->post_transform_, add_second_class);
+}
+
 class RuntimeSVMClassifierFloat : public RuntimeSVMClassifier<float>
 {
     public:
@@ -421,6 +568,10 @@ in :epkg:`onnxruntime`.)pbdoc"
     #endif
     ;
 
+    // the runtimes use the thread pool of _op_onnx_numpy
+    ThreadPool::share(py::capsule(py::module::import(
+        "mlprodict.onnxrt.ops_cpu._op_onnx_numpy").attr("thread_pool_capsule")()));
+
     py::class_<RuntimeSVMClassifierFloat> clf (m, "RuntimeSVMClassifierFloat",
         R"pbdoc(Implements runtime for operator SVMClassifier. The code is inspired from
 `svm_classifier.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/svm_classifier.cc>`_
@@ -433,7 +584,13 @@ in :epkg:`onnxruntime`.
     clf.def("init", &RuntimeSVMClassifierFloat::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     clf.def("compute", &RuntimeSVMClassifierFloat::compute,
-            "Computes the predictions for the SVM classifier.");
+            "Computes the predictions for the SVM classifier, the kernels of a batch "
+            "are computed by blocks of observations with a matrix product.");
+    clf.def("scratch_allocations", &RuntimeSVMClassifierFloat::scratch_allocations,
+            "Returns the number of scratch buffers allocated by *compute* since "
+            "the runtime was initialized, every thread reuses the buffers allocated "
+            "by *init*, it remains null unless more threads than expected compute "
+            "predictions at the same time.");
     clf.def("runtime_options", &RuntimeSVMClassifierFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeSVMClassifierFloat::omp_get_max_threads,
@@ -451,7 +608,13 @@ in :epkg:`onnxruntime`.
     cld.def("init", &RuntimeSVMClassifierDouble::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     cld.def("compute", &RuntimeSVMClassifierDouble::compute,
-            "Computes the predictions for the SVM classifier.");
+            "Computes the predictions for the SVM classifier, the kernels of a batch "
+            "are computed by blocks of observations with a matrix product.");
+    cld.def("scratch_allocations", &RuntimeSVMClassifierDouble::scratch_allocations,
+            "Returns the number of scratch buffers allocated by *compute* since "
+            "the runtime was initialized, every thread reuses the buffers allocated "
+            "by *init*, it remains null unless more threads than expected compute "
+            "predictions at the same time.");
     cld.def("runtime_options", &RuntimeSVMClassifierDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeSVMClassifierDouble::omp_get_max_threads,
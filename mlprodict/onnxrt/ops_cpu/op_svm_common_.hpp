@@ -8,6 +8,8 @@
 #include <vector>
 #include <thread>
 #include <iterator>
+#include <algorithm>
+#include <limits>
 
 #ifndef SKIP_PYTHON
 //#include <pybind11/iostream.h>
@@ -25,6 +27,15 @@ namespace py = pybind11;
 
 #include "op_common_.hpp"
 #include "op_common_num_.hpp"
+#include "op_common_thread_pool_.hpp"
+
+// number of observations whose kernels are computed
+// at the same time with a matrix product
+#define SVM_BLOCK_N 64
+
+// number of observations scored by one task of the thread pool
+// when their kernels are computed one observation at a time
+#define SVM_CHUNK_N 4
 
 
 template<typename NTYPE>
@@ -46,6 +57,11 @@ class RuntimeSVMCommon
         POST_EVAL_TRANSFORM post_transform_;
         SVM_TYPE mode_;  //how are we computing SVM? 0=LibSVC, 1=LibLinear
         int omp_N_;
+
+        // support vectors stored feature by feature (feature_count_, vector_count_)
+        // and their squared norms in double, used to compute the kernels of a batch
+        std::vector<NTYPE> support_vectors_t_;
+        std::vector<double> support_norms_;
     
     public:
 
@@ -63,6 +79,15 @@ class RuntimeSVMCommon
         NTYPE kernel_dot_gil_free(
                 const NTYPE* A, int64_t a, const std::vector<NTYPE>& B,
                 int64_t b, int64_t len, KERNEL k) const;
+
+        void kernel_matrix_gil_free(
+                const NTYPE* X, int64_t n_rows, int64_t stride, NTYPE* K) const;
+
+    protected:
+
+        void init_kernel_matrix();
+
+        double kernel_from_dot(double dot, KERNEL k) const;
     
     public:
         
@@ -105,17 +130,10 @@ void RuntimeSVMCommon<NTYPE>::init(
 
 
 template<typename NTYPE>
-NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_gil_free(
-        const NTYPE* A, int64_t a,
-        const std::vector<NTYPE>& B, int64_t b,
-        int64_t len, KERNEL k) const {
-    double sum = 0;
+double RuntimeSVMCommon<NTYPE>::kernel_from_dot(double sum, KERNEL k) const {
     double val;
-    const NTYPE* pA = A + a;
-    const NTYPE* pB = B.data() + b;
     switch(k) {
         case KERNEL::POLY:
-            sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
             sum = gamma_ * sum + coef0_;
             switch (degree_) {
                 case 2:
@@ -134,25 +152,114 @@ NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_gil_free(
             }
             break;
         case KERNEL::SIGMOID:
-            sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
             sum = gamma_ * sum + coef0_;
             sum = std::tanh(sum);
             break;
         case KERNEL::RBF:
-            for (int64_t i = len; i > 0; --i, ++pA, ++pB) {
-                val = *pA - *pB;
-                sum += val * val;
-            }
-            sum = std::exp(-gamma_ * sum);
-            break;
+            throw std::runtime_error("Kernel RBF does not depend on the dot product only.");
         case KERNEL::LINEAR:
-            sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
             break;
     }
+    return sum;
+}
+
+
+template<typename NTYPE>
+NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_gil_free(
+        const NTYPE* A, int64_t a,
+        const std::vector<NTYPE>& B, int64_t b,
+        int64_t len, KERNEL k) const {
+    double sum;
+    const NTYPE* pA = A + a;
+    const NTYPE* pB = B.data() + b;
+    if (k == KERNEL::RBF) {
+        sum = vector_squared_distance_pointer(pA, pB, (size_t)len);
+        sum = std::exp(-gamma_ * sum);
+    }
+    else {
+        sum = vector_dot_product_pointer(pA, pB, (size_t)len);
+        sum = kernel_from_dot(sum, k);
+    }
     return (NTYPE)sum;
 }
 
 
+template<typename NTYPE>
+inline double squared_norm_double(const NTYPE* x, int64_t n) {
+    double s = 0;
+    for (; n > 0; --n, ++x)
+        s += (double)*x * (double)*x;
+    return s;
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::init_kernel_matrix() {
+    support_vectors_t_.clear();
+    support_norms_.clear();
+    if (mode_ != SVM_TYPE::SVM_SVC || vector_count_ == 0)
+        return;
+    support_vectors_t_.resize(support_vectors_.size());
+    support_norms_.resize(vector_count_);
+    const NTYPE* sv = support_vectors_.data();
+    for (int64_t j = 0; j < vector_count_; ++j, sv += feature_count_) {
+        for (int64_t f = 0; f < feature_count_; ++f)
+            support_vectors_t_[f * vector_count_ + j] = sv[f];
+        support_norms_[j] = squared_norm_double(sv, feature_count_);
+    }
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::kernel_matrix_gil_free(
+        const NTYPE* X, int64_t n_rows, int64_t stride, NTYPE* K) const {
+    // K[i, j] = kernel(X[i], support vector j), K is (n_rows, vector_count_),
+    // the dot products come from a matrix product X SV', RBF uses
+    // ||x - sv||^2 = ||x||^2 + ||sv||^2 - 2 x.sv, the norms are computed in
+    // double but x.sv comes from the matrix product, the squared distance is
+    // computed again when the rounding errors of x.sv may be larger than
+    // sqrt(epsilon) times the result (unscaled features),
+    // exp and tanh are applied to the whole matrix at once
+    int64_t size = n_rows * vector_count_;
+    std::fill(K, K + size, (NTYPE)0);
+    matrix_product_add_pointer(X, stride, support_vectors_t_.data(), vector_count_,
+                               K, vector_count_, n_rows, vector_count_, feature_count_);
+    NTYPE* k = K;
+    const NTYPE* x = X;
+    int64_t j;
+    // bound of the rounding errors of a dot product computed with NTYPE
+    // relative to ||x||^2 + ||sv||^2, divided by sqrt(epsilon)
+    const double rbf_tolerance = (double)(feature_count_ + 2) *
+                                 std::sqrt((double)std::numeric_limits<NTYPE>::epsilon());
+    switch(kernel_type_) {
+        case KERNEL::RBF:
+            for (int64_t i = 0; i < n_rows; ++i, x += stride) {
+                double norm = squared_norm_double(x, feature_count_);
+                double d;
+                for (j = 0; j < vector_count_; ++j, ++k) {
+                    d = norm + support_norms_[j] - 2 * (double)*k;
+                    if (d <= rbf_tolerance * (norm + support_norms_[j]))
+                        d = vector_squared_distance_pointer(
+                            x, support_vectors_.data() + j * feature_count_,
+                            (size_t)feature_count_);
+                    *k = (NTYPE)(-gamma_ * (d > 0 ? d : 0));
+                }
+            }
+            vector_exp_pointer(K, K, (size_t)size);
+            break;
+        case KERNEL::SIGMOID:
+            for (j = size; j > 0; --j, ++k)
+                *k = gamma_ * *k + coef0_;
+            vector_tanh_pointer(K, K, (size_t)size);
+            break;
+        case KERNEL::LINEAR:
+            break;
+        default:
+            for (j = size; j > 0; --j, ++k)
+                *k = (NTYPE)kernel_from_dot(*k, kernel_type_);
+            break;
+    }
+}
 
 
 template<typename NTYPE>
@@ -35,6 +35,9 @@ class RuntimeSVMRegressor : public RuntimeSVMCommon<NTYPE>
 
         void compute_gil_free(const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
                               const py::array_t<NTYPE>& X, py::array_t<NTYPE>& Z) const;
+
+        void compute_gil_free_block(const NTYPE * x_data, int64_t n_rows, int64_t stride,
+                                    NTYPE * z_data) const;
 };
 
 
@@ -80,6 +83,7 @@ void RuntimeSVMRegressor<NTYPE>::Initialize() {
         this->mode_ = SVM_TYPE::SVM_LINEAR;
         this->kernel_type_ = KERNEL::LINEAR;
     }
+    this->init_kernel_matrix();
 }
 
 
@@ -130,21 +134,52 @@ void RuntimeSVMRegressor<NTYPE>::compute_gil_free(
     auto Z_ = _mutable_unchecked1(Z); // Z.mutable_unchecked<(size_t)1>();
     const NTYPE* x_data = X.data(0);
     NTYPE* z_data = (NTYPE*)Z_.data(0);
-    int64_t current_weight_0, j;
-    NTYPE sum;
 
-    if (N <= this->omp_N_) {
-        for (int64_t n = 0; n < N; ++n) {
-            COMPUTE_LOOP()
+    // the kernels of a block of observations are computed with a matrix
+    // product if there is more than one observation, the observations are
+    // otherwise scored one by one and a task is a small chunk of them
+    bool by_block = N > 1 && this->mode_ == SVM_TYPE::SVM_SVC && this->vector_count_ > 0;
+    auto compute_rows = [&](int64_t begin, int64_t end) {
+        if (by_block) {
+            for (; begin < end; begin += SVM_BLOCK_N)
+                compute_gil_free_block(x_data + begin * stride,
+                                       std::min((int64_t)SVM_BLOCK_N, end - begin),
+                                       stride, z_data + begin);
+        }
+        else {
+            int64_t current_weight_0, j;
+            NTYPE sum;
+            for (int64_t n = begin; n < end; ++n) {
+                COMPUTE_LOOP()
+            }
         }
+    };
+
+    if (N <= this->omp_N_) {
+        compute_rows(0, N);
     }
     else {
-#ifdef USE_OPENMP
-#pragma omp parallel for private(current_weight_0, j, sum)
-#endif
-        for (int64_t n = 0; n < N; ++n) {
-            COMPUTE_LOOP()
-        }
+        int64_t task_n = by_block ? SVM_BLOCK_N : SVM_CHUNK_N;
+        ThreadPool::global().parallel_for(
+            (N + task_n - 1) / task_n, [&](int64_t b, int) {
+                compute_rows(b * task_n, std::min(b * task_n + task_n, N));
+            });
+    }
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMRegressor<NTYPE>::compute_gil_free_block(
+        const NTYPE * x_data, int64_t n_rows, int64_t stride, NTYPE * z_data) const {
+    std::vector<NTYPE> kernels(n_rows * this->vector_count_);
+    this->kernel_matrix_gil_free(x_data, n_rows, stride, kernels.data());
+    NTYPE sum;
+    for (int64_t n = 0; n < n_rows; ++n) {
+        sum = vector_dot_product_pointer(this->coefficients_.data(),
+                                         kernels.data() + n * this->vector_count_,
+                                         (size_t)this->vector_count_);
+        sum += this->rho_[0];
+        z_data[n] = one_class_ ? (sum > 0 ? 1 : -1) : sum;
     }
 }
 
@@ -177,6 +212,10 @@ in :epkg:`onnxruntime`.)pbdoc"
     #endif
     ;
 
+    // the runtimes use the thread pool of _op_onnx_numpy
+    ThreadPool::share(py::capsule(py::module::import(
+        "mlprodict.onnxrt.ops_cpu._op_onnx_numpy").attr("thread_pool_capsule")()));
+
     py::class_<RuntimeSVMRegressorFloat> clf (m, "RuntimeSVMRegressorFloat",
         R"pbdoc(Implements float runtime for operator SVMRegressor. The code is inspired from
 `svm_regressor.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/svm_regressor.cc>`_
@@ -189,7 +228,8 @@ in :epkg:`onnxruntime`.
     clf.def("init", &RuntimeSVMRegressorFloat::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     clf.def("compute", &RuntimeSVMRegressorFloat::compute,
-            "Computes the predictions for the SVM regressor.");
+            "Computes the predictions for the SVM regressor, the kernels of a batch "
+            "are computed by blocks of observations with a matrix product.");
     clf.def("runtime_options", &RuntimeSVMRegressorFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeSVMRegressorFloat::omp_get_max_threads,
@@ -207,7 +247,8 @@ in :epkg:`onnxruntime`.
     cld.def("init", &RuntimeSVMRegressorDouble::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     cld.def("compute", &RuntimeSVMRegressorDouble::compute,
-            "Computes the predictions for the SVM regressor.");
+            "Computes the predictions for the SVM regressor, the kernels of a batch "
+            "are computed by blocks of observations with a matrix product.");
     cld.def("runtime_options", &RuntimeSVMRegressorDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeSVMRegressorDouble::omp_get_max_threads,
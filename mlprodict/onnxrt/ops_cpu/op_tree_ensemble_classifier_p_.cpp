@@ -4,7 +4,11 @@
 #include "op_tree_ensemble_common_p_.hpp"
 
 
-template<typename NTYPE>
+/**
+* NTYPE is the type of the thresholds, the weights and the scores,
+* XTYPE the type of the features (see RuntimeTreeEnsembleRegressorP).
+*/
+template<typename NTYPE, typename XTYPE = NTYPE>
 class RuntimeTreeEnsembleClassifierP : public RuntimeTreeEnsembleCommonP<NTYPE>
 {
     public :
@@ -16,7 +20,7 @@ class RuntimeTreeEnsembleClassifierP : public RuntimeTreeEnsembleCommonP<NTYPE>
 
     public:
         
-        RuntimeTreeEnsembleClassifierP(int omp_tree, int omp_N);
+        RuntimeTreeEnsembleClassifierP(int omp_tree, int omp_N, bool packed = false, bool quantized = false);
         ~RuntimeTreeEnsembleClassifierP();
 
         void init(
@@ -39,24 +43,32 @@ class RuntimeTreeEnsembleClassifierP : public RuntimeTreeEnsembleCommonP<NTYPE>
             const std::string& post_transform // 16
             );
         
-        py::tuple compute_cl(py::array_t<NTYPE> X);
+        py::tuple compute_cl(py::array_t<XTYPE> X);
+        py::tuple compute_label(py::array_t<XTYPE> X);
+        int64_t compute_npy(const std::string& input, const std::string& output,
+                            const std::string& labels, int64_t chunk_rows);
         py::array_t<NTYPE> compute_tree_outputs(py::array_t<NTYPE> X);
+
+        py::bytes serialize() const;
+        void deserialize(py::bytes blob);
+        void save(const std::string& filename) const;
+        void load(const std::string& filename);
 };
 
 
-template<typename NTYPE>
-RuntimeTreeEnsembleClassifierP<NTYPE>::RuntimeTreeEnsembleClassifierP(int omp_tree, int omp_N) :
-   RuntimeTreeEnsembleCommonP<NTYPE>(omp_tree, omp_N) {
+template<typename NTYPE, typename XTYPE>
+RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::RuntimeTreeEnsembleClassifierP(int omp_tree, int omp_N, bool packed, bool quantized) :
+   RuntimeTreeEnsembleCommonP<NTYPE>(omp_tree, omp_N, packed, quantized) {
 }
 
 
-template<typename NTYPE>
-RuntimeTreeEnsembleClassifierP<NTYPE>::~RuntimeTreeEnsembleClassifierP() {
+template<typename NTYPE, typename XTYPE>
+RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::~RuntimeTreeEnsembleClassifierP() {
 }
 
 
-template<typename NTYPE>
-void RuntimeTreeEnsembleClassifierP<NTYPE>::init(
+template<typename NTYPE, typename XTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::init(
             py::array_t<NTYPE> base_values, // 0
             py::array_t<int64_t> class_ids, // 1
             py::array_t<int64_t> class_nodeids, // 2
@@ -98,37 +110,93 @@ void RuntimeTreeEnsembleClassifierP<NTYPE>::init(
 }
 
 
-template<typename NTYPE>
-py::tuple RuntimeTreeEnsembleClassifierP<NTYPE>::compute_cl(py::array_t<NTYPE> X) {
+template<typename NTYPE, typename XTYPE>
+py::tuple RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::compute_cl(py::array_t<XTYPE> X) {
     return this->compute_cl_agg(X, _AggregatorClassifier<NTYPE>(
-                                this->roots_.size(), this->n_targets_or_classes_,
+                                this->n_trees_, this->n_targets_or_classes_,
                                 this->post_transform_, &(this->base_values_),
                                 &classlabels_int64s_, binary_case_,
                                 weights_are_all_positive_));
 }
 
 
-template<typename NTYPE>
-py::array_t<NTYPE> RuntimeTreeEnsembleClassifierP<NTYPE>::compute_tree_outputs(py::array_t<NTYPE> X) {
+template<typename NTYPE, typename XTYPE>
+int64_t RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::compute_npy(
+        const std::string& input, const std::string& output,
+        const std::string& labels, int64_t chunk_rows) {
+    return this->template compute_npy_agg<_AggregatorClassifier<NTYPE>, XTYPE>(
+                                 input, output, &labels, chunk_rows,
+                                 _AggregatorClassifier<NTYPE>(
+                                 this->n_trees_, this->n_targets_or_classes_,
+                                 this->post_transform_, &(this->base_values_),
+                                 &classlabels_int64s_, binary_case_,
+                                 weights_are_all_positive_));
+}
+
+
+template<typename NTYPE, typename XTYPE>
+py::tuple RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::compute_label(py::array_t<XTYPE> X) {
+    return this->compute_label_agg(X, _AggregatorClassifier<NTYPE>(
+                                   this->n_trees_, this->n_targets_or_classes_,
+                                   this->post_transform_, &(this->base_values_),
+                                   &classlabels_int64s_, binary_case_,
+                                   weights_are_all_positive_));
+}
+
+
+template<typename NTYPE, typename XTYPE>
+py::array_t<NTYPE> RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::compute_tree_outputs(py::array_t<NTYPE> X) {
     return this->compute_tree_outputs_agg(X, _AggregatorClassifier<NTYPE>(
-                                          this->roots_.size(), this->n_targets_or_classes_,
+                                          this->n_trees_, this->n_targets_or_classes_,
                                           this->post_transform_, &(this->base_values_),
                                           &classlabels_int64s_, binary_case_,
                                           weights_are_all_positive_));
 }
 
 
+template<typename NTYPE, typename XTYPE>
+py::bytes RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::serialize() const {
+    return py::bytes(this->to_blob(&classlabels_int64s_, binary_case_, weights_are_all_positive_));
+}
+
+
+template<typename NTYPE, typename XTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::deserialize(py::bytes blob) {
+    this->deserialize_blob(blob, &classlabels_int64s_, &binary_case_, &weights_are_all_positive_);
+}
+
+
+template<typename NTYPE, typename XTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::save(const std::string& filename) const {
+    this->save_blob(filename, this->to_blob(&classlabels_int64s_, binary_case_,
+                                            weights_are_all_positive_));
+}
+
+
+template<typename NTYPE, typename XTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE, XTYPE>::load(const std::string& filename) {
+    this->load_file(filename, &classlabels_int64s_, &binary_case_, &weights_are_all_positive_);
+}
+
+
 class RuntimeTreeEnsembleClassifierPFloat : public RuntimeTreeEnsembleClassifierP<float> {
     public:
-        RuntimeTreeEnsembleClassifierPFloat(int omp_tree, int omp_N) :
-            RuntimeTreeEnsembleClassifierP<float>(omp_tree, omp_N) {}
+        RuntimeTreeEnsembleClassifierPFloat(int omp_tree, int omp_N, bool packed = false, bool quantized = false) :
+            RuntimeTreeEnsembleClassifierP<float>(omp_tree, omp_N, packed, quantized) {}
 };
 
 
 class RuntimeTreeEnsembleClassifierPDouble : public RuntimeTreeEnsembleClassifierP<double> {
     public:
-        RuntimeTreeEnsembleClassifierPDouble(int omp_tree, int omp_N) :
-            RuntimeTreeEnsembleClassifierP<double>(omp_tree, omp_N) {}
+        RuntimeTreeEnsembleClassifierPDouble(int omp_tree, int omp_N, bool packed = false, bool quantized = false) :
+            RuntimeTreeEnsembleClassifierP<double>(omp_tree, omp_N, packed, quantized) {}
+};
+
+
+class RuntimeTreeEnsembleClassifierPFloatDouble : public RuntimeTreeEnsembleClassifierP<double, float> {
+    public:
+        RuntimeTreeEnsembleClassifierPFloatDouble(int omp_tree, int omp_N, bool packed = false, bool quantized = false) :
+            RuntimeTreeEnsembleClassifierP<double, float>(omp_tree, omp_N, packed, quantized) {}
 };
 
 
@@ -145,28 +213,83 @@ in :epkg:`onnxruntime`.)pbdoc"
     #endif
     ;
 
+    // the runtimes use the thread pool of _op_onnx_numpy
+    ThreadPool::share(py::capsule(py::module::import(
+        "mlprodict.onnxrt.ops_cpu._op_onnx_numpy").attr("thread_pool_capsule")()));
+
     py::class_<RuntimeTreeEnsembleClassifierPFloat> clf (m, "RuntimeTreeEnsembleClassifierPFloat",
         R"pbdoc(Implements float runtime for operator TreeEnsembleClassifier. The code is inspired from
 `tree_ensemble_Classifier.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_Classifier.cc>`_
 in :epkg:`onnxruntime`. Supports float only.
 
-:param omp_tree: number of trees above which the runtime uses :epkg:`openmp`
-    to parallelize tree computation when the number of observations it 1
+:param omp_tree: number of trees above which the runtime splits the trees
+    into blocks computed in parallel by the thread pool
 :param omp_N: number of observvations above which the runtime uses
-    :epkg:`openmp` to parallelize the predictions
+    the thread pool to parallelize the predictions
+:param packed: stores the nodes with a compact layout (16 bytes per node
+    for float), leaves weights are stored in a contiguous array
+:param quantized: replaces thresholds by their rank among the thresholds
+    of the same feature (8 or 16 bits), batches are converted into ranks
+    before the trees are evaluated, decisions are the same
 )pbdoc");
 
     clf.def(py::init<int, int>());
+    clf.def(py::init<int, int, bool>());
+    clf.def(py::init<int, int, bool, bool>());
     clf.def_readwrite("omp_tree_", &RuntimeTreeEnsembleClassifierPFloat::omp_tree_,
-        "Number of trees above which the computation is parallelized for one observation.");
+        "Number of trees above which the trees are split into blocks computed in parallel.");
     clf.def_readwrite("omp_N_", &RuntimeTreeEnsembleClassifierPFloat::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    clf.def_readonly("dense_leaves_", &RuntimeTreeEnsembleClassifierPFloat::dense_leaves_,
+        "Every leaf holds one weight per class, the weights are stored in a dense table.");
+    clf.def_readwrite("deterministic_", &RuntimeTreeEnsembleClassifierPFloat::deterministic_,
+        "Sums the trees in blocks of fixed size reduced pairwise, "
+        "the predictions do not depend on the number of threads.");
+    clf.def_readwrite("profile_", &RuntimeTreeEnsembleClassifierPFloat::profile_,
+        "Counts the visits of every node and the branches taken during the predictions, "
+        "the predictions are slower, see *get_node_counts*.");
+    clf.def("get_node_counts", &RuntimeTreeEnsembleClassifierPFloat::get_node_counts,
+        "Returns a matrix (n_nodes, 3), visits, true branches, false branches for every node "
+        "in the order of the ONNX attributes (the order of the compact layout "
+        "if the model was restored from a blob), filled when *profile_* is True.");
+    clf.def("get_hitrates", &RuntimeTreeEnsembleClassifierPFloat::get_hitrates,
+        "Returns the visits of every node divided by the number of profiled observations, "
+        "it can be used as attribute *nodes_hitrates* to reorder the nodes.");
+    clf.def("reset_node_counts", &RuntimeTreeEnsembleClassifierPFloat::reset_node_counts,
+        "Resets the counters filled when *profile_* is True.");
+    clf.def_readwrite("tile_N_", &RuntimeTreeEnsembleClassifierPFloat::tile_N_,
+        "Number of observations every tree is evaluated for before moving to the next tree, "
+        "1 evaluates all trees for one observation at a time.");
+    clf.def_readwrite("use_simd_", &RuntimeTreeEnsembleClassifierPFloat::use_simd_,
+        "Uses the vectorized traversal (AVX2, AVX-512) when it is available, "
+        "it requires the compact layout (*packed*), float and the same mode for every node, "
+        "``runtime_options()`` tells which instruction set was selected.");
+    clf.def_readwrite("use_quickscorer_", &RuntimeTreeEnsembleClassifierPFloat::use_quickscorer_,
+        "Evaluates the trees with bitvectors (QuickScorer) if every tree has "
+        "at most 64 leaves and the vectorized traversal, the quantized thresholds "
+        "and the deterministic mode are not used.");
     clf.def_readonly("roots_", &RuntimeTreeEnsembleClassifierPFloat::roots_,
                      "Returns the roots indices.");
     clf.def("init", &RuntimeTreeEnsembleClassifierPFloat::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     clf.def("compute", &RuntimeTreeEnsembleClassifierPFloat::compute_cl,
-            "Computes the predictions for the random forest.");
+            "Computes the predictions for the random forest, X may be C-ordered, "
+            "Fortran-ordered or strided, it is not copied.");
+    clf.def("compute_npy", &RuntimeTreeEnsembleClassifierPFloat::compute_npy,
+            "Computes the scores of a matrix stored in a .npy file by chunks of "
+            "*chunk_rows* rows (0 for the default) and saves them in another .npy file, "
+            "the labels are saved in file *labels* if it is not empty, "
+            "the next chunk is read while the current one is scored. "
+            "Returns the number of rows.");
+    clf.def("compute_label", &RuntimeTreeEnsembleClassifierPFloat::compute_label,
+            "Computes the labels only and stops evaluating the trees for an observation "
+            "once the remaining trees cannot change its label (more than two classes). "
+            "Returns the labels and the number of evaluated trees for every observation.");
+    clf.def("set_early_exit_order", &RuntimeTreeEnsembleClassifierPFloat::set_early_exit_order,
+            "Changes the order in which *compute_label* evaluates the trees, "
+            "an empty list restores the default order (largest range of weights first).");
+    clf.def_readonly("early_exit_order_", &RuntimeTreeEnsembleClassifierPFloat::early_exit_order_,
+        "Order in which *compute_label* evaluates the trees.");
     clf.def("runtime_options", &RuntimeTreeEnsembleClassifierPFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeTreeEnsembleClassifierPFloat::omp_get_max_threads,
@@ -176,6 +299,12 @@ in :epkg:`onnxruntime`. Supports float only.
     clf.def_readonly("n_classes_", &RuntimeTreeEnsembleClassifierPFloat::n_targets_or_classes_, "See :ref:`lpyort-TreeEnsembleClassifier`.");
     clf.def_readonly("post_transform_", &RuntimeTreeEnsembleClassifierPFloat::post_transform_, "See :ref:`lpyort-TreeEnsembleClassifier`.");
 
+    clf.def("autotune", &RuntimeTreeEnsembleClassifierPFloat::autotune,
+        "Measures the prediction time of sample *X* with several settings "
+        "repeated *repeat* times and keeps the fastest ones in "
+        "*tile_N_*, *omp_tree_*, *omp_N_*, they are saved with the model. "
+        "No other thread may call *compute* until it returns, these "
+        "attributes are modified while the GIL is released.");
     clf.def("debug_threshold", &RuntimeTreeEnsembleClassifierPFloat::debug_threshold,
         "Checks every features against every features against every threshold. Returns a matrix of boolean.");
     clf.def("compute_tree_outputs", &RuntimeTreeEnsembleClassifierPFloat::compute_tree_outputs,
@@ -184,33 +313,104 @@ in :epkg:`onnxruntime`. Supports float only.
         "Tells if all nodes applies the same rule for thresholds.");
     clf.def_readonly("has_missing_tracks_", &RuntimeTreeEnsembleClassifierPFloat::has_missing_tracks_,
         "Tells if the model handles missing values.");
+    clf.def_readonly("packed_", &RuntimeTreeEnsembleClassifierPFloat::packed_,
+        "Tells if the nodes are stored with the compact layout.");
+    clf.def_readonly("quantized_", &RuntimeTreeEnsembleClassifierPFloat::quantized_,
+        "Tells if batches are evaluated with quantized thresholds.");
+    clf.def_readonly("load_time_", &RuntimeTreeEnsembleClassifierPFloat::load_time_,
+        "Duration of the last call to *init*, *load* or *deserialize* in seconds.");
+    clf.def_readonly("node_order_", &RuntimeTreeEnsembleClassifierPFloat::node_order_,
+        "Tells how the nodes were reordered after loading the model, "
+        "``HITRATES`` (most probable child next to its parent) or ``BFS`` (breadth-first).");
     clf.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleClassifierPFloat::get_nodes_modes,
         "Returns the mode for every node.");
     clf.def("__sizeof__", &RuntimeTreeEnsembleClassifierPFloat::get_sizeof,
         "Returns the size of the object.");
+    clf.def("serialize", &RuntimeTreeEnsembleClassifierPFloat::serialize,
+        "Returns the model stored with the compact layout as a binary blob, "
+        "the bitvector evaluation and the quantized thresholds are built again "
+        "when the blob is loaded.");
+    clf.def("deserialize", &RuntimeTreeEnsembleClassifierPFloat::deserialize,
+        "Restores a model from a blob returned by *serialize*.");
+    clf.def("save", &RuntimeTreeEnsembleClassifierPFloat::save,
+        "Saves the blob returned by *serialize* into a file.");
+    clf.def("load", &RuntimeTreeEnsembleClassifierPFloat::load,
+        "Maps a file created by *save* in memory and uses it without copying it, "
+        "processes loading the same file share the same memory.");
 
     py::class_<RuntimeTreeEnsembleClassifierPDouble> cld (m, "RuntimeTreeEnsembleClassifierPDouble",
         R"pbdoc(Implements double runtime for operator TreeEnsembleClassifier. The code is inspired from
 `tree_ensemble_Classifier.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_Classifier.cc>`_
 in :epkg:`onnxruntime`. Supports double only.
 
-:param omp_tree: number of trees above which the runtime uses :epkg:`openmp`
-    to parallelize tree computation when the number of observations it 1
+:param omp_tree: number of trees above which the runtime splits the trees
+    into blocks computed in parallel by the thread pool
 :param omp_N: number of observvations above which the runtime uses
-    :epkg:`openmp` to parallelize the predictions
+    the thread pool to parallelize the predictions
+:param packed: stores the nodes with a compact layout (16 bytes per node
+    for float), leaves weights are stored in a contiguous array
+:param quantized: replaces thresholds by their rank among the thresholds
+    of the same feature (8 or 16 bits), batches are converted into ranks
+    before the trees are evaluated, decisions are the same
 )pbdoc");
 
     cld.def(py::init<int, int>());
+    cld.def(py::init<int, int, bool>());
+    cld.def(py::init<int, int, bool, bool>());
     cld.def_readwrite("omp_tree_", &RuntimeTreeEnsembleClassifierPDouble::omp_tree_,
-        "Number of trees above which the computation is parallelized for one observation.");
+        "Number of trees above which the trees are split into blocks computed in parallel.");
     cld.def_readwrite("omp_N_", &RuntimeTreeEnsembleClassifierPDouble::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    cld.def_readonly("dense_leaves_", &RuntimeTreeEnsembleClassifierPDouble::dense_leaves_,
+        "Every leaf holds one weight per class, the weights are stored in a dense table.");
+    cld.def_readwrite("deterministic_", &RuntimeTreeEnsembleClassifierPDouble::deterministic_,
+        "Sums the trees in blocks of fixed size reduced pairwise, "
+        "the predictions do not depend on the number of threads.");
+    cld.def_readwrite("profile_", &RuntimeTreeEnsembleClassifierPDouble::profile_,
+        "Counts the visits of every node and the branches taken during the predictions, "
+        "the predictions are slower, see *get_node_counts*.");
+    cld.def("get_node_counts", &RuntimeTreeEnsembleClassifierPDouble::get_node_counts,
+        "Returns a matrix (n_nodes, 3), visits, true branches, false branches for every node "
+        "in the order of the ONNX attributes (the order of the compact layout "
+        "if the model was restored from a blob), filled when *profile_* is True.");
+    cld.def("get_hitrates", &RuntimeTreeEnsembleClassifierPDouble::get_hitrates,
+        "Returns the visits of every node divided by the number of profiled observations, "
+        "it can be used as attribute *nodes_hitrates* to reorder the nodes.");
+    cld.def("reset_node_counts", &RuntimeTreeEnsembleClassifierPDouble::reset_node_counts,
+        "Resets the counters filled when *profile_* is True.");
+    cld.def_readwrite("tile_N_", &RuntimeTreeEnsembleClassifierPDouble::tile_N_,
+        "Number of observations every tree is evaluated for before moving to the next tree, "
+        "1 evaluates all trees for one observation at a time.");
+    cld.def_readwrite("use_simd_", &RuntimeTreeEnsembleClassifierPDouble::use_simd_,
+        "Uses the vectorized traversal (AVX2, AVX-512) when it is available, "
+        "it requires the compact layout (*packed*), float and the same mode for every node, "
+        "``runtime_options()`` tells which instruction set was selected.");
+    cld.def_readwrite("use_quickscorer_", &RuntimeTreeEnsembleClassifierPDouble::use_quickscorer_,
+        "Evaluates the trees with bitvectors (QuickScorer) if every tree has "
+        "at most 64 leaves and the vectorized traversal, the quantized thresholds "
+        "and the deterministic mode are not used.");
     cld.def_readonly("roots_", &RuntimeTreeEnsembleClassifierPDouble::roots_,
                      "Returns the roots indices.");
     cld.def("init", &RuntimeTreeEnsembleClassifierPDouble::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     cld.def("compute", &RuntimeTreeEnsembleClassifierPDouble::compute_cl,
-            "Computes the predictions for the random forest.");
+            "Computes the predictions for the random forest, X may be C-ordered, "
+            "Fortran-ordered or strided, it is not copied.");
+    cld.def("compute_npy", &RuntimeTreeEnsembleClassifierPDouble::compute_npy,
+            "Computes the scores of a matrix stored in a .npy file by chunks of "
+            "*chunk_rows* rows (0 for the default) and saves them in another .npy file, "
+            "the labels are saved in file *labels* if it is not empty, "
+            "the next chunk is read while the current one is scored. "
+            "Returns the number of rows.");
+    cld.def("compute_label", &RuntimeTreeEnsembleClassifierPDouble::compute_label,
+            "Computes the labels only and stops evaluating the trees for an observation "
+            "once the remaining trees cannot change its label (more than two classes). "
+            "Returns the labels and the number of evaluated trees for every observation.");
+    cld.def("set_early_exit_order", &RuntimeTreeEnsembleClassifierPDouble::set_early_exit_order,
+            "Changes the order in which *compute_label* evaluates the trees, "
+            "an empty list restores the default order (largest range of weights first).");
+    cld.def_readonly("early_exit_order_", &RuntimeTreeEnsembleClassifierPDouble::early_exit_order_,
+        "Order in which *compute_label* evaluates the trees.");
     cld.def("runtime_options", &RuntimeTreeEnsembleClassifierPDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeTreeEnsembleClassifierPDouble::omp_get_max_threads,
@@ -220,6 +420,12 @@ in :epkg:`onnxruntime`. Supports double only.
     cld.def_readonly("n_classes_", &RuntimeTreeEnsembleClassifierPDouble::n_targets_or_classes_, "See :ref:`lpyort-TreeEnsembleClassifierDouble`.");
     cld.def_readonly("post_transform_", &RuntimeTreeEnsembleClassifierPDouble::post_transform_, "See :ref:`lpyort-TreeEnsembleClassifierDouble`.");
 
+    cld.def("autotune", &RuntimeTreeEnsembleClassifierPDouble::autotune,
+        "Measures the prediction time of sample *X* with several settings "
+        "repeated *repeat* times and keeps the fastest ones in "
+        "*tile_N_*, *omp_tree_*, *omp_N_*, they are saved with the model. "
+        "No other thread may call *compute* until it returns, these "
+        "attributes are modified while the GIL is released.");
     cld.def("debug_threshold", &RuntimeTreeEnsembleClassifierPDouble::debug_threshold,
         "Checks every features against every features against every threshold. Returns a matrix of boolean.");
     cld.def("compute_tree_outputs", &RuntimeTreeEnsembleClassifierPDouble::compute_tree_outputs,
@@ -228,10 +434,154 @@ in :epkg:`onnxruntime`. Supports double only.
         "Tells if all nodes applies the same rule for thresholds.");
     cld.def_readonly("has_missing_tracks_", &RuntimeTreeEnsembleClassifierPDouble::has_missing_tracks_,
         "Tells if the model handles missing values.");
+    cld.def_readonly("packed_", &RuntimeTreeEnsembleClassifierPDouble::packed_,
+        "Tells if the nodes are stored with the compact layout.");
+    cld.def_readonly("quantized_", &RuntimeTreeEnsembleClassifierPDouble::quantized_,
+        "Tells if batches are evaluated with quantized thresholds.");
+    cld.def_readonly("load_time_", &RuntimeTreeEnsembleClassifierPDouble::load_time_,
+        "Duration of the last call to *init*, *load* or *deserialize* in seconds.");
+    cld.def_readonly("node_order_", &RuntimeTreeEnsembleClassifierPDouble::node_order_,
+        "Tells how the nodes were reordered after loading the model, "
+        "``HITRATES`` (most probable child next to its parent) or ``BFS`` (breadth-first).");
     cld.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleClassifierPDouble::get_nodes_modes,
         "Returns the mode for every node.");
     cld.def("__sizeof__", &RuntimeTreeEnsembleClassifierPDouble::get_sizeof,
         "Returns the size of the object.");
+    cld.def("serialize", &RuntimeTreeEnsembleClassifierPDouble::serialize,
+        "Returns the model stored with the compact layout as a binary blob, "
+        "the bitvector evaluation and the quantized thresholds are built again "
+        "when the blob is loaded.");
+    cld.def("deserialize", &RuntimeTreeEnsembleClassifierPDouble::deserialize,
+        "Restores a model from a blob returned by *serialize*.");
+    cld.def("save", &RuntimeTreeEnsembleClassifierPDouble::save,
+        "Saves the blob returned by *serialize* into a file.");
+    cld.def("load", &RuntimeTreeEnsembleClassifierPDouble::load,
+        "Maps a file created by *save* in memory and uses it without copying it, "
+        "processes loading the same file share the same memory.");
+
+    py::class_<RuntimeTreeEnsembleClassifierPFloatDouble> clfd (m, "RuntimeTreeEnsembleClassifierPFloatDouble",
+        R"pbdoc(Implements mixed runtime for operator TreeEnsembleClassifier. The code is inspired from
+`tree_ensemble_Classifier.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_Classifier.cc>`_
+in :epkg:`onnxruntime`. Methods *compute* and *compute_label* take float features,
+the model is stored in double and the scores are summed in double
+(see :class:`RuntimeTreeEnsembleRegressorPFloatDouble
+<mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_.RuntimeTreeEnsembleRegressorPFloatDouble>`).
+
+:param omp_tree: number of trees above which the runtime splits the trees
+    into blocks computed in parallel by the thread pool
+:param omp_N: number of observvations above which the runtime uses
+    the thread pool to parallelize the predictions
+:param packed: stores the nodes with a compact layout (16 bytes per node
+    for float), leaves weights are stored in a contiguous array
+:param quantized: replaces thresholds by their rank among the thresholds
+    of the same feature (8 or 16 bits), batches are converted into ranks
+    before the trees are evaluated, decisions are the same
+)pbdoc");
+
+    clfd.def(py::init<int, int>());
+    clfd.def(py::init<int, int, bool>());
+    clfd.def(py::init<int, int, bool, bool>());
+    clfd.def_readwrite("omp_tree_", &RuntimeTreeEnsembleClassifierPFloatDouble::omp_tree_,
+        "Number of trees above which the trees are split into blocks computed in parallel.");
+    clfd.def_readwrite("omp_N_", &RuntimeTreeEnsembleClassifierPFloatDouble::omp_N_,
+        "Number of observations above which the computation is parallelized.");
+    clfd.def_readonly("dense_leaves_", &RuntimeTreeEnsembleClassifierPFloatDouble::dense_leaves_,
+        "Every leaf holds one weight per class, the weights are stored in a dense table.");
+    clfd.def_readwrite("deterministic_", &RuntimeTreeEnsembleClassifierPFloatDouble::deterministic_,
+        "Sums the trees in blocks of fixed size reduced pairwise, "
+        "the predictions do not depend on the number of threads.");
+    clfd.def_readwrite("profile_", &RuntimeTreeEnsembleClassifierPFloatDouble::profile_,
+        "Counts the visits of every node and the branches taken during the predictions, "
+        "the predictions are slower, see *get_node_counts*.");
+    clfd.def("get_node_counts", &RuntimeTreeEnsembleClassifierPFloatDouble::get_node_counts,
+        "Returns a matrix (n_nodes, 3), visits, true branches, false branches for every node "
+        "in the order of the ONNX attributes (the order of the compact layout "
+        "if the model was restored from a blob), filled when *profile_* is True.");
+    clfd.def("get_hitrates", &RuntimeTreeEnsembleClassifierPFloatDouble::get_hitrates,
+        "Returns the visits of every node divided by the number of profiled observations, "
+        "it can be used as attribute *nodes_hitrates* to reorder the nodes.");
+    clfd.def("reset_node_counts", &RuntimeTreeEnsembleClassifierPFloatDouble::reset_node_counts,
+        "Resets the counters filled when *profile_* is True.");
+    clfd.def_readwrite("tile_N_", &RuntimeTreeEnsembleClassifierPFloatDouble::tile_N_,
+        "Number of observations every tree is evaluated for before moving to the next tree, "
+        "1 evaluates all trees for one observation at a time.");
+    clfd.def_readwrite("use_simd_", &RuntimeTreeEnsembleClassifierPFloatDouble::use_simd_,
+        "Uses the vectorized traversal (AVX2, AVX-512) when it is available, "
+        "it requires the compact layout (*packed*), float and the same mode for every node, "
+        "``runtime_options()`` tells which instruction set was selected.");
+    clfd.def_readwrite("use_quickscorer_", &RuntimeTreeEnsembleClassifierPFloatDouble::use_quickscorer_,
+        "Evaluates the trees with bitvectors (QuickScorer) if every tree has "
+        "at most 64 leaves and the vectorized traversal, the quantized thresholds "
+        "and the deterministic mode are not used.");
+    clfd.def_readonly("roots_", &RuntimeTreeEnsembleClassifierPFloatDouble::roots_,
+                     "Returns the roots indices.");
+    clfd.def("init", &RuntimeTreeEnsembleClassifierPFloatDouble::init,
+            "Initializes the runtime with the ONNX attributes in alphabetical order.");
+    clfd.def("compute", &RuntimeTreeEnsembleClassifierPFloatDouble::compute_cl,
+            "Computes the predictions for the random forest, X may be C-ordered, "
+            "Fortran-ordered or strided, it is not copied.");
+    clfd.def("compute_npy", &RuntimeTreeEnsembleClassifierPFloatDouble::compute_npy,
+            "Computes the scores of a matrix stored in a .npy file by chunks of "
+            "*chunk_rows* rows (0 for the default) and saves them in another .npy file, "
+            "the labels are saved in file *labels* if it is not empty, "
+            "the next chunk is read while the current one is scored. "
+            "Returns the number of rows.");
+    clfd.def("compute_label", &RuntimeTreeEnsembleClassifierPFloatDouble::compute_label,
+            "Computes the labels only and stops evaluating the trees for an observation "
+            "once the remaining trees cannot change its label (more than two classes). "
+            "Returns the labels and the number of evaluated trees for every observation.");
+    clfd.def("set_early_exit_order", &RuntimeTreeEnsembleClassifierPFloatDouble::set_early_exit_order,
+            "Changes the order in which *compute_label* evaluates the trees, "
+            "an empty list restores the default order (largest range of weights first).");
+    clfd.def_readonly("early_exit_order_", &RuntimeTreeEnsembleClassifierPFloatDouble::early_exit_order_,
+        "Order in which *compute_label* evaluates the trees.");
+    clfd.def("runtime_options", &RuntimeTreeEnsembleClassifierPFloatDouble::runtime_options,
+            "Returns indications about how the runtime was compiled.");
+    clfd.def("omp_get_max_threads", &RuntimeTreeEnsembleClassifierPFloatDouble::omp_get_max_threads,
+            "Returns omp_get_max_threads from openmp library.");
+
+    clfd.def_readonly("base_values_", &RuntimeTreeEnsembleClassifierPFloatDouble::base_values_, "See :ref:`lpyort-TreeEnsembleClassifierDouble`.");
+    clfd.def_readonly("n_classes_", &RuntimeTreeEnsembleClassifierPFloatDouble::n_targets_or_classes_, "See :ref:`lpyort-TreeEnsembleClassifierDouble`.");
+    clfd.def_readonly("post_transform_", &RuntimeTreeEnsembleClassifierPFloatDouble::post_transform_, "See :ref:`lpyort-TreeEnsembleClassifierDouble`.");
+
+    clfd.def("autotune", &RuntimeTreeEnsembleClassifierPFloatDouble::autotune,
+        "Measures the prediction time of sample *X* with several settings "
+        "repeated *repeat* times and keeps the fastest ones in "
+        "*tile_N_*, *omp_tree_*, *omp_N_*, they are saved with the model. "
+        "No other thread may call *compute* until it returns, these "
+        "attributes are modified while the GIL is released.");
+    clfd.def("debug_threshold", &RuntimeTreeEnsembleClassifierPFloatDouble::debug_threshold,
+        "Checks every features against every features against every threshold. Returns a matrix of boolean.");
+    clfd.def("compute_tree_outputs", &RuntimeTreeEnsembleClassifierPFloatDouble::compute_tree_outputs,
+        "Computes every tree output.");
+    clfd.def_readonly("same_mode_", &RuntimeTreeEnsembleClassifierPFloatDouble::same_mode_,
+        "Tells if all nodes applies the same rule for thresholds.");
+    clfd.def_readonly("has_missing_tracks_", &RuntimeTreeEnsembleClassifierPFloatDouble::has_missing_tracks_,
+        "Tells if the model handles missing values.");
+    clfd.def_readonly("packed_", &RuntimeTreeEnsembleClassifierPFloatDouble::packed_,
+        "Tells if the nodes are stored with the compact layout.");
+    clfd.def_readonly("quantized_", &RuntimeTreeEnsembleClassifierPFloatDouble::quantized_,
+        "Tells if batches are evaluated with quantized thresholds.");
+    clfd.def_readonly("load_time_", &RuntimeTreeEnsembleClassifierPFloatDouble::load_time_,
+        "Duration of the last call to *init*, *load* or *deserialize* in seconds.");
+    clfd.def_readonly("node_order_", &RuntimeTreeEnsembleClassifierPFloatDouble::node_order_,
+        "Tells how the nodes were reordered after loading the model, "
+        "``HITRATES`` (most probable child next to its parent) or ``BFS`` (breadth-first).");
+    clfd.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleClassifierPFloatDouble::get_nodes_modes,
+        "Returns the mode for every node.");
+    clfd.def("__sizeof__", &RuntimeTreeEnsembleClassifierPFloatDouble::get_sizeof,
+        "Returns the size of the object.");
+    clfd.def("serialize", &RuntimeTreeEnsembleClassifierPFloatDouble::serialize,
+        "Returns the model stored with the compact layout as a binary blob, "
+        "the bitvector evaluation and the quantized thresholds are built again "
+        "when the blob is loaded.");
+    clfd.def("deserialize", &RuntimeTreeEnsembleClassifierPFloatDouble::deserialize,
+        "Restores a model from a blob returned by *serialize*.");
+    clfd.def("save", &RuntimeTreeEnsembleClassifierPFloatDouble::save,
+        "Saves the blob returned by *serialize* into a file.");
+    clfd.def("load", &RuntimeTreeEnsembleClassifierPFloatDouble::load,
+        "Maps a file created by *save* in memory and uses it without copying it, "
+        "processes loading the same file share the same memory.");
 }
 
 #endif
@@ -4,6 +4,20 @@
 // https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_regressor.cc.
 
 #include "op_tree_ensemble_common_p_agg_.hpp"
+#include "op_tree_ensemble_common_p_kernel_.hpp"
+#include "op_tree_ensemble_common_p_simd_.hpp"
+#include "op_tree_ensemble_common_p_qs_.hpp"
+#include "op_tree_ensemble_common_p_quant_.hpp"
+#include "op_tree_ensemble_common_p_blob_.hpp"
+#include "op_tree_ensemble_common_p_stream_.hpp"
+#include "op_common_thread_pool_.hpp"
+#include <deque>
+#include <future>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
 
 #if USE_OPENMP
 #include <omp.h>
@@ -11,15 +25,211 @@
 #define omp_get_thread_num() 0
 #endif
 
+// number of tasks per thread when trees are split into blocks,
+// more tasks than threads let the pool balance the load
+#define TREE_TASKS_PER_THREAD 4
+
+// number of trees of a block in deterministic mode
+#define TREE_DETERMINISTIC_BLOCK 16
+
 // https://cims.nyu.edu/~stadler/hpc17/material/ompLec.pdf
 // http://amestoy.perso.enseeiht.fr/COURS/CoursMulticoreProgrammingButtari.pdf
 
 
 /**
-* This classes parallelizes itself the computation,
-* it keeps buffer for every thread it generates. Calling
-* the same compute function from different thread will
-* cause computation errors. The class is not thread safe.
+* Readers-writer lock (C++11 has no shared_mutex). The compute
+* functions hold it shared, autotune holds it exclusively while
+* it changes the parallelization parameters.
+*/
+class TreeEnsembleSettingsLock {
+    public:
+
+        TreeEnsembleSettingsLock() : readers_(0), writer_(false) {}
+
+        void lock_shared() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (writer_)
+                cond_.wait(lock);
+            ++readers_;
+        }
+
+        void unlock_shared() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --readers_;
+            }
+            cond_.notify_all();
+        }
+
+        void lock() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (writer_)
+                cond_.wait(lock);
+            writer_ = true;
+            while (readers_ > 0)
+                cond_.wait(lock);
+        }
+
+        void unlock() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                writer_ = false;
+            }
+            cond_.notify_all();
+        }
+
+        class Shared {
+            public:
+                Shared(TreeEnsembleSettingsLock& settings) : settings_(settings) {
+                    settings_.lock_shared();
+                }
+                ~Shared() { settings_.unlock_shared(); }
+            private:
+                TreeEnsembleSettingsLock& settings_;
+        };
+
+    private:
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        int readers_;
+        bool writer_;
+};
+
+
+/**
+* Buffers used while computing the predictions. Every thread
+* owns its own buffers, they are shared by all models
+* and only grow.
+*/
+template<typename NTYPE>
+struct TreeEnsembleScratch {
+    std::vector<NTYPE> scores;
+    std::vector<unsigned char> has_scores;
+    std::vector<NTYPE> tile_scores;
+    std::vector<unsigned char> tile_has_scores;
+    std::vector<NTYPE> block_scores;
+    std::vector<unsigned char> block_has_scores;
+    // add_second_class of every row of a tile, see write_scores_batch
+    std::vector<int> add_second_class;
+    // rows converted into NTYPE when the input type is different
+    std::vector<NTYPE> inputs;
+    // features of a tile replaced by their bins (quantized trees)
+    std::vector<uint8_t> bins8;
+    std::vector<uint16_t> bins16;
+    // exit leaves of every tree for one row (QuickScorer)
+    std::vector<uint64_t> bitvectors;
+
+    static TreeEnsembleScratch<NTYPE>& get() {
+        static thread_local TreeEnsembleScratch<NTYPE> scratch;
+        return scratch;
+    }
+
+    inline std::vector<uint8_t>& bins(uint8_t) { return bins8; }
+    inline std::vector<uint16_t>& bins(uint16_t) { return bins16; }
+
+    // resizes both buffers and sets them to zero
+    static inline void reset(std::vector<NTYPE>& values,
+                             std::vector<unsigned char>& has_values, size_t n) {
+        values.resize(n);
+        has_values.resize(n);
+        std::fill(values.begin(), values.end(), (NTYPE)0);
+        std::fill(has_values.begin(), has_values.end(), 0);
+    }
+};
+
+
+/**
+* Features given to the compute functions, feature j of row i is
+* data[i * row_stride + j * col_stride], strides are expressed in elements.
+* C-ordered, Fortran-ordered or strided matrices are used without
+* being copied.
+*/
+template<typename XTYPE>
+struct TreeInput {
+    const XTYPE* data;
+    int64_t n_cols;
+    int64_t row_stride;
+    int64_t col_stride;
+
+    TreeInput(const XTYPE* data_, int64_t n_cols_) :
+        data(data_), n_cols(n_cols_), row_stride(n_cols_), col_stride(1) {}
+    TreeInput(const XTYPE* data_, int64_t n_cols_, int64_t row_stride_, int64_t col_stride_) :
+        data(data_), n_cols(n_cols_), row_stride(row_stride_), col_stride(col_stride_) {}
+};
+
+
+template<typename XTYPE>
+TreeInput<XTYPE> tree_input(const py::array_t<XTYPE>& X, const std::vector<int64_t>& x_dims) {
+    if (X.strides(0) % (ssize_t)sizeof(XTYPE) != 0 || X.strides(1) % (ssize_t)sizeof(XTYPE) != 0)
+        throw std::runtime_error("X strides must be a multiple of the size of its type.");
+    return TreeInput<XTYPE>(X.data(0), x_dims[1],
+                            (int64_t)X.strides(0) / (int64_t)sizeof(XTYPE),
+                            (int64_t)X.strides(1) / (int64_t)sizeof(XTYPE));
+}
+
+
+/**
+* Copies rows [begin, end[ into *buffer* with a C order. If the matrix
+* is column-major, every feature is read as a contiguous run of rows
+* and scattered into the rows of the tile.
+*/
+template<typename NTYPE, typename XTYPE>
+inline void tree_gather_rows(const TreeInput<XTYPE>& input, int64_t begin, int64_t end,
+                             std::vector<NTYPE>& buffer) {
+    int64_t n_cols = input.n_cols;
+    buffer.resize((end - begin) * n_cols);
+    NTYPE* dest = buffer.data();
+    if (input.col_stride == 1) {
+        const XTYPE* row = input.data + begin * input.row_stride;
+        for (int64_t i = begin; i < end; ++i, row += input.row_stride, dest += n_cols)
+            std::copy(row, row + n_cols, dest);
+        return;
+    }
+    const XTYPE* col = input.data + begin * input.row_stride;
+    for (int64_t j = 0; j < n_cols; ++j, col += input.col_stride) {
+        const XTYPE* x = col;
+        NTYPE* d = dest + j;
+        for (int64_t i = begin; i < end; ++i, x += input.row_stride, d += n_cols)
+            *d = (NTYPE)*x;
+    }
+}
+
+
+/**
+* Returns rows [begin, end[ of the input and sets *stride* to the distance
+* between two consecutive rows. The trees compare features and thresholds
+* with the same type NTYPE, rows of another type (float rows for
+* a double model) or rows whose features are not contiguous
+* (Fortran order) are copied into *buffer* one tile at a time,
+* the whole batch is never copied.
+*/
+template<typename NTYPE>
+inline const NTYPE* tree_input_rows(const TreeInput<NTYPE>& input, int64_t begin, int64_t end,
+                                    std::vector<NTYPE>& buffer, int64_t& stride) {
+    if (input.col_stride == 1) {
+        stride = input.row_stride;
+        return input.data + begin * input.row_stride;
+    }
+    stride = input.n_cols;
+    tree_gather_rows(input, begin, end, buffer);
+    return buffer.data();
+}
+
+
+template<typename NTYPE, typename XTYPE>
+inline const NTYPE* tree_input_rows(const TreeInput<XTYPE>& input, int64_t begin, int64_t end,
+                                    std::vector<NTYPE>& buffer, int64_t& stride) {
+    stride = input.n_cols;
+    tree_gather_rows(input, begin, end, buffer);
+    return buffer.data();
+}
+
+
+/**
+* This classes parallelizes itself the computation.
+* The model is not modified by the compute functions,
+* they can be called from different threads at the same time.
 */
 template<typename NTYPE>
 class RuntimeTreeEnsembleCommonP
@@ -41,11 +251,73 @@ class RuntimeTreeEnsembleCommonP
         bool has_missing_tracks_;
         int omp_tree_;
         int omp_N_;
+        int tile_N_;
         int64_t sizeof_;
+        std::string node_order_;
+        // mode every traversal is specialized for, TREE_MODE_MIXED if nodes
+        // do not share the same mode
+        int kernel_mode_;
+
+        // compact layout, nodes_ and roots_ are empty if packed_ is true,
+        // the arrays are owned by the class or memory mapped (see load)
+        bool packed_;
+        TreeArrayView<TreeNodeElementPacked<NTYPE>> packed_nodes_;
+        TreeArrayView<uint32_t> packed_roots_;
+        TreeArrayView<SparseValue<NTYPE>> leaf_weights_;
+
+        // vectorized traversal, only available with the compact layout
+        bool use_simd_;
+        int simd_level_;
+        NODE_MODE simd_mode_;
+
+        // every leaf holds one weight per class, the weights are stored
+        // in a matrix (n_leaves, n_classes), a leaf points to its row
+        // (truenode for the compact layout, dense_offset otherwise)
+        bool dense_leaves_;
+        std::vector<NTYPE> dense_weights_;
+
+        // bitvector evaluation, only built for trees with less than 64 leaves,
+        // it evaluates all trees at once and is not used in deterministic mode
+        // which sums the trees by blocks (see get_tree_blocks)
+        bool use_quickscorer_;
+        TreeEnsembleQuickScorer<NTYPE> quickscorer_;
+
+        // quantized thresholds, batches are converted into ranks
+        bool quantized_;
+        TreeEnsembleQuantized<NTYPE> quantized_forest_;
+
+        // trees are summed in fixed blocks whatever the number of threads,
+        // the blocks are reduced pairwise, results do not depend on the
+        // parallelization
+        bool deterministic_;
+
+        // early exit (see compute_label_agg): order in which the trees
+        // are evaluated, bounds of the sum of the trees remaining after
+        // every position in that order, empty if the labels cannot be
+        // known before all trees are evaluated
+        std::vector<int64_t> early_exit_order_;
+        std::vector<NTYPE> early_exit_low_;
+        std::vector<NTYPE> early_exit_high_;
+        std::vector<NTYPE> early_exit_slack_;
+        // smallest and largest weight of every tree for every class
+        std::vector<NTYPE> tree_min_weights_;
+        std::vector<NTYPE> tree_max_weights_;
+
+        // profiling, the predictions go through a dedicated traversal
+        // counting the visits of every node, the other traversals are
+        // not instrumented
+        bool profile_;
+        // position of every node in the ONNX attributes,
+        // empty if the model was loaded from a blob
+        std::vector<uint32_t> node_positions_;
+
+        // duration of the last initialization in seconds
+        double load_time_;
 
     public:
 
-        RuntimeTreeEnsembleCommonP(int omp_tree, int omp_N);
+        RuntimeTreeEnsembleCommonP(int omp_tree, int omp_N, bool packed = false,
+                                   bool quantized = false);
         ~RuntimeTreeEnsembleCommonP();
 
         void init(
@@ -86,13 +358,54 @@ class RuntimeTreeEnsembleCommonP
             const std::vector<int64_t>& target_class_treeids,
             const std::vector<NTYPE>& target_class_weights);
 
+        void init_p(
+            const std::string &aggregate_function,
+            const NTYPE* base_values, int64_t n_base_values,
+            int64_t n_targets_or_classes,
+            int64_t n_nodes,
+            const int64_t* nodes_falsenodeids,
+            const int64_t* nodes_featureids,
+            const NTYPE* nodes_hitrates, int64_t n_hitrates,
+            const int64_t* nodes_missing_value_tracks_true, int64_t n_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            const int64_t* nodes_nodeids,
+            const int64_t* nodes_treeids,
+            const int64_t* nodes_truenodeids,
+            const NTYPE* nodes_values,
+            const std::string& post_transform,
+            int64_t n_weights,
+            const int64_t* target_class_ids,
+            const int64_t* target_class_nodeids,
+            const int64_t* target_class_treeids,
+            const NTYPE* target_class_weights);
+
         TreeNodeElement<NTYPE> * ProcessTreeNodeLeave(
             TreeNodeElement<NTYPE> * root, const NTYPE* x_data) const;
 
+        const TreeNodeElementPacked<NTYPE> * ProcessTreeNodeLeavePacked(
+            const TreeNodeElementPacked<NTYPE> * root, const NTYPE* x_data) const;
+
+        template<typename AGG>
+        inline void ProcessTreePrediction1(
+            const AGG &agg, int64_t j, const NTYPE* x_data,
+            NTYPE* predictions, unsigned char* has_predictions) const;
+
+        template<typename AGG>
+        inline void ProcessTreePrediction(
+            const AGG &agg, int64_t j, const NTYPE* x_data,
+            NTYPE* predictions, unsigned char* has_predictions) const;
+
+        inline const NTYPE* dense_leaf_weights(int64_t j, const NTYPE* x_data) const;
+
         std::string runtime_options();
         std::vector<std::string> get_nodes_modes() const;
 
-        int omp_get_max_threads();
+        py::bytes serialize() const;
+        void deserialize(py::bytes blob);
+        void save(const std::string& filename) const;
+        void load(const std::string& filename);
+
+        int omp_get_max_threads() const;
         int64_t get_sizeof();
 
         template<typename AGG>
@@ -100,37 +413,185 @@ class RuntimeTreeEnsembleCommonP
         
         py::array_t<int> debug_threshold(py::array_t<NTYPE> values) const;
 
-        // The two following methods uses buffers to avoid
-        // spending time allocating buffers. As a consequence,
-        // These methods are not thread-safe.
+        // Measures the prediction time of a sample on this machine and
+        // updates tile_N_, omp_tree_, omp_N_. The compute functions called
+        // by other threads wait for it to return (see settings_lock_).
+        void autotune(py::array_t<NTYPE> X, int repeat);
+
+        // The two following methods use buffers local to the calling thread
+        // (see TreeEnsembleScratch), they are thread-safe.
+        // X may be float for a double model, scores are still
+        // accumulated with NTYPE, X may be column-major or strided
+        // (see tree_input_rows).
+        template<typename AGG, typename XTYPE>
+        py::array_t<NTYPE> compute_agg(py::array_t<XTYPE> X, const AGG &agg) const;
+
+        template<typename AGG, typename XTYPE>
+        py::tuple compute_cl_agg(py::array_t<XTYPE> X, const AGG &agg) const;
+
+        // Only computes the labels, the trees are evaluated in the order
+        // early_exit_order_ until the label cannot change anymore.
+        // The labels are the labels of compute when it does not split
+        // the trees between threads or in deterministic mode.
+        // Returns the labels and the number of evaluated trees for every row.
+        template<typename AGG, typename XTYPE>
+        py::tuple compute_label_agg(py::array_t<XTYPE> X, const AGG &agg) const;
+
+        // Scores a 2D array stored in a .npy file by chunks of *chunk_rows*
+        // rows and writes the scores in another .npy file, the next chunk
+        // is read and the previous scores are written while the current
+        // chunk is scored. *labels* is NULL for a regressor, the labels
+        // are saved if it is not empty. Returns the number of rows.
+        template<typename AGG, typename XTYPE>
+        int64_t compute_npy_agg(const std::string& input, const std::string& output,
+                                const std::string* labels, int64_t chunk_rows,
+                                const AGG &agg) const;
+
+        // Changes the order used by compute_label_agg, an empty order
+        // evaluates first the trees with the largest range of weights,
+        // not thread-safe.
+        void set_early_exit_order(const std::vector<int64_t>& order);
+
+        // Counters filled when profile_ is true, nodes follow the order
+        // of the ONNX attributes. get_node_counts returns a matrix
+        // (n_nodes, 3): visits, true branches, false branches.
+        // get_hitrates returns the visits divided by the number
+        // of profiled observations, it can replace nodes_hitrates.
+        py::array_t<int64_t> get_node_counts() const;
+        py::array_t<NTYPE> get_hitrates() const;
+        void reset_node_counts();
+
+    private :
+
+        void reorder_nodes(bool use_hitrates);
+        int64_t get_tile_size(int64_t N) const;
+        int64_t get_tree_blocks(int64_t n_tiles, int64_t stride) const;
+        int64_t get_simd_width(int64_t stride) const;
+        void select_simd();
+        void select_kernels();
+        bool can_pack() const;
+        void pack_nodes();
+        void build_dense_leaves();
+        void build_early_exit();
+        void fill_packed(std::vector<TreeNodeElementPacked<NTYPE>>& packed_nodes,
+                         std::vector<uint32_t>& packed_roots,
+                         std::vector<SparseValue<NTYPE>>& leaf_weights) const;
+        void unpack_nodes(std::vector<TreeNodeElement<NTYPE>>& nodes,
+                          std::vector<TreeNodeElement<NTYPE>*>& roots) const;
+
+        template<typename AGG, typename XTYPE>
+        void compute_gil_free(int64_t N, const TreeInput<XTYPE>& input,
+                              NTYPE* z_data, int64_t* y_data, const AGG &agg) const;
+
+        template<typename AGG, typename XTYPE>
+        void compute_gil_free_profile(int64_t N, const TreeInput<XTYPE>& input,
+                                      NTYPE* z_data, int64_t* y_data, const AGG &agg) const;
+        int64_t node_position(int64_t i) const;
+
+        // The tile kernels add the predictions of trees [tree_begin, tree_end[
+        // for rows [begin, end[ to scores, the caller finalizes them.
+        template<typename AGG, int MODE, bool MISSING, bool PACKED>
+        void compute_gil_free_tile1(const AGG &agg, int64_t begin, int64_t end,
+                                    int64_t tree_begin, int64_t tree_end,
+                                    const NTYPE* x_data, int64_t stride,
+                                    NTYPE* scores, unsigned char* has_scores) const;
+
+        template<typename AGG, int MODE, bool MISSING, bool PACKED>
+        void compute_gil_free_tile(const AGG &agg, int64_t begin, int64_t end,
+                                   int64_t tree_begin, int64_t tree_end,
+                                   const NTYPE* x_data, int64_t stride,
+                                   NTYPE* tile_scores, unsigned char* tile_has_scores) const;
+
         template<typename AGG>
-        py::array_t<NTYPE> compute_agg(py::array_t<NTYPE> X, const AGG &agg);
+        void reduce_blocks(const AGG &agg, int64_t n_blocks, int64_t block_stride,
+                           int64_t n, NTYPE* scores, unsigned char* has_scores) const;
 
         template<typename AGG>
-        py::tuple compute_cl_agg(py::array_t<NTYPE> X, const AGG &agg);
+        void finalize_tile(const AGG &agg, int64_t begin, int64_t end,
+                           NTYPE* tile_scores, unsigned char* tile_has_scores,
+                           NTYPE* z_data, int64_t* y_data,
+                           std::vector<int>& add_second_class) const;
 
-    private :
+        // kernels specialized for the mode, the missing tracks and the layout
+        template<typename AGG>
+        using tile_kernel = void (RuntimeTreeEnsembleCommonP<NTYPE>::*)(
+            const AGG&, int64_t, int64_t, int64_t, int64_t, const NTYPE*, int64_t,
+            NTYPE*, unsigned char*) const;
+
+        template<typename AGG, typename QTYPE, int MODE, bool MISSING>
+        void compute_quantized_tile1(const AGG &agg, int64_t n,
+                                     int64_t tree_begin, int64_t tree_end,
+                                     const NTYPE* x_data, int64_t stride,
+                                     NTYPE* scores, unsigned char* has_scores) const;
+
+        template<typename AGG, typename QTYPE, int MODE, bool MISSING>
+        void compute_quantized_tile(const AGG &agg, int64_t n,
+                                    int64_t tree_begin, int64_t tree_end,
+                                    const NTYPE* x_data, int64_t stride,
+                                    NTYPE* scores, unsigned char* has_scores) const;
 
         template<typename AGG>
-        void compute_gil_free(const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
-                              const py::array_t<NTYPE>& X, py::array_t<NTYPE>& Z,
-                              py::array_t<int64_t>* Y, const AGG &agg);
+        tile_kernel<AGG> select_tile_kernel() const;
+
+        TreeNodeElement<NTYPE> * (*find_leave_)(
+            TreeNodeElement<NTYPE> *, const NTYPE*);
+        const TreeNodeElementPacked<NTYPE> * (*find_leave_packed_)(
+            const TreeNodeElementPacked<NTYPE> *,
+            const TreeNodeElementPacked<NTYPE> *, const NTYPE*);
     
+    protected:
+
+        // *class_labels* is NULL for a regressor
+        std::string to_blob(const std::vector<int64_t>* class_labels,
+                            bool binary_case, bool weights_are_all_positive) const;
+        void load_blob(const char* data, int64_t size, std::vector<int64_t>* class_labels,
+                       bool* binary_case, bool* weights_are_all_positive);
+        void deserialize_blob(py::bytes blob, std::vector<int64_t>* class_labels,
+                              bool* binary_case, bool* weights_are_all_positive);
+        void load_file(const std::string& filename, std::vector<int64_t>* class_labels,
+                       bool* binary_case, bool* weights_are_all_positive);
+        static void save_blob(const std::string& filename, const std::string& blob);
+
     private:
-        // buffers, mutable
-        std::vector<NTYPE> _scores_t_tree;
-        std::vector<unsigned char> _has_scores_t_tree;
-    
-        std::vector<std::vector<NTYPE>> _scores_classes;
-        std::vector<std::vector<unsigned char>> _has_scores_classes;
+        // storage of the compact layout
+        std::vector<TreeNodeElementPacked<NTYPE>> packed_nodes_data_;
+        std::vector<uint32_t> packed_roots_data_;
+        std::vector<SparseValue<NTYPE>> leaf_weights_data_;
+        std::vector<int64_t> blob_data_;
+        std::unique_ptr<TreeEnsembleMappedFile> mapped_;
+
+        // visits and true branches of every node, number of profiled
+        // observations, the compute functions update them under profile_mutex_
+        mutable std::vector<int64_t> profile_counts_;
+        mutable int64_t profile_rows_;
+        mutable std::mutex profile_mutex_;
+
+        // held by the compute functions while the GIL is released,
+        // autotune changes omp_tree_, omp_N_, tile_N_ holding it exclusively
+        mutable TreeEnsembleSettingsLock settings_lock_;
 };
 
 
 template<typename NTYPE>
-RuntimeTreeEnsembleCommonP<NTYPE>::RuntimeTreeEnsembleCommonP(int omp_tree, int omp_N) {
+RuntimeTreeEnsembleCommonP<NTYPE>::RuntimeTreeEnsembleCommonP(
+        int omp_tree, int omp_N, bool packed, bool quantized) {
     omp_tree_ = omp_tree;
     omp_N_ = omp_N;
+    tile_N_ = 16;
+    packed_ = packed;
+    quantized_ = quantized;
+    use_simd_ = true;
+    simd_level_ = TREE_SIMD_NONE;
+    use_quickscorer_ = true;
+    kernel_mode_ = TREE_MODE_MIXED;
+    find_leave_ = &tree_find_leave<NTYPE, TREE_MODE_MIXED, true>;
+    find_leave_packed_ = &tree_find_leave_packed<NTYPE, TREE_MODE_MIXED, true>;
     nodes_ = NULL;
+    dense_leaves_ = false;
+    deterministic_ = false;
+    profile_ = false;
+    profile_rows_ = 0;
+    load_time_ = 0;
 }
 
 
@@ -147,12 +608,28 @@ std::string RuntimeTreeEnsembleCommonP<NTYPE>::runtime_options() {
 #ifdef USE_OPENMP
     res += "OPENMP";
 #endif
+    if (use_simd_ && simd_level_ != TREE_SIMD_NONE) {
+        if (!res.empty())
+            res += " ";
+        res += tree_simd_name(simd_level_);
+    }
+    else if (use_quickscorer_ && quickscorer_.n_trees_ > 0 &&
+             !quantized_ && !deterministic_) {
+        if (!res.empty())
+            res += " ";
+        res += "QUICKSCORER";
+    }
+    if (quantized_) {
+        if (!res.empty())
+            res += " ";
+        res += quantized_forest_.bits_ == 8 ? "QUANTIZED8" : "QUANTIZED16";
+    }
     return res;
 }
 
 
 template<typename NTYPE>
-int RuntimeTreeEnsembleCommonP<NTYPE>::omp_get_max_threads() {
+int RuntimeTreeEnsembleCommonP<NTYPE>::omp_get_max_threads() const {
 #if USE_OPENMP
     return ::omp_get_max_threads();
 #else
@@ -167,6 +644,30 @@ int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_sizeof() {
 }
 
 
+/**
+* Returns a pointer on the data of an attribute without copying it,
+* NULL if the array is empty. *expected* is the expected number
+* of elements or -1 if any size is allowed.
+*/
+template<typename T>
+const T* tree_array_buffer(const py::array_t<T>& arr, int64_t expected, const char* name) {
+    if (expected >= 0 && arr.size() != expected) {
+        char buffer[1000];
+        sprintf(buffer, "Attribute %s has %d elements but %d are expected.",
+                name, (int)arr.size(), (int)expected);
+        throw std::runtime_error(buffer);
+    }
+    if (arr.size() == 0)
+        return NULL;
+    if (arr.ndim() == 1 && arr.size() > 1 && arr.strides(0) != (ssize_t)sizeof(T)) {
+        char buffer[1000];
+        sprintf(buffer, "Attribute %s must be contiguous.", name);
+        throw std::runtime_error(buffer);
+    }
+    return arr.data(0);
+}
+
+
 template<typename NTYPE>
 void RuntimeTreeEnsembleCommonP<NTYPE>::init(
             const std::string &aggregate_function,
@@ -187,49 +688,31 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init(
             py::array_t<int64_t> target_class_treeids,
             py::array_t<NTYPE> target_class_weights) {
 
-    std::vector<NTYPE> cbasevalues;
-    array2vector(cbasevalues, base_values, NTYPE);
-
-    std::vector<int64_t> tnodes_treeids;
-    std::vector<int64_t> tnodes_nodeids;
-    std::vector<int64_t> tnodes_featureids;
-    std::vector<NTYPE> tnodes_values;
-    std::vector<NTYPE> tnodes_hitrates;
-    std::vector<int64_t> tnodes_truenodeids;
-    std::vector<int64_t> tnodes_falsenodeids;
-    std::vector<int64_t> tmissing_tracks_true;
-
-    array2vector(tnodes_falsenodeids, nodes_falsenodeids, int64_t);
-    array2vector(tnodes_featureids, nodes_featureids, int64_t);
-    array2vector(tnodes_hitrates, nodes_hitrates, NTYPE);
-    array2vector(tmissing_tracks_true, nodes_missing_value_tracks_true, int64_t);
-    array2vector(tnodes_truenodeids, nodes_truenodeids, int64_t);
-    //nodes_modes_names_ = nodes_modes;
-    array2vector(tnodes_nodeids, nodes_nodeids, int64_t);
-    array2vector(tnodes_treeids, nodes_treeids, int64_t);
-    array2vector(tnodes_truenodeids, nodes_truenodeids, int64_t);
-    array2vector(tnodes_values, nodes_values, NTYPE);
-    array2vector(tnodes_truenodeids, nodes_truenodeids, int64_t);
-
-    std::vector<int64_t> ttarget_class_nodeids;
-    std::vector<int64_t> ttarget_class_treeids;
-    std::vector<int64_t> ttarget_class_ids;
-    std::vector<NTYPE> ttarget_class_weights;
-    
-    array2vector(ttarget_class_ids, target_class_ids, int64_t);
-    array2vector(ttarget_class_nodeids, target_class_nodeids, int64_t);
-    array2vector(ttarget_class_treeids, target_class_treeids, int64_t);
-    array2vector(ttarget_class_weights, target_class_weights, NTYPE);
-    
-    init_c(aggregate_function, cbasevalues, n_targets_or_classes,
-           tnodes_falsenodeids, tnodes_featureids, tnodes_hitrates,
-           tmissing_tracks_true, nodes_modes,
-           tnodes_nodeids, tnodes_treeids, tnodes_truenodeids,
-           tnodes_values, post_transform, ttarget_class_ids,
-           ttarget_class_nodeids, ttarget_class_treeids,
-           ttarget_class_weights);
-}    
-    
+    int64_t n_nodes = nodes_treeids.size();
+    int64_t n_weights = target_class_nodeids.size();
+    init_p(aggregate_function,
+           tree_array_buffer(base_values, -1, "base_values"), base_values.size(),
+           n_targets_or_classes, n_nodes,
+           tree_array_buffer(nodes_falsenodeids, n_nodes, "nodes_falsenodeids"),
+           tree_array_buffer(nodes_featureids, n_nodes, "nodes_featureids"),
+           tree_array_buffer(nodes_hitrates, -1, "nodes_hitrates"),
+           nodes_hitrates.size(),
+           tree_array_buffer(nodes_missing_value_tracks_true, -1,
+                             "nodes_missing_value_tracks_true"),
+           nodes_missing_value_tracks_true.size(),
+           nodes_modes,
+           tree_array_buffer(nodes_nodeids, n_nodes, "nodes_nodeids"),
+           tree_array_buffer(nodes_treeids, n_nodes, "nodes_treeids"),
+           tree_array_buffer(nodes_truenodeids, n_nodes, "nodes_truenodeids"),
+           tree_array_buffer(nodes_values, n_nodes, "nodes_values"),
+           post_transform, n_weights,
+           tree_array_buffer(target_class_ids, n_weights, "target_class_ids"),
+           tree_array_buffer(target_class_nodeids, n_weights, "target_class_nodeids"),
+           tree_array_buffer(target_class_treeids, n_weights, "target_class_treeids"),
+           tree_array_buffer(target_class_weights, n_weights, "target_class_weights"));
+}
+
+
 template<typename NTYPE>
 void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
             const std::string &aggregate_function,
@@ -249,11 +732,53 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
             const std::vector<int64_t>& target_class_nodeids,
             const std::vector<int64_t>& target_class_treeids,
             const std::vector<NTYPE>& target_class_weights) {
+    init_p(aggregate_function, base_values.data(), base_values.size(),
+           n_targets_or_classes, nodes_treeids.size(),
+           nodes_falsenodeids.data(), nodes_featureids.data(),
+           nodes_hitrates.data(), nodes_hitrates.size(),
+           nodes_missing_value_tracks_true.data(), nodes_missing_value_tracks_true.size(),
+           nodes_modes, nodes_nodeids.data(), nodes_treeids.data(),
+           nodes_truenodeids.data(), nodes_values.data(), post_transform,
+           target_class_nodeids.size(), target_class_ids.data(),
+           target_class_nodeids.data(), target_class_treeids.data(),
+           target_class_weights.data());
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::init_p(
+            const std::string &aggregate_function,
+            const NTYPE* base_values, int64_t n_base_values,
+            int64_t n_targets_or_classes,
+            int64_t n_nodes,
+            const int64_t* nodes_falsenodeids,
+            const int64_t* nodes_featureids,
+            const NTYPE* nodes_hitrates, int64_t n_hitrates,
+            const int64_t* nodes_missing_value_tracks_true, int64_t n_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            const int64_t* nodes_nodeids,
+            const int64_t* nodes_treeids,
+            const int64_t* nodes_truenodeids,
+            const NTYPE* nodes_values,
+            const std::string& post_transform,
+            int64_t n_weights,
+            const int64_t* target_class_ids,
+            const int64_t* target_class_nodeids,
+            const int64_t* target_class_treeids,
+            const NTYPE* target_class_weights) {
+
+    auto start = std::chrono::high_resolution_clock::now();
+    if ((int64_t)nodes_modes.size() != n_nodes) {
+        char buffer[1000];
+        sprintf(buffer, "nodes_modes has %d elements but there are %d nodes.",
+                (int)nodes_modes.size(), (int)n_nodes);
+        throw std::runtime_error(buffer);
+    }
 
     sizeof_ = sizeof(RuntimeTreeEnsembleCommonP<NTYPE>);
     aggregate_function_ = to_AGGREGATE_FUNCTION(aggregate_function);
     post_transform_ = to_POST_EVAL_TRANSFORM(post_transform);
-    base_values_ = base_values;
+    base_values_ = std::vector<NTYPE>(base_values, base_values + n_base_values);
     sizeof_ += sizeof(NTYPE) * base_values_.size();
     n_targets_or_classes_ = n_targets_or_classes;
     max_tree_depth_ = 1000;
@@ -276,86 +801,84 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
     
     // filling nodes
 
-    n_nodes_ = nodes_treeids.size();
+    n_nodes_ = n_nodes;
+    if (nodes_ != NULL)
+        delete [] nodes_;
     nodes_ = new TreeNodeElement<NTYPE>[(int)n_nodes_];
     roots_.clear();
-    std::map<TreeNodeElementId, TreeNodeElement<NTYPE>*> idi;
-    size_t i;
+    TreeNodeIndex idi;
+    int64_t i = idi.init(nodes_treeids, nodes_nodeids, n_nodes_);
+    if (i != -1) {
+        char buffer[1000];
+        sprintf(buffer, "Node %d in tree %d is already there.",
+                (int)nodes_nodeids[i], (int)nodes_treeids[i]);
+        throw std::runtime_error(buffer);
+    }
 
-    for (i = 0; i < nodes_treeids.size(); ++i) {
+    for (i = 0; i < n_nodes_; ++i) {
         TreeNodeElement<NTYPE> * node = nodes_ + i;
         node->id.tree_id = (int)nodes_treeids[i];
         node->id.node_id = (int)nodes_nodeids[i];
         node->feature_id = (int)nodes_featureids[i];
         node->value = nodes_values[i];
-        node->hitrates = i < nodes_hitrates.size() ? nodes_hitrates[i] : -1;
+        node->hitrates = i < n_hitrates ? nodes_hitrates[i] : -1;
         node->mode = cmodes[i];
         node->is_not_leave = node->mode != NODE_MODE::LEAF;
         node->truenode = NULL; // nodes_truenodeids[i];
         node->falsenode = NULL; // nodes_falsenodeids[i];
-        node->missing_tracks = i < (size_t)nodes_missing_value_tracks_true.size()
+        node->missing_tracks = i < n_missing_value_tracks_true
                                     ? (nodes_missing_value_tracks_true[i] == 1 
                                             ? MissingTrack::TRUE : MissingTrack::FALSE)
                                     : MissingTrack::NONE;
         node->is_missing_track_true = node->missing_tracks == MissingTrack::TRUE;
-        if (idi.find(node->id) != idi.end()) {
-            char buffer[1000];
-            sprintf(buffer, "Node %d in tree %d is already there.",
-                    (int)node->id.node_id, (int)node->id.tree_id);
-            throw std::runtime_error(buffer);
-        }
-        idi.insert(std::pair<TreeNodeElementId, TreeNodeElement<NTYPE>*>(node->id, node));
+        node->dense_offset = -1;
         sizeof_ += node->get_sizeof();
     }
 
-    TreeNodeElementId coor;
+    int64_t found;
+    int node_id;
     TreeNodeElement<NTYPE> * it;
-    for(i = 0; i < (size_t)n_nodes_; ++i) {
+    for(i = 0; i < n_nodes_; ++i) {
         it = nodes_ + i;
         if (!it->is_not_leave)
             continue;
-        coor.tree_id = it->id.tree_id;
-        coor.node_id = (int)nodes_truenodeids[i];
-
-        auto found = idi.find(coor);
-        if (found == idi.end()) {
+        node_id = (int)nodes_truenodeids[i];
+        found = idi.find(it->id.tree_id, node_id);
+        if (found == -1) {
             char buffer[1000];
             sprintf(buffer, "Unable to find node %d-%d (truenode).",
-                    (int)coor.tree_id, (int)coor.node_id);
+                    (int)it->id.tree_id, node_id);
             throw std::runtime_error(buffer);
         }
-        if (coor.node_id >= 0 && coor.node_id < n_nodes_) {
-            it->truenode = found->second;
-            if ((it->truenode->id.tree_id != it->id.tree_id) ||
-                (it->truenode->id.node_id == it->id.node_id)) {
+        if (node_id >= 0 && node_id < n_nodes_) {
+            it->truenode = nodes_ + found;
+            if (it->truenode->id.node_id == it->id.node_id) {
                 char buffer[1000];
                 sprintf(
                     buffer,
                     "truenode [%d] is pointing either to itself [node id=%d], either to another tree [%d!=%d-%d].",
                     (int)i, (int)it->id.node_id, (int)it->id.tree_id,
-                    (int)it->truenode->id.tree_id, (int)it->truenode->id.tree_id);
+                    (int)it->truenode->id.tree_id, (int)it->truenode->id.node_id);
                 throw std::runtime_error(buffer);
             }
         }
         else it->truenode = NULL;
 
-        coor.node_id = (int)nodes_falsenodeids[i];
-        found = idi.find(coor);
-        if (found == idi.end()) {
+        node_id = (int)nodes_falsenodeids[i];
+        found = idi.find(it->id.tree_id, node_id);
+        if (found == -1) {
             char buffer[1000];
             sprintf(buffer, "Unable to find node %d-%d (falsenode).",
-                    (int)coor.tree_id, (int)coor.node_id);
+                    (int)it->id.tree_id, node_id);
             throw std::runtime_error(buffer);
         }
-        if (coor.node_id >= 0 && coor.node_id < n_nodes_) {
-            it->falsenode = found->second;
-            if ((it->falsenode->id.tree_id != it->id.tree_id) ||
-                (it->falsenode->id.node_id == it->id.node_id )) {
-                throw std::runtime_error("One falsenode is pointing either to itself, either to another tree.");
+        if (node_id >= 0 && node_id < n_nodes_) {
+            it->falsenode = nodes_ + found;
+            if (it->falsenode->id.node_id == it->id.node_id) {
                 char buffer[1000];
                 sprintf(buffer, "falsenode [%d] is pointing either to itself [node id=%d], either to another tree [%d!=%d-%d].",
                     (int)i, (int)it->id.node_id, (int)it->id.tree_id,
-                    (int)it->falsenode->id.tree_id, (int)it->falsenode->id.tree_id);
+                    (int)it->falsenode->id.tree_id, (int)it->falsenode->id.node_id);
                 throw std::runtime_error(buffer);
             }
         }
@@ -363,96 +886,818 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
     }
     
     int64_t previous = -1;
-    for(i = 0; i < (size_t)n_nodes_; ++i) {
+    for(i = 0; i < n_nodes_; ++i) {
         if ((previous == -1) || (previous != nodes_[i].id.tree_id))
             roots_.push_back(nodes_ + i);
         previous = nodes_[i].id.tree_id;
     }
 
-    TreeNodeElementId ind;
     SparseValue<NTYPE> w;
-    for (i = 0; i < target_class_nodeids.size(); i++) {
-        ind.tree_id = (int)target_class_treeids[i];
-        ind.node_id = (int)target_class_nodeids[i];
-        if (idi.find(ind) == idi.end()) {
+    for (i = 0; i < n_weights; i++) {
+        found = idi.find(target_class_treeids[i], target_class_nodeids[i]);
+        if (found == -1) {
             char buffer[1000];
-            sprintf(buffer, "Unable to find node %d-%d (weights).", (int)coor.tree_id, (int)coor.node_id);
+            sprintf(buffer, "Unable to find node %d-%d (weights).",
+                    (int)target_class_treeids[i], (int)target_class_nodeids[i]);
             throw std::runtime_error(buffer);
         }
         w.i = target_class_ids[i];
         w.value = target_class_weights[i];
-        idi[ind]->weights.push_back(w);
+        nodes_[found].weights.push_back(w);
     }
 
     n_trees_ = roots_.size();
     has_missing_tracks_ = false;
-    for (auto it = nodes_missing_value_tracks_true.cbegin();
-         it != nodes_missing_value_tracks_true.cend(); ++it) {
-        if (*it) {
+    for (i = 0; i < n_missing_value_tracks_true; ++i) {
+        if (nodes_missing_value_tracks_true[i]) {
             has_missing_tracks_ = true;
             break;
         }
     }
     sizeof_ += sizeof(TreeNodeElement<NTYPE>) * roots_.size();
 
-    if (n_targets_or_classes_ == 1) {
-        _scores_t_tree.resize(n_trees_);
-        _has_scores_t_tree.resize(n_trees_);
+    bool use_hitrates = n_hitrates == n_nodes_;
+    reorder_nodes(use_hitrates);
+    reset_node_counts();
+    if (quickscorer_.init(roots_, same_mode_, has_missing_tracks_))
+        sizeof_ += quickscorer_.get_sizeof();
+    if (quantized_) {
+        // falls back to the float comparisons if thresholds cannot be quantized
+        quantized_ = quantized_forest_.init(nodes_, n_nodes_, roots_);
+        sizeof_ += quantized_forest_.get_sizeof();
+    }
+
+    if (packed_)
+        pack_nodes();
+    build_dense_leaves();
+    build_early_exit();
+    select_kernels();
+    select_simd();
+
+    load_time_ = std::chrono::duration<double>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::reorder_nodes(bool use_hitrates) {
+    // Nodes are laid out tree by tree. With hitrates, a depth-first
+    // walk places the most probable child right after its parent,
+    // otherwise the walk is breadth-first.
+    node_order_ = use_hitrates ? "HITRATES" : "BFS";
+    std::vector<int64_t> new_index(n_nodes_, -1);
+    std::vector<TreeNodeElement<NTYPE>*> order;
+    order.reserve(n_nodes_);
+    std::deque<TreeNodeElement<NTYPE>*> pending;
+    TreeNodeElement<NTYPE> * node;
+    TreeNodeElement<NTYPE> * first;
+    TreeNodeElement<NTYPE> * second;
+
+    for (auto it = roots_.begin(); it != roots_.end(); ++it) {
+        pending.push_back(*it);
+        while (!pending.empty()) {
+            if (use_hitrates) {
+                node = pending.back();
+                pending.pop_back();
+            }
+            else {
+                node = pending.front();
+                pending.pop_front();
+            }
+            if (node == NULL || new_index[node - nodes_] != -1)
+                continue;
+            new_index[node - nodes_] = (int64_t)order.size();
+            order.push_back(node);
+            if (!node->is_not_leave)
+                continue;
+            if (use_hitrates && node->truenode != NULL && node->falsenode != NULL) {
+                // the last pushed node is the next one to be processed
+                if (node->falsenode->hitrates > node->truenode->hitrates) {
+                    first = node->falsenode;
+                    second = node->truenode;
+                }
+                else {
+                    first = node->truenode;
+                    second = node->falsenode;
+                }
+                pending.push_back(second);
+                pending.push_back(first);
+            }
+            else {
+                pending.push_back(node->truenode);
+                pending.push_back(node->falsenode);
+            }
+        }
+    }
+    // unreachable nodes are kept at the end
+    for (int64_t i = 0; i < n_nodes_; ++i) {
+        if (new_index[i] == -1) {
+            new_index[i] = (int64_t)order.size();
+            order.push_back(nodes_ + i);
+        }
+    }
+
+    // nodes_ still follows the order of the attributes
+    node_positions_.resize(n_nodes_);
+    for (int64_t i = 0; i < n_nodes_; ++i)
+        node_positions_[i] = (uint32_t)(order[i] - nodes_);
+    sizeof_ += sizeof(uint32_t) * node_positions_.size();
+
+    TreeNodeElement<NTYPE> * new_nodes = new TreeNodeElement<NTYPE>[(int)n_nodes_];
+    for (int64_t i = 0; i < n_nodes_; ++i) {
+        node = new_nodes + i;
+        *node = std::move(*(order[i]));
+        if (node->truenode != NULL)
+            node->truenode = new_nodes + new_index[node->truenode - nodes_];
+        if (node->falsenode != NULL)
+            node->falsenode = new_nodes + new_index[node->falsenode - nodes_];
+    }
+    for (auto it = roots_.begin(); it != roots_.end(); ++it)
+        *it = new_nodes + new_index[*it - nodes_];
+    delete [] nodes_;
+    nodes_ = new_nodes;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::can_pack() const {
+    // The packed layout cannot store more than 2^24 features
+    // or 2^32 nodes, the runtime keeps the default layout in that case.
+    if ((uint64_t)n_nodes_ >= ((uint64_t)1 << 32))
+        return false;
+    for (int64_t i = 0; i < n_nodes_; ++i) {
+        if (nodes_[i].is_not_leave &&
+                (nodes_[i].feature_id < 0 || nodes_[i].feature_id > PACKED_FEATURE_MASK))
+            return false;
+    }
+    return true;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::fill_packed(
+        std::vector<TreeNodeElementPacked<NTYPE>>& packed_nodes,
+        std::vector<uint32_t>& packed_roots,
+        std::vector<SparseValue<NTYPE>>& leaf_weights) const {
+    packed_nodes.resize(n_nodes_);
+    leaf_weights.clear();
+    TreeNodeElement<NTYPE> * node;
+    TreeNodeElementPacked<NTYPE> * pnode;
+    for (int64_t i = 0; i < n_nodes_; ++i) {
+        node = nodes_ + i;
+        pnode = &(packed_nodes[i]);
+        pnode->value = node->value;
+        pnode->feature_flags = ((uint32_t)node->mode) << PACKED_MODE_SHIFT;
+        if (node->is_missing_track_true)
+            pnode->feature_flags |= PACKED_MISSING_TRACK_TRUE;
+        if (node->is_not_leave) {
+            pnode->feature_flags |= (uint32_t)node->feature_id;
+            pnode->truenode = (uint32_t)(node->truenode - nodes_);
+            pnode->falsenode = (uint32_t)(node->falsenode - nodes_);
+        }
+        else {
+            pnode->feature_flags |= PACKED_LEAF;
+            pnode->truenode = (uint32_t)leaf_weights.size();
+            pnode->falsenode = (uint32_t)node->weights.size();
+            leaf_weights.insert(leaf_weights.end(), node->weights.begin(), node->weights.end());
+        }
+    }
+    packed_roots.resize(roots_.size());
+    for (size_t j = 0; j < roots_.size(); ++j)
+        packed_roots[j] = (uint32_t)(roots_[j] - nodes_);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::unpack_nodes(
+        std::vector<TreeNodeElement<NTYPE>>& nodes,
+        std::vector<TreeNodeElement<NTYPE>*>& roots) const {
+    // temporary copy with the default layout used to build the structures
+    // which are not stored in a blob, only the fields they read are filled
+    nodes.resize(n_nodes_);
+    const TreeNodeElementPacked<NTYPE> * pnode;
+    TreeNodeElement<NTYPE> * node;
+    for (int64_t i = 0; i < n_nodes_; ++i) {
+        pnode = &(packed_nodes_[i]);
+        node = &(nodes[i]);
+        node->value = pnode->value;
+        node->hitrates = 0;
+        node->mode = pnode->mode();
+        node->is_missing_track_true = pnode->is_missing_track_true();
+        node->is_not_leave = pnode->is_not_leave();
+        node->dense_offset = 0;
+        if (node->is_not_leave) {
+            node->feature_id = pnode->feature_id();
+            node->truenode = nodes.data() + pnode->truenode;
+            node->falsenode = nodes.data() + pnode->falsenode;
+        }
+        else {
+            node->feature_id = 0;
+            node->truenode = NULL;
+            node->falsenode = NULL;
+            node->weights.assign(leaf_weights_.data() + pnode->truenode,
+                                 leaf_weights_.data() + pnode->truenode + pnode->falsenode);
+        }
+    }
+    roots.resize(packed_roots_.size());
+    for (size_t j = 0; j < packed_roots_.size(); ++j)
+        roots[j] = nodes.data() + packed_roots_[j];
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::pack_nodes() {
+    if (!can_pack()) {
+        packed_ = false;
+        return;
     }
-    _scores_classes.resize(omp_get_max_threads());
-    _has_scores_classes.resize(omp_get_max_threads());
-    for(size_t i = 0; i < _scores_classes.size(); ++i) {
-        _scores_classes[i].resize(n_targets_or_classes_);
-        _has_scores_classes[i].resize(n_targets_or_classes_);
+    fill_packed(packed_nodes_data_, packed_roots_data_, leaf_weights_data_);
+    packed_nodes_.assign(packed_nodes_data_);
+    packed_roots_.assign(packed_roots_data_);
+    leaf_weights_.assign(leaf_weights_data_);
+
+    delete [] nodes_;
+    nodes_ = NULL;
+    roots_.clear();
+
+    sizeof_ = sizeof(RuntimeTreeEnsembleCommonP<NTYPE>) +
+              sizeof(NTYPE) * base_values_.size() +
+              sizeof(TreeNodeElementPacked<NTYPE>) * packed_nodes_.size() +
+              sizeof(SparseValue<NTYPE>) * leaf_weights_.size() +
+              sizeof(uint32_t) * packed_roots_.size() +
+              sizeof(uint32_t) * node_positions_.size() +
+              quickscorer_.get_sizeof() +
+              quantized_forest_.get_sizeof();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::build_dense_leaves() {
+    dense_leaves_ = false;
+    dense_weights_.clear();
+    int64_t n_classes = n_targets_or_classes_;
+    if (n_classes <= 1)
+        return;
+
+    // every leaf must hold exactly one weight per class
+    std::vector<unsigned char> seen(n_classes);
+    auto is_dense = [&](const SparseValue<NTYPE>* weights, int64_t n) -> bool {
+        if (n != n_classes)
+            return false;
+        std::fill(seen.begin(), seen.end(), 0);
+        for (int64_t k = 0; k < n; ++k) {
+            if (weights[k].i < 0 || weights[k].i >= n_classes || seen[weights[k].i])
+                return false;
+            seen[weights[k].i] = 1;
+        }
+        return true;
+    };
+
+    if (packed_) {
+        // the row of a leaf starts at the position of its first sparse weight
+        for (auto it = packed_nodes_.begin(); it != packed_nodes_.end(); ++it) {
+            if (!it->is_not_leave() &&
+                    !is_dense(leaf_weights_.data() + it->truenode, it->falsenode))
+                return;
+        }
+        dense_weights_.resize(leaf_weights_.size());
+        const SparseValue<NTYPE>* weights;
+        for (auto it = packed_nodes_.begin(); it != packed_nodes_.end(); ++it) {
+            if (it->is_not_leave())
+                continue;
+            weights = leaf_weights_.data() + it->truenode;
+            for (int64_t k = 0; k < n_classes; ++k)
+                dense_weights_[it->truenode + weights[k].i] = weights[k].value;
+        }
     }
+    else {
+        TreeNodeElement<NTYPE> * node;
+        for (int64_t i = 0; i < n_nodes_; ++i) {
+            node = nodes_ + i;
+            if (!node->is_not_leave &&
+                    !is_dense(node->weights.data(), (int64_t)node->weights.size()))
+                return;
+        }
+        for (int64_t i = 0; i < n_nodes_; ++i) {
+            node = nodes_ + i;
+            if (node->is_not_leave)
+                continue;
+            node->dense_offset = (int64_t)dense_weights_.size();
+            dense_weights_.resize(dense_weights_.size() + n_classes);
+            for (auto it = node->weights.begin(); it != node->weights.end(); ++it)
+                dense_weights_[node->dense_offset + it->i] = it->value;
+        }
+    }
+    dense_leaves_ = true;
+    sizeof_ += sizeof(NTYPE) * dense_weights_.size();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::build_early_exit() {
+    early_exit_order_.resize(n_trees_);
+    for (int64_t j = 0; j < n_trees_; ++j)
+        early_exit_order_[j] = j;
+    early_exit_low_.clear();
+    early_exit_high_.clear();
+    early_exit_slack_.clear();
+    tree_min_weights_.clear();
+    tree_max_weights_.clear();
+
+    // The label is the class with the highest score, a class without
+    // any score is not a candidate, base values or dense leaves
+    // guarantee every class has one.
+    int64_t n_classes = n_targets_or_classes_;
+    if (n_classes <= 2 || aggregate_function_ != AGGREGATE_FUNCTION::SUM ||
+            !(dense_leaves_ || (int64_t)base_values_.size() == n_classes))
+        return;
+
+    // A class missing in a leaf receives 0.
+    tree_min_weights_.resize(n_trees_ * n_classes, (NTYPE)0);
+    tree_max_weights_.resize(n_trees_ * n_classes, (NTYPE)0);
+    std::vector<NTYPE> leaf(n_classes);
+    auto add_leaf = [&](int64_t j, const SparseValue<NTYPE>* begin,
+                        const SparseValue<NTYPE>* end, bool first_leaf) {
+        std::fill(leaf.begin(), leaf.end(), (NTYPE)0);
+        for (auto it = begin; it != end; ++it)
+            leaf[it->i] += it->value;
+        NTYPE* lo = tree_min_weights_.data() + j * n_classes;
+        NTYPE* hi = tree_max_weights_.data() + j * n_classes;
+        for (int64_t k = 0; k < n_classes; ++k) {
+            lo[k] = first_leaf || leaf[k] < lo[k] ? leaf[k] : lo[k];
+            hi[k] = first_leaf || leaf[k] > hi[k] ? leaf[k] : hi[k];
+        }
+    };
+
+    bool first_leaf;
+    if (packed_) {
+        std::vector<uint32_t> stack;
+        const TreeNodeElementPacked<NTYPE> * node;
+        for (int64_t j = 0; j < n_trees_; ++j) {
+            first_leaf = true;
+            stack.push_back(packed_roots_[j]);
+            while (!stack.empty()) {
+                node = packed_nodes_.data() + stack.back();
+                stack.pop_back();
+                if (node->is_not_leave()) {
+                    stack.push_back(node->truenode);
+                    stack.push_back(node->falsenode);
+                    continue;
+                }
+                add_leaf(j, leaf_weights_.data() + node->truenode,
+                         leaf_weights_.data() + node->truenode + node->falsenode, first_leaf);
+                first_leaf = false;
+            }
+        }
+    }
+    else {
+        std::vector<TreeNodeElement<NTYPE>*> stack;
+        TreeNodeElement<NTYPE> * node;
+        for (int64_t j = 0; j < n_trees_; ++j) {
+            first_leaf = true;
+            stack.push_back(roots_[j]);
+            while (!stack.empty()) {
+                node = stack.back();
+                stack.pop_back();
+                if (node->is_not_leave) {
+                    stack.push_back(node->truenode);
+                    stack.push_back(node->falsenode);
+                    continue;
+                }
+                add_leaf(j, node->weights.data(), node->weights.data() + node->weights.size(),
+                         first_leaf);
+                first_leaf = false;
+            }
+        }
+    }
+
+    // Partial sums and complete sums are both rounded, the error of each
+    // is bounded by (n_trees + 2) * epsilon * sum of the absolute values.
+    early_exit_slack_.resize(n_classes);
+    NTYPE eps = std::numeric_limits<NTYPE>::epsilon() * (NTYPE)(2 * (n_trees_ + 2));
+    for (int64_t k = 0; k < n_classes; ++k) {
+        NTYPE total = (int64_t)base_values_.size() == n_classes ? std::abs(base_values_[k]) : 0;
+        for (int64_t j = 0; j < n_trees_; ++j)
+            total += std::max(std::abs(tree_min_weights_[j * n_classes + k]),
+                              std::abs(tree_max_weights_[j * n_classes + k]));
+        early_exit_slack_[k] = eps * total;
+    }
+    sizeof_ += sizeof(NTYPE) * (n_trees_ * n_classes * 4 + n_classes) +
+               sizeof(int64_t) * n_trees_;
+    set_early_exit_order(std::vector<int64_t>());
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_early_exit_order(const std::vector<int64_t>& order) {
+    int64_t n_classes = n_targets_or_classes_;
+    if (order.empty()) {
+        // trees with the largest range of weights first
+        std::vector<NTYPE> range(n_trees_, (NTYPE)0);
+        if (!tree_min_weights_.empty()) {
+            for (int64_t j = 0; j < n_trees_; ++j)
+                for (int64_t k = 0; k < n_classes; ++k)
+                    range[j] += tree_max_weights_[j * n_classes + k] -
+                                tree_min_weights_[j * n_classes + k];
+        }
+        for (int64_t j = 0; j < n_trees_; ++j)
+            early_exit_order_[j] = j;
+        std::stable_sort(early_exit_order_.begin(), early_exit_order_.end(),
+                         [&range](int64_t a, int64_t b) { return range[a] > range[b]; });
+    }
+    else {
+        if ((int64_t)order.size() != n_trees_)
+            throw std::runtime_error("The order must contain every tree once.");
+        std::vector<unsigned char> seen(n_trees_, 0);
+        for (auto it = order.begin(); it != order.end(); ++it) {
+            if (*it < 0 || *it >= n_trees_ || seen[*it])
+                throw std::runtime_error("The order must contain every tree once.");
+            seen[*it] = 1;
+        }
+        early_exit_order_ = order;
+    }
+    if (tree_min_weights_.empty())
+        return;
+
+    // early_exit_low_[k * n_classes + c]: sum of the smallest weights
+    // of class c for the trees at positions [k, n_trees_[
+    early_exit_low_.resize((n_trees_ + 1) * n_classes);
+    early_exit_high_.resize((n_trees_ + 1) * n_classes);
+    std::fill(early_exit_low_.begin() + n_trees_ * n_classes, early_exit_low_.end(), (NTYPE)0);
+    std::fill(early_exit_high_.begin() + n_trees_ * n_classes, early_exit_high_.end(), (NTYPE)0);
+    for (int64_t k = n_trees_ - 1; k >= 0; --k) {
+        int64_t j = early_exit_order_[k];
+        for (int64_t c = 0; c < n_classes; ++c) {
+            early_exit_low_[k * n_classes + c] = early_exit_low_[(k + 1) * n_classes + c] +
+                                                 tree_min_weights_[j * n_classes + c];
+            early_exit_high_[k * n_classes + c] = early_exit_high_[(k + 1) * n_classes + c] +
+                                                  tree_max_weights_[j * n_classes + c];
+        }
+    }
+}
+
+
+template<typename NTYPE>
+std::string RuntimeTreeEnsembleCommonP<NTYPE>::to_blob(
+        const std::vector<int64_t>* class_labels,
+        bool binary_case, bool weights_are_all_positive) const {
+    std::vector<TreeNodeElementPacked<NTYPE>> packed_nodes;
+    std::vector<uint32_t> packed_roots;
+    std::vector<SparseValue<NTYPE>> leaf_weights;
+    TreeArrayView<TreeNodeElementPacked<NTYPE>> pnodes = packed_nodes_;
+    TreeArrayView<uint32_t> proots = packed_roots_;
+    TreeArrayView<SparseValue<NTYPE>> pweights = leaf_weights_;
+    if (!packed_) {
+        if (!can_pack())
+            throw std::runtime_error("This tree ensemble cannot be stored with the compact layout.");
+        fill_packed(packed_nodes, packed_roots, leaf_weights);
+        pnodes.assign(packed_nodes);
+        proots.assign(packed_roots);
+        pweights.assign(leaf_weights);
+    }
+
+    TreeEnsembleBlobHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, TREE_BLOB_MAGIC);
+    header.version = TREE_BLOB_VERSION;
+    header.sizeof_ntype = sizeof(NTYPE);
+    header.n_targets_or_classes = n_targets_or_classes_;
+    header.n_nodes = n_nodes_;
+    header.n_trees = n_trees_;
+    header.n_base_values = base_values_.size();
+    header.n_leaf_weights = pweights.size();
+    header.post_transform = (int32_t)post_transform_;
+    header.aggregate_function = (int32_t)aggregate_function_;
+    header.same_mode = same_mode_ ? 1 : 0;
+    header.has_missing_tracks = has_missing_tracks_ ? 1 : 0;
+    header.use_hitrates = node_order_ == "HITRATES" ? 1 : 0;
+    header.omp_tree = omp_tree_;
+    header.omp_N = omp_N_;
+    header.tile_N = tile_N_;
+    header.deterministic = deterministic_ ? 1 : 0;
+    header.quickscorer = quickscorer_.n_trees_ > 0 ? 1 : 0;
+    header.quantized = quantized_ ? 1 : 0;
+    header.is_classifier = class_labels == NULL ? 0 : 1;
+    header.binary_case = binary_case ? 1 : 0;
+    header.weights_are_all_positive = weights_are_all_positive ? 1 : 0;
+    header.n_class_labels = class_labels == NULL ? 0 : class_labels->size();
+    header.offset_base_values = tree_blob_align(sizeof(header));
+    header.offset_nodes = tree_blob_align(
+        header.offset_base_values + sizeof(NTYPE) * base_values_.size());
+    header.offset_roots = tree_blob_align(
+        header.offset_nodes + sizeof(TreeNodeElementPacked<NTYPE>) * pnodes.size());
+    header.offset_leaf_weights = tree_blob_align(
+        header.offset_roots + sizeof(uint32_t) * proots.size());
+    header.offset_class_labels = tree_blob_align(
+        header.offset_leaf_weights + sizeof(SparseValue<NTYPE>) * pweights.size());
+    header.size = header.offset_class_labels + sizeof(int64_t) * header.n_class_labels;
+
+    std::string blob((size_t)header.size, '\0');
+    char* data = &(blob[0]);
+    memcpy(data, &header, sizeof(header));
+    if (!base_values_.empty())
+        memcpy(data + header.offset_base_values, base_values_.data(),
+               sizeof(NTYPE) * base_values_.size());
+    if (!pnodes.empty())
+        memcpy(data + header.offset_nodes, pnodes.data(),
+               sizeof(TreeNodeElementPacked<NTYPE>) * pnodes.size());
+    if (!proots.empty())
+        memcpy(data + header.offset_roots, proots.data(), sizeof(uint32_t) * proots.size());
+    if (!pweights.empty())
+        memcpy(data + header.offset_leaf_weights, pweights.data(),
+               sizeof(SparseValue<NTYPE>) * pweights.size());
+    if (header.n_class_labels > 0)
+        memcpy(data + header.offset_class_labels, class_labels->data(),
+               sizeof(int64_t) * header.n_class_labels);
+    return blob;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::load_blob(
+        const char* data, int64_t size, std::vector<int64_t>* class_labels,
+        bool* binary_case, bool* weights_are_all_positive) {
+    TreeEnsembleBlobHeader header;
+    if (size < (int64_t)sizeof(header))
+        throw std::runtime_error("Invalid tree ensemble blob (too small).");
+    memcpy(&header, data, sizeof(header));
+    if (strncmp(header.magic, TREE_BLOB_MAGIC, sizeof(header.magic)) != 0)
+        throw std::runtime_error("Invalid tree ensemble blob (wrong magic number).");
+    if (header.version != TREE_BLOB_VERSION) {
+        char buffer[1000];
+        sprintf(buffer, "Unexpected tree ensemble blob version %d (expected %d).",
+                (int)header.version, TREE_BLOB_VERSION);
+        throw std::runtime_error(buffer);
+    }
+    if (header.sizeof_ntype != sizeof(NTYPE))
+        throw std::runtime_error("The tree ensemble blob was saved with another type.");
+    if ((header.is_classifier != 0) != (class_labels != NULL))
+        throw std::runtime_error(header.is_classifier
+            ? "The tree ensemble blob stores a classifier."
+            : "The tree ensemble blob stores a regressor.");
+
+    // every section must be aligned and inside the blob
+    if (header.size > size || header.n_nodes < 0 || header.n_nodes >= ((int64_t)1 << 32) ||
+            header.n_trees < 0 || header.n_base_values < 0 || header.n_leaf_weights < 0 ||
+            header.n_class_labels < 0)
+        throw std::runtime_error("Invalid tree ensemble blob (truncated).");
+    const int64_t offsets[] = {header.offset_base_values, header.offset_nodes,
+                               header.offset_roots, header.offset_leaf_weights,
+                               header.offset_class_labels};
+    const int64_t lengths[] = {
+        header.n_base_values * (int64_t)sizeof(NTYPE),
+        header.n_nodes * (int64_t)sizeof(TreeNodeElementPacked<NTYPE>),
+        header.n_trees * (int64_t)sizeof(uint32_t),
+        header.n_leaf_weights * (int64_t)sizeof(SparseValue<NTYPE>),
+        header.n_class_labels * (int64_t)sizeof(int64_t)};
+    for (int k = 0; k < 5; ++k) {
+        if (offsets[k] < (int64_t)sizeof(header) || offsets[k] % 8 != 0 ||
+                lengths[k] > header.size - offsets[k])
+            throw std::runtime_error("Invalid tree ensemble blob (truncated).");
+    }
+
+    const TreeNodeElementPacked<NTYPE>* pnodes =
+        (const TreeNodeElementPacked<NTYPE>*)(data + header.offset_nodes);
+    const uint32_t* proots = (const uint32_t*)(data + header.offset_roots);
+    const SparseValue<NTYPE>* pweights =
+        (const SparseValue<NTYPE>*)(data + header.offset_leaf_weights);
+    if (header.post_transform < (int32_t)POST_EVAL_TRANSFORM::NONE ||
+            header.post_transform > (int32_t)POST_EVAL_TRANSFORM::PROBIT ||
+            header.aggregate_function < (int32_t)AGGREGATE_FUNCTION::AVERAGE ||
+            header.aggregate_function > (int32_t)AGGREGATE_FUNCTION::MAX)
+        throw std::runtime_error("Invalid tree ensemble blob (unknown enum value).");
+    for (int64_t i = 0; i < header.n_nodes; ++i) {
+        if (pnodes[i].is_not_leave()
+                ? (pnodes[i].mode() >= NODE_MODE::LEAF ||
+                   pnodes[i].truenode >= header.n_nodes || pnodes[i].falsenode >= header.n_nodes)
+                : (pnodes[i].mode() > NODE_MODE::LEAF ||
+                   (int64_t)pnodes[i].truenode + pnodes[i].falsenode > header.n_leaf_weights))
+            throw std::runtime_error("Invalid tree ensemble blob (node out of range).");
+    }
+    for (int64_t j = 0; j < header.n_trees; ++j) {
+        if (proots[j] >= header.n_nodes)
+            throw std::runtime_error("Invalid tree ensemble blob (root out of range).");
+    }
+    for (int64_t i = 0; i < header.n_leaf_weights; ++i) {
+        if (pweights[i].i < 0 || pweights[i].i >= header.n_targets_or_classes)
+            throw std::runtime_error("Invalid tree ensemble blob (class out of range).");
+    }
+    // every node is reached at most once from the root of its tree,
+    // the traversal of a tree with a cycle would never end
+    std::vector<int64_t> visited((size_t)header.n_nodes, -1);
+    std::vector<uint32_t> stack;
+    uint32_t inode;
+    for (int64_t j = 0; j < header.n_trees; ++j) {
+        stack.push_back(proots[j]);
+        while (!stack.empty()) {
+            inode = stack.back();
+            stack.pop_back();
+            if (visited[inode] == j)
+                throw std::runtime_error("Invalid tree ensemble blob (cycle in a tree).");
+            visited[inode] = j;
+            if (pnodes[inode].is_not_leave()) {
+                stack.push_back(pnodes[inode].truenode);
+                stack.push_back(pnodes[inode].falsenode);
+            }
+        }
+    }
+
+    // the blob is valid, the previous model is released
+    if (nodes_ != NULL)
+        delete [] nodes_;
+    nodes_ = NULL;
+    roots_.clear();
+    packed_nodes_data_ = std::vector<TreeNodeElementPacked<NTYPE>>();
+    packed_roots_data_ = std::vector<uint32_t>();
+    leaf_weights_data_ = std::vector<SparseValue<NTYPE>>();
+    // the bitvector evaluation and the quantized thresholds are built below
+    quickscorer_.clear();
+    quantized_forest_.clear();
+    quantized_ = false;
+    node_positions_.clear();
+
+    const NTYPE* base_values = (const NTYPE*)(data + header.offset_base_values);
+    base_values_ = std::vector<NTYPE>(base_values, base_values + header.n_base_values);
+    n_targets_or_classes_ = header.n_targets_or_classes;
+    post_transform_ = (POST_EVAL_TRANSFORM)header.post_transform;
+    aggregate_function_ = (AGGREGATE_FUNCTION)header.aggregate_function;
+    n_nodes_ = header.n_nodes;
+    n_trees_ = header.n_trees;
+    max_tree_depth_ = 1000;
+    same_mode_ = header.same_mode != 0;
+    has_missing_tracks_ = header.has_missing_tracks != 0;
+    node_order_ = header.use_hitrates ? "HITRATES" : "BFS";
+    omp_tree_ = header.omp_tree;
+    omp_N_ = header.omp_N;
+    tile_N_ = header.tile_N;
+    deterministic_ = header.deterministic != 0;
+    if (class_labels != NULL) {
+        const int64_t* labels = (const int64_t*)(data + header.offset_class_labels);
+        *class_labels = std::vector<int64_t>(labels, labels + header.n_class_labels);
+        *binary_case = header.binary_case != 0;
+        *weights_are_all_positive = header.weights_are_all_positive != 0;
+    }
+
+    packed_ = true;
+    packed_nodes_.assign(pnodes, (size_t)header.n_nodes);
+    packed_roots_.assign(proots, (size_t)header.n_trees);
+    leaf_weights_.assign(pweights, (size_t)header.n_leaf_weights);
+    if (header.quickscorer != 0 || header.quantized != 0) {
+        // they are not stored in the blob, they are built again
+        // from a temporary copy of the nodes
+        std::vector<TreeNodeElement<NTYPE>> nodes;
+        std::vector<TreeNodeElement<NTYPE>*> roots;
+        unpack_nodes(nodes, roots);
+        if (header.quickscorer != 0)
+            quickscorer_.init(roots, same_mode_, has_missing_tracks_);
+        if (header.quantized != 0)
+            quantized_ = quantized_forest_.init(nodes.data(), n_nodes_, roots);
+    }
+    sizeof_ = sizeof(RuntimeTreeEnsembleCommonP<NTYPE>) +
+              sizeof(NTYPE) * base_values_.size() + header.size +
+              quickscorer_.get_sizeof() + quantized_forest_.get_sizeof();
+    reset_node_counts();
+
+    build_dense_leaves();
+    build_early_exit();
+    select_kernels();
+    select_simd();
+}
+
+
+template<typename NTYPE>
+py::bytes RuntimeTreeEnsembleCommonP<NTYPE>::serialize() const {
+    return py::bytes(to_blob(NULL, false, false));
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::deserialize(py::bytes blob) {
+    deserialize_blob(blob, NULL, NULL, NULL);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::save(const std::string& filename) const {
+    save_blob(filename, to_blob(NULL, false, false));
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::load(const std::string& filename) {
+    load_file(filename, NULL, NULL, NULL);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::deserialize_blob(
+        py::bytes blob, std::vector<int64_t>* class_labels,
+        bool* binary_case, bool* weights_are_all_positive) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string content = blob;
+    // the sections must be aligned on 8 bytes
+    std::vector<int64_t> data((content.size() + sizeof(int64_t) - 1) / sizeof(int64_t));
+    if (!content.empty())
+        memcpy(data.data(), content.data(), content.size());
+    load_blob((const char*)data.data(), (int64_t)content.size(),
+              class_labels, binary_case, weights_are_all_positive);
+    blob_data_.swap(data);
+    mapped_.reset();
+    load_time_ = std::chrono::duration<double>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::save_blob(const std::string& filename,
+                                                  const std::string& blob) {
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    f.write(blob.data(), blob.size());
+    f.close();
+    if (f.fail())
+        throw std::runtime_error(std::string("Unable to write file '") + filename + std::string("'."));
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::load_file(
+        const std::string& filename, std::vector<int64_t>* class_labels,
+        bool* binary_case, bool* weights_are_all_positive) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<TreeEnsembleMappedFile> mapped(new TreeEnsembleMappedFile(filename));
+    load_blob(mapped->data(), mapped->size(), class_labels, binary_case, weights_are_all_positive);
+    // the previous mapping, if any, is released with *mapped*
+    mapped_.swap(mapped);
+    blob_data_ = std::vector<int64_t>();
+    load_time_ = std::chrono::duration<double>(
+        std::chrono::high_resolution_clock::now() - start).count();
 }
 
 
 template<typename NTYPE>
 std::vector<std::string> RuntimeTreeEnsembleCommonP<NTYPE>::get_nodes_modes() const {
     std::vector<std::string> res;
-    for(int i = 0; i < (int)n_nodes_; ++i)
-        res.push_back(to_str(nodes_[i].mode));
+    if (packed_) {
+        for(int i = 0; i < (int)n_nodes_; ++i)
+            res.push_back(to_str(packed_nodes_[i].mode()));
+    }
+    else {
+        for(int i = 0; i < (int)n_nodes_; ++i)
+            res.push_back(to_str(nodes_[i].mode));
+    }
     return res;
 }
 
 
+py::detail::unchecked_mutable_reference<float, 1> _mutable_unchecked1(py::array_t<float>& Z) {
+    return Z.mutable_unchecked<1>();
+}
+
+
+py::detail::unchecked_mutable_reference<int64_t, 1> _mutable_unchecked1(py::array_t<int64_t>& Z) {
+    return Z.mutable_unchecked<1>();
+}
+
+
+py::detail::unchecked_mutable_reference<double, 1> _mutable_unchecked1(py::array_t<double>& Z) {
+    return Z.mutable_unchecked<1>();
+}
+
+
 template<typename NTYPE>
-template<typename AGG>
-py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_agg(py::array_t<NTYPE> X, const AGG &agg) {
+template<typename AGG, typename XTYPE>
+py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_agg(py::array_t<XTYPE> X, const AGG &agg) const {
     std::vector<int64_t> x_dims;
     arrayshape2vector(x_dims, X);
     if (x_dims.size() != 2)
         throw std::runtime_error("X must have 2 dimensions.");
 
     // Does not handle 3D tensors
-    bool xdims1 = x_dims.size() == 1;
-    int64_t stride = xdims1 ? x_dims[0] : x_dims[1];  
-    int64_t N = xdims1 ? 1 : x_dims[0];
+    int64_t N = x_dims[0];
 
     py::array_t<NTYPE> Z(x_dims[0] * n_targets_or_classes_);
 
     {
         py::gil_scoped_release release;
-        compute_gil_free(x_dims, N, stride, X, Z, NULL, agg);
+        TreeEnsembleSettingsLock::Shared settings(settings_lock_);
+        compute_gil_free(N, tree_input(X, x_dims), (NTYPE*)_mutable_unchecked1(Z).data(0),
+                         (int64_t*)NULL, agg);
     }
     return Z;
 }
 
 
 template<typename NTYPE>
-template<typename AGG>
+template<typename AGG, typename XTYPE>
 py::tuple RuntimeTreeEnsembleCommonP<NTYPE>::compute_cl_agg(
-        py::array_t<NTYPE> X, const AGG &agg) {
+        py::array_t<XTYPE> X, const AGG &agg) const {
     std::vector<int64_t> x_dims;
     arrayshape2vector(x_dims, X);
     if (x_dims.size() != 2)
         throw std::runtime_error("X must have 2 dimensions.");
 
     // Does not handle 3D tensors
-    bool xdims1 = x_dims.size() == 1;
-    int64_t stride = xdims1 ? x_dims[0] : x_dims[1];  
-    int64_t N = xdims1 ? 1 : x_dims[0];
+    int64_t N = x_dims[0];
 
     // Tensor* Y = context->Output(0, TensorShape({N}));
     // auto* Z = context->Output(1, TensorShape({N, class_count_}));
@@ -461,320 +1706,986 @@ py::tuple RuntimeTreeEnsembleCommonP<NTYPE>::compute_cl_agg(
 
     {
         py::gil_scoped_release release;
-        compute_gil_free(x_dims, N, stride, X, Z, &Y, agg);
+        TreeEnsembleSettingsLock::Shared settings(settings_lock_);
+        compute_gil_free(N, tree_input(X, x_dims), (NTYPE*)_mutable_unchecked1(Z).data(0),
+                         (int64_t*)_mutable_unchecked1(Y).data(0), agg);
     }
     return py::make_tuple(Y, Z);
 }
 
 
-py::detail::unchecked_mutable_reference<float, 1> _mutable_unchecked1(py::array_t<float>& Z) {
-    return Z.mutable_unchecked<1>();
-}
+template<typename NTYPE>
+template<typename AGG, typename XTYPE>
+py::tuple RuntimeTreeEnsembleCommonP<NTYPE>::compute_label_agg(
+        py::array_t<XTYPE> X, const AGG &agg) const {
+    std::vector<int64_t> x_dims;
+    arrayshape2vector(x_dims, X);
+    if (x_dims.size() != 2)
+        throw std::runtime_error("X must have 2 dimensions.");
 
+    int64_t N = x_dims[0];
+    TreeInput<XTYPE> input = tree_input(X, x_dims);
+    py::array_t<int64_t> Y(N);
+    py::array_t<int64_t> E(N);
 
-py::detail::unchecked_mutable_reference<int64_t, 1> _mutable_unchecked1(py::array_t<int64_t>& Z) {
-    return Z.mutable_unchecked<1>();
+    {
+        py::gil_scoped_release release;
+        TreeEnsembleSettingsLock::Shared settings(settings_lock_);
+        int64_t* y_data = (int64_t*)_mutable_unchecked1(Y).data(0);
+        int64_t* e_data = (int64_t*)_mutable_unchecked1(E).data(0);
+        int64_t n_classes = n_targets_or_classes_;
+        bool early_exit = !early_exit_low_.empty();
+        bool dense = dense_leaves_ && !quantized_;
+        int64_t tile = get_tile_size(N);
+        int64_t n_tiles = (N + tile - 1) / tile;
+        // blocks of trees used by compute (see compute_gil_free)
+        tile_kernel<AGG> kernel = select_tile_kernel<AGG>();
+        int64_t block = deterministic_ ? TREE_DETERMINISTIC_BLOCK : n_trees_;
+        int64_t n_blocks = deterministic_ && n_trees_ > 0 ? (n_trees_ + block - 1) / block : 1;
+
+        auto compute_tile = [&](int64_t t, int) {
+            TreeEnsembleScratch<NTYPE>& scratch = TreeEnsembleScratch<NTYPE>::get();
+            std::vector<NTYPE>& scores = scratch.scores;
+            std::vector<unsigned char>& has_scores = scratch.has_scores;
+            // FinalizeScores also writes the scores before the post transform
+            std::vector<NTYPE>& z = scratch.tile_scores;
+            z.resize(std::max(n_classes, (int64_t)2));
+            int64_t begin = t * tile;
+            int64_t end = std::min(N, begin + tile);
+            int64_t stride;
+            const NTYPE* rows = tree_input_rows(input, begin, end, scratch.inputs, stride);
+            const NTYPE* x;
+            int64_t i, j, k, b;
+            for (i = begin; i < end; ++i) {
+                x = rows + (i - begin) * stride;
+                TreeEnsembleScratch<NTYPE>::reset(scores, has_scores, n_classes);
+                for (k = 0; k < n_trees_;) {
+                    j = early_exit ? early_exit_order_[k] : k;
+                    if (dense)
+                        agg.ProcessLeafPredictionDense(scores.data(), dense_leaf_weights(j, x),
+                                                       has_scores.data());
+                    else
+                        ProcessTreePrediction(agg, j, x, scores.data(), has_scores.data());
+                    ++k;
+                    if (early_exit && k < n_trees_ &&
+                            agg.SettledLabel(scores.data(), early_exit_low_.data() + k * n_classes,
+                                             early_exit_high_.data() + k * n_classes,
+                                             early_exit_slack_.data(), y_data + i))
+                        break;
+                }
+                e_data[i] = k;
+                if (k < n_trees_)
+                    continue;
+                if (early_exit) {
+                    // The sums follow early_exit_order_, compute sums the trees
+                    // in their original order and rounding may change the label
+                    // of a near tie, the scores are then computed again like compute.
+                    if (agg.SettledLabel(scores.data(), early_exit_low_.data() + k * n_classes,
+                                         early_exit_high_.data() + k * n_classes,
+                                         early_exit_slack_.data(), y_data + i))
+                        continue;
+                    TreeEnsembleScratch<NTYPE>::reset(scores, has_scores, n_blocks * n_classes);
+                    for (b = 0; b < n_blocks; ++b)
+                        (this->*kernel)(agg, 0, 1, b * block, std::min((b + 1) * block, n_trees_),
+                                        x, stride, scores.data() + b * n_classes,
+                                        has_scores.data() + b * n_classes);
+                    reduce_blocks(agg, n_blocks, n_classes, n_classes,
+                                  scores.data(), has_scores.data());
+                }
+                else if (dense && n_trees_ > 0)
+                    std::fill(has_scores.begin(), has_scores.end(), 1);
+                if (n_classes == 1)
+                    agg.FinalizeScores1(z.data(), scores[0], has_scores[0], y_data + i);
+                else
+                    agg.FinalizeScores(scores.data(), has_scores.data(), z.data(), y_data + i);
+            }
+        };
+
+        if (N > omp_N_)
+            ThreadPool::global().parallel_for(n_tiles, compute_tile);
+        else {
+            for (int64_t t = 0; t < n_tiles; ++t)
+                compute_tile(t, 0);
+        }
+    }
+    return py::make_tuple(Y, E);
 }
 
 
-py::detail::unchecked_mutable_reference<double, 1> _mutable_unchecked1(py::array_t<double>& Z) {
-    return Z.mutable_unchecked<1>();
+template<typename NTYPE>
+template<typename AGG, typename XTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::compute_npy_agg(
+        const std::string& input, const std::string& output,
+        const std::string* labels, int64_t chunk_rows, const AGG &agg) const {
+    py::gil_scoped_release release;
+    TreeEnsembleSettingsLock::Shared settings(settings_lock_);
+    NpyChunkReader<XTYPE> reader(input);
+    int64_t N = reader.n_rows();
+    int64_t stride = reader.n_cols();
+    int64_t n_classes = n_targets_or_classes_;
+    if (chunk_rows <= 0)
+        chunk_rows = TREE_STREAM_CHUNK;
+    NpyChunkWriter<NTYPE> writer(output, std::vector<int64_t>{N, n_classes});
+    std::unique_ptr<NpyChunkWriter<int64_t>> label_writer;
+    if (labels != NULL && !labels->empty())
+        label_writer.reset(new NpyChunkWriter<int64_t>(*labels, std::vector<int64_t>{N}));
+
+    // two buffers, one is scored while the other one is read or written
+    std::vector<XTYPE> x[2];
+    std::vector<NTYPE> z[2];
+    std::vector<int64_t> y[2];
+    int64_t n_chunks = (N + chunk_rows - 1) / chunk_rows;
+    auto chunk_size = [&](int64_t c) { return std::min(chunk_rows, N - c * chunk_rows); };
+    auto write_chunk = [&](int64_t c, int b) {
+        writer.write(z[b].data(), chunk_size(c) * n_classes);
+        if (label_writer)
+            label_writer->write(y[b].data(), chunk_size(c));
+    };
+    if (n_chunks > 0) {
+        x[0].resize(chunk_size(0) * stride);
+        reader.read(x[0].data(), chunk_size(0));
+    }
+
+    // declared after the buffers, it waits for the pending task
+    // before they are destroyed if an exception is raised
+    std::future<void> io;
+    for (int64_t c = 0; c < n_chunks; ++c) {
+        int b = (int)(c % 2);
+        int64_t n = chunk_size(c);
+        if (io.valid())
+            io.get();
+        io = std::async(std::launch::async, [&, c, b]() {
+            if (c > 0)
+                write_chunk(c - 1, 1 - b);
+            if (c + 1 < n_chunks) {
+                x[1 - b].resize(chunk_size(c + 1) * stride);
+                reader.read(x[1 - b].data(), chunk_size(c + 1));
+            }
+        });
+        z[b].resize(n * n_classes);
+        if (labels != NULL)
+            y[b].resize(n);
+        compute_gil_free(n, TreeInput<XTYPE>(x[b].data(), stride), z[b].data(),
+                         labels == NULL ? (int64_t*)NULL : y[b].data(), agg);
+    }
+    if (io.valid())
+        io.get();
+    if (n_chunks > 0)
+        write_chunk(n_chunks - 1, (int)((n_chunks - 1) % 2));
+    writer.close();
+    if (label_writer)
+        label_writer->close();
+    return N;
 }
 
 
 template<typename NTYPE>
-template<typename AGG>
+template<typename AGG, typename XTYPE>
 void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free(
-                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
-                const py::array_t<NTYPE>& X, py::array_t<NTYPE>& Z,
-                py::array_t<int64_t>* Y, const AGG &agg) {
+                int64_t N, const TreeInput<XTYPE>& input,
+                NTYPE* z_data, int64_t* y_data, const AGG &agg) const {
 
-    // expected primary-expression before ')' token
-    auto Z_ = _mutable_unchecked1(Z); // Z.mutable_unchecked<(size_t)1>();
-    const NTYPE* x_data = X.data(0);
+    if (profile_) {
+        compute_gil_free_profile(N, input, z_data, y_data, agg);
+        return;
+    }
 
-    if (n_targets_or_classes_ == 1) {
-        if (N == 1) {
+    if (N == 1 && n_trees_ <= omp_tree_ && !deterministic_) {
+        // a single row and a few trees, no parallelization
+        TreeEnsembleScratch<NTYPE>& scratch = TreeEnsembleScratch<NTYPE>::get();
+        int64_t stride;
+        const NTYPE* x = tree_input_rows(input, 0, 1, scratch.inputs, stride);
+        if (n_targets_or_classes_ == 1) {
             NTYPE scores = 0;
             unsigned char has_scores = 0;
-            if (n_trees_ <= omp_tree_) {
+            for (int64_t j = 0; j < n_trees_; ++j)
+                ProcessTreePrediction1(agg, j, x, &scores, &has_scores);
+            agg.FinalizeScores1(z_data, scores, has_scores, y_data);
+        }
+        else {
+            std::vector<NTYPE>& scores = scratch.scores;
+            std::vector<unsigned char>& has_scores = scratch.has_scores;
+            TreeEnsembleScratch<NTYPE>::reset(scores, has_scores, n_targets_or_classes_);
+            if (dense_leaves_ && !quantized_) {
                 for (int64_t j = 0; j < n_trees_; ++j)
-                    agg.ProcessTreeNodePrediction1(
-                        &scores,
-                        ProcessTreeNodeLeave(roots_[j], x_data),
-                        &has_scores);
+                    agg.ProcessLeafPredictionDense(scores.data(), dense_leaf_weights(j, x),
+                                                   has_scores.data());
+                if (n_trees_ > 0)
+                    std::fill(has_scores.begin(), has_scores.end(), 1);
             }
             else {
-                std::fill(_scores_t_tree.begin(), _scores_t_tree.end(), (NTYPE)0);
-                std::fill(_has_scores_t_tree.begin(), _has_scores_t_tree.end(), 0);
-                #ifdef USE_OPENMP
-                #pragma omp parallel for
-                #endif
-                for (int64_t j = 0; j < n_trees_; ++j) {
-                    agg.ProcessTreeNodePrediction1(
-                        &(_scores_t_tree[j]),
-                        ProcessTreeNodeLeave(roots_[j], x_data),
-                        &(_has_scores_t_tree[j]));
-                }
-                auto it = _scores_t_tree.cbegin();
-                auto it2 = _has_scores_t_tree.cbegin();
-                for(; it != _scores_t_tree.cend(); ++it, ++it2)
-                    agg.MergePrediction1(&scores, &has_scores, &(*it), &(*it2));
+                for (int64_t j = 0; j < n_trees_; ++j)
+                    ProcessTreePrediction(agg, j, x, scores.data(), has_scores.data());
             }
+            int add_second_class = agg.FinalizeScores(scores.data(), has_scores.data(),
+                                                      z_data, y_data);
+            agg.PostTransform(1, z_data, &add_second_class);
+        }
+        return;
+    }
 
-            agg.FinalizeScores1((NTYPE*)Z_.data(0), scores, has_scores,
-                                Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(0));
+    // Rows are split into tiles and trees into blocks, every pair
+    // (tile, block) is a task run by the thread pool.
+    int64_t n_classes = n_targets_or_classes_;
+    int64_t tile = get_tile_size(N);
+    int64_t n_tiles = (N + tile - 1) / tile;
+    int64_t n_blocks = get_tree_blocks(n_tiles, input.n_cols);
+    int64_t block = deterministic_
+        ? TREE_DETERMINISTIC_BLOCK : (n_trees_ + n_blocks - 1) / n_blocks;
+    n_blocks = (n_trees_ + block - 1) / block;
+    bool parallel = N > omp_N_ || n_trees_ > omp_tree_;
+    tile_kernel<AGG> kernel = select_tile_kernel<AGG>();
+
+    if (n_blocks > 1 && (!parallel ||
+            n_tiles >= TREE_TASKS_PER_THREAD * ThreadPool::global().n_threads())) {
+        // deterministic mode, enough tiles for every thread,
+        // every task computes all blocks for one tile
+        auto compute_tile_blocks = [&](int64_t t, int th) {
+            TreeEnsembleScratch<NTYPE>& scratch = TreeEnsembleScratch<NTYPE>::get();
+            int64_t begin = t * tile;
+            int64_t end = std::min(begin + tile, N);
+            int64_t size = (end - begin) * n_classes;
+            int64_t stride;
+            const NTYPE* x = tree_input_rows(input, begin, end, scratch.inputs, stride);
+            TreeEnsembleScratch<NTYPE>::reset(scratch.block_scores, scratch.block_has_scores,
+                                              n_blocks * size);
+            for (int64_t b = 0; b < n_blocks; ++b)
+                (this->*kernel)(agg, 0, end - begin, b * block, std::min((b + 1) * block, n_trees_),
+                                x, stride, scratch.block_scores.data() + b * size,
+                                scratch.block_has_scores.data() + b * size);
+            reduce_blocks(agg, n_blocks, size, size,
+                          scratch.block_scores.data(), scratch.block_has_scores.data());
+            finalize_tile(agg, begin, end,
+                          scratch.block_scores.data(), scratch.block_has_scores.data(),
+                          z_data, y_data, scratch.add_second_class);
+        };
+        if (parallel)
+            ThreadPool::global().parallel_for(n_tiles, compute_tile_blocks);
+        else {
+            for (int64_t t = 0; t < n_tiles; ++t)
+                compute_tile_blocks(t, 0);
         }
+        return;
+    }
+
+    if (n_blocks == 1) {
+        auto compute_tile = [&](int64_t t, int th) {
+            TreeEnsembleScratch<NTYPE>& scratch = TreeEnsembleScratch<NTYPE>::get();
+            int64_t begin = t * tile;
+            int64_t end = std::min(begin + tile, N);
+            int64_t stride;
+            const NTYPE* x = tree_input_rows(input, begin, end, scratch.inputs, stride);
+            TreeEnsembleScratch<NTYPE>::reset(scratch.tile_scores, scratch.tile_has_scores,
+                                              (end - begin) * n_classes);
+            (this->*kernel)(agg, 0, end - begin, 0, n_trees_, x, stride,
+                            scratch.tile_scores.data(), scratch.tile_has_scores.data());
+            finalize_tile(agg, begin, end,
+                          scratch.tile_scores.data(), scratch.tile_has_scores.data(),
+                          z_data, y_data, scratch.add_second_class);
+        };
+        if (parallel)
+            ThreadPool::global().parallel_for(n_tiles, compute_tile);
         else {
-            if (N <= omp_N_) {
-                NTYPE scores;
-                unsigned char has_scores;
-                size_t j;
-
-                for (int64_t i = 0; i < N; ++i) {
-                    scores = 0;
-                    has_scores = 0;
-                    for (j = 0; j < (size_t)n_trees_; ++j)
-                        agg.ProcessTreeNodePrediction1(
-                            &scores,
-                            ProcessTreeNodeLeave(roots_[j], x_data + i * stride),
-                            &has_scores);
-                    agg.FinalizeScores1((NTYPE*)Z_.data(i), scores, has_scores,
-                                        Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(i));
+            for (int64_t t = 0; t < n_tiles; ++t)
+                compute_tile(t, 0);
+        }
+        return;
+    }
+
+    // every block of trees fills its own copy of the scores
+    TreeEnsembleScratch<NTYPE>& scratch = TreeEnsembleScratch<NTYPE>::get();
+    int64_t block_size = N * n_classes;
+    TreeEnsembleScratch<NTYPE>::reset(scratch.block_scores, scratch.block_has_scores,
+                                      n_blocks * block_size);
+    NTYPE* block_scores = scratch.block_scores.data();
+    unsigned char* block_has_scores = scratch.block_has_scores.data();
+
+    ThreadPool::global().parallel_for(n_tiles * n_blocks, [&](int64_t task, int th) {
+        int64_t t = task / n_blocks;
+        int64_t b = task % n_blocks;
+        int64_t begin = t * tile;
+        int64_t end = std::min(begin + tile, N);
+        int64_t offset = b * block_size + begin * n_classes;
+        // every block copies the rows of its tile again if the types
+        // or the layout differ
+        int64_t stride;
+        const NTYPE* x = tree_input_rows(input, begin, end,
+                                         TreeEnsembleScratch<NTYPE>::get().inputs, stride);
+        (this->*kernel)(agg, 0, end - begin,
+                        b * block, std::min((b + 1) * block, n_trees_), x, stride,
+                        block_scores + offset, block_has_scores + offset);
+    });
+
+    // blocks are merged in the same order whatever the thread which computed them
+    ThreadPool::global().parallel_for(n_tiles, [&](int64_t t, int th) {
+        TreeEnsembleScratch<NTYPE>& row_scratch = TreeEnsembleScratch<NTYPE>::get();
+        int64_t begin = t * tile;
+        int64_t end = std::min(begin + tile, N);
+        NTYPE* scores = block_scores + begin * n_classes;
+        unsigned char* has_scores = block_has_scores + begin * n_classes;
+        reduce_blocks(agg, n_blocks, block_size, (end - begin) * n_classes, scores, has_scores);
+        finalize_tile(agg, begin, end, scores, has_scores, z_data, y_data,
+                      row_scratch.add_second_class);
+    });
+}
+
+
+template<typename NTYPE>
+template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::reduce_blocks(
+        const AGG &agg, int64_t n_blocks, int64_t block_stride,
+        int64_t n, NTYPE* scores, unsigned char* has_scores) const {
+    // pairwise reduction into the first block, the order only
+    // depends on the number of blocks
+    int64_t i, b, offset;
+    for (int64_t step = 1; step < n_blocks; step *= 2) {
+        for (b = 0; b + step < n_blocks; b += 2 * step) {
+            offset = step * block_stride;
+            NTYPE* dest = scores + b * block_stride;
+            unsigned char* has_dest = has_scores + b * block_stride;
+            if (n_targets_or_classes_ == 1) {
+                for (i = 0; i < n; ++i)
+                    agg.MergePrediction1(dest + i, has_dest + i,
+                                         dest + offset + i, has_dest + offset + i);
+            }
+            else
+                agg.MergePrediction(n, dest, has_dest, dest + offset, has_dest + offset);
+        }
+    }
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_tile_size(int64_t N) const {
+    int64_t tile = tile_N_ < 1 ? 1 : (int64_t)tile_N_;
+    if (N > omp_N_) {
+        // keeps every thread busy
+        int64_t per_thread = N / ThreadPool::global().n_threads();
+        if (per_thread < tile)
+            tile = per_thread < 1 ? 1 : per_thread;
+    }
+    return tile;
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_tree_blocks(int64_t n_tiles, int64_t stride) const {
+    if (deterministic_)
+        return (n_trees_ + TREE_DETERMINISTIC_BLOCK - 1) / TREE_DETERMINISTIC_BLOCK;
+    // Trees are split only when the tiles cannot keep every thread busy,
+    // the bitvector evaluation computes all trees at once.
+    int n_threads = ThreadPool::global().n_threads();
+    if (n_threads <= 1 || n_trees_ <= omp_tree_ ||
+            (!quantized_ && get_simd_width(stride) == 0 &&
+             use_quickscorer_ && quickscorer_.n_trees_ > 0))
+        return 1;
+    int64_t n_blocks = (TREE_TASKS_PER_THREAD * n_threads + n_tiles - 1) / n_tiles;
+    return std::max((int64_t)1, std::min(n_blocks, n_trees_));
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::select_kernels() {
+    kernel_mode_ = (int)NODE_MODE::BRANCH_LEQ;
+    if (!same_mode_)
+        kernel_mode_ = TREE_MODE_MIXED;
+    else if (packed_) {
+        for (auto it = packed_nodes_.begin(); it != packed_nodes_.end(); ++it) {
+            if (it->is_not_leave()) {
+                kernel_mode_ = (int)it->mode();
+                break;
+            }
+        }
+    }
+    else {
+        for (int64_t i = 0; i < n_nodes_; ++i) {
+            if (nodes_[i].is_not_leave) {
+                kernel_mode_ = (int)nodes_[i].mode;
+                break;
+            }
+        }
+    }
+
+    #define TREE_KERNEL_FIND(MODE, MISSING) \
+        find_leave_ = &tree_find_leave<NTYPE, MODE, MISSING>; \
+        find_leave_packed_ = &tree_find_leave_packed<NTYPE, MODE, MISSING>;
+    TREE_KERNEL_SWITCH(kernel_mode_, has_missing_tracks_, TREE_KERNEL_FIND)
+    #undef TREE_KERNEL_FIND
+}
+
+
+template<typename NTYPE>
+template<typename AGG>
+typename RuntimeTreeEnsembleCommonP<NTYPE>::template tile_kernel<AGG>
+        RuntimeTreeEnsembleCommonP<NTYPE>::select_tile_kernel() const {
+    #define TREE_KERNEL_TILE(MODE, MISSING) \
+        if (n_targets_or_classes_ == 1) { \
+            if (packed_) \
+                return &RuntimeTreeEnsembleCommonP<NTYPE>::template \
+                    compute_gil_free_tile1<AGG, MODE, MISSING, true>; \
+            return &RuntimeTreeEnsembleCommonP<NTYPE>::template \
+                compute_gil_free_tile1<AGG, MODE, MISSING, false>; \
+        } \
+        if (packed_) \
+            return &RuntimeTreeEnsembleCommonP<NTYPE>::template \
+                compute_gil_free_tile<AGG, MODE, MISSING, true>; \
+        return &RuntimeTreeEnsembleCommonP<NTYPE>::template \
+            compute_gil_free_tile<AGG, MODE, MISSING, false>;
+    TREE_KERNEL_SWITCH(kernel_mode_, has_missing_tracks_, TREE_KERNEL_TILE)
+    #undef TREE_KERNEL_TILE
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::select_simd() {
+    // The vectorized traversal needs the compact layout, the same mode
+    // for every node and node indices fitting in a 32 bits gather.
+    simd_level_ = TREE_SIMD_NONE;
+    if (!packed_ || !same_mode_ || n_nodes_ >= ((int64_t)1 << 29))
+        return;
+    for (auto it = packed_nodes_.begin(); it != packed_nodes_.end(); ++it) {
+        if (it->is_not_leave()) {
+            simd_mode_ = it->mode();
+            simd_level_ = tree_simd_level<NTYPE>();
+            return;
+        }
+    }
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_simd_width(int64_t stride) const {
+    if (!use_simd_ || simd_level_ == TREE_SIMD_NONE)
+        return 0;
+    int64_t width = tree_simd_width(simd_level_);
+    // offsets of the gathered features are 32 bits integers
+    return stride * width < ((int64_t)1 << 31) ? width : 0;
+}
+
+
+template<typename NTYPE>
+template<typename AGG, typename QTYPE, int MODE, bool MISSING>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_quantized_tile1(
+        const AGG &agg, int64_t n, int64_t tree_begin, int64_t tree_end,
+        const NTYPE* x_data, int64_t stride,
+        NTYPE* scores, unsigned char* has_scores) const {
+    int64_t n_cols = quantized_forest_.n_columns();
+    std::vector<QTYPE>& bins = TreeEnsembleScratch<NTYPE>::get().bins((QTYPE)0);
+    bins.resize(n * n_cols);
+    quantized_forest_.bin(x_data, n, stride, bins.data());
+    const TreeNodeElementQuantized<QTYPE> * nodes = quantized_forest_.nodes((QTYPE)0);
+    const TreeNodeElementQuantized<QTYPE> * root;
+    const QTYPE* row;
+    int64_t i;
+    for (int64_t j = tree_begin; j < tree_end; ++j) {
+        root = nodes + quantized_forest_.roots_[j];
+        for (i = 0, row = bins.data(); i < n; ++i, row += n_cols)
+            agg.ProcessLeafPrediction1(
+                scores + i,
+                quantized_forest_.weights_.data() +
+                    tree_find_leave_quantized<QTYPE, MODE, MISSING>(nodes, root, row)->truenode,
+                has_scores + i);
+    }
+}
+
+
+template<typename NTYPE>
+template<typename AGG, typename QTYPE, int MODE, bool MISSING>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_quantized_tile(
+        const AGG &agg, int64_t n, int64_t tree_begin, int64_t tree_end,
+        const NTYPE* x_data, int64_t stride,
+        NTYPE* scores, unsigned char* has_scores) const {
+    int64_t n_cols = quantized_forest_.n_columns();
+    int64_t n_classes = n_targets_or_classes_;
+    std::vector<QTYPE>& bins = TreeEnsembleScratch<NTYPE>::get().bins((QTYPE)0);
+    bins.resize(n * n_cols);
+    quantized_forest_.bin(x_data, n, stride, bins.data());
+    const TreeNodeElementQuantized<QTYPE> * nodes = quantized_forest_.nodes((QTYPE)0);
+    const TreeNodeElementQuantized<QTYPE> * root;
+    const TreeNodeElementQuantized<QTYPE> * leaf;
+    const SparseValue<NTYPE> * weights;
+    const QTYPE* row;
+    int64_t i;
+    for (int64_t j = tree_begin; j < tree_end; ++j) {
+        root = nodes + quantized_forest_.roots_[j];
+        for (i = 0, row = bins.data(); i < n; ++i, row += n_cols) {
+            leaf = tree_find_leave_quantized<QTYPE, MODE, MISSING>(nodes, root, row);
+            weights = quantized_forest_.weights_.data() + leaf->truenode;
+            agg.ProcessLeafPrediction(scores + i * n_classes, weights, weights + leaf->falsenode,
+                                      has_scores + i * n_classes);
+        }
+    }
+}
+
+
+template<typename NTYPE>
+template<typename AGG, int MODE, bool MISSING, bool PACKED>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_tile1(
+        const AGG &agg, int64_t begin, int64_t end,
+        int64_t tree_begin, int64_t tree_end,
+        const NTYPE* x_data, int64_t stride,
+        NTYPE* scores, unsigned char* has_scores) const {
+    // Every tree is evaluated for all rows of the tile before
+    // going to the next one, the tree stays in cache.
+    int64_t n = end - begin;
+    const NTYPE* x_begin = x_data + begin * stride;
+    const NTYPE* x;
+    int64_t i, j, k;
+    // the vectorized traversal is faster when it is available
+    int64_t width = get_simd_width(stride);
+    if (quantized_) {
+        if (quantized_forest_.bits_ == 8)
+            compute_quantized_tile1<AGG, uint8_t, MODE, MISSING>(
+                agg, n, tree_begin, tree_end, x_begin, stride, scores, has_scores);
+        else
+            compute_quantized_tile1<AGG, uint16_t, MODE, MISSING>(
+                agg, n, tree_begin, tree_end, x_begin, stride, scores, has_scores);
+    }
+    else if (width == 0 && use_quickscorer_ && quickscorer_.n_trees_ > 0 &&
+             tree_begin == 0 && tree_end == n_trees_) {
+        // all trees are evaluated at once (see get_tree_blocks)
+        std::vector<uint64_t>& bitvectors = TreeEnsembleScratch<NTYPE>::get().bitvectors;
+        bitvectors.resize(n_trees_);
+        const SparseValue<NTYPE> * weights_end;
+        for (i = 0, x = x_begin; i < n; ++i, x += stride) {
+            quickscorer_.compute_leaves(x, bitvectors.data());
+            for (j = 0; j < n_trees_; ++j)
+                agg.ProcessLeafPrediction1(
+                    scores + i, quickscorer_.leaf_weights(j, bitvectors[j], &weights_end),
+                    has_scores + i);
+        }
+    }
+    else {
+        uint32_t leaves[16];
+        for (j = tree_begin; j < tree_end; ++j) {
+            i = 0;
+            x = x_begin;
+            if (width > 0) {
+                for (; i + width <= n; i += width, x += width * stride) {
+                    tree_simd_leaves(simd_level_, simd_mode_, has_missing_tracks_,
+                                     packed_nodes_.data(), packed_roots_[j], x, stride, leaves);
+                    for (k = 0; k < width; ++k)
+                        agg.ProcessLeafPrediction1(
+                            scores + i + k,
+                            leaf_weights_.data() + packed_nodes_[leaves[k]].truenode,
+                            has_scores + i + k);
                 }
             }
+            if (PACKED) {
+                const TreeNodeElementPacked<NTYPE> * nodes = packed_nodes_.data();
+                const TreeNodeElementPacked<NTYPE> * root = nodes + packed_roots_[j];
+                for (; i < n; ++i, x += stride)
+                    agg.ProcessLeafPrediction1(
+                        scores + i,
+                        leaf_weights_.data() +
+                            tree_find_leave_packed<NTYPE, MODE, MISSING>(nodes, root, x)->truenode,
+                        has_scores + i);
+            }
             else {
-                NTYPE scores;
-                unsigned char has_scores;
-                size_t j;
-
-                #ifdef USE_OPENMP
-                #pragma omp parallel for private(j, scores, has_scores)
-                #endif
-                for (int64_t i = 0; i < N; ++i) {
-                    scores = 0;
-                    has_scores = 0;
-                    for (j = 0; j < (size_t)n_trees_; ++j)
-                        agg.ProcessTreeNodePrediction1(
-                            &scores,
-                            ProcessTreeNodeLeave(roots_[j], x_data + i * stride),
-                            &has_scores);
-                    agg.FinalizeScores1((NTYPE*)Z_.data(i), scores, has_scores,
-                                        Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(i));
-                }
+                TreeNodeElement<NTYPE> * root = roots_[j];
+                for (; i < n; ++i, x += stride)
+                    agg.ProcessTreeNodePrediction1(
+                        scores + i, tree_find_leave<NTYPE, MODE, MISSING>(root, x),
+                        has_scores + i);
+            }
+        }
+    }
+}
+
+
+template<typename NTYPE>
+template<typename AGG, int MODE, bool MISSING, bool PACKED>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_tile(
+        const AGG &agg, int64_t begin, int64_t end,
+        int64_t tree_begin, int64_t tree_end,
+        const NTYPE* x_data, int64_t stride,
+        NTYPE* tile_scores, unsigned char* tile_has_scores) const {
+    int64_t n = end - begin;
+    int64_t n_classes = n_targets_or_classes_;
+    const NTYPE* x_begin = x_data + begin * stride;
+    const NTYPE* x;
+    const TreeNodeElementPacked<NTYPE> * leaf;
+    const SparseValue<NTYPE> * weights;
+    const SparseValue<NTYPE> * weights_end;
+    int64_t i, j, k;
+    int64_t width = get_simd_width(stride);
+    if (quantized_) {
+        if (quantized_forest_.bits_ == 8)
+            compute_quantized_tile<AGG, uint8_t, MODE, MISSING>(
+                agg, n, tree_begin, tree_end, x_begin, stride, tile_scores, tile_has_scores);
+        else
+            compute_quantized_tile<AGG, uint16_t, MODE, MISSING>(
+                agg, n, tree_begin, tree_end, x_begin, stride, tile_scores, tile_has_scores);
+    }
+    else if (width == 0 && use_quickscorer_ && quickscorer_.n_trees_ > 0 &&
+             tree_begin == 0 && tree_end == n_trees_) {
+        std::vector<uint64_t>& bitvectors = TreeEnsembleScratch<NTYPE>::get().bitvectors;
+        bitvectors.resize(n_trees_);
+        for (i = 0, x = x_begin; i < n; ++i, x += stride) {
+            quickscorer_.compute_leaves(x, bitvectors.data());
+            for (j = 0; j < n_trees_; ++j) {
+                weights = quickscorer_.leaf_weights(j, bitvectors[j], &weights_end);
+                agg.ProcessLeafPrediction(tile_scores + i * n_classes, weights, weights_end,
+                                          tile_has_scores + i * n_classes);
             }
         }
     }
     else {
-        if (N == 1) {
-            std::vector<NTYPE>& scores = _scores_classes[0];
-            std::vector<unsigned char>& has_scores = _has_scores_classes[0];
-            std::fill(scores.begin(), scores.end(), (NTYPE)0);
-            std::fill(has_scores.begin(), has_scores.end(), 0);
-
-            if (n_trees_ <= omp_tree_) {
-                for (int64_t j = 0; j < n_trees_; ++j) {
-                    agg.ProcessTreeNodePrediction(
-                        scores.data(),
-                        ProcessTreeNodeLeave(roots_[j], x_data),
-                        has_scores.data());
+        uint32_t leaves[16];
+        for (j = tree_begin; j < tree_end; ++j) {
+            i = 0;
+            x = x_begin;
+            if (width > 0) {
+                for (; i + width <= n; i += width, x += width * stride) {
+                    tree_simd_leaves(simd_level_, simd_mode_, has_missing_tracks_,
+                                     packed_nodes_.data(), packed_roots_[j], x, stride, leaves);
+                    for (k = 0; k < width; ++k) {
+                        leaf = packed_nodes_.data() + leaves[k];
+                        if (dense_leaves_) {
+                            agg.ProcessLeafPredictionDense(tile_scores + (i + k) * n_classes,
+                                                           dense_weights_.data() + leaf->truenode,
+                                                           tile_has_scores + (i + k) * n_classes);
+                            continue;
+                        }
+                        weights = leaf_weights_.data() + leaf->truenode;
+                        agg.ProcessLeafPrediction(tile_scores + (i + k) * n_classes,
+                                                  weights, weights + leaf->falsenode,
+                                                  tile_has_scores + (i + k) * n_classes);
+                    }
                 }
-                agg.FinalizeScores(scores, has_scores, (NTYPE*)Z_.data(0), -1,
-                                   Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(0));
             }
-            else {
-                for(size_t i = 0; i < _scores_classes.size(); ++i) {
-                    std::fill(_scores_classes[i].begin(), _scores_classes[i].end(), (NTYPE)0);
-                    std::fill(_has_scores_classes[i].begin(), _has_scores_classes[i].end(), 0);
+            if (PACKED) {
+                const TreeNodeElementPacked<NTYPE> * nodes = packed_nodes_.data();
+                const TreeNodeElementPacked<NTYPE> * root = nodes + packed_roots_[j];
+                if (dense_leaves_) {
+                    for (; i < n; ++i, x += stride)
+                        agg.ProcessLeafPredictionDense(
+                            tile_scores + i * n_classes,
+                            dense_weights_.data() +
+                                tree_find_leave_packed<NTYPE, MODE, MISSING>(nodes, root, x)->truenode,
+                            tile_has_scores + i * n_classes);
                 }
-                #ifdef USE_OPENMP
-                #pragma omp parallel
-                #endif
-                {
-                    #ifdef USE_OPENMP
-                    #pragma omp for
-                    #endif
-                    for (int64_t j = 0; j < n_trees_; ++j) {
-                        auto th = omp_get_thread_num();
-                        std::vector<NTYPE>& private_scores = _scores_classes[th];
-                        std::vector<unsigned char>& private_has_scores = _has_scores_classes[th];
-                        agg.ProcessTreeNodePrediction(
-                            private_scores.data(),
-                            ProcessTreeNodeLeave(roots_[j], x_data),
-                            private_has_scores.data());
-                    }
+                for (; i < n; ++i, x += stride) {
+                    leaf = tree_find_leave_packed<NTYPE, MODE, MISSING>(nodes, root, x);
+                    weights = leaf_weights_.data() + leaf->truenode;
+                    agg.ProcessLeafPrediction(tile_scores + i * n_classes,
+                                              weights, weights + leaf->falsenode,
+                                              tile_has_scores + i * n_classes);
                 }
-            
-                for (size_t i = 1; i < _scores_classes.size(); ++i) {
-                    agg.MergePrediction(n_targets_or_classes_,
-                        scores.data(), has_scores.data(),
-                        _scores_classes[i].data(), _has_scores_classes[i].data());
+            }
+            else {
+                TreeNodeElement<NTYPE> * root = roots_[j];
+                if (dense_leaves_) {
+                    for (; i < n; ++i, x += stride)
+                        agg.ProcessLeafPredictionDense(
+                            tile_scores + i * n_classes,
+                            dense_weights_.data() +
+                                tree_find_leave<NTYPE, MODE, MISSING>(root, x)->dense_offset,
+                            tile_has_scores + i * n_classes);
                 }
-
-                agg.FinalizeScores(scores, has_scores, (NTYPE*)Z_.data(0), -1,
-                                   Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(0));
+                for (; i < n; ++i, x += stride)
+                    agg.ProcessTreeNodePrediction(
+                        tile_scores + i * n_classes, tree_find_leave<NTYPE, MODE, MISSING>(root, x),
+                        tile_has_scores + i * n_classes);
             }
         }
-        else {
-            if (N <= omp_N_) {
-                std::vector<NTYPE>& scores = _scores_classes[0];
-                std::vector<unsigned char>& has_scores = _has_scores_classes[0];
-                size_t j;
-
-                for (int64_t i = 0; i < N; ++i) {
-                    std::fill(scores.begin(), scores.end(), (NTYPE)0);
-                    std::fill(has_scores.begin(), has_scores.end(), 0);
-                    for (j = 0; j < roots_.size(); ++j)
-                        agg.ProcessTreeNodePrediction(
-                            scores.data(),
-                            ProcessTreeNodeLeave(roots_[j], x_data + i * stride),
-                            has_scores.data());
-                    agg.FinalizeScores(scores, has_scores,
-                                       (NTYPE*)Z_.data(i * n_targets_or_classes_), -1,
-                                       Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(i));
+        // the dense aggregation does not track the classes receiving a weight,
+        // they all do
+        if (dense_leaves_ && tree_end > tree_begin)
+            std::fill(tile_has_scores, tile_has_scores + n * n_classes, 1);
+    }
+}
+
+
+template<typename NTYPE>
+template<typename AGG, typename XTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_profile(
+        int64_t N, const TreeInput<XTYPE>& input,
+        NTYPE* z_data, int64_t* y_data, const AGG &agg) const {
+    int64_t n_classes = n_targets_or_classes_;
+    int64_t tile = get_tile_size(N);
+    int64_t n_tiles = (N + tile - 1) / tile;
+    // one set of counters per thread, merged at the end
+    std::vector<std::vector<int64_t>> counts(ThreadPool::global().n_threads());
+
+    auto compute_tile = [&](int64_t t, int th) {
+        std::vector<int64_t>& local = counts[th];
+        if (local.empty())
+            local.resize(n_nodes_ * 2, 0);
+        TreeEnsembleScratch<NTYPE>& scratch = TreeEnsembleScratch<NTYPE>::get();
+        std::vector<NTYPE>& scores = scratch.scores;
+        std::vector<unsigned char>& has_scores = scratch.has_scores;
+        int64_t begin = t * tile;
+        int64_t end = std::min(N, begin + tile);
+        scratch.add_second_class.resize(end - begin);
+        int64_t stride;
+        const NTYPE* rows = tree_input_rows(input, begin, end, scratch.inputs, stride);
+        const NTYPE* x;
+        const SparseValue<NTYPE> * weights;
+        int64_t i, j, leaf;
+        for (i = begin; i < end; ++i) {
+            x = rows + (i - begin) * stride;
+            TreeEnsembleScratch<NTYPE>::reset(scores, has_scores, n_classes);
+            for (j = 0; j < n_trees_; ++j) {
+                if (packed_) {
+                    leaf = tree_profile_leave_packed(packed_nodes_.data(), packed_roots_[j],
+                                                     x, local.data());
+                    weights = leaf_weights_.data() + packed_nodes_[leaf].truenode;
+                    agg.ProcessLeafPrediction(scores.data(), weights,
+                                              weights + packed_nodes_[leaf].falsenode,
+                                              has_scores.data());
                 }
-            }
-            else {
-                #ifdef USE_OPENMP
-                #pragma omp parallel
-                #endif
-                {
-                    #ifdef USE_OPENMP
-                    #pragma omp for
-                    #endif
-                    for (int64_t i = 0; i < N; ++i) {
-                        auto th = omp_get_thread_num();
-                        std::vector<NTYPE>& scores = _scores_classes[th];
-                        std::vector<unsigned char>& has_scores = _has_scores_classes[th];
-                        std::fill(scores.begin(), scores.end(), (NTYPE)0);
-                        std::fill(has_scores.begin(), has_scores.end(), 0);
-                        for (size_t j = 0; j < roots_.size(); ++j)
-                            agg.ProcessTreeNodePrediction(
-                                scores.data(),
-                                ProcessTreeNodeLeave(roots_[j], x_data + i * stride),
-                                has_scores.data());
-                        agg.FinalizeScores(scores, has_scores,
-                                           (NTYPE*)Z_.data(i * n_targets_or_classes_), -1,
-                                           Y == NULL ? NULL : (int64_t*)_mutable_unchecked1(*Y).data(i));
-                    }
+                else {
+                    leaf = tree_profile_leave(nodes_, roots_[j], x, local.data());
+                    agg.ProcessTreeNodePrediction(scores.data(), nodes_ + leaf, has_scores.data());
                 }
             }
+            if (n_classes == 1)
+                agg.FinalizeScores1(z_data + i, scores[0], has_scores[0],
+                                    y_data == NULL ? NULL : y_data + i);
+            else
+                scratch.add_second_class[i - begin] = agg.FinalizeScores(
+                    scores.data(), has_scores.data(), z_data + i * n_classes,
+                    y_data == NULL ? NULL : y_data + i);
         }
+        if (n_classes > 1)
+            agg.PostTransform(end - begin, z_data + begin * n_classes,
+                              scratch.add_second_class.data());
+    };
+
+    if (N > omp_N_ || n_trees_ > omp_tree_)
+        ThreadPool::global().parallel_for(n_tiles, compute_tile);
+    else {
+        for (int64_t t = 0; t < n_tiles; ++t)
+            compute_tile(t, 0);
+    }
+
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    profile_counts_.resize(n_nodes_ * 2, 0);
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        for (size_t k = 0; k < it->size(); ++k)
+            profile_counts_[k] += (*it)[k];
     }
+    profile_rows_ += N;
 }
-              
 
 
-#define TREE_FIND_VALUE(CMP) \
-    if (has_missing_tracks_) { \
-        while (root->is_not_leave) { \
-            val = x_data[root->feature_id]; \
-            root = (val CMP root->value || \
-                    (root->is_missing_track_true && _isnan_(val) )) \
-                        ? root->truenode : root->falsenode; \
-        } \
-    } \
-    else { \
-        while (root->is_not_leave) { \
-            val = x_data[root->feature_id]; \
-            root = val CMP root->value ? root->truenode : root->falsenode; \
-        } \
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::node_position(int64_t i) const {
+    return node_positions_.empty() ? i : (int64_t)node_positions_[i];
+}
+
+
+template<typename NTYPE>
+py::array_t<int64_t> RuntimeTreeEnsembleCommonP<NTYPE>::get_node_counts() const {
+    py::array_t<int64_t> res(n_nodes_ * 3);
+    int64_t* data = (int64_t*)_mutable_unchecked1(res).data(0);
+    std::fill(data, data + n_nodes_ * 3, 0);
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    int64_t* row;
+    bool leaf;
+    for (int64_t i = 0; i < (int64_t)profile_counts_.size() / 2; ++i) {
+        row = data + node_position(i) * 3;
+        leaf = packed_ ? !packed_nodes_[i].is_not_leave() : !nodes_[i].is_not_leave;
+        row[0] = profile_counts_[i * 2];
+        row[1] = profile_counts_[i * 2 + 1];
+        row[2] = leaf ? 0 : row[0] - row[1];
+    }
+    res.resize({(size_t)n_nodes_, (size_t)3});
+    return res;
+}
+
+
+template<typename NTYPE>
+py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::get_hitrates() const {
+    py::array_t<NTYPE> res(n_nodes_);
+    NTYPE* data = (NTYPE*)_mutable_unchecked1(res).data(0);
+    std::fill(data, data + n_nodes_, (NTYPE)0);
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (profile_counts_.empty() || profile_rows_ == 0)
+        return res;
+    for (int64_t i = 0; i < n_nodes_; ++i)
+        data[node_position(i)] = (NTYPE)profile_counts_[i * 2] / (NTYPE)profile_rows_;
+    return res;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::reset_node_counts() {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    profile_counts_ = std::vector<int64_t>();
+    profile_rows_ = 0;
+}
+
+
+template<typename NTYPE>
+template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::finalize_tile(
+        const AGG &agg, int64_t begin, int64_t end,
+        NTYPE* tile_scores, unsigned char* tile_has_scores,
+        NTYPE* z_data, int64_t* y_data, std::vector<int>& add_second_class) const {
+    int64_t n = end - begin;
+    int64_t n_classes = n_targets_or_classes_;
+    int64_t i;
+    if (n_classes == 1) {
+        for (i = 0; i < n; ++i)
+            agg.FinalizeScores1(z_data + begin + i, tile_scores[i], tile_has_scores[i],
+                                y_data == NULL ? NULL : y_data + begin + i);
+        return;
     }
+    // the raw scores are written first, the post transform
+    // is then applied to the whole tile
+    add_second_class.resize(n);
+    for (i = 0; i < n; ++i)
+        add_second_class[i] = agg.FinalizeScores(
+            tile_scores + i * n_classes, tile_has_scores + i * n_classes,
+            z_data + (begin + i) * n_classes,
+            y_data == NULL ? NULL : y_data + begin + i);
+    agg.PostTransform(n, z_data + begin * n_classes, add_second_class.data());
+}
 
 
 template<typename NTYPE>
 TreeNodeElement<NTYPE> * 
         RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreeNodeLeave(
             TreeNodeElement<NTYPE> * root, const NTYPE* x_data) const {
-    NTYPE val;
-    if (same_mode_) {
-        switch(root->mode) {
-            case NODE_MODE::BRANCH_LEQ:
-                if (has_missing_tracks_) {
-                    while (root->is_not_leave) {
-                        val = x_data[root->feature_id];
-                        root = (val <= root->value ||
-                                (root->is_missing_track_true && _isnan_(val) ))
-                                    ? root->truenode : root->falsenode;
-                    }
-                }
-                else {
-                    while (root->is_not_leave) {
-                        val = x_data[root->feature_id];
-                        root = val <= root->value ? root->truenode : root->falsenode;
-                    }
-                }
-                break;
-            case NODE_MODE::BRANCH_LT:
-                TREE_FIND_VALUE(<)
-                break;
-            case NODE_MODE::BRANCH_GTE:
-                TREE_FIND_VALUE(>=)
-                break;
-            case NODE_MODE::BRANCH_GT:
-                TREE_FIND_VALUE(>)
-                break;
-            case NODE_MODE::BRANCH_EQ:
-                TREE_FIND_VALUE(==)
-                break;
-            case NODE_MODE::BRANCH_NEQ:
-                TREE_FIND_VALUE(!=)
-                break;
-            case NODE_MODE::LEAF:
-                break;
-            default: {
-                std::ostringstream err_msg;
-                err_msg << "Invalid mode of value: " << static_cast<std::underlying_type<NODE_MODE>::type>(root->mode);
-                throw std::runtime_error(err_msg.str());
-            }
+    return (*find_leave_)(root, x_data);
+}
+
+
+template<typename NTYPE>
+const TreeNodeElementPacked<NTYPE> * 
+        RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreeNodeLeavePacked(
+            const TreeNodeElementPacked<NTYPE> * root, const NTYPE* x_data) const {
+    return (*find_leave_packed_)(packed_nodes_.data(), root, x_data);
+}
+
+
+template<typename NTYPE>
+template<typename AGG>
+inline void RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreePrediction1(
+        const AGG &agg, int64_t j, const NTYPE* x_data,
+        NTYPE* predictions, unsigned char* has_predictions) const {
+    if (packed_) {
+        const TreeNodeElementPacked<NTYPE> * leaf = ProcessTreeNodeLeavePacked(
+            packed_nodes_.data() + packed_roots_[j], x_data);
+        agg.ProcessLeafPrediction1(predictions, leaf_weights_.data() + leaf->truenode,
+                                   has_predictions);
+    }
+    else
+        agg.ProcessTreeNodePrediction1(predictions, ProcessTreeNodeLeave(roots_[j], x_data),
+                                       has_predictions);
+}
+
+
+template<typename NTYPE>
+template<typename AGG>
+inline void RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreePrediction(
+        const AGG &agg, int64_t j, const NTYPE* x_data,
+        NTYPE* predictions, unsigned char* has_predictions) const {
+    if (packed_) {
+        const TreeNodeElementPacked<NTYPE> * leaf = ProcessTreeNodeLeavePacked(
+            packed_nodes_.data() + packed_roots_[j], x_data);
+        const SparseValue<NTYPE> * weights = leaf_weights_.data() + leaf->truenode;
+        agg.ProcessLeafPrediction(predictions, weights, weights + leaf->falsenode,
+                                  has_predictions);
+    }
+    else
+        agg.ProcessTreeNodePrediction(predictions, ProcessTreeNodeLeave(roots_[j], x_data),
+                                      has_predictions);
+}
+
+
+template<typename NTYPE>
+inline const NTYPE* RuntimeTreeEnsembleCommonP<NTYPE>::dense_leaf_weights(
+        int64_t j, const NTYPE* x_data) const {
+    if (packed_)
+        return dense_weights_.data() + ProcessTreeNodeLeavePacked(
+            packed_nodes_.data() + packed_roots_[j], x_data)->truenode;
+    return dense_weights_.data() + ProcessTreeNodeLeave(roots_[j], x_data)->dense_offset;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::autotune(py::array_t<NTYPE> X, int repeat) {
+    std::vector<int64_t> x_dims;
+    arrayshape2vector(x_dims, X);
+    if (x_dims.size() != 2 || x_dims[0] == 0)
+        throw std::runtime_error("X must have 2 dimensions and at least one row.");
+    if (repeat < 1)
+        repeat = 1;
+    int64_t N = x_dims[0];
+    py::array_t<NTYPE> Z(N * n_targets_or_classes_);
+    TreeInput<NTYPE> input = tree_input(X, x_dims);
+    NTYPE* z_data = (NTYPE*)_mutable_unchecked1(Z).data(0);
+    _AggregatorSum<NTYPE> agg(n_trees_, n_targets_or_classes_, post_transform_, &base_values_);
+    const int sequential = std::numeric_limits<int>::max();
+    py::gil_scoped_release release;
+    // the intermediate values must not be seen by another thread
+    std::lock_guard<TreeEnsembleSettingsLock> settings(settings_lock_);
+
+    // best time of the first n rows
+    auto measure = [&](int64_t n) -> double {
+        double best = -1;
+        for (int r = 0; r < repeat; ++r) {
+            auto start = std::chrono::high_resolution_clock::now();
+            compute_gil_free(n, input, z_data, (int64_t*)NULL, agg);
+            double t = std::chrono::duration<double>(
+                std::chrono::high_resolution_clock::now() - start).count();
+            if (best < 0 || t < best)
+                best = t;
+        }
+        return best;
+    };
+
+    // tile size on one thread
+    omp_tree_ = sequential;
+    omp_N_ = sequential;
+    int tiles[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    int best_tile = 1;
+    double best_time = -1, t;
+    for (size_t i = 0; i < sizeof(tiles) / sizeof(int); ++i) {
+        if (tiles[i] > 1 && tiles[i] > N)
+            break;
+        tile_N_ = tiles[i];
+        t = measure(N);
+        if (best_time < 0 || t < best_time) {
+            best_time = t;
+            best_tile = tiles[i];
         }
     }
-    else {  // Different rules to compare to node thresholds.
-        NTYPE threshold;
-        while (root->is_not_leave) {
-            val = x_data[root->feature_id];
-            threshold = root->value;
-            switch (root->mode) {
-                case NODE_MODE::BRANCH_LEQ:
-                    root = val <= threshold || (root->is_missing_track_true && _isnan_(val))
-                              ? root->truenode
-                              : root->falsenode;
-                    break;
-                case NODE_MODE::BRANCH_LT:
-                    root = val < threshold || (root->is_missing_track_true && _isnan_(val))
-                              ? root->truenode
-                              : root->falsenode;
-                    break;
-                case NODE_MODE::BRANCH_GTE:
-                    root = val >= threshold || (root->is_missing_track_true && _isnan_(val))
-                              ? root->truenode
-                              : root->falsenode;
-                    break;
-                case NODE_MODE::BRANCH_GT:
-                    root = val > threshold || (root->is_missing_track_true && _isnan_(val))
-                              ? root->truenode
-                              : root->falsenode;
-                    break;
-                case NODE_MODE::BRANCH_EQ:
-                    root = val == threshold || (root->is_missing_track_true && _isnan_(val))
-                              ? root->truenode
-                              : root->falsenode;
-                    break;
-                case NODE_MODE::BRANCH_NEQ:
-                    root = val != threshold || (root->is_missing_track_true && _isnan_(val))
-                              ? root->truenode
-                              : root->falsenode;
-                    break;
-                default: {
-                    std::ostringstream err_msg;
-                    err_msg << "Invalid mode of value: "
-                            << static_cast<std::underlying_type<NODE_MODE>::type>(root->mode);
-                    throw std::runtime_error(err_msg.str());
-                }
-            }
-        }      
+    tile_N_ = best_tile;
+
+    if (ThreadPool::global().n_threads() <= 1) {
+        omp_tree_ = (int)n_trees_;
+        omp_N_ = (int)N;
+        return;
     }
-    return root;
+
+    // trees in parallel for one observation
+    double t_seq = measure(1);
+    omp_tree_ = 0;
+    double t_par = measure(1);
+    int best_omp_tree = t_par < t_seq ? 0 : (int)n_trees_;
+
+    // smallest batch for which rows are better computed in parallel,
+    // batches bigger than the sample are computed in parallel,
+    // the trees are not split during these measures otherwise
+    // both settings would go through the thread pool
+    omp_tree_ = (int)n_trees_;
+    omp_N_ = (int)N;
+    for (int64_t n = 2; n <= N; n *= 2) {
+        omp_N_ = sequential;
+        t_seq = measure(n);
+        omp_N_ = 0;
+        t_par = measure(n);
+        if (t_par < t_seq) {
+            omp_N_ = (int)n - 1;
+            break;
+        }
+        omp_N_ = (int)N;
+    }
+    omp_tree_ = best_omp_tree;
 }
 
 
@@ -786,10 +2697,12 @@ py::array_t<int> RuntimeTreeEnsembleCommonP<NTYPE>::debug_threshold(
     const NTYPE* end = x_data + values.size();
     const NTYPE* pv;
     auto itb = result.begin();
-    auto nodes_end = nodes_ + n_nodes_;
-    for(auto it = nodes_; it != nodes_end; ++it)
+    NTYPE threshold;
+    for(int64_t i = 0; i < n_nodes_; ++i) {
+        threshold = packed_ ? packed_nodes_[i].value : nodes_[i].value;
         for(pv=x_data; pv != end; ++pv, ++itb)
-            *itb = *pv <= it->value ? 1 : 0;
+            *itb = *pv <= threshold ? 1 : 0;
+    }
     std::vector<ssize_t> shape = { n_nodes_, values.size() };
     std::vector<ssize_t> strides = { (ssize_t)(values.size()*sizeof(int)),
                                      (ssize_t)sizeof(int) };
@@ -814,28 +2727,26 @@ py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_tree_outputs_agg(p
     if (x_dims.size() != 2)
         throw std::runtime_error("X must have 2 dimensions.");
 
-    int64_t stride = x_dims.size() == 1 ? x_dims[0] : x_dims[1];  
-    int64_t N = x_dims.size() == 1 ? 1 : x_dims[0];
+    int64_t N = x_dims[0];
+    TreeInput<NTYPE> input = tree_input(X, x_dims);
 
-    std::vector<NTYPE> result(N * roots_.size());
-    const NTYPE* x_data = X.data(0);
+    std::vector<NTYPE> result(N * n_trees_);
+    std::vector<NTYPE> row;
+    int64_t stride;
     auto itb = result.begin();
 
     for (int64_t i=0; i < N; ++i) {  //for each class or target
-        int64_t current_weight_0 = i * stride;
-        for (size_t j = 0; j < roots_.size(); ++j, ++itb) {
+        const NTYPE* x = tree_input_rows(input, i, i + 1, row, stride);
+        for (int64_t j = 0; j < n_trees_; ++j, ++itb) {
             std::vector<NTYPE> scores(n_targets_or_classes_, (NTYPE)0);
             std::vector<unsigned char> has_scores(n_targets_or_classes_, 0);
-            agg.ProcessTreeNodePrediction(
-                    scores.data(),
-                    ProcessTreeNodeLeave(roots_[j], x_data + current_weight_0),
-                    has_scores.data());
+            ProcessTreePrediction(agg, j, x, scores.data(), has_scores.data());
             *itb = scores[0];
         }
     }
 
-    std::vector<ssize_t> shape = { (ssize_t)N, (ssize_t)roots_.size() };
-    std::vector<ssize_t> strides = { (ssize_t)(roots_.size()*sizeof(NTYPE)),
+    std::vector<ssize_t> shape = { (ssize_t)N, (ssize_t)n_trees_ };
+    std::vector<ssize_t> strides = { (ssize_t)(n_trees_*sizeof(NTYPE)),
                                      (ssize_t)sizeof(NTYPE) };
     return py::array_t<NTYPE>(
         py::buffer_info(
@@ -11,6 +11,7 @@
 #include <thread>
 #include <iterator>
 #include <algorithm>
+#include <map>
 
 #ifndef SKIP_PYTHON
 //#include <pybind11/iostream.h>
@@ -38,6 +39,125 @@ struct TreeNodeElementId {
 };
 
 
+/**
+* Finds the position of a node from its tree id and node id.
+* Node ids are usually small integers within a tree, a flat array
+* indexed by *offset of the tree + node id - smallest node id in the tree*
+* stores every position. A map is used instead if the ids are too sparse.
+*/
+class TreeNodeIndex {
+    public:
+
+        TreeNodeIndex() : min_tree_id_(0), sparse_(false) {}
+
+        // Returns -1 or the index of the first node already indexed.
+        int64_t init(const int64_t* tree_ids, const int64_t* node_ids, int64_t n) {
+            clear();
+            if (n == 0)
+                return -1;
+            int64_t max_tree_id = tree_ids[0];
+            min_tree_id_ = tree_ids[0];
+            int64_t i;
+            for (i = 1; i < n; ++i) {
+                if (tree_ids[i] < min_tree_id_)
+                    min_tree_id_ = tree_ids[i];
+                else if (tree_ids[i] > max_tree_id)
+                    max_tree_id = tree_ids[i];
+            }
+            if (max_tree_id - min_tree_id_ >= n)
+                return init_sparse(tree_ids, node_ids, n);
+
+            tree_slots_.resize(max_tree_id - min_tree_id_ + 1, -1);
+            int64_t slot;
+            for (i = 0; i < n; ++i) {
+                int64_t& s = tree_slots_[tree_ids[i] - min_tree_id_];
+                if (s == -1) {
+                    s = (int64_t)min_node_ids_.size();
+                    min_node_ids_.push_back(node_ids[i]);
+                    offsets_.push_back(node_ids[i]);
+                }
+                else if (node_ids[i] < min_node_ids_[s])
+                    min_node_ids_[s] = node_ids[i];
+                else if (node_ids[i] > offsets_[s])
+                    offsets_[s] = node_ids[i];
+            }
+            // offsets_ holds the largest node id of every tree until here
+            int64_t total = 0, range;
+            for (slot = 0; slot < (int64_t)offsets_.size(); ++slot) {
+                range = offsets_[slot] - min_node_ids_[slot] + 1;
+                offsets_[slot] = total;
+                total += range;
+            }
+            offsets_.push_back(total);
+            if (total > 2 * n + 1024)
+                return init_sparse(tree_ids, node_ids, n);
+
+            positions_.resize(total, -1);
+            for (i = 0; i < n; ++i) {
+                slot = tree_slots_[tree_ids[i] - min_tree_id_];
+                int64_t& pos = positions_[offsets_[slot] + node_ids[i] - min_node_ids_[slot]];
+                if (pos != -1)
+                    return i;
+                pos = i;
+            }
+            return -1;
+        }
+
+        // Returns the position of the node or -1 if it does not exist.
+        inline int64_t find(int64_t tree_id, int64_t node_id) const {
+            if (sparse_) {
+                TreeNodeElementId id;
+                id.tree_id = (int)tree_id;
+                id.node_id = (int)node_id;
+                auto it = sparse_ids_.find(id);
+                return it == sparse_ids_.end() ? -1 : it->second;
+            }
+            tree_id -= min_tree_id_;
+            if (tree_id < 0 || tree_id >= (int64_t)tree_slots_.size())
+                return -1;
+            int64_t slot = tree_slots_[tree_id];
+            if (slot == -1)
+                return -1;
+            node_id -= min_node_ids_[slot];
+            if (node_id < 0 || node_id >= offsets_[slot + 1] - offsets_[slot])
+                return -1;
+            return positions_[offsets_[slot] + node_id];
+        }
+
+        void clear() {
+            sparse_ = false;
+            tree_slots_.clear();
+            min_node_ids_.clear();
+            offsets_.clear();
+            positions_.clear();
+            sparse_ids_.clear();
+        }
+
+    private:
+
+        int64_t init_sparse(const int64_t* tree_ids, const int64_t* node_ids, int64_t n) {
+            clear();
+            sparse_ = true;
+            TreeNodeElementId id;
+            for (int64_t i = 0; i < n; ++i) {
+                id.tree_id = (int)tree_ids[i];
+                id.node_id = (int)node_ids[i];
+                if (!sparse_ids_.insert(std::pair<TreeNodeElementId, int64_t>(id, i)).second)
+                    return i;
+            }
+            return -1;
+        }
+
+        int64_t min_tree_id_;
+        bool sparse_;
+        std::vector<int64_t> tree_slots_;
+        std::vector<int64_t> min_node_ids_;
+        std::vector<int64_t> offsets_;
+        std::vector<int64_t> positions_;
+        std::map<TreeNodeElementId, int64_t> sparse_ids_;
+};
+
+
 template<typename NTYPE>
 struct SparseValue {
     int64_t i;
@@ -63,6 +183,8 @@ struct TreeNodeElement {
     TreeNodeElement *falsenode;
     MissingTrack missing_tracks;
     std::vector<SparseValue<NTYPE>> weights;
+    // position of the leaf weights in the dense table (see dense_leaves_)
+    int64_t dense_offset;
     
     bool is_not_leave;
     bool is_missing_track_true;
@@ -73,6 +195,42 @@ struct TreeNodeElement {
 };
 
 
+#define PACKED_FEATURE_MASK 0x00ffffff
+#define PACKED_MODE_SHIFT 24
+#define PACKED_MISSING_TRACK_TRUE 0x40000000
+#define PACKED_LEAF 0x80000000
+
+
+/**
+* Compact version of TreeNodeElement (16 bytes for float, 24 for double).
+* The feature index, the node mode and the flags share the same
+* 32 bits. *truenode* and *falsenode* are indices in the array
+* of packed nodes. For a leaf, *truenode* is the position of the first
+* weight in a contiguous array of weights and *falsenode*
+* the number of weights.
+*/
+template<typename NTYPE>
+struct TreeNodeElementPacked {
+    NTYPE value;
+    uint32_t feature_flags;
+    uint32_t truenode;
+    uint32_t falsenode;
+
+    inline int feature_id() const {
+        return (int)(feature_flags & PACKED_FEATURE_MASK);
+    }
+    inline NODE_MODE mode() const {
+        return (NODE_MODE)((feature_flags >> PACKED_MODE_SHIFT) & 0x7);
+    }
+    inline bool is_not_leave() const {
+        return (feature_flags & PACKED_LEAF) == 0;
+    }
+    inline bool is_missing_track_true() const {
+        return (feature_flags & PACKED_MISSING_TRACK_TRUE) != 0;
+    }
+};
+
+
 template<typename NTYPE>
 class _Aggregator
 {
@@ -104,6 +262,9 @@ class _Aggregator
         inline void ProcessTreeNodePrediction1(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                                unsigned char* has_predictions) const {}
 
+        inline void ProcessLeafPrediction1(NTYPE* predictions, const SparseValue<NTYPE>* weights,
+                                           unsigned char* has_predictions) const {}
+
         inline void MergePrediction1(NTYPE* predictions, unsigned char* has_predictions,
                                      NTYPE* predictions2, unsigned char* has_predictions2) const {}
 
@@ -119,21 +280,30 @@ class _Aggregator
         void ProcessTreeNodePrediction(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                        unsigned char* has_predictions) const {}
 
+        void ProcessLeafPrediction(NTYPE* predictions, const SparseValue<NTYPE>* begin,
+                                   const SparseValue<NTYPE>* end,
+                                   unsigned char* has_predictions) const {}
+
         void MergePrediction(int64_t n,
                              NTYPE* predictions, unsigned char* has_predictions,
                              NTYPE* predictions2, unsigned char* has_predictions2) const {}
 
-        void FinalizeScores(std::vector<NTYPE>& scores,
-                            std::vector<unsigned char>& has_scores,
-                            NTYPE* Z, int add_second_class,
-                            int64_t * Y = 0) const {
+        // Writes the scores of one row into Z before the post transform,
+        // returns add_second_class for write_scores_batch.
+        int FinalizeScores(const NTYPE* scores, unsigned char* has_scores,
+                           NTYPE* Z, int64_t * Y = 0) const {
             NTYPE val;
             for (int64_t jt = 0; jt < n_targets_or_classes_; ++jt) {
                 val = use_base_values_ ? (*base_values_)[jt] : 0.f;
                 val += has_scores[jt] ? scores[jt] : 0;
-                scores[jt] = val;
+                Z[jt] = val;
             }
-            write_scores(scores, post_transform_, Z, add_second_class);
+            return SCORES_FULL_ROW;
+        }
+
+        // Applies the post transform to n rows filled by FinalizeScores.
+        void PostTransform(int64_t n, NTYPE* Z, const int* add_second_class) const {
+            write_scores_batch(n, n_targets_or_classes_, Z, post_transform_, add_second_class);
         }
 };
 
@@ -163,7 +333,12 @@ class _AggregatorSum : public _Aggregator<NTYPE>
         inline void ProcessTreeNodePrediction1(NTYPE* predictions,
                                                TreeNodeElement<NTYPE> * root,
                                                unsigned char* has_predictions) const {
-            *predictions += root->weights[0].value;
+            ProcessLeafPrediction1(predictions, root->weights.data(), has_predictions);
+        }
+
+        inline void ProcessLeafPrediction1(NTYPE* predictions, const SparseValue<NTYPE>* weights,
+                                           unsigned char* has_predictions) const {
+            *predictions += weights->value;
         }
 
         inline void MergePrediction1(NTYPE* predictions, unsigned char* has_predictions,
@@ -182,12 +357,28 @@ class _AggregatorSum : public _Aggregator<NTYPE>
         
         void ProcessTreeNodePrediction(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                        unsigned char* has_predictions) const {
-            for(auto it = root->weights.cbegin(); it != root->weights.cend(); ++it) {
+            ProcessLeafPrediction(predictions, root->weights.data(),
+                                  root->weights.data() + root->weights.size(),
+                                  has_predictions);
+        }
+
+        void ProcessLeafPrediction(NTYPE* predictions, const SparseValue<NTYPE>* begin,
+                                   const SparseValue<NTYPE>* end,
+                                   unsigned char* has_predictions) const {
+            for(auto it = begin; it != end; ++it) {
                 predictions[it->i] += it->value;
                 has_predictions[it->i] = 1;
             }
         }
 
+        // every target receives a weight, has_predictions is set by the caller
+        inline void ProcessLeafPredictionDense(NTYPE* predictions, const NTYPE* weights,
+                                               unsigned char* has_predictions) const {
+            int64_t n = this->n_targets_or_classes_;
+            for(int64_t i = 0; i < n; ++i)
+                predictions[i] += weights[i];
+        }
+
         void MergePrediction(int64_t n, NTYPE* predictions, unsigned char* has_predictions,
                              const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             for(int64_t i = 0; i < n; ++i) {
@@ -198,17 +389,17 @@ class _AggregatorSum : public _Aggregator<NTYPE>
             }
         }
 
-        void FinalizeScores(std::vector<NTYPE>& scores,
-                            std::vector<unsigned char>& has_scores,
-                            NTYPE* Z, int add_second_class,
-                            int64_t * Y = 0) const {
+        int FinalizeScores(const NTYPE* scores, unsigned char* has_scores,
+                           NTYPE* Z, int64_t * Y = 0) const {
+            int64_t n = this->n_targets_or_classes_;
             if (this->use_base_values_) {
-                auto it = scores.begin();
-                auto it2 = this->base_values_->cbegin();
-                for (; it != scores.end(); ++it, ++it2)
-                    *it += *it2;
+                const NTYPE* base = this->base_values_->data();
+                for (int64_t i = 0; i < n; ++i)
+                    Z[i] = scores[i] + base[i];
             }
-            write_scores(scores, this->post_transform_, Z, add_second_class);
+            else
+                memcpy(Z, scores, n * sizeof(NTYPE));
+            return SCORES_FULL_ROW;
         }
 };
 
@@ -235,22 +426,21 @@ class _AggregatorAverage : public _AggregatorSum<NTYPE>
             *Z = this->post_transform_ == POST_EVAL_TRANSFORM::PROBIT ? ComputeProbit(val) : val;
         }
 
-        void FinalizeScores(std::vector<NTYPE>& scores,
-                            std::vector<unsigned char>& has_scores,
-                            NTYPE* Z, int add_second_class,
-                            int64_t * Y = 0) const {
+        int FinalizeScores(const NTYPE* scores, unsigned char* has_scores,
+                           NTYPE* Z, int64_t * Y = 0) const {
+            int64_t n = this->n_targets_or_classes_;
+            int64_t i;
             if (this->use_base_values_) {
-                auto it = scores.begin();
-                auto it2 = this->base_values_->cbegin();
-                for (; it != scores.end(); ++it, ++it2)
-                    *it = *it / this->n_trees_ + *it2;
+                const NTYPE* base = this->base_values_->data();
+                for (i = 0; i < n; ++i)
+                    Z[i] = scores[i] / this->n_trees_ + base[i];
             }
-            else {                
-                for (auto it = scores.begin(); it != scores.end(); ++it)
-                    *it /= this->n_trees_;
+            else {
+                for (i = 0; i < n; ++i)
+                    Z[i] = scores[i] / this->n_trees_;
             }
-            write_scores(scores, this->post_transform_, Z, add_second_class);
-        }        
+            return SCORES_FULL_ROW;
+        }
 };
 
 
@@ -272,8 +462,13 @@ class _AggregatorMin : public _Aggregator<NTYPE>
                                
         inline void ProcessTreeNodePrediction1(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                                unsigned char* has_predictions) const {
-            *predictions = (!(*has_predictions) || root->weights[0].value < *predictions) 
-                                    ? root->weights[0].value : *predictions;
+            ProcessLeafPrediction1(predictions, root->weights.data(), has_predictions);
+        }
+
+        inline void ProcessLeafPrediction1(NTYPE* predictions, const SparseValue<NTYPE>* weights,
+                                           unsigned char* has_predictions) const {
+            *predictions = (!(*has_predictions) || weights->value < *predictions) 
+                                    ? weights->value : *predictions;
             *has_predictions = 1;
         }
 
@@ -291,13 +486,31 @@ class _AggregatorMin : public _Aggregator<NTYPE>
         
         void ProcessTreeNodePrediction(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                        unsigned char* has_predictions) const {
-            for(auto it = root->weights.cbegin(); it != root->weights.cend(); ++it) {
+            ProcessLeafPrediction(predictions, root->weights.data(),
+                                  root->weights.data() + root->weights.size(),
+                                  has_predictions);
+        }
+
+        void ProcessLeafPrediction(NTYPE* predictions, const SparseValue<NTYPE>* begin,
+                                   const SparseValue<NTYPE>* end,
+                                   unsigned char* has_predictions) const {
+            for(auto it = begin; it != end; ++it) {
                 predictions[it->i] = (!has_predictions[it->i] || it->value < predictions[it->i]) 
                                         ? it->value : predictions[it->i];
                 has_predictions[it->i] = 1;
             }
         }
 
+        inline void ProcessLeafPredictionDense(NTYPE* predictions, const NTYPE* weights,
+                                               unsigned char* has_predictions) const {
+            int64_t n = this->n_targets_or_classes_;
+            for(int64_t i = 0; i < n; ++i) {
+                predictions[i] = (!has_predictions[i] || weights[i] < predictions[i])
+                                    ? weights[i] : predictions[i];
+                has_predictions[i] = 1;
+            }
+        }
+
         void MergePrediction(int64_t n, NTYPE* predictions, unsigned char* has_predictions,
                              const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             for(int64_t i = 0; i < n; ++i) {
@@ -331,8 +544,13 @@ class _AggregatorMax : public _Aggregator<NTYPE>
 
         inline void ProcessTreeNodePrediction1(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                                unsigned char* has_predictions) const {
-            *predictions = (!(*has_predictions) || root->weights[0].value > *predictions) 
-                                    ? root->weights[0].value : *predictions;
+            ProcessLeafPrediction1(predictions, root->weights.data(), has_predictions);
+        }
+
+        inline void ProcessLeafPrediction1(NTYPE* predictions, const SparseValue<NTYPE>* weights,
+                                           unsigned char* has_predictions) const {
+            *predictions = (!(*has_predictions) || weights->value > *predictions) 
+                                    ? weights->value : *predictions;
             *has_predictions = 1;
         }
 
@@ -350,13 +568,31 @@ class _AggregatorMax : public _Aggregator<NTYPE>
 
         void ProcessTreeNodePrediction(NTYPE* predictions, TreeNodeElement<NTYPE> * root,
                                        unsigned char* has_predictions) const {
-            for(auto it = root->weights.cbegin(); it != root->weights.cend(); ++it) {
+            ProcessLeafPrediction(predictions, root->weights.data(),
+                                  root->weights.data() + root->weights.size(),
+                                  has_predictions);
+        }
+
+        void ProcessLeafPrediction(NTYPE* predictions, const SparseValue<NTYPE>* begin,
+                                   const SparseValue<NTYPE>* end,
+                                   unsigned char* has_predictions) const {
+            for(auto it = begin; it != end; ++it) {
                 predictions[it->i] = (!has_predictions[it->i] || it->value > predictions[it->i]) 
                                         ? it->value : predictions[it->i];
                 has_predictions[it->i] = 1;
             }
         }
 
+        inline void ProcessLeafPredictionDense(NTYPE* predictions, const NTYPE* weights,
+                                               unsigned char* has_predictions) const {
+            int64_t n = this->n_targets_or_classes_;
+            for(int64_t i = 0; i < n; ++i) {
+                predictions[i] = (!has_predictions[i] || weights[i] > predictions[i])
+                                    ? weights[i] : predictions[i];
+                has_predictions[i] = 1;
+            }
+        }
+
         void MergePrediction(int64_t n, NTYPE* predictions, unsigned char* has_predictions,
                              NTYPE* predictions2, unsigned char* has_predictions2) const {
             for(int64_t i = 0; i < n; ++i) {
@@ -406,18 +642,15 @@ class _AggregatorClassifier : public _AggregatorSum<NTYPE>
             
         const char * name() const { return "_AggregatorClassifier"; }
 
-        void get_max_weight(const std::vector<NTYPE>& classes, 
-                            const std::vector<unsigned char>& has_scores, 
+        void get_max_weight(const NTYPE* classes,
+                            const unsigned char* has_scores,
                             int64_t& maxclass, NTYPE& maxweight) const {
             maxclass = -1;
             maxweight = (NTYPE)0;
-            typename std::vector<NTYPE>::const_iterator it;
-            typename std::vector<unsigned char>::const_iterator itb;
-            for (it = classes.cbegin(), itb = has_scores.cbegin();
-               it != classes.cend(); ++it, ++itb) {
-                if (*itb && (maxclass == -1 || *it > maxweight)) {
-                    maxclass = (int64_t)(it - classes.cbegin());
-                    maxweight = *it;
+            for (int64_t k = 0; k < this->n_targets_or_classes_; ++k) {
+                if (has_scores[k] && (maxclass == -1 || classes[k] > maxweight)) {
+                    maxclass = k;
+                    maxweight = classes[k];
                 }
             }
         }
@@ -491,60 +724,89 @@ class _AggregatorClassifier : public _AggregatorSum<NTYPE>
 
         // N outputs
         
-        void FinalizeScores(std::vector<NTYPE>& scores,
-                            std::vector<unsigned char>& has_scores,
-                            NTYPE* Z, int add_second_class,
-                            int64_t * Y = 0) const {
+        int FinalizeScores(const NTYPE* scores, unsigned char* has_scores,
+                           NTYPE* Z, int64_t * Y = 0) const {
             NTYPE maxweight = (NTYPE)0;
             int64_t maxclass = -1;
 
             int write_additional_scores = -1;
             if (this->n_targets_or_classes_ > 2) {
+                memcpy(Z, scores, this->n_targets_or_classes_ * sizeof(NTYPE));
                 // add base values
                 for (int64_t k = 0, end = static_cast<int64_t>(this->base_values_->size()); k < end; ++k) {
                     if (!has_scores[k]) {
                       has_scores[k] = true;
-                      scores[k] = (*(this->base_values_))[k];
+                      Z[k] = (*(this->base_values_))[k];
                     }
                     else {
-                        scores[k] += (*(this->base_values_))[k];
+                        Z[k] += (*(this->base_values_))[k];
                     }
                 }
-                get_max_weight(scores, has_scores, maxclass, maxweight);
+                get_max_weight(Z, has_scores, maxclass, maxweight);
                 *Y = (*class_labels_)[maxclass];
+                return SCORES_FULL_ROW;
             }
-            else { // binary case
-                if (this->base_values_->size() == 2) {
-                    // add base values
-                    if (has_scores[1]) {
-                        // base_value_[0] is not used.
-                        // It assumes base_value[0] == base_value[1] in this case.
-                        // The specification does not forbid it but does not
-                        // say what the output should be in that case.
-                        scores[1] = (*(this->base_values_))[1] + scores[0];
-                        scores[0] = -scores[1];
-                        has_scores[1] = true;
-                    }
-                    else {
-                        // binary as multiclass
-                        scores[1] += (*(this->base_values_))[1];
-                        scores[0] += (*(this->base_values_))[0];
-                    }
-                }
-                else if (this->base_values_->size() == 1) {
-                    // ONNX is vague about two classes and only one base_values.
-                    scores[0] += (*(this->base_values_))[0];
-                    if (!has_scores[1])
-                      scores.pop_back();
+
+            // binary case, the row holds one score if the second one is missing
+            bool one_score = false;
+            Z[0] = scores[0];
+            Z[1] = scores[1];
+            if (this->base_values_->size() == 2) {
+                // add base values
+                if (has_scores[1]) {
+                    // base_value_[0] is not used.
+                    // It assumes base_value[0] == base_value[1] in this case.
+                    // The specification does not forbid it but does not
+                    // say what the output should be in that case.
+                    Z[1] = (*(this->base_values_))[1] + scores[0];
+                    Z[0] = -Z[1];
+                    has_scores[1] = true;
                 }
-                else if (this->base_values_->size() == 0) {
-                    if (!has_scores[1])
-                      scores.pop_back();
+                else {
+                    // binary as multiclass
+                    Z[1] += (*(this->base_values_))[1];
+                    Z[0] += (*(this->base_values_))[0];
                 }
-
-                *Y = _set_score_binary(write_additional_scores, &(scores[0]), &(has_scores[0]));
+            }
+            else if (this->base_values_->size() == 1) {
+                // ONNX is vague about two classes and only one base_values.
+                Z[0] += (*(this->base_values_))[0];
+                one_score = !has_scores[1];
+            }
+            else if (this->base_values_->size() == 0) {
+                one_score = !has_scores[1];
             }
 
-            write_scores(scores, this->post_transform_, Z, write_additional_scores);
+            *Y = _set_score_binary(write_additional_scores, Z, has_scores);
+            return one_score ? write_additional_scores : SCORES_FULL_ROW;
+        }
+
+        // Early exit (more than two classes, every class has a score).
+        // The remaining trees add between low[k] and high[k] to class k,
+        // slack[k] bounds the rounding errors. Returns true and sets Y
+        // if no class can overtake the best one.
+        bool SettledLabel(const NTYPE* scores, const NTYPE* low, const NTYPE* high,
+                          const NTYPE* slack, int64_t * Y) const {
+            int64_t n = this->n_targets_or_classes_;
+            const NTYPE* base = this->use_base_values_ ? this->base_values_->data() : NULL;
+            int64_t best = 0;
+            NTYPE best_score = scores[0] + (base == NULL ? 0 : base[0]);
+            NTYPE score;
+            int64_t k;
+            for (k = 1; k < n; ++k) {
+                score = scores[k] + (base == NULL ? 0 : base[k]);
+                if (score > best_score) {
+                    best = k;
+                    best_score = score;
+                }
+            }
+            NTYPE bound = best_score + low[best] - slack[best];
+            for (k = 0; k < n; ++k) {
+                if (k != best && scores[k] + (base == NULL ? 0 : base[k]) +
+                                 high[k] + slack[k] >= bound)
+                    return false;
+            }
+            *Y = (*class_labels_)[best];
+            return true;
         }
 };
@@ -0,0 +1,191 @@
+#pragma once
+
+// Flat binary format of a tree ensemble stored with the compact layout.
+// A file can be mapped in memory and used without any parsing,
+// processes mapping the same file share the same physical pages.
+
+#include "op_tree_ensemble_common_p_agg_.hpp"
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TREE_BLOB_MAGIC "MLPTREE"
+#define TREE_BLOB_VERSION 2
+// every section starts on a cache line
+#define TREE_BLOB_ALIGN 64
+
+
+/**
+* Read only array which either points to a std::vector
+* or to a memory mapped file.
+*/
+template<typename T>
+class TreeArrayView {
+    public:
+
+        TreeArrayView() : data_(NULL), size_(0) {}
+
+        inline const T* data() const { return data_; }
+        inline size_t size() const { return size_; }
+        inline bool empty() const { return size_ == 0; }
+        inline const T& operator[](size_t i) const { return data_[i]; }
+        inline const T* begin() const { return data_; }
+        inline const T* end() const { return data_ + size_; }
+
+        void assign(const T* data, size_t size) {
+            data_ = data;
+            size_ = size;
+        }
+        void assign(const std::vector<T>& v) {
+            assign(v.data(), v.size());
+        }
+        void clear() {
+            assign(NULL, 0);
+        }
+
+    private:
+
+        const T* data_;
+        size_t size_;
+};
+
+
+/**
+* Header of the binary format, sections follow in this order:
+* base values, packed nodes, roots, leaf weights, class labels
+* (classifier only).
+* Integers and floats are stored with the byte order of the machine.
+*/
+struct TreeEnsembleBlobHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sizeof_ntype;
+    int64_t size;
+    int64_t n_targets_or_classes;
+    int64_t n_nodes;
+    int64_t n_trees;
+    int64_t n_base_values;
+    int64_t n_leaf_weights;
+    int32_t post_transform;
+    int32_t aggregate_function;
+    int32_t same_mode;
+    int32_t has_missing_tracks;
+    int32_t use_hitrates;
+    int32_t omp_tree;
+    int32_t omp_N;
+    int32_t tile_N;
+    int32_t is_classifier;
+    int32_t binary_case;
+    int32_t weights_are_all_positive;
+    int32_t deterministic;
+    // the QuickScorer structures and the quantized forest
+    // are built again when the blob is loaded
+    int32_t quickscorer;
+    int32_t quantized;
+    int64_t n_class_labels;
+    int64_t offset_base_values;
+    int64_t offset_nodes;
+    int64_t offset_roots;
+    int64_t offset_leaf_weights;
+    int64_t offset_class_labels;
+};
+
+
+inline int64_t tree_blob_align(int64_t offset) {
+    return (offset + TREE_BLOB_ALIGN - 1) / TREE_BLOB_ALIGN * TREE_BLOB_ALIGN;
+}
+
+
+/**
+* Read only memory mapping of a whole file.
+*/
+class TreeEnsembleMappedFile {
+    public:
+
+        TreeEnsembleMappedFile(const std::string& filename) {
+            data_ = NULL;
+            size_ = 0;
+#if defined(_WIN32)
+            file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            mapping_ = NULL;
+            LARGE_INTEGER size;
+            if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+                fail(filename);
+            size_ = (int64_t)size.QuadPart;
+            mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping_ == NULL)
+                fail(filename);
+            data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+            if (data_ == NULL)
+                fail(filename);
+#else
+            int fd = open(filename.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd == -1)
+                fail(filename);
+            if (fstat(fd, &st) == -1) {
+                close(fd);
+                fail(filename);
+            }
+            size_ = (int64_t)st.st_size;
+            void* p = size_ > 0 ? mmap(NULL, (size_t)size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (p == MAP_FAILED)
+                fail(filename);
+            data_ = (const char*)p;
+#endif
+        }
+
+        ~TreeEnsembleMappedFile() {
+            release();
+        }
+
+        inline const char* data() const { return data_; }
+        inline int64_t size() const { return size_; }
+
+    private:
+
+        TreeEnsembleMappedFile(const TreeEnsembleMappedFile&);
+        TreeEnsembleMappedFile& operator=(const TreeEnsembleMappedFile&);
+
+        void release() {
+#if defined(_WIN32)
+            if (data_ != NULL)
+                UnmapViewOfFile(data_);
+            if (mapping_ != NULL)
+                CloseHandle(mapping_);
+            if (file_ != INVALID_HANDLE_VALUE)
+                CloseHandle(file_);
+            mapping_ = NULL;
+            file_ = INVALID_HANDLE_VALUE;
+#else
+            if (data_ != NULL)
+                munmap((void*)data_, (size_t)size_);
+#endif
+            data_ = NULL;
+        }
+
+        void fail(const std::string& filename) {
+            release();
+            throw std::runtime_error(std::string("Unable to map file '") + filename + std::string("'."));
+        }
+
+        const char* data_;
+        int64_t size_;
+#if defined(_WIN32)
+        HANDLE file_;
+        HANDLE mapping_;
+#endif
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+// Tree traversals specialized at compile time for every node mode,
+// with or without missing value tracks. The runtime picks one
+// of them when the model is loaded.
+
+#include "op_tree_ensemble_common_p_agg_.hpp"
+
+// Nodes do not share the same mode, the mode is checked for every node.
+#define TREE_MODE_MIXED -1
+
+
+template<typename NTYPE, int MODE>
+inline bool tree_compare(NTYPE val, NTYPE threshold, NODE_MODE mode) {
+    switch(MODE) {
+        case (int)NODE_MODE::BRANCH_LEQ:
+            return val <= threshold;
+        case (int)NODE_MODE::BRANCH_LT:
+            return val < threshold;
+        case (int)NODE_MODE::BRANCH_GTE:
+            return val >= threshold;
+        case (int)NODE_MODE::BRANCH_GT:
+            return val > threshold;
+        case (int)NODE_MODE::BRANCH_EQ:
+            return val == threshold;
+        case (int)NODE_MODE::BRANCH_NEQ:
+            return val != threshold;
+        default:
+            break;
+    }
+    // TREE_MODE_MIXED
+    switch (mode) {
+        case NODE_MODE::BRANCH_LEQ:
+            return val <= threshold;
+        case NODE_MODE::BRANCH_LT:
+            return val < threshold;
+        case NODE_MODE::BRANCH_GTE:
+            return val >= threshold;
+        case NODE_MODE::BRANCH_GT:
+            return val > threshold;
+        case NODE_MODE::BRANCH_EQ:
+            return val == threshold;
+        case NODE_MODE::BRANCH_NEQ:
+            return val != threshold;
+        default: {
+            std::ostringstream err_msg;
+            err_msg << "Invalid mode of value: "
+                    << static_cast<std::underlying_type<NODE_MODE>::type>(mode);
+            throw std::runtime_error(err_msg.str());
+        }
+    }
+}
+
+
+template<typename NTYPE, int MODE, bool MISSING>
+inline TreeNodeElement<NTYPE> * tree_find_leave(
+        TreeNodeElement<NTYPE> * root, const NTYPE* x_data) {
+    NTYPE val;
+    while (root->is_not_leave) {
+        val = x_data[root->feature_id];
+        root = (tree_compare<NTYPE, MODE>(val, root->value, root->mode) ||
+                (MISSING && root->is_missing_track_true && _isnan_(val)))
+                    ? root->truenode : root->falsenode;
+    }
+    return root;
+}
+
+
+template<typename NTYPE, int MODE, bool MISSING>
+inline const TreeNodeElementPacked<NTYPE> * tree_find_leave_packed(
+        const TreeNodeElementPacked<NTYPE> * nodes,
+        const TreeNodeElementPacked<NTYPE> * root, const NTYPE* x_data) {
+    NTYPE val;
+    while (root->is_not_leave()) {
+        val = x_data[root->feature_id()];
+        root = nodes + ((tree_compare<NTYPE, MODE>(val, root->value, root->mode()) ||
+                         (MISSING && root->is_missing_track_true() && _isnan_(val)))
+                            ? root->truenode : root->falsenode);
+    }
+    return root;
+}
+
+
+// Traversals counting the visits of every node and the number of times
+// the true branch is taken (counts[2 * i] and counts[2 * i + 1]),
+// they return the index of the leaf. They are only used when the
+// runtime profiles the model, the other traversals do not count anything.
+template<typename NTYPE>
+inline int64_t tree_profile_leave(
+        const TreeNodeElement<NTYPE> * nodes, const TreeNodeElement<NTYPE> * root,
+        const NTYPE* x_data, int64_t* counts) {
+    NTYPE val;
+    int64_t index;
+    while (root->is_not_leave) {
+        index = root - nodes;
+        ++counts[index * 2];
+        val = x_data[root->feature_id];
+        if (tree_compare<NTYPE, TREE_MODE_MIXED>(val, root->value, root->mode) ||
+                (root->is_missing_track_true && _isnan_(val))) {
+            ++counts[index * 2 + 1];
+            root = root->truenode;
+        }
+        else
+            root = root->falsenode;
+    }
+    index = root - nodes;
+    ++counts[index * 2];
+    return index;
+}
+
+
+template<typename NTYPE>
+inline int64_t tree_profile_leave_packed(
+        const TreeNodeElementPacked<NTYPE> * nodes, int64_t index,
+        const NTYPE* x_data, int64_t* counts) {
+    NTYPE val;
+    const TreeNodeElementPacked<NTYPE> * node = nodes + index;
+    while (node->is_not_leave()) {
+        ++counts[index * 2];
+        val = x_data[node->feature_id()];
+        if (tree_compare<NTYPE, TREE_MODE_MIXED>(val, node->value, node->mode()) ||
+                (node->is_missing_track_true() && _isnan_(val))) {
+            ++counts[index * 2 + 1];
+            index = node->truenode;
+        }
+        else
+            index = node->falsenode;
+        node = nodes + index;
+    }
+    ++counts[index * 2];
+    return index;
+}
+
+
+// Expands KERNEL(MODE, MISSING) for the values of mode and missing
+// known at runtime.
+#define TREE_KERNEL_CASE(mode_value, missing, KERNEL) \
+    case mode_value: \
+        if (missing) { KERNEL(mode_value, true) } \
+        else { KERNEL(mode_value, false) } \
+        break;
+
+#define TREE_KERNEL_SWITCH(mode, missing, KERNEL) \
+    switch(mode) { \
+        TREE_KERNEL_CASE(TREE_MODE_MIXED, missing, KERNEL) \
+        TREE_KERNEL_CASE((int)NODE_MODE::BRANCH_LEQ, missing, KERNEL) \
+        TREE_KERNEL_CASE((int)NODE_MODE::BRANCH_LT, missing, KERNEL) \
+        TREE_KERNEL_CASE((int)NODE_MODE::BRANCH_GTE, missing, KERNEL) \
+        TREE_KERNEL_CASE((int)NODE_MODE::BRANCH_GT, missing, KERNEL) \
+        TREE_KERNEL_CASE((int)NODE_MODE::BRANCH_EQ, missing, KERNEL) \
+        TREE_KERNEL_CASE((int)NODE_MODE::BRANCH_NEQ, missing, KERNEL) \
+        default: \
+            throw std::runtime_error("Unexpected mode for the tree kernels."); \
+    }
@@ -0,0 +1,296 @@
+#pragma once
+
+// Implements the evaluation described in
+// *QuickScorer: a Fast Algorithm to Rank Documents with Additive
+// Ensembles of Regression Trees*, Lucchese et al., SIGIR 2015.
+
+#include "op_tree_ensemble_common_p_agg_.hpp"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define QS_MAX_LEAVES 64
+
+
+template<typename NTYPE>
+struct QuickScorerNode {
+    TreeNodeElement<NTYPE>* node;
+    uint32_t tree_id;
+    uint64_t mask;
+};
+
+
+/**
+* Evaluates a forest without walking the trees.
+* The leaves of every tree are numbered from left to right
+* (true branch first), a tree is a 64 bits mask with one bit per leaf.
+* Every node owns a mask removing the leaves of its true branch.
+* The nodes are sorted by feature and threshold. For every feature,
+* the evaluation goes through the nodes whose condition is false and applies
+* their masks to their tree. The exit leaf of a tree is the first bit
+* left in its mask. It only works if every tree has less than
+* QS_MAX_LEAVES leaves and all nodes share the same mode
+* among BRANCH_LEQ, BRANCH_LT, BRANCH_GTE, BRANCH_GT.
+*/
+template<typename NTYPE>
+class TreeEnsembleQuickScorer {
+    public:
+
+        int64_t n_trees_;
+        int64_t n_features_;
+        // modes BRANCH_GTE, BRANCH_GT are processed as BRANCH_LEQ, BRANCH_LT
+        // with negative thresholds and features
+        bool negate_;
+        bool strict_;
+        bool has_missing_tracks_;
+
+        // nodes sorted by feature then threshold
+        std::vector<int64_t> feature_offsets_;
+        std::vector<NTYPE> thresholds_;
+        std::vector<uint32_t> tree_ids_;
+        std::vector<uint64_t> masks_;
+        std::vector<unsigned char> missing_tracks_true_;
+
+        // weights of leaf l of tree j: weights_[weights_start_[leaf_offsets_[j] + l]:...]
+        std::vector<uint32_t> leaf_offsets_;
+        std::vector<uint32_t> weights_start_;
+        std::vector<SparseValue<NTYPE>> weights_;
+
+    public:
+
+        TreeEnsembleQuickScorer();
+
+        bool init(const std::vector<TreeNodeElement<NTYPE>*>& roots,
+                  bool same_mode, bool has_missing_tracks);
+        void clear();
+        int64_t get_sizeof() const;
+
+        void compute_leaves(const NTYPE* x_data, uint64_t* bitvectors) const;
+
+        inline const SparseValue<NTYPE>* leaf_weights(
+                int64_t j, uint64_t bitvector, const SparseValue<NTYPE>** end) const {
+            uint32_t leaf = leaf_offsets_[j] + first_bit(bitvector);
+            *end = weights_.data() + weights_start_[leaf + 1];
+            return weights_.data() + weights_start_[leaf];
+        }
+
+    private:
+
+        static inline uint32_t first_bit(uint64_t v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long n;
+            _BitScanForward64(&n, v);
+            return (uint32_t)n;
+#elif defined(__GNUC__)
+            return (uint32_t)__builtin_ctzll(v);
+#else
+            uint32_t n = 0;
+            while ((v & 1) == 0) {
+                v >>= 1;
+                ++n;
+            }
+            return n;
+#endif
+        }
+
+        bool add_tree(TreeNodeElement<NTYPE>* root, uint32_t tree_id,
+                      std::vector<QuickScorerNode<NTYPE>>& nodes);
+};
+
+
+template<typename NTYPE>
+TreeEnsembleQuickScorer<NTYPE>::TreeEnsembleQuickScorer() {
+    n_trees_ = 0;
+    n_features_ = 0;
+    negate_ = false;
+    strict_ = false;
+    has_missing_tracks_ = false;
+}
+
+
+template<typename NTYPE>
+void TreeEnsembleQuickScorer<NTYPE>::clear() {
+    n_trees_ = 0;
+    n_features_ = 0;
+    feature_offsets_.clear();
+    thresholds_.clear();
+    tree_ids_.clear();
+    masks_.clear();
+    missing_tracks_true_.clear();
+    leaf_offsets_.clear();
+    weights_start_.clear();
+    weights_.clear();
+}
+
+
+template<typename NTYPE>
+int64_t TreeEnsembleQuickScorer<NTYPE>::get_sizeof() const {
+    return feature_offsets_.size() * sizeof(int64_t) +
+           thresholds_.size() * sizeof(NTYPE) +
+           tree_ids_.size() * sizeof(uint32_t) +
+           masks_.size() * sizeof(uint64_t) +
+           missing_tracks_true_.size() +
+           leaf_offsets_.size() * sizeof(uint32_t) +
+           weights_start_.size() * sizeof(uint32_t) +
+           weights_.size() * sizeof(SparseValue<NTYPE>);
+}
+
+
+template<typename NTYPE>
+bool TreeEnsembleQuickScorer<NTYPE>::add_tree(
+        TreeNodeElement<NTYPE>* root, uint32_t tree_id,
+        std::vector<QuickScorerNode<NTYPE>>& nodes) {
+    // depth first, true branch first, leaves are numbered in that order
+    struct visit {
+        TreeNodeElement<NTYPE>* node;
+        int step;
+        uint32_t first_leaf;
+    };
+    std::vector<visit> stack;
+    uint32_t n_leaves = 0;
+    stack.push_back({root, 0, 0});
+    while (!stack.empty()) {
+        visit& v = stack.back();
+        if (v.node == NULL)
+            return false;
+        if (!v.node->is_not_leave) {
+            if (n_leaves >= QS_MAX_LEAVES)
+                return false;
+            weights_.insert(weights_.end(), v.node->weights.begin(), v.node->weights.end());
+            weights_start_.push_back((uint32_t)weights_.size());
+            ++n_leaves;
+            stack.pop_back();
+        }
+        else if (stack.size() > QS_MAX_LEAVES)
+            return false;
+        else if (v.step == 0) {
+            v.step = 1;
+            v.first_leaf = n_leaves;
+            stack.push_back({v.node->truenode, 0, 0});
+        }
+        else if (v.step == 1) {
+            // the true branch is done, its leaves are [first_leaf, n_leaves[
+            v.step = 2;
+            QuickScorerNode<NTYPE> qs;
+            qs.node = v.node;
+            qs.tree_id = tree_id;
+            qs.mask = ~(uint64_t)0;
+            for (uint32_t l = v.first_leaf; l < n_leaves; ++l)
+                qs.mask &= ~((uint64_t)1 << l);
+            nodes.push_back(qs);
+            stack.push_back({v.node->falsenode, 0, 0});
+        }
+        else
+            stack.pop_back();
+    }
+    return true;
+}
+
+
+template<typename NTYPE>
+bool TreeEnsembleQuickScorer<NTYPE>::init(
+        const std::vector<TreeNodeElement<NTYPE>*>& roots,
+        bool same_mode, bool has_missing_tracks) {
+    clear();
+    if (!same_mode)
+        return false;
+
+    std::vector<QuickScorerNode<NTYPE>> nodes;
+    weights_start_.push_back(0);
+    for (size_t j = 0; j < roots.size(); ++j) {
+        leaf_offsets_.push_back((uint32_t)(weights_start_.size() - 1));
+        if (!add_tree(roots[j], (uint32_t)j, nodes)) {
+            clear();
+            return false;
+        }
+    }
+
+    NODE_MODE mode = nodes.empty() ? NODE_MODE::BRANCH_LEQ : nodes[0].node->mode;
+    switch(mode) {
+        case NODE_MODE::BRANCH_LEQ:
+            negate_ = false;
+            strict_ = false;
+            break;
+        case NODE_MODE::BRANCH_LT:
+            negate_ = false;
+            strict_ = true;
+            break;
+        case NODE_MODE::BRANCH_GTE:
+            negate_ = true;
+            strict_ = false;
+            break;
+        case NODE_MODE::BRANCH_GT:
+            negate_ = true;
+            strict_ = true;
+            break;
+        default:
+            clear();
+            return false;
+    }
+
+    // sorts the nodes by feature and threshold
+    bool negate = negate_;
+    std::stable_sort(nodes.begin(), nodes.end(),
+                     [negate](const QuickScorerNode<NTYPE>& a, const QuickScorerNode<NTYPE>& b) {
+        if (a.node->feature_id != b.node->feature_id)
+            return a.node->feature_id < b.node->feature_id;
+        return negate ? a.node->value > b.node->value : a.node->value < b.node->value;
+    });
+    if (!nodes.empty() && nodes[0].node->feature_id < 0) {
+        clear();
+        return false;
+    }
+
+    n_trees_ = roots.size();
+    n_features_ = nodes.empty() ? 0 : (nodes.back().node->feature_id + 1);
+    has_missing_tracks_ = has_missing_tracks;
+    thresholds_.resize(nodes.size());
+    tree_ids_.resize(nodes.size());
+    masks_.resize(nodes.size());
+    if (has_missing_tracks_)
+        missing_tracks_true_.resize(nodes.size());
+    feature_offsets_.resize(n_features_ + 1, 0);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        thresholds_[i] = negate_ ? -nodes[i].node->value : nodes[i].node->value;
+        tree_ids_[i] = nodes[i].tree_id;
+        masks_[i] = nodes[i].mask;
+        if (has_missing_tracks_)
+            missing_tracks_true_[i] = nodes[i].node->is_missing_track_true ? 1 : 0;
+        ++feature_offsets_[nodes[i].node->feature_id + 1];
+    }
+    for (int64_t f = 0; f < n_features_; ++f)
+        feature_offsets_[f + 1] += feature_offsets_[f];
+    return true;
+}
+
+
+#define QS_APPLY_MASKS(CMP) \
+    for (; k < end && thresholds_[k] CMP val; ++k) \
+        bitvectors[tree_ids_[k]] &= masks_[k];
+
+
+template<typename NTYPE>
+void TreeEnsembleQuickScorer<NTYPE>::compute_leaves(
+        const NTYPE* x_data, uint64_t* bitvectors) const {
+    std::fill(bitvectors, bitvectors + n_trees_, ~(uint64_t)0);
+    int64_t k, end;
+    NTYPE val;
+    for (int64_t f = 0; f < n_features_; ++f) {
+        k = feature_offsets_[f];
+        end = feature_offsets_[f + 1];
+        val = negate_ ? -x_data[f] : x_data[f];
+        if (_isnan_(val)) {
+            // every condition is false except for missing tracks
+            for (; k < end; ++k) {
+                if (!has_missing_tracks_ || !missing_tracks_true_[k])
+                    bitvectors[tree_ids_[k]] &= masks_[k];
+            }
+        }
+        else if (strict_) {
+            QS_APPLY_MASKS(<=)
+        }
+        else {
+            QS_APPLY_MASKS(<)
+        }
+    }
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+// Quantized evaluation: thresholds are replaced by their rank among
+// the thresholds of the same feature, features are converted into ranks
+// once per batch, trees compare small integers.
+
+#include "op_tree_ensemble_common_p_kernel_.hpp"
+#include "op_tree_ensemble_common_p_simd_.hpp"
+#include <limits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define QUANTIZED_MODE_MASK 0x07
+#define QUANTIZED_MISSING_TRACK_TRUE 0x40
+#define QUANTIZED_LEAF 0x80
+// thresholds of every feature are padded with NaN to a multiple of this value
+#define QUANTIZED_PAD 8
+// above that number of thresholds, binary search replaces the linear count
+#define QUANTIZED_LINEAR_MAX 64
+
+
+/**
+* Node of a quantized tree (12 bytes for uint8_t, 16 for uint16_t).
+* If t_0 < t_1 < ... are the sorted thresholds of a feature,
+* threshold t_k becomes 2k+1 and a value x becomes
+* #{t_i < x} + #{t_i <= x}. Both codes compare the same way
+* the original values compare for every node mode.
+* The maximum value of QTYPE is used for missing values.
+* *truenode*, *falsenode* follow the same convention as
+* TreeNodeElementPacked.
+*/
+template<typename QTYPE>
+struct TreeNodeElementQuantized {
+    uint32_t truenode;
+    uint32_t falsenode;
+    uint16_t feature_id;
+    QTYPE threshold;
+    uint8_t flags;
+
+    inline NODE_MODE mode() const {
+        return (NODE_MODE)(flags & QUANTIZED_MODE_MASK);
+    }
+    inline bool is_not_leave() const {
+        return (flags & QUANTIZED_LEAF) == 0;
+    }
+    inline bool is_missing_track_true() const {
+        return (flags & QUANTIZED_MISSING_TRACK_TRUE) != 0;
+    }
+};
+
+
+template<typename QTYPE, int MODE>
+inline bool tree_compare_quantized(QTYPE val, QTYPE threshold, NODE_MODE mode) {
+    if (val == std::numeric_limits<QTYPE>::max())
+        // a missing value, every comparison is false except !=
+        return (MODE == TREE_MODE_MIXED ? mode : (NODE_MODE)MODE) == NODE_MODE::BRANCH_NEQ;
+    return tree_compare<QTYPE, MODE>(val, threshold, mode);
+}
+
+
+template<typename QTYPE, int MODE, bool MISSING>
+inline const TreeNodeElementQuantized<QTYPE> * tree_find_leave_quantized(
+        const TreeNodeElementQuantized<QTYPE> * nodes,
+        const TreeNodeElementQuantized<QTYPE> * root, const QTYPE* bins) {
+    QTYPE val;
+    while (root->is_not_leave()) {
+        val = bins[root->feature_id];
+        root = nodes + ((tree_compare_quantized<QTYPE, MODE>(val, root->threshold, root->mode()) ||
+                         (MISSING && root->is_missing_track_true() &&
+                          val == std::numeric_limits<QTYPE>::max()))
+                            ? root->truenode : root->falsenode);
+    }
+    return root;
+}
+
+
+inline int quantized_popcount(unsigned int v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return (int)__popcnt(v);
+#else
+    return __builtin_popcount(v);
+#endif
+}
+
+
+#if defined(TREE_SIMD_X86)
+
+TREE_SIMD_TARGET_AVX2 inline int quantized_code_avx2(
+        const float* thresholds, int64_t n, float x) {
+    __m256 vx = _mm256_set1_ps(x);
+    __m256 vt;
+    int c = 0;
+    for (int64_t k = 0; k < n; k += 8) {
+        vt = _mm256_loadu_ps(thresholds + k);
+        c += quantized_popcount(_mm256_movemask_ps(_mm256_cmp_ps(vt, vx, _CMP_LT_OQ))) +
+             quantized_popcount(_mm256_movemask_ps(_mm256_cmp_ps(vt, vx, _CMP_LE_OQ)));
+    }
+    return c;
+}
+
+
+TREE_SIMD_TARGET_AVX2 inline int quantized_code_avx2(
+        const double* thresholds, int64_t n, double x) {
+    __m256d vx = _mm256_set1_pd(x);
+    __m256d vt;
+    int c = 0;
+    for (int64_t k = 0; k < n; k += 4) {
+        vt = _mm256_loadu_pd(thresholds + k);
+        c += quantized_popcount(_mm256_movemask_pd(_mm256_cmp_pd(vt, vx, _CMP_LT_OQ))) +
+             quantized_popcount(_mm256_movemask_pd(_mm256_cmp_pd(vt, vx, _CMP_LE_OQ)));
+    }
+    return c;
+}
+
+#endif
+
+
+/**
+* Quantized copy of a forest, it is built from the nodes
+* of RuntimeTreeEnsembleCommonP. Thresholds are stored with uint8_t
+* if every feature has less than 128 distinct thresholds,
+* uint16_t if it has less than 32768.
+*/
+template<typename NTYPE>
+class TreeEnsembleQuantized {
+    public:
+
+        // 0 if the forest cannot be quantized, 8 or 16
+        int bits_;
+        // original index of every column of the quantized features
+        std::vector<int64_t> features_;
+        // thresholds of column f: thresholds_[threshold_offsets_[f]:threshold_offsets_[f+1]]
+        std::vector<int64_t> threshold_offsets_;
+        std::vector<int64_t> n_thresholds_;
+        std::vector<NTYPE> thresholds_;
+        std::vector<TreeNodeElementQuantized<uint8_t>> nodes8_;
+        std::vector<TreeNodeElementQuantized<uint16_t>> nodes16_;
+        std::vector<uint32_t> roots_;
+        std::vector<SparseValue<NTYPE>> weights_;
+        bool use_simd_;
+
+    public:
+
+        TreeEnsembleQuantized();
+
+        bool init(const TreeNodeElement<NTYPE>* nodes, int64_t n_nodes,
+                  const std::vector<TreeNodeElement<NTYPE>*>& roots);
+        void clear();
+        int64_t get_sizeof() const;
+
+        inline int64_t n_columns() const { return (int64_t)features_.size(); }
+
+        template<typename QTYPE>
+        void bin(const NTYPE* x_data, int64_t n, int64_t stride, QTYPE* bins) const;
+
+        inline const TreeNodeElementQuantized<uint8_t>* nodes(uint8_t) const {
+            return nodes8_.data();
+        }
+        inline const TreeNodeElementQuantized<uint16_t>* nodes(uint16_t) const {
+            return nodes16_.data();
+        }
+
+    private:
+
+        template<typename QTYPE>
+        void fill_nodes(const TreeNodeElement<NTYPE>* nodes, int64_t n_nodes,
+                        const std::vector<int64_t>& columns,
+                        std::vector<TreeNodeElementQuantized<QTYPE>>& qnodes);
+};
+
+
+template<typename NTYPE>
+TreeEnsembleQuantized<NTYPE>::TreeEnsembleQuantized() {
+    bits_ = 0;
+    use_simd_ = tree_simd_cpu_level() != TREE_SIMD_NONE;
+}
+
+
+template<typename NTYPE>
+void TreeEnsembleQuantized<NTYPE>::clear() {
+    bits_ = 0;
+    features_.clear();
+    threshold_offsets_.clear();
+    n_thresholds_.clear();
+    thresholds_.clear();
+    nodes8_.clear();
+    nodes16_.clear();
+    roots_.clear();
+    weights_.clear();
+}
+
+
+template<typename NTYPE>
+int64_t TreeEnsembleQuantized<NTYPE>::get_sizeof() const {
+    return features_.size() * sizeof(int64_t) +
+           threshold_offsets_.size() * sizeof(int64_t) +
+           n_thresholds_.size() * sizeof(int64_t) +
+           thresholds_.size() * sizeof(NTYPE) +
+           nodes8_.size() * sizeof(TreeNodeElementQuantized<uint8_t>) +
+           nodes16_.size() * sizeof(TreeNodeElementQuantized<uint16_t>) +
+           roots_.size() * sizeof(uint32_t) +
+           weights_.size() * sizeof(SparseValue<NTYPE>);
+}
+
+
+template<typename NTYPE>
+bool TreeEnsembleQuantized<NTYPE>::init(
+        const TreeNodeElement<NTYPE>* nodes, int64_t n_nodes,
+        const std::vector<TreeNodeElement<NTYPE>*>& roots) {
+    clear();
+    if ((uint64_t)n_nodes >= ((uint64_t)1 << 32))
+        return false;
+
+    // distinct thresholds for every feature
+    std::map<int64_t, std::vector<NTYPE>> by_feature;
+    for (int64_t i = 0; i < n_nodes; ++i) {
+        if (!nodes[i].is_not_leave)
+            continue;
+        if (nodes[i].feature_id < 0 || _isnan_(nodes[i].value))
+            return false;
+        by_feature[nodes[i].feature_id].push_back(nodes[i].value);
+    }
+    if (by_feature.size() > 0xffff)
+        return false;
+
+    std::vector<int64_t> columns(by_feature.empty() ? 0 : by_feature.rbegin()->first + 1, -1);
+    int64_t max_thresholds = 0;
+    threshold_offsets_.push_back(0);
+    for (auto it = by_feature.begin(); it != by_feature.end(); ++it) {
+        std::vector<NTYPE>& th = it->second;
+        std::sort(th.begin(), th.end());
+        th.erase(std::unique(th.begin(), th.end()), th.end());
+        columns[it->first] = (int64_t)features_.size();
+        features_.push_back(it->first);
+        n_thresholds_.push_back((int64_t)th.size());
+        if ((int64_t)th.size() > max_thresholds)
+            max_thresholds = (int64_t)th.size();
+        thresholds_.insert(thresholds_.end(), th.begin(), th.end());
+        while (thresholds_.size() % QUANTIZED_PAD != 0)
+            thresholds_.push_back(std::numeric_limits<NTYPE>::quiet_NaN());
+        threshold_offsets_.push_back((int64_t)thresholds_.size());
+    }
+
+    // code 2k+1 for the last threshold must stay below the missing value
+    if (max_thresholds * 2 < 0xff) {
+        bits_ = 8;
+        fill_nodes(nodes, n_nodes, columns, nodes8_);
+    }
+    else if (max_thresholds * 2 < 0xffff) {
+        bits_ = 16;
+        fill_nodes(nodes, n_nodes, columns, nodes16_);
+    }
+    else {
+        clear();
+        return false;
+    }
+    roots_.resize(roots.size());
+    for (size_t j = 0; j < roots.size(); ++j)
+        roots_[j] = (uint32_t)(roots[j] - nodes);
+    return true;
+}
+
+
+template<typename NTYPE>
+template<typename QTYPE>
+void TreeEnsembleQuantized<NTYPE>::fill_nodes(
+        const TreeNodeElement<NTYPE>* nodes, int64_t n_nodes,
+        const std::vector<int64_t>& columns,
+        std::vector<TreeNodeElementQuantized<QTYPE>>& qnodes) {
+    qnodes.resize(n_nodes);
+    const TreeNodeElement<NTYPE>* node;
+    TreeNodeElementQuantized<QTYPE>* qnode;
+    for (int64_t i = 0; i < n_nodes; ++i) {
+        node = nodes + i;
+        qnode = &(qnodes[i]);
+        qnode->flags = (uint8_t)node->mode;
+        if (node->is_missing_track_true)
+            qnode->flags |= QUANTIZED_MISSING_TRACK_TRUE;
+        if (node->is_not_leave) {
+            int64_t col = columns[node->feature_id];
+            const NTYPE* begin = thresholds_.data() + threshold_offsets_[col];
+            const NTYPE* found = std::lower_bound(begin, begin + n_thresholds_[col], node->value);
+            qnode->feature_id = (uint16_t)col;
+            qnode->threshold = (QTYPE)((found - begin) * 2 + 1);
+            qnode->truenode = (uint32_t)(node->truenode - nodes);
+            qnode->falsenode = (uint32_t)(node->falsenode - nodes);
+        }
+        else {
+            qnode->flags |= QUANTIZED_LEAF;
+            qnode->feature_id = 0;
+            qnode->threshold = 0;
+            qnode->truenode = (uint32_t)weights_.size();
+            qnode->falsenode = (uint32_t)node->weights.size();
+            weights_.insert(weights_.end(), node->weights.begin(), node->weights.end());
+        }
+    }
+}
+
+
+template<typename NTYPE>
+template<typename QTYPE>
+void TreeEnsembleQuantized<NTYPE>::bin(
+        const NTYPE* x_data, int64_t n, int64_t stride, QTYPE* bins) const {
+    int64_t n_cols = n_columns();
+    const NTYPE* th;
+    int64_t nt;
+    NTYPE x;
+    for (int64_t i = 0; i < n; ++i, x_data += stride, bins += n_cols) {
+        for (int64_t c = 0; c < n_cols; ++c) {
+            x = x_data[features_[c]];
+            if (_isnan_(x)) {
+                bins[c] = std::numeric_limits<QTYPE>::max();
+                continue;
+            }
+            th = thresholds_.data() + threshold_offsets_[c];
+            nt = n_thresholds_[c];
+#if defined(TREE_SIMD_X86)
+            if (use_simd_ && nt <= QUANTIZED_LINEAR_MAX) {
+                // padded NaN thresholds are never counted
+                bins[c] = (QTYPE)quantized_code_avx2(th, threshold_offsets_[c + 1] - threshold_offsets_[c], x);
+                continue;
+            }
+#endif
+            bins[c] = (QTYPE)((std::lower_bound(th, th + nt, x) - th) +
+                              (std::upper_bound(th, th + nt, x) - th));
+        }
+    }
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+// Vectorized traversal of a tree stored with TreeNodeElementPacked<float>:
+// 8 (AVX2) or 16 (AVX-512) observations walk the same tree at the same time,
+// features and thresholds are loaded with gather instructions.
+// The instruction set is checked at runtime, the compiler
+// does not need any specific option.
+
+#include "op_tree_ensemble_common_p_agg_.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TREE_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TREE_SIMD_TARGET_AVX2
+#define TREE_SIMD_TARGET_AVX512
+#else
+#define TREE_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define TREE_SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+#define TREE_SIMD_NONE 0
+#define TREE_SIMD_AVX2 1
+#define TREE_SIMD_AVX512 2
+
+
+/**
+* Returns the best instruction set available on this machine
+* for the vectorized traversal (TREE_SIMD_NONE, TREE_SIMD_AVX2,
+* TREE_SIMD_AVX512).
+*/
+inline int tree_simd_cpu_level() {
+#if defined(TREE_SIMD_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+    static int level = -1;
+    if (level == -1) {
+        int info[4];
+        level = TREE_SIMD_NONE;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (osxsave) {
+            unsigned long long xcr0 = _xgetbv(0);
+            __cpuidex(info, 7, 0);
+            if ((xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0)
+                level = TREE_SIMD_AVX2;
+            if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0)
+                level = TREE_SIMD_AVX512;
+        }
+    }
+    return level;
+#else
+    static int level = __builtin_cpu_supports("avx512f")
+        ? TREE_SIMD_AVX512
+        : (__builtin_cpu_supports("avx2") ? TREE_SIMD_AVX2 : TREE_SIMD_NONE);
+    return level;
+#endif
+#else
+    return TREE_SIMD_NONE;
+#endif
+}
+
+
+inline const char* tree_simd_name(int level) {
+    switch(level) {
+        case TREE_SIMD_AVX2: return "AVX2";
+        case TREE_SIMD_AVX512: return "AVX512";
+        default: return "";
+    }
+}
+
+
+/**
+* Number of observations processed at once by the vectorized traversal.
+*/
+inline int tree_simd_width(int level) {
+    switch(level) {
+        case TREE_SIMD_AVX2: return 8;
+        case TREE_SIMD_AVX512: return 16;
+        default: return 1;
+    }
+}
+
+
+#if defined(TREE_SIMD_X86)
+
+// Comparison predicates, *x CMP threshold*, NaN values behave like
+// the scalar comparison (only != is true).
+#define TREE_SIMD_PRED(mode) \
+    (mode == NODE_MODE::BRANCH_LEQ ? _CMP_LE_OQ : \
+     mode == NODE_MODE::BRANCH_LT ? _CMP_LT_OQ : \
+     mode == NODE_MODE::BRANCH_GTE ? _CMP_GE_OQ : \
+     mode == NODE_MODE::BRANCH_GT ? _CMP_GT_OQ : \
+     mode == NODE_MODE::BRANCH_EQ ? _CMP_EQ_OQ : _CMP_NEQ_UQ)
+
+
+template<int PRED, bool MISSING>
+TREE_SIMD_TARGET_AVX2 inline void tree_simd_leaves_avx2(
+        const TreeNodeElementPacked<float>* nodes, uint32_t root,
+        const float* x_data, int64_t stride, uint32_t* leaves) {
+    // A node is 4 integers: value, feature_flags, truenode, falsenode.
+    const int* base = (const int*)nodes;
+    const __m256i feature_mask = _mm256_set1_epi32(PACKED_FEATURE_MASK);
+    const __m256i missing_mask = _mm256_set1_epi32(PACKED_MISSING_TRACK_TRUE);
+    const __m256i rows = _mm256_mullo_epi32(
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+    __m256i idx = _mm256_set1_epi32((int)root);
+    __m256i pos, flags, next;
+    __m256 leaf, val, cond;
+    for (;;) {
+        pos = _mm256_slli_epi32(idx, 2);
+        flags = _mm256_i32gather_epi32(base + 1, pos, 4);
+        // the sign bit is PACKED_LEAF
+        leaf = _mm256_castsi256_ps(flags);
+        if (_mm256_movemask_ps(leaf) == 0xff)
+            break;
+        val = _mm256_mask_i32gather_ps(
+            _mm256_setzero_ps(), x_data,
+            _mm256_add_epi32(rows, _mm256_and_si256(flags, feature_mask)),
+            _mm256_xor_ps(leaf, _mm256_castsi256_ps(_mm256_set1_epi32(-1))), 4);
+        cond = _mm256_cmp_ps(val, _mm256_i32gather_ps((const float*)base, pos, 4), PRED);
+        if (MISSING)
+            cond = _mm256_or_ps(cond, _mm256_and_ps(
+                _mm256_cmp_ps(val, val, _CMP_UNORD_Q),
+                _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                    _mm256_and_si256(flags, missing_mask), missing_mask))));
+        next = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(_mm256_i32gather_epi32(base + 3, pos, 4)),
+            _mm256_castsi256_ps(_mm256_i32gather_epi32(base + 2, pos, 4)),
+            cond));
+        idx = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(next), _mm256_castsi256_ps(idx), leaf));
+    }
+    _mm256_storeu_si256((__m256i*)leaves, idx);
+}
+
+
+template<int PRED, bool MISSING>
+TREE_SIMD_TARGET_AVX512 inline void tree_simd_leaves_avx512(
+        const TreeNodeElementPacked<float>* nodes, uint32_t root,
+        const float* x_data, int64_t stride, uint32_t* leaves) {
+    const int* base = (const int*)nodes;
+    const __m512i feature_mask = _mm512_set1_epi32(PACKED_FEATURE_MASK);
+    const __m512i missing_mask = _mm512_set1_epi32(PACKED_MISSING_TRACK_TRUE);
+    const __m512i leaf_mask = _mm512_set1_epi32((int)PACKED_LEAF);
+    const __m512i zero = _mm512_setzero_si512();
+    const __mmask16 all = 0xffff;
+    const __m512i rows = _mm512_mullo_epi32(
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+        _mm512_set1_epi32((int)stride));
+    __m512i idx = _mm512_set1_epi32((int)root);
+    __m512i pos, flags, next;
+    __m512 val;
+    __mmask16 leaf, cond;
+    for (;;) {
+        pos = _mm512_maskz_slli_epi32(all, idx, 2);
+        flags = _mm512_mask_i32gather_epi32(zero, all, pos, base + 1, 4);
+        leaf = _mm512_test_epi32_mask(flags, leaf_mask);
+        if (leaf == 0xffff)
+            break;
+        val = _mm512_mask_i32gather_ps(
+            _mm512_setzero_ps(), (__mmask16)~leaf,
+            _mm512_add_epi32(rows, _mm512_and_si512(flags, feature_mask)), x_data, 4);
+        cond = _mm512_cmp_ps_mask(
+            val, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), all, pos, (const float*)base, 4),
+            PRED);
+        if (MISSING)
+            cond |= _mm512_cmp_ps_mask(val, val, _CMP_UNORD_Q) &
+                    _mm512_test_epi32_mask(flags, missing_mask);
+        next = _mm512_mask_blend_epi32(cond,
+                                       _mm512_mask_i32gather_epi32(zero, all, pos, base + 3, 4),
+                                       _mm512_mask_i32gather_epi32(zero, all, pos, base + 2, 4));
+        idx = _mm512_mask_blend_epi32(leaf, next, idx);
+    }
+    _mm512_storeu_si512((void*)leaves, idx);
+}
+
+
+#define TREE_SIMD_CASE(FCT, mode) \
+    case NODE_MODE::mode: \
+        if (missing) \
+            FCT<TREE_SIMD_PRED(NODE_MODE::mode), true>(nodes, root, x_data, stride, leaves); \
+        else \
+            FCT<TREE_SIMD_PRED(NODE_MODE::mode), false>(nodes, root, x_data, stride, leaves); \
+        break;
+
+#define TREE_SIMD_SWITCH(FCT) \
+    switch(mode) { \
+        TREE_SIMD_CASE(FCT, BRANCH_LEQ) \
+        TREE_SIMD_CASE(FCT, BRANCH_LT) \
+        TREE_SIMD_CASE(FCT, BRANCH_GTE) \
+        TREE_SIMD_CASE(FCT, BRANCH_GT) \
+        TREE_SIMD_CASE(FCT, BRANCH_EQ) \
+        TREE_SIMD_CASE(FCT, BRANCH_NEQ) \
+        default: \
+            throw std::runtime_error("Unexpected mode for the vectorized traversal."); \
+    }
+
+#endif
+
+
+/**
+* Tells if the vectorized traversal is implemented for this type,
+* only float is implemented (gathers are limited to 8 doubles with AVX-512).
+*/
+template<typename NTYPE>
+inline int tree_simd_level() {
+    return TREE_SIMD_NONE;
+}
+
+
+template<>
+inline int tree_simd_level<float>() {
+    return tree_simd_cpu_level();
+}
+
+
+/**
+* Walks *tree_simd_width(level)* consecutive observations
+* starting at *x_data* through the tree starting at node *root*,
+* all nodes must share the same *mode*. The indices of the reached leaves
+* are stored in *leaves*.
+*/
+template<typename NTYPE>
+inline void tree_simd_leaves(int level, NODE_MODE mode, bool missing,
+                             const TreeNodeElementPacked<NTYPE>* nodes, uint32_t root,
+                             const NTYPE* x_data, int64_t stride, uint32_t* leaves) {
+    throw std::runtime_error("The vectorized traversal is only implemented for float.");
+}
+
+
+template<>
+inline void tree_simd_leaves<float>(int level, NODE_MODE mode, bool missing,
+                                    const TreeNodeElementPacked<float>* nodes, uint32_t root,
+                                    const float* x_data, int64_t stride, uint32_t* leaves) {
+#if defined(TREE_SIMD_X86)
+    if (level == TREE_SIMD_AVX512) {
+        TREE_SIMD_SWITCH(tree_simd_leaves_avx512)
+    }
+    else if (level == TREE_SIMD_AVX2) {
+        TREE_SIMD_SWITCH(tree_simd_leaves_avx2)
+    }
+    else
+#endif
+        throw std::runtime_error("No vectorized traversal for this machine.");
+}
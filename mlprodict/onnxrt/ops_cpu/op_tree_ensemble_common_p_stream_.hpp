@@ -0,0 +1,173 @@
+#pragma once
+
+// Reads and writes numpy files (.npy) by chunks of rows,
+// the runtimes use them to score inputs which do not fit in memory.
+// Only C-ordered little endian arrays are supported.
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_SIZE 6
+// the header of a file written by numpy ends on a multiple of this value
+#define NPY_HEADER_ALIGN 64
+// default number of rows read at once by the streaming functions
+#define TREE_STREAM_CHUNK 65536
+
+
+template<typename T> inline const char* npy_descr();
+template<> inline const char* npy_descr<float>() { return "<f4"; }
+template<> inline const char* npy_descr<double>() { return "<f8"; }
+template<> inline const char* npy_descr<int64_t>() { return "<i8"; }
+
+
+/**
+* Reads a 2D array stored in a .npy file by chunks of rows,
+* the rows are read in the order they appear in the file.
+*/
+template<typename T>
+class NpyChunkReader {
+    public:
+
+        NpyChunkReader(const std::string& filename) : filename_(filename), n_read_(0) {
+            f_.open(filename.c_str(), std::ios::in | std::ios::binary);
+            if (!f_.is_open())
+                fail("Unable to open file");
+            char magic[NPY_MAGIC_SIZE + 2];
+            f_.read(magic, NPY_MAGIC_SIZE + 2);
+            if (!f_ || memcmp(magic, NPY_MAGIC, NPY_MAGIC_SIZE) != 0)
+                fail("Not a numpy file");
+            // version 1 stores the header length on 2 bytes, versions 2 and 3 on 4
+            uint32_t header_size = 0;
+            unsigned char len[4] = {0, 0, 0, 0};
+            f_.read((char*)len, magic[NPY_MAGIC_SIZE] == 1 ? 2 : 4);
+            for (int i = 3; i >= 0; --i)
+                header_size = (header_size << 8) | len[i];
+            std::string header(header_size, ' ');
+            f_.read(&header[0], header_size);
+            if (!f_)
+                fail("Truncated header in file");
+
+            if (header_value(header, "descr").find(npy_descr<T>()) == std::string::npos)
+                fail(std::string("Unexpected type, expected '") + npy_descr<T>() +
+                     std::string("', got ") + header_value(header, "descr") +
+                     std::string(" in file"));
+            if (header_value(header, "fortran_order") != "False")
+                fail("Only C-ordered arrays are supported in file");
+            std::vector<int64_t> shape;
+            std::string s = header_value(header, "shape");
+            for (size_t i = 0; i < s.size(); ++i) {
+                if (s[i] >= '0' && s[i] <= '9') {
+                    size_t end = s.find_first_not_of("0123456789", i);
+                    shape.push_back(std::stoll(s.substr(i, end - i)));
+                    i = end == std::string::npos ? s.size() : end;
+                }
+            }
+            if (shape.size() != 2)
+                fail("Only 2D arrays are supported in file");
+            n_rows_ = shape[0];
+            n_cols_ = shape[1];
+        }
+
+        inline int64_t n_rows() const { return n_rows_; }
+        inline int64_t n_cols() const { return n_cols_; }
+        inline int64_t n_read() const { return n_read_; }
+
+        // Reads the next *n* rows into *buffer*.
+        void read(T* buffer, int64_t n) {
+            if (n_read_ + n > n_rows_)
+                fail("Reading beyond the last row of file");
+            f_.read((char*)buffer, (std::streamsize)(n * n_cols_ * sizeof(T)));
+            if (!f_)
+                fail("Truncated data in file");
+            n_read_ += n;
+        }
+
+    private:
+
+        // returns the raw value of *key* in the header dictionary
+        std::string header_value(const std::string& header, const std::string& key) const {
+            size_t pos = header.find(std::string("'") + key + std::string("'"));
+            if (pos == std::string::npos)
+                return std::string();
+            pos = header.find(':', pos);
+            if (pos == std::string::npos)
+                return std::string();
+            pos = header.find_first_not_of(' ', pos + 1);
+            if (pos == std::string::npos)
+                return std::string();
+            size_t end = header[pos] == '('
+                ? header.find(')', pos) + 1 : header.find_first_of(",}", pos);
+            return header.substr(pos, end - pos);
+        }
+
+        void fail(const std::string& message) const {
+            throw std::runtime_error(message + std::string(" '") + filename_ + std::string("'."));
+        }
+
+        std::string filename_;
+        std::ifstream f_;
+        int64_t n_rows_;
+        int64_t n_cols_;
+        int64_t n_read_;
+};
+
+
+/**
+* Writes an array in a .npy file by chunks of rows,
+* the shape is known before the first row is written.
+*/
+template<typename T>
+class NpyChunkWriter {
+    public:
+
+        NpyChunkWriter(const std::string& filename, const std::vector<int64_t>& shape) :
+                filename_(filename) {
+            f_.open(filename.c_str(), std::ios::out | std::ios::binary);
+            if (!f_.is_open())
+                fail("Unable to create file");
+            std::ostringstream dict;
+            dict << "{'descr': '" << npy_descr<T>() << "', 'fortran_order': False, 'shape': (";
+            for (size_t i = 0; i < shape.size(); ++i)
+                dict << shape[i] << (shape.size() == 1 || i + 1 < shape.size() ? ", " : "");
+            dict << "), }";
+            std::string header = dict.str();
+            // version 1, the header is padded with spaces and ends with a newline
+            size_t total = NPY_MAGIC_SIZE + 4 + header.size() + 1;
+            header.append((NPY_HEADER_ALIGN - total % NPY_HEADER_ALIGN) % NPY_HEADER_ALIGN, ' ');
+            header.push_back('\n');
+            if (header.size() > 65535)
+                fail("Header too long for file");
+            unsigned char prefix[4] = {1, 0, (unsigned char)(header.size() & 0xff),
+                                       (unsigned char)(header.size() >> 8)};
+            f_.write(NPY_MAGIC, NPY_MAGIC_SIZE);
+            f_.write((const char*)prefix, 4);
+            f_.write(header.data(), header.size());
+        }
+
+        void write(const T* data, int64_t size) {
+            f_.write((const char*)data, (std::streamsize)(size * sizeof(T)));
+            if (!f_)
+                fail("Unable to write file");
+        }
+
+        void close() {
+            f_.close();
+            if (f_.fail())
+                fail("Unable to write file");
+        }
+
+    private:
+
+        void fail(const std::string& message) const {
+            throw std::runtime_error(message + std::string(" '") + filename_ + std::string("'."));
+        }
+
+        std::string filename_;
+        std::ofstream f_;
+};
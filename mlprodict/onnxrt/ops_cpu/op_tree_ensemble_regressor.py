@@ -6,7 +6,7 @@
 """
 from collections import OrderedDict
 import numpy
-from ._op_helper import _get_typed_class_attribute
+from ._op_helper import _get_typed_class_attribute, _stream_compute
 from ._op import OpRunUnaryNum, RuntimeTypeError
 from ._new_ops import OperatorSchema
 from .op_tree_ensemble_regressor_ import (  # pylint: disable=E0611
@@ -62,6 +62,48 @@ class TreeEnsembleRegressorCommon(OpRunUnaryNum):
                 for k in self.__class__.atts]
         self.rt_.init(*atts)
 
+    def __getstate__(self):
+        """
+        For pickle, the runtime is stored as a binary blob
+        (see method *serialize*), it is not built again from the attributes.
+        """
+        state = self.__dict__.copy()
+        if hasattr(self.rt_, 'serialize'):
+            state['rt_'] = (self.rt_.__class__.__name__, self.rt_.serialize())
+        return state
+
+    def __setstate__(self, state):
+        """
+        For pickle.
+        """
+        if isinstance(state.get('rt_', None), tuple):
+            name, blob = state['rt_']
+            classes = {cl.__name__: cl for cl in [
+                RuntimeTreeEnsembleRegressorPFloat, RuntimeTreeEnsembleRegressorPDouble]}
+            rt = classes[name](60, 20)
+            rt.deserialize(blob)
+            state = state.copy()
+            state['rt_'] = rt
+        self.__dict__.update(state)
+
+    def run_stream(self, chunks, out):
+        """
+        Computes the predictions of inputs too big to stay in memory.
+
+        :param chunks: iterable of 2D arrays, the next one is retrieved
+            while the current one is computed, or the name of a *.npy* file
+            read by the runtime by chunks of rows
+        :param out: array *(N, n_targets)* receiving the predictions
+            (a :epkg:`numpy` memmap for example), or the name of the *.npy*
+            file to create if *chunks* is a filename
+        :return: number of rows
+
+        This requires the runtime version 1.
+        """
+        if isinstance(chunks, str):
+            return self.rt_.compute_npy(chunks, out, 0)
+        return _stream_compute(self.rt_.compute, chunks, [out])
+
     def _run(self, x):  # pylint: disable=W0221
         """
         This is a C++ implementation coming from
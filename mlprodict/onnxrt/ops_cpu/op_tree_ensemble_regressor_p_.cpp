@@ -4,12 +4,17 @@
 #include "op_tree_ensemble_common_p_.hpp"
 
 
-template<typename NTYPE>
+/**
+* NTYPE is the type of the thresholds, the weights and the scores,
+* XTYPE the type of the features (float features with a double model
+* accumulates float inputs in double).
+*/
+template<typename NTYPE, typename XTYPE = NTYPE>
 class RuntimeTreeEnsembleRegressorP : public RuntimeTreeEnsembleCommonP<NTYPE>
 {
     public:
 
-        RuntimeTreeEnsembleRegressorP(int omp_tree, int omp_N);
+        RuntimeTreeEnsembleRegressorP(int omp_tree, int omp_N, bool packed = false, bool quantized = false);
         ~RuntimeTreeEnsembleRegressorP();
 
         void init(
@@ -31,24 +36,26 @@ class RuntimeTreeEnsembleRegressorP : public RuntimeTreeEnsembleCommonP<NTYPE>
             py::array_t<int64_t> target_treeids,
             py::array_t<NTYPE> target_weights);
         
-        py::array_t<NTYPE> compute(py::array_t<NTYPE> X);
+        py::array_t<NTYPE> compute(py::array_t<XTYPE> X);
+        int64_t compute_npy(const std::string& input, const std::string& output,
+                            int64_t chunk_rows);
         py::array_t<NTYPE> compute_tree_outputs(py::array_t<NTYPE> X);
 };
 
 
-template<typename NTYPE>
-RuntimeTreeEnsembleRegressorP<NTYPE>::RuntimeTreeEnsembleRegressorP(int omp_tree, int omp_N) :
-   RuntimeTreeEnsembleCommonP<NTYPE>(omp_tree, omp_N) {
+template<typename NTYPE, typename XTYPE>
+RuntimeTreeEnsembleRegressorP<NTYPE, XTYPE>::RuntimeTreeEnsembleRegressorP(int omp_tree, int omp_N, bool packed, bool quantized) :
+   RuntimeTreeEnsembleCommonP<NTYPE>(omp_tree, omp_N, packed, quantized) {
 }
 
 
-template<typename NTYPE>
-RuntimeTreeEnsembleRegressorP<NTYPE>::~RuntimeTreeEnsembleRegressorP() {
+template<typename NTYPE, typename XTYPE>
+RuntimeTreeEnsembleRegressorP<NTYPE, XTYPE>::~RuntimeTreeEnsembleRegressorP() {
 }
 
 
-template<typename NTYPE>
-void RuntimeTreeEnsembleRegressorP<NTYPE>::init(
+template<typename NTYPE, typename XTYPE>
+void RuntimeTreeEnsembleRegressorP<NTYPE, XTYPE>::init(
             const std::string &aggregate_function,
             py::array_t<NTYPE> base_values,
             int64_t n_targets,
@@ -76,48 +83,77 @@ void RuntimeTreeEnsembleRegressorP<NTYPE>::init(
 }
 
 
-template<typename NTYPE>
-py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute(py::array_t<NTYPE> X) {
+template<typename NTYPE, typename XTYPE>
+py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE, XTYPE>::compute(py::array_t<XTYPE> X) {
     switch(this->aggregate_function_) {
         case AGGREGATE_FUNCTION::AVERAGE:
             return this->compute_agg(X, _AggregatorAverage<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::SUM:
             return this->compute_agg(X, _AggregatorSum<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MIN:
             return this->compute_agg(X, _AggregatorMin<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MAX:
             return this->compute_agg(X, _AggregatorMax<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
     }        
     throw std::runtime_error("Unknown aggregation function in TreeEnsemble.");
 }
 
 
-template<typename NTYPE>
-py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute_tree_outputs(py::array_t<NTYPE> X) {
+template<typename NTYPE, typename XTYPE>
+int64_t RuntimeTreeEnsembleRegressorP<NTYPE, XTYPE>::compute_npy(
+        const std::string& input, const std::string& output, int64_t chunk_rows) {
+    switch(this->aggregate_function_) {
+        case AGGREGATE_FUNCTION::AVERAGE:
+            return this->template compute_npy_agg<_AggregatorAverage<NTYPE>, XTYPE>(
+                        input, output, NULL, chunk_rows, _AggregatorAverage<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+        case AGGREGATE_FUNCTION::SUM:
+            return this->template compute_npy_agg<_AggregatorSum<NTYPE>, XTYPE>(
+                        input, output, NULL, chunk_rows, _AggregatorSum<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+        case AGGREGATE_FUNCTION::MIN:
+            return this->template compute_npy_agg<_AggregatorMin<NTYPE>, XTYPE>(
+                        input, output, NULL, chunk_rows, _AggregatorMin<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+        case AGGREGATE_FUNCTION::MAX:
+            return this->template compute_npy_agg<_AggregatorMax<NTYPE>, XTYPE>(
+                        input, output, NULL, chunk_rows, _AggregatorMax<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+    }        
+    throw std::runtime_error("Unknown aggregation function in TreeEnsemble.");
+}
+
+
+template<typename NTYPE, typename XTYPE>
+py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE, XTYPE>::compute_tree_outputs(py::array_t<NTYPE> X) {
     switch(this->aggregate_function_) {
         case AGGREGATE_FUNCTION::AVERAGE:
             return this->compute_tree_outputs_agg(X, _AggregatorAverage<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::SUM:
             return this->compute_tree_outputs_agg(X, _AggregatorSum<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MIN:
             return this->compute_tree_outputs_agg(X, _AggregatorMin<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MAX:
             return this->compute_tree_outputs_agg(X, _AggregatorMax<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
     }        
     throw std::runtime_error("Unknown aggregation function in TreeEnsemble.");
@@ -126,15 +162,22 @@ py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute_tree_outputs(py
 
 class RuntimeTreeEnsembleRegressorPFloat : public RuntimeTreeEnsembleRegressorP<float> {
     public:
-        RuntimeTreeEnsembleRegressorPFloat(int omp_tree, int omp_N) :
-            RuntimeTreeEnsembleRegressorP<float>(omp_tree, omp_N) {}
+        RuntimeTreeEnsembleRegressorPFloat(int omp_tree, int omp_N, bool packed = false, bool quantized = false) :
+            RuntimeTreeEnsembleRegressorP<float>(omp_tree, omp_N, packed, quantized) {}
 };
 
 
 class RuntimeTreeEnsembleRegressorPDouble : public RuntimeTreeEnsembleRegressorP<double> {
     public:
-        RuntimeTreeEnsembleRegressorPDouble(int omp_tree, int omp_N) :
-            RuntimeTreeEnsembleRegressorP<double>(omp_tree, omp_N) {}
+        RuntimeTreeEnsembleRegressorPDouble(int omp_tree, int omp_N, bool packed = false, bool quantized = false) :
+            RuntimeTreeEnsembleRegressorP<double>(omp_tree, omp_N, packed, quantized) {}
+};
+
+
+class RuntimeTreeEnsembleRegressorPFloatDouble : public RuntimeTreeEnsembleRegressorP<double, float> {
+    public:
+        RuntimeTreeEnsembleRegressorPFloatDouble(int omp_tree, int omp_N, bool packed = false, bool quantized = false) :
+            RuntimeTreeEnsembleRegressorP<double, float>(omp_tree, omp_N, packed, quantized) {}
 };
 
 
@@ -269,29 +312,73 @@ in :epkg:`onnxruntime`.)pbdoc"
           "Test the runtime (min).");
     m.def("test_tree_regressor_multitarget_max", &test_tree_regressor_multitarget_max,
           "Test the runtime (max).");
+    // the runtimes use the thread pool of _op_onnx_numpy
+    ThreadPool::share(py::capsule(py::module::import(
+        "mlprodict.onnxrt.ops_cpu._op_onnx_numpy").attr("thread_pool_capsule")()));
 
     py::class_<RuntimeTreeEnsembleRegressorPFloat> clf (m, "RuntimeTreeEnsembleRegressorPFloat",
         R"pbdoc(Implements float runtime for operator TreeEnsembleRegressor. The code is inspired from
 `tree_ensemble_regressor.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_Regressor.cc>`_
 in :epkg:`onnxruntime`. Supports float only.
 
-:param omp_tree: number of trees above which the runtime uses :epkg:`openmp`
-    to parallelize tree computation when the number of observations it 1
+:param omp_tree: number of trees above which the runtime splits the trees
+    into blocks computed in parallel by the thread pool
 :param omp_N: number of observvations above which the runtime uses
-:epkg:`openmp` to parallelize the predictions
+    the thread pool to parallelize the predictions
+:param packed: stores the nodes with a compact layout (16 bytes per node
+    for float), leaves weights are stored in a contiguous array
+:param quantized: replaces thresholds by their rank among the thresholds
+    of the same feature (8 or 16 bits), batches are converted into ranks
+    before the trees are evaluated, decisions are the same
 )pbdoc");
 
     clf.def(py::init<int, int>());
+    clf.def(py::init<int, int, bool>());
+    clf.def(py::init<int, int, bool, bool>());
     clf.def_readwrite("omp_tree_", &RuntimeTreeEnsembleRegressorPFloat::omp_tree_,
-        "Number of trees above which the computation is parallelized for one observation.");
+        "Number of trees above which the trees are split into blocks computed in parallel.");
     clf.def_readwrite("omp_N_", &RuntimeTreeEnsembleRegressorPFloat::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    clf.def_readonly("dense_leaves_", &RuntimeTreeEnsembleRegressorPFloat::dense_leaves_,
+        "Every leaf holds one weight per class, the weights are stored in a dense table.");
+    clf.def_readwrite("deterministic_", &RuntimeTreeEnsembleRegressorPFloat::deterministic_,
+        "Sums the trees in blocks of fixed size reduced pairwise, "
+        "the predictions do not depend on the number of threads.");
+    clf.def_readwrite("profile_", &RuntimeTreeEnsembleRegressorPFloat::profile_,
+        "Counts the visits of every node and the branches taken during the predictions, "
+        "the predictions are slower, see *get_node_counts*.");
+    clf.def("get_node_counts", &RuntimeTreeEnsembleRegressorPFloat::get_node_counts,
+        "Returns a matrix (n_nodes, 3), visits, true branches, false branches for every node "
+        "in the order of the ONNX attributes (the order of the compact layout "
+        "if the model was restored from a blob), filled when *profile_* is True.");
+    clf.def("get_hitrates", &RuntimeTreeEnsembleRegressorPFloat::get_hitrates,
+        "Returns the visits of every node divided by the number of profiled observations, "
+        "it can be used as attribute *nodes_hitrates* to reorder the nodes.");
+    clf.def("reset_node_counts", &RuntimeTreeEnsembleRegressorPFloat::reset_node_counts,
+        "Resets the counters filled when *profile_* is True.");
+    clf.def_readwrite("tile_N_", &RuntimeTreeEnsembleRegressorPFloat::tile_N_,
+        "Number of observations every tree is evaluated for before moving to the next tree, "
+        "1 evaluates all trees for one observation at a time.");
+    clf.def_readwrite("use_simd_", &RuntimeTreeEnsembleRegressorPFloat::use_simd_,
+        "Uses the vectorized traversal (AVX2, AVX-512) when it is available, "
+        "it requires the compact layout (*packed*), float and the same mode for every node, "
+        "``runtime_options()`` tells which instruction set was selected.");
+    clf.def_readwrite("use_quickscorer_", &RuntimeTreeEnsembleRegressorPFloat::use_quickscorer_,
+        "Evaluates the trees with bitvectors (QuickScorer) if every tree has "
+        "at most 64 leaves and the vectorized traversal, the quantized thresholds "
+        "and the deterministic mode are not used.");
     clf.def_readonly("roots_", &RuntimeTreeEnsembleRegressorPFloat::roots_,
                      "Returns the roots indices.");
     clf.def("init", &RuntimeTreeEnsembleRegressorPFloat::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     clf.def("compute", &RuntimeTreeEnsembleRegressorPFloat::compute,
-            "Computes the predictions for the random forest.");
+            "Computes the predictions for the random forest, X may be C-ordered, "
+            "Fortran-ordered or strided, it is not copied.");
+    clf.def("compute_npy", &RuntimeTreeEnsembleRegressorPFloat::compute_npy,
+            "Computes the predictions of a matrix stored in a .npy file by chunks of "
+            "*chunk_rows* rows (0 for the default) and saves them in another .npy file, "
+            "the next chunk is read while the current one is scored. "
+            "Returns the number of rows.");
     clf.def("runtime_options", &RuntimeTreeEnsembleRegressorPFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeTreeEnsembleRegressorPFloat::omp_get_max_threads,
@@ -301,6 +388,12 @@ in :epkg:`onnxruntime`. Supports float only.
     clf.def_readonly("n_targets_", &RuntimeTreeEnsembleRegressorPFloat::n_targets_or_classes_, "See :ref:`lpyort-TreeEnsembleRegressor`.");
     clf.def_readonly("post_transform_", &RuntimeTreeEnsembleRegressorPFloat::post_transform_, "See :ref:`lpyort-TreeEnsembleRegressor`.");
 
+    clf.def("autotune", &RuntimeTreeEnsembleRegressorPFloat::autotune,
+        "Measures the prediction time of sample *X* with several settings "
+        "repeated *repeat* times and keeps the fastest ones in "
+        "*tile_N_*, *omp_tree_*, *omp_N_*, they are saved with the model. "
+        "No other thread may call *compute* until it returns, these "
+        "attributes are modified while the GIL is released.");
     clf.def("debug_threshold", &RuntimeTreeEnsembleRegressorPFloat::debug_threshold,
         "Checks every features against every features against every threshold. Returns a matrix of boolean.");
     clf.def("compute_tree_outputs", &RuntimeTreeEnsembleRegressorPFloat::compute_tree_outputs,
@@ -309,33 +402,94 @@ in :epkg:`onnxruntime`. Supports float only.
         "Tells if all nodes applies the same rule for thresholds.");
     clf.def_readonly("has_missing_tracks_", &RuntimeTreeEnsembleRegressorPFloat::has_missing_tracks_,
         "Tells if the model handles missing values.");
+    clf.def_readonly("packed_", &RuntimeTreeEnsembleRegressorPFloat::packed_,
+        "Tells if the nodes are stored with the compact layout.");
+    clf.def_readonly("quantized_", &RuntimeTreeEnsembleRegressorPFloat::quantized_,
+        "Tells if batches are evaluated with quantized thresholds.");
+    clf.def_readonly("load_time_", &RuntimeTreeEnsembleRegressorPFloat::load_time_,
+        "Duration of the last call to *init*, *load* or *deserialize* in seconds.");
+    clf.def_readonly("node_order_", &RuntimeTreeEnsembleRegressorPFloat::node_order_,
+        "Tells how the nodes were reordered after loading the model, "
+        "``HITRATES`` (most probable child next to its parent) or ``BFS`` (breadth-first).");
     clf.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleRegressorPFloat::get_nodes_modes,
         "Returns the mode for every node.");
     clf.def("__sizeof__", &RuntimeTreeEnsembleRegressorPFloat::get_sizeof,
         "Returns the size of the object.");
+    clf.def("serialize", &RuntimeTreeEnsembleRegressorPFloat::serialize,
+        "Returns the model stored with the compact layout as a binary blob, "
+        "the bitvector evaluation and the quantized thresholds are built again "
+        "when the blob is loaded.");
+    clf.def("deserialize", &RuntimeTreeEnsembleRegressorPFloat::deserialize,
+        "Restores a model from a blob returned by *serialize*.");
+    clf.def("save", &RuntimeTreeEnsembleRegressorPFloat::save,
+        "Saves the blob returned by *serialize* into a file.");
+    clf.def("load", &RuntimeTreeEnsembleRegressorPFloat::load,
+        "Maps a file created by *save* in memory and uses it without copying it, "
+        "processes loading the same file share the same memory.");
 
     py::class_<RuntimeTreeEnsembleRegressorPDouble> cld (m, "RuntimeTreeEnsembleRegressorPDouble",
         R"pbdoc(Implements double runtime for operator TreeEnsembleRegressor. The code is inspired from
 `tree_ensemble_regressor.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_Regressor.cc>`_
 in :epkg:`onnxruntime`. Supports double only.
 
-:param omp_tree: number of trees above which the runtime uses :epkg:`openmp`
-    to parallelize tree computation when the number of observations it 1
+:param omp_tree: number of trees above which the runtime splits the trees
+    into blocks computed in parallel by the thread pool
 :param omp_N: number of observvations above which the runtime uses
-:epkg:`openmp` to parallelize the predictions
+    the thread pool to parallelize the predictions
+:param packed: stores the nodes with a compact layout (16 bytes per node
+    for float), leaves weights are stored in a contiguous array
+:param quantized: replaces thresholds by their rank among the thresholds
+    of the same feature (8 or 16 bits), batches are converted into ranks
+    before the trees are evaluated, decisions are the same
 )pbdoc");
 
     cld.def(py::init<int, int>());
+    cld.def(py::init<int, int, bool>());
+    cld.def(py::init<int, int, bool, bool>());
     cld.def_readwrite("omp_tree_", &RuntimeTreeEnsembleRegressorPDouble::omp_tree_,
-        "Number of trees above which the computation is parallelized for one observation.");
+        "Number of trees above which the trees are split into blocks computed in parallel.");
     cld.def_readwrite("omp_N_", &RuntimeTreeEnsembleRegressorPDouble::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    cld.def_readonly("dense_leaves_", &RuntimeTreeEnsembleRegressorPDouble::dense_leaves_,
+        "Every leaf holds one weight per class, the weights are stored in a dense table.");
+    cld.def_readwrite("deterministic_", &RuntimeTreeEnsembleRegressorPDouble::deterministic_,
+        "Sums the trees in blocks of fixed size reduced pairwise, "
+        "the predictions do not depend on the number of threads.");
+    cld.def_readwrite("profile_", &RuntimeTreeEnsembleRegressorPDouble::profile_,
+        "Counts the visits of every node and the branches taken during the predictions, "
+        "the predictions are slower, see *get_node_counts*.");
+    cld.def("get_node_counts", &RuntimeTreeEnsembleRegressorPDouble::get_node_counts,
+        "Returns a matrix (n_nodes, 3), visits, true branches, false branches for every node "
+        "in the order of the ONNX attributes (the order of the compact layout "
+        "if the model was restored from a blob), filled when *profile_* is True.");
+    cld.def("get_hitrates", &RuntimeTreeEnsembleRegressorPDouble::get_hitrates,
+        "Returns the visits of every node divided by the number of profiled observations, "
+        "it can be used as attribute *nodes_hitrates* to reorder the nodes.");
+    cld.def("reset_node_counts", &RuntimeTreeEnsembleRegressorPDouble::reset_node_counts,
+        "Resets the counters filled when *profile_* is True.");
+    cld.def_readwrite("tile_N_", &RuntimeTreeEnsembleRegressorPDouble::tile_N_,
+        "Number of observations every tree is evaluated for before moving to the next tree, "
+        "1 evaluates all trees for one observation at a time.");
+    cld.def_readwrite("use_simd_", &RuntimeTreeEnsembleRegressorPDouble::use_simd_,
+        "Uses the vectorized traversal (AVX2, AVX-512) when it is available, "
+        "it requires the compact layout (*packed*), float and the same mode for every node, "
+        "``runtime_options()`` tells which instruction set was selected.");
+    cld.def_readwrite("use_quickscorer_", &RuntimeTreeEnsembleRegressorPDouble::use_quickscorer_,
+        "Evaluates the trees with bitvectors (QuickScorer) if every tree has "
+        "at most 64 leaves and the vectorized traversal, the quantized thresholds "
+        "and the deterministic mode are not used.");
     cld.def_readonly("roots_", &RuntimeTreeEnsembleRegressorPDouble::roots_,
                      "Returns the roots indices.");
     cld.def("init", &RuntimeTreeEnsembleRegressorPDouble::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     cld.def("compute", &RuntimeTreeEnsembleRegressorPDouble::compute,
-            "Computes the predictions for the random forest.");
+            "Computes the predictions for the random forest, X may be C-ordered, "
+            "Fortran-ordered or strided, it is not copied.");
+    cld.def("compute_npy", &RuntimeTreeEnsembleRegressorPDouble::compute_npy,
+            "Computes the predictions of a matrix stored in a .npy file by chunks of "
+            "*chunk_rows* rows (0 for the default) and saves them in another .npy file, "
+            "the next chunk is read while the current one is scored. "
+            "Returns the number of rows.");
     cld.def("runtime_options", &RuntimeTreeEnsembleRegressorPDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeTreeEnsembleRegressorPDouble::omp_get_max_threads,
@@ -345,6 +499,12 @@ in :epkg:`onnxruntime`. Supports double only.
     cld.def_readonly("n_targets_", &RuntimeTreeEnsembleRegressorPDouble::n_targets_or_classes_, "See :ref:`lpyort-TreeEnsembleRegressorDouble`.");
     cld.def_readonly("post_transform_", &RuntimeTreeEnsembleRegressorPDouble::post_transform_, "See :ref:`lpyort-TreeEnsembleRegressorDouble`.");
 
+    cld.def("autotune", &RuntimeTreeEnsembleRegressorPDouble::autotune,
+        "Measures the prediction time of sample *X* with several settings "
+        "repeated *repeat* times and keeps the fastest ones in "
+        "*tile_N_*, *omp_tree_*, *omp_N_*, they are saved with the model. "
+        "No other thread may call *compute* until it returns, these "
+        "attributes are modified while the GIL is released.");
     cld.def("debug_threshold", &RuntimeTreeEnsembleRegressorPDouble::debug_threshold,
         "Checks every features against every features against every threshold. Returns a matrix of boolean.");
     cld.def("compute_tree_outputs", &RuntimeTreeEnsembleRegressorPDouble::compute_tree_outputs,
@@ -353,10 +513,145 @@ in :epkg:`onnxruntime`. Supports double only.
         "Tells if all nodes applies the same rule for thresholds.");
     cld.def_readonly("has_missing_tracks_", &RuntimeTreeEnsembleRegressorPDouble::has_missing_tracks_,
         "Tells if the model handles missing values.");
+    cld.def_readonly("packed_", &RuntimeTreeEnsembleRegressorPDouble::packed_,
+        "Tells if the nodes are stored with the compact layout.");
+    cld.def_readonly("quantized_", &RuntimeTreeEnsembleRegressorPDouble::quantized_,
+        "Tells if batches are evaluated with quantized thresholds.");
+    cld.def_readonly("load_time_", &RuntimeTreeEnsembleRegressorPDouble::load_time_,
+        "Duration of the last call to *init*, *load* or *deserialize* in seconds.");
+    cld.def_readonly("node_order_", &RuntimeTreeEnsembleRegressorPDouble::node_order_,
+        "Tells how the nodes were reordered after loading the model, "
+        "``HITRATES`` (most probable child next to its parent) or ``BFS`` (breadth-first).");
     cld.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleRegressorPDouble::get_nodes_modes,
         "Returns the mode for every node.");
     cld.def("__sizeof__", &RuntimeTreeEnsembleRegressorPDouble::get_sizeof,
         "Returns the size of the object.");
+    cld.def("serialize", &RuntimeTreeEnsembleRegressorPDouble::serialize,
+        "Returns the model stored with the compact layout as a binary blob, "
+        "the bitvector evaluation and the quantized thresholds are built again "
+        "when the blob is loaded.");
+    cld.def("deserialize", &RuntimeTreeEnsembleRegressorPDouble::deserialize,
+        "Restores a model from a blob returned by *serialize*.");
+    cld.def("save", &RuntimeTreeEnsembleRegressorPDouble::save,
+        "Saves the blob returned by *serialize* into a file.");
+    cld.def("load", &RuntimeTreeEnsembleRegressorPDouble::load,
+        "Maps a file created by *save* in memory and uses it without copying it, "
+        "processes loading the same file share the same memory.");
+
+    py::class_<RuntimeTreeEnsembleRegressorPFloatDouble> clfd (m, "RuntimeTreeEnsembleRegressorPFloatDouble",
+        R"pbdoc(Implements mixed runtime for operator TreeEnsembleRegressor. The code is inspired from
+`tree_ensemble_regressor.cc <https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_Regressor.cc>`_
+in :epkg:`onnxruntime`. Method *compute* takes float features and returns double
+predictions, the model is stored in double and the trees are summed in double.
+Rows are converted into double one tile at a time, the batch is never
+converted as a whole. Thresholds coming from a float model are exactly
+represented in double, decisions are the same as the float runtime.
+
+:param omp_tree: number of trees above which the runtime splits the trees
+    into blocks computed in parallel by the thread pool
+:param omp_N: number of observvations above which the runtime uses
+    the thread pool to parallelize the predictions
+:param packed: stores the nodes with a compact layout (16 bytes per node
+    for float), leaves weights are stored in a contiguous array
+:param quantized: replaces thresholds by their rank among the thresholds
+    of the same feature (8 or 16 bits), batches are converted into ranks
+    before the trees are evaluated, decisions are the same
+)pbdoc");
+
+    clfd.def(py::init<int, int>());
+    clfd.def(py::init<int, int, bool>());
+    clfd.def(py::init<int, int, bool, bool>());
+    clfd.def_readwrite("omp_tree_", &RuntimeTreeEnsembleRegressorPFloatDouble::omp_tree_,
+        "Number of trees above which the trees are split into blocks computed in parallel.");
+    clfd.def_readwrite("omp_N_", &RuntimeTreeEnsembleRegressorPFloatDouble::omp_N_,
+        "Number of observations above which the computation is parallelized.");
+    clfd.def_readonly("dense_leaves_", &RuntimeTreeEnsembleRegressorPFloatDouble::dense_leaves_,
+        "Every leaf holds one weight per class, the weights are stored in a dense table.");
+    clfd.def_readwrite("deterministic_", &RuntimeTreeEnsembleRegressorPFloatDouble::deterministic_,
+        "Sums the trees in blocks of fixed size reduced pairwise, "
+        "the predictions do not depend on the number of threads.");
+    clfd.def_readwrite("profile_", &RuntimeTreeEnsembleRegressorPFloatDouble::profile_,
+        "Counts the visits of every node and the branches taken during the predictions, "
+        "the predictions are slower, see *get_node_counts*.");
+    clfd.def("get_node_counts", &RuntimeTreeEnsembleRegressorPFloatDouble::get_node_counts,
+        "Returns a matrix (n_nodes, 3), visits, true branches, false branches for every node "
+        "in the order of the ONNX attributes (the order of the compact layout "
+        "if the model was restored from a blob), filled when *profile_* is True.");
+    clfd.def("get_hitrates", &RuntimeTreeEnsembleRegressorPFloatDouble::get_hitrates,
+        "Returns the visits of every node divided by the number of profiled observations, "
+        "it can be used as attribute *nodes_hitrates* to reorder the nodes.");
+    clfd.def("reset_node_counts", &RuntimeTreeEnsembleRegressorPFloatDouble::reset_node_counts,
+        "Resets the counters filled when *profile_* is True.");
+    clfd.def_readwrite("tile_N_", &RuntimeTreeEnsembleRegressorPFloatDouble::tile_N_,
+        "Number of observations every tree is evaluated for before moving to the next tree, "
+        "1 evaluates all trees for one observation at a time.");
+    clfd.def_readwrite("use_simd_", &RuntimeTreeEnsembleRegressorPFloatDouble::use_simd_,
+        "Uses the vectorized traversal (AVX2, AVX-512) when it is available, "
+        "it requires the compact layout (*packed*), float and the same mode for every node, "
+        "``runtime_options()`` tells which instruction set was selected.");
+    clfd.def_readwrite("use_quickscorer_", &RuntimeTreeEnsembleRegressorPFloatDouble::use_quickscorer_,
+        "Evaluates the trees with bitvectors (QuickScorer) if every tree has "
+        "at most 64 leaves and the vectorized traversal, the quantized thresholds "
+        "and the deterministic mode are not used.");
+    clfd.def_readonly("roots_", &RuntimeTreeEnsembleRegressorPFloatDouble::roots_,
+                     "Returns the roots indices.");
+    clfd.def("init", &RuntimeTreeEnsembleRegressorPFloatDouble::init,
+            "Initializes the runtime with the ONNX attributes in alphabetical order.");
+    clfd.def("compute", &RuntimeTreeEnsembleRegressorPFloatDouble::compute,
+            "Computes the predictions for the random forest, float features, double predictions, "
+            "X may be C-ordered, Fortran-ordered or strided, it is not copied.");
+    clfd.def("compute_npy", &RuntimeTreeEnsembleRegressorPFloatDouble::compute_npy,
+            "Computes the predictions of a matrix stored in a .npy file by chunks of "
+            "*chunk_rows* rows (0 for the default) and saves them in another .npy file, "
+            "the next chunk is read while the current one is scored. "
+            "Returns the number of rows.");
+    clfd.def("runtime_options", &RuntimeTreeEnsembleRegressorPFloatDouble::runtime_options,
+            "Returns indications about how the runtime was compiled.");
+    clfd.def("omp_get_max_threads", &RuntimeTreeEnsembleRegressorPFloatDouble::omp_get_max_threads,
+            "Returns omp_get_max_threads from openmp library.");
+
+    clfd.def_readonly("base_values_", &RuntimeTreeEnsembleRegressorPFloatDouble::base_values_, "See :ref:`lpyort-TreeEnsembleRegressorDouble`.");
+    clfd.def_readonly("n_targets_", &RuntimeTreeEnsembleRegressorPFloatDouble::n_targets_or_classes_, "See :ref:`lpyort-TreeEnsembleRegressorDouble`.");
+    clfd.def_readonly("post_transform_", &RuntimeTreeEnsembleRegressorPFloatDouble::post_transform_, "See :ref:`lpyort-TreeEnsembleRegressorDouble`.");
+
+    clfd.def("autotune", &RuntimeTreeEnsembleRegressorPFloatDouble::autotune,
+        "Measures the prediction time of sample *X* with several settings "
+        "repeated *repeat* times and keeps the fastest ones in "
+        "*tile_N_*, *omp_tree_*, *omp_N_*, they are saved with the model. "
+        "No other thread may call *compute* until it returns, these "
+        "attributes are modified while the GIL is released.");
+    clfd.def("debug_threshold", &RuntimeTreeEnsembleRegressorPFloatDouble::debug_threshold,
+        "Checks every features against every features against every threshold. Returns a matrix of boolean.");
+    clfd.def("compute_tree_outputs", &RuntimeTreeEnsembleRegressorPFloatDouble::compute_tree_outputs,
+        "Computes every tree output.");
+    clfd.def_readonly("same_mode_", &RuntimeTreeEnsembleRegressorPFloatDouble::same_mode_,
+        "Tells if all nodes applies the same rule for thresholds.");
+    clfd.def_readonly("has_missing_tracks_", &RuntimeTreeEnsembleRegressorPFloatDouble::has_missing_tracks_,
+        "Tells if the model handles missing values.");
+    clfd.def_readonly("packed_", &RuntimeTreeEnsembleRegressorPFloatDouble::packed_,
+        "Tells if the nodes are stored with the compact layout.");
+    clfd.def_readonly("quantized_", &RuntimeTreeEnsembleRegressorPFloatDouble::quantized_,
+        "Tells if batches are evaluated with quantized thresholds.");
+    clfd.def_readonly("load_time_", &RuntimeTreeEnsembleRegressorPFloatDouble::load_time_,
+        "Duration of the last call to *init*, *load* or *deserialize* in seconds.");
+    clfd.def_readonly("node_order_", &RuntimeTreeEnsembleRegressorPFloatDouble::node_order_,
+        "Tells how the nodes were reordered after loading the model, "
+        "``HITRATES`` (most probable child next to its parent) or ``BFS`` (breadth-first).");
+    clfd.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleRegressorPFloatDouble::get_nodes_modes,
+        "Returns the mode for every node.");
+    clfd.def("__sizeof__", &RuntimeTreeEnsembleRegressorPFloatDouble::get_sizeof,
+        "Returns the size of the object.");
+    clfd.def("serialize", &RuntimeTreeEnsembleRegressorPFloatDouble::serialize,
+        "Returns the model stored with the compact layout as a binary blob, "
+        "the bitvector evaluation and the quantized thresholds are built again "
+        "when the blob is loaded.");
+    clfd.def("deserialize", &RuntimeTreeEnsembleRegressorPFloatDouble::deserialize,
+        "Restores a model from a blob returned by *serialize*.");
+    clfd.def("save", &RuntimeTreeEnsembleRegressorPFloatDouble::save,
+        "Saves the blob returned by *serialize* into a file.");
+    clfd.def("load", &RuntimeTreeEnsembleRegressorPFloatDouble::load,
+        "Maps a file created by *save* in memory and uses it without copying it, "
+        "processes loading the same file share the same memory.");
 }
 
 #endif
@@ -362,7 +362,8 @@ if not r:
     ext_conv = Extension(
         'mlprodict.onnxrt.ops_cpu.op_conv_',
         [os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_conv_.cpp'),
-         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp')],
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp'),
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_num_.cpp')],
         extra_compile_args=extra_compile_args,
         extra_link_args=extra_link_args,
         include_dirs=[
@@ -377,7 +378,8 @@ if not r:
     ext_conv_transpose = Extension(
         'mlprodict.onnxrt.ops_cpu.op_conv_transpose_',
         [os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_conv_transpose_.cpp'),
-         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp')],
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp'),
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_num_.cpp')],
         extra_compile_args=extra_compile_args,
         extra_link_args=extra_link_args,
         include_dirs=[